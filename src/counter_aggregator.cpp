@@ -0,0 +1,311 @@
+/** @file
+ * @brief write-behind aggregation of INCRBY, HINCRBY and ZINCRBY
+ * @author yafei.zhang@langtaojin.com
+ * @date
+ * @version
+ *
+ */
+#include "counter_aggregator.h"
+#include "redis.h"
+#include "redis_partition.h"
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+#include <boost/functional/hash.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/unordered_map.hpp>
+
+LIBREDIS_NAMESPACE_BEGIN
+
+namespace
+{
+  // a counter: INCRBY key, HINCRBY key field or ZINCRBY key member
+  struct CounterId
+  {
+    kCommand command;
+    std::string key;
+    std::string field;
+
+    CounterId(kCommand _command, const std::string& _key, const std::string& _field)
+      : command(_command), key(_key), field(_field) {}
+
+    bool operator==(const CounterId& other)const
+    {
+      return command==other.command && key==other.key && field==other.field;
+    }
+  };
+
+  size_t hash_value(const CounterId& id)
+  {
+    size_t seed = 0;
+    boost::hash_combine(seed, static_cast<int>(id.command));
+    boost::hash_combine(seed, id.key);
+    boost::hash_combine(seed, id.field);
+    return seed;
+  }
+
+  // the pending sum, 'd' of ZINCRBY and 'i' of the others
+  struct Sum
+  {
+    int64_t i;
+    double d;
+
+    Sum() : i(0), d(0.0) {}
+  };
+
+  typedef boost::unordered_map<CounterId, Sum> counter_map_t;
+  typedef boost::function<bool (redis_command_vector_t *)> exec_pipeline_t;
+
+  struct Shard
+  {
+    boost::mutex mutex;
+    counter_map_t counters;
+  };
+}
+
+/************************************************************************/
+/*CounterAggregator::Impl*/
+/************************************************************************/
+class CounterAggregator::Impl
+{
+  private:
+    RedisBase2 * const redis_;
+    const exec_pipeline_t exec_pipeline_;
+    const CounterAggregatorOptions options_;
+    const size_t shard_count_;
+    Shard * shards_;
+
+    boost::atomic<uint64_t> increments_;
+    boost::atomic<uint64_t> merged_;
+    boost::atomic<uint64_t> flushes_;
+    boost::atomic<uint64_t> commands_;
+    boost::atomic<uint64_t> failed_;
+    boost::atomic<size_t> pending_;
+
+    // flushes are serialized, they use 'redis_' and 'batch_'
+    mutable boost::mutex flush_mutex_;
+    CommandBatch batch_;
+    std::string error_;
+
+    // the thread flushing behind
+    boost::mutex mutex_;
+    boost::condition_variable wake_;
+    bool flush_requested_;
+    bool stopping_;
+    boost::scoped_ptr<boost::thread> thread_;
+
+    void run()
+    {
+      boost::mutex::scoped_lock guard(mutex_);
+      while (!stopping_)
+      {
+        if (!flush_requested_)
+          (void)wake_.timed_wait(guard,
+              boost::posix_time::milliseconds(options_.flush_interval_ms));
+        if (stopping_)
+          break;
+        flush_requested_ = false;
+
+        guard.unlock();
+        (void)flush();
+        guard.lock();
+      }
+    }
+
+    void request_flush()
+    {
+      boost::mutex::scoped_lock guard(mutex_);
+      flush_requested_ = true;
+      wake_.notify_one();
+    }
+
+  public:
+    Impl(RedisBase2 * redis, const exec_pipeline_t& exec_pipeline,
+        const CounterAggregatorOptions& options)
+      : redis_(redis), exec_pipeline_(exec_pipeline), options_(options),
+      shard_count_(options.shards ? options.shards : 1),
+      shards_(new Shard[shard_count_]),
+      increments_(0), merged_(0), flushes_(0), commands_(0), failed_(0), pending_(0),
+      flush_requested_(false), stopping_(false)
+    {
+      thread_.reset(new boost::thread(boost::bind(&Impl::run, this)));
+    }
+
+    ~Impl()
+    {
+      (void)stop();
+      delete [] shards_;
+    }
+
+    void add(kCommand command, const std::string& key, const std::string& field,
+        int64_t i, double d)
+    {
+      bool full = false;
+      {
+        Shard& shard = shards_[boost::hash<std::string>()(key) % shard_count_];
+        boost::mutex::scoped_lock guard(shard.mutex);
+        std::pair<counter_map_t::iterator, bool> ret = shard.counters.insert(
+            std::make_pair(CounterId(command, key, field), Sum()));
+        ret.first->second.i += i;
+        ret.first->second.d += d;
+        if (!ret.second)
+          merged_++;
+        else if (++pending_==options_.max_pending)
+          full = true;
+      }
+      increments_++;
+
+      if (full)
+        request_flush();
+    }
+
+    bool flush()
+    {
+      boost::mutex::scoped_lock guard(flush_mutex_);
+      batch_.clear();
+
+      for (size_t s=0; s<shard_count_; s++)
+      {
+        counter_map_t counters;
+        {
+          boost::mutex::scoped_lock shard_guard(shards_[s].mutex);
+          counters.swap(shards_[s].counters);
+        }
+        pending_ -= counters.size();
+
+        for (counter_map_t::const_iterator it=counters.begin(); it!=counters.end(); ++it)
+        {
+          const CounterId& id = it->first;
+          const Sum& sum = it->second;
+          if (id.command==ZINCRBY ? sum.d==0.0 : sum.i==0)
+            continue;
+
+          RedisCommand * c = batch_.add(id.command);
+          c->push_arg(id.key);
+          switch (id.command)
+          {
+            case HINCRBY:
+              c->push_arg(id.field);
+              c->push_arg(sum.i);
+              break;
+            case ZINCRBY:
+              c->push_arg(sum.d);
+              c->push_arg(id.field);
+              break;
+            default:
+              c->push_arg(sum.i);
+              break;
+          }
+        }
+      }
+
+      if (batch_.empty())
+        return true;
+
+      bool ret = exec_pipeline_(batch_.commands());
+      flushes_++;
+      commands_ += batch_.size();
+      if (!ret)
+      {
+        // INCRBY and HINCRBY reply integers, ZINCRBY replies bulks
+        for (size_t i=0; i<batch_.size(); i++)
+        {
+          const RedisOutput& out = batch_[i]->out;
+          if (!out.is_i() && !out.is_bulk())
+            failed_++;
+        }
+        error_ = redis_->last_error();
+      }
+      return ret;
+    }
+
+    bool stop()
+    {
+      {
+        boost::mutex::scoped_lock guard(mutex_);
+        stopping_ = true;
+        wake_.notify_one();
+      }
+      if (thread_)
+      {
+        thread_->join();
+        thread_.reset();
+      }
+      return flush();
+    }
+
+    std::string last_error()const
+    {
+      boost::mutex::scoped_lock guard(flush_mutex_);
+      return error_;
+    }
+
+    CounterAggregatorStats get_stats()const
+    {
+      CounterAggregatorStats stats;
+      stats.increments = increments_;
+      stats.merged = merged_;
+      stats.flushes = flushes_;
+      stats.commands = commands_;
+      stats.failed = failed_;
+      stats.pending = pending_;
+      return stats;
+    }
+};
+
+/************************************************************************/
+/*CounterAggregator*/
+/************************************************************************/
+CounterAggregator::CounterAggregator(Redis2 * redis,
+    const CounterAggregatorOptions& options)
+  : impl_(new Impl(redis, boost::bind(&Redis2::exec_pipeline, redis, _1), options)) {}
+
+CounterAggregator::CounterAggregator(Redis2P * redis,
+    const CounterAggregatorOptions& options)
+  : impl_(new Impl(redis, boost::bind(&Redis2P::exec_pipeline, redis, _1), options)) {}
+
+CounterAggregator::~CounterAggregator()
+{
+  delete impl_;
+}
+
+void CounterAggregator::incrby(const std::string& key, int64_t inc)
+{
+  impl_->add(INCRBY, key, std::string(), inc, 0.0);
+}
+
+void CounterAggregator::hincrby(const std::string& key, const std::string& field, int64_t inc)
+{
+  impl_->add(HINCRBY, key, field, inc, 0.0);
+}
+
+void CounterAggregator::zincrby(const std::string& key, double increment,
+    const std::string& member)
+{
+  impl_->add(ZINCRBY, key, member, 0, increment);
+}
+
+bool CounterAggregator::flush()
+{
+  return impl_->flush();
+}
+
+bool CounterAggregator::stop()
+{
+  return impl_->stop();
+}
+
+std::string CounterAggregator::last_error()const
+{
+  return impl_->last_error();
+}
+
+CounterAggregatorStats CounterAggregator::get_stats()const
+{
+  return impl_->get_stats();
+}
+
+LIBREDIS_NAMESPACE_END
@@ -0,0 +1,94 @@
+/** @file
+ * @brief write-behind aggregation of INCRBY, HINCRBY and ZINCRBY
+ * @author yafei.zhang@langtaojin.com
+ * @date
+ * @version
+ *
+ */
+#ifndef _LANGTAOJIN_LIBREDIS_COUNTER_AGGREGATOR_H_
+#define _LANGTAOJIN_LIBREDIS_COUNTER_AGGREGATOR_H_
+
+#include "redis_base.h"
+
+LIBREDIS_NAMESPACE_BEGIN
+
+class Redis2;
+class Redis2P;
+
+struct CounterAggregatorOptions
+{
+  // pending increments are flushed every 'flush_interval_ms' milliseconds,
+  // an increment is written within it(and the time of a flush)
+  int flush_interval_ms;
+  // so many pending counters(keys, fields or members) flush at once
+  size_t max_pending;
+  // shards of pending counters, each has its own lock
+  size_t shards;
+
+  CounterAggregatorOptions()
+    : flush_interval_ms(100), max_pending(10000), shards(16) {}
+};
+
+struct CounterAggregatorStats
+{
+  uint64_t increments;// calls
+  uint64_t merged;// calls merged into a pending counter
+  uint64_t flushes;// pipelines executed
+  uint64_t commands;// commands written
+  uint64_t failed;// commands failed, their increments are lost
+  size_t pending;// counters waiting for the next flush
+
+  CounterAggregatorStats()
+    : increments(0), merged(0), flushes(0), commands(0), failed(0), pending(0) {}
+};
+
+/************************************************************************/
+/**
+ * CounterAggregator merges increments of the same counter in the process
+ * and writes the sums behind, in one pipeline per flush through 'redis'
+ * (a Redis2P routes every counter by its key), trading
+ * 'flush_interval_ms' of staleness for far fewer writes.
+ * Increments summing to zero are not written.
+ *
+ * A command failing in a flush is not written again(it may have been done),
+ * its increment is lost and counted.
+ *
+ * Call stop() on shutdown(the destructor does too), pending increments are flushed.
+ *
+ * multi thread safe
+ */
+/************************************************************************/
+class CounterAggregator
+{
+  private:
+    class Impl;
+    Impl * impl_;
+
+    CounterAggregator(const CounterAggregator&);
+    CounterAggregator& operator=(const CounterAggregator&);
+
+  public:
+    // 'redis' is not owned and is used only by the aggregator until stop() returns
+    explicit CounterAggregator(Redis2 * redis,
+        const CounterAggregatorOptions& options = CounterAggregatorOptions());
+    explicit CounterAggregator(Redis2P * redis,
+        const CounterAggregatorOptions& options = CounterAggregatorOptions());
+    ~CounterAggregator();
+
+    void incrby(const std::string& key, int64_t inc);
+    void hincrby(const std::string& key, const std::string& field, int64_t inc);
+    void zincrby(const std::string& key, double increment, const std::string& member);
+
+    // write all pending increments now
+    // return false, some failed, the error is in 'last_error()'
+    bool flush();
+    // stop flushing behind and flush, increments after it wait for flush()
+    bool stop();
+
+    std::string last_error()const;
+    CounterAggregatorStats get_stats()const;
+};
+
+LIBREDIS_NAMESPACE_END
+
+#endif// _LANGTAOJIN_LIBREDIS_COUNTER_AGGREGATOR_H_
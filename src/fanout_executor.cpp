@@ -0,0 +1,201 @@
+/** @file
+ * @brief a shared executor for calls fanning out to many hosts
+ * @author yafei.zhang@langtaojin.com
+ * @date
+ * @version
+ *
+ */
+#include "fanout_executor.h"
+#include "redis_base.h"
+#include <deque>
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+LIBREDIS_NAMESPACE_BEGIN
+
+namespace
+{
+  enum
+  {
+    kDefaultThreads = 16
+  };
+
+  boost::atomic<int> s_threads(kDefaultThreads);
+
+  // the tasks of one run(), shared by the caller and the workers
+  class Batch
+  {
+    private:
+      const std::vector<FanoutExecutor::task_t> * const tasks_;
+      // 'tasks_' is touched only with a claimed index below 'size_',
+      // while the caller is still waiting
+      const size_t size_;
+      boost::atomic<size_t> next_;
+
+      boost::mutex mutex_;
+      boost::condition_variable done_;
+      size_t pending_;
+      bool failed_;
+      std::string error_;
+
+    public:
+      explicit Batch(const std::vector<FanoutExecutor::task_t> * tasks)
+        : tasks_(tasks), size_(tasks->size()), next_(0),
+        pending_(tasks->size()), failed_(false) {}
+
+      // run tasks until none is left
+      void work()
+      {
+        for (;;)
+        {
+          size_t i = next_++;
+          if (i>=size_)
+            return;
+
+          bool failed = false;
+          std::string error;
+          try
+          {
+            (*tasks_)[i]();
+          }
+          catch (std::exception& e)
+          {
+            failed = true;
+            error = e.what();
+          }
+          catch (...)
+          {
+            failed = true;
+            error = "unknown exception";
+          }
+
+          boost::mutex::scoped_lock guard(mutex_);
+          if (failed && !failed_)
+          {
+            failed_ = true;
+            error_ = error;
+          }
+          if (--pending_==0)
+            done_.notify_all();
+        }
+      }
+
+      void wait()
+      {
+        boost::mutex::scoped_lock guard(mutex_);
+        while (pending_)
+          done_.wait(guard);
+      }
+
+      bool failed(std::string * error)const
+      {
+        if (failed_)
+          *error = error_;
+        return failed_;
+      }
+  };
+
+  typedef boost::shared_ptr<Batch> batch_sp_t;
+
+  // workers live until the process exits, they are joined then
+  class WorkerPool
+  {
+    private:
+      std::deque<batch_sp_t> queue_;
+      boost::mutex mutex_;
+      boost::condition_variable ready_;
+      boost::thread_group workers_;
+      size_t worker_count_;
+      bool stopping_;
+
+      void worker()
+      {
+        for (;;)
+        {
+          batch_sp_t batch;
+          {
+            boost::mutex::scoped_lock guard(mutex_);
+            while (queue_.empty() && !stopping_)
+              ready_.wait(guard);
+            if (queue_.empty())
+              return;
+            batch = queue_.front();
+            queue_.pop_front();
+          }
+          batch->work();
+        }
+      }
+
+    public:
+      WorkerPool() : worker_count_(0), stopping_(false) {}
+
+      ~WorkerPool()
+      {
+        {
+          boost::mutex::scoped_lock guard(mutex_);
+          stopping_ = true;
+          ready_.notify_all();
+        }
+        // a worker in a task waits for its I/O, which has a deadline
+        workers_.join_all();
+      }
+
+      // let 'helpers' workers join 'batch', return the number of them
+      size_t submit(const batch_sp_t& batch, size_t helpers)
+      {
+        boost::mutex::scoped_lock guard(mutex_);
+        if (stopping_)
+          return 0;
+
+        size_t threads = static_cast<size_t>(s_threads>0 ? static_cast<int>(s_threads) : 0);
+        while (worker_count_<threads)
+        {
+          try
+          {
+            workers_.create_thread(boost::bind(&WorkerPool::worker, this));
+            worker_count_++;
+          }
+          catch (boost::thread_resource_error&)
+          {
+            break;
+          }
+        }
+
+        if (helpers>worker_count_)
+          helpers = worker_count_;
+        for (size_t i=0; i<helpers; i++)
+          queue_.push_back(batch);
+        for (size_t i=0; i<helpers; i++)
+          ready_.notify_one();
+        return helpers;
+      }
+  } s_pool;
+}
+
+void FanoutExecutor::run(const std::vector<task_t>& tasks)
+{
+  if (tasks.empty())
+    return;
+
+  batch_sp_t batch = boost::make_shared<Batch>(&tasks);
+  if (tasks.size()>1 && s_threads>0)
+    (void)s_pool.submit(batch, tasks.size() - 1);
+
+  batch->work();
+  batch->wait();
+
+  std::string error;
+  if (batch->failed(&error))
+    throw RedisException(error);
+}
+
+void set_fanout_threads(int threads)
+{
+  s_threads = threads<0 ? 0 : threads;
+}
+
+LIBREDIS_NAMESPACE_END
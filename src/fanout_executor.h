@@ -0,0 +1,63 @@
+/** @file
+ * @brief a shared executor for calls fanning out to many hosts
+ * @author yafei.zhang@langtaojin.com
+ * @date
+ * @version
+ * inner header
+ */
+#ifndef _LANGTAOJIN_LIBREDIS_FANOUT_EXECUTOR_H_
+#define _LANGTAOJIN_LIBREDIS_FANOUT_EXECUTOR_H_
+
+#include "redis_common.h"
+#include <boost/function.hpp>
+
+LIBREDIS_NAMESPACE_BEGIN
+
+/************************************************************************/
+/**
+ * FanoutExecutor scatters the per-host calls of one operation over a pool
+ * shared by the process(see set_fanout_threads), and gathers them.
+ * The calling thread takes tasks too, so a busy pool delays nothing:
+ * tasks no worker has taken are run by the caller.
+ * Tasks bound their own I/O(the deadline of the operation),
+ * run() returns when all of them are done.
+ *
+ * multi thread safe
+ */
+/************************************************************************/
+class FanoutExecutor
+{
+  public:
+    typedef boost::function<void ()> task_t;
+
+    // A task throwing does not stop the others,
+    // the first exception is thrown again as RedisException after all are done.
+    static void run(const std::vector<task_t>& tasks);
+};
+
+// Store the result of 'f' into '*ret', for tasks returning bool.
+template <class F>
+class StoreResult
+{
+  private:
+    F f_;
+    char * ret_;
+
+  public:
+    StoreResult(const F& f, char * ret) : f_(f), ret_(ret) {}
+
+    void operator()()
+    {
+      *ret_ = f_() ? 1 : 0;
+    }
+};
+
+template <class F>
+inline StoreResult<F> store_result(const F& f, char * ret)
+{
+  return StoreResult<F>(f, ret);
+}
+
+LIBREDIS_NAMESPACE_END
+
+#endif// _LANGTAOJIN_LIBREDIS_FANOUT_EXECUTOR_H_
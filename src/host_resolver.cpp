@@ -0,0 +1,307 @@
+/** @file
+ * @brief a caching host resolver with a refresher thread
+ * @author yafei.zhang@langtaojin.com
+ * @date
+ * @version
+ *
+ */
+#include "host_resolver.h"
+#include <errno.h>
+#include <map>
+#include <vector>
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/shared_mutex.hpp>
+
+LIBREDIS_NAMESPACE_BEGIN
+
+namespace
+{
+  time_t system_now()
+  {
+    return ::time(NULL);
+  }
+}
+
+/************************************************************************/
+/*HostResolver::Impl*/
+/************************************************************************/
+// the cache, shared by the resolver and its refresher thread
+class HostResolver::Impl
+{
+  private:
+    typedef std::pair<std::string, std::string> host_service_t;
+    struct HostEntry
+    {
+      std::vector<net_endpoint> endpoints;
+      int ec;
+      time_t expire;
+      mutable boost::atomic<time_t> last_used;
+      mutable boost::atomic<unsigned> next;
+
+      HostEntry() : ec(0), expire(0), last_used(0), next(0) {}
+    };
+    typedef boost::shared_ptr<HostEntry> host_entry_sp_t;
+    typedef std::map<host_service_t, host_entry_sp_t> dns_cache_t;
+
+    dns_cache_t dns_cache_;
+    mutable boost::shared_mutex dns_cache_mutex_;
+    boost::atomic<int> ttl_;
+    boost::atomic<int> negative_ttl_;
+
+    boost::mutex stop_mutex_;
+    boost::condition_variable stop_cond_;
+    bool stopping_;
+
+  public:
+    const HostResolverOptions options;
+
+  private:
+    host_entry_sp_t __resolve(
+        const std::string& host,
+        const std::string& service,
+        const net_endpoint& hints,
+        time_t now,
+        int ttl,
+        int negative_ttl)const
+    {
+      host_entry_sp_t entry(new HostEntry);
+      net_endpoint eps[kMaxHostAddresses];
+
+      eps[0] = hints;
+      int ret = options.lookup(host.c_str(), service.c_str(), eps, kMaxHostAddresses);
+      if (ret<=0)
+      {
+        entry->ec = errno;
+        entry->expire = now + negative_ttl;
+      }
+      else
+      {
+        entry->endpoints.assign(eps, eps + ret);
+        entry->expire = now + ttl;
+      }
+      entry->last_used = now;
+      return entry;
+    }
+
+    static void __pick(const HostEntry& entry, net_endpoint * endpoint, int * ec)
+    {
+      *ec = entry.ec;
+      if (entry.ec==0)
+        *endpoint = entry.endpoints[entry.next++ % entry.endpoints.size()];
+    }
+
+    // return true, found in cache
+    // return false, not found in cache or a failure expired
+    bool __lookup_cache(
+        const std::string& host,
+        const std::string& service,
+        time_t now,
+        net_endpoint * endpoint,
+        int * ec)const
+    {
+      host_service_t key = std::make_pair(host, service);
+      dns_cache_t::const_iterator iter;
+
+      boost::shared_lock<boost::shared_mutex> guard(dns_cache_mutex_);
+
+      iter = dns_cache_.find(key);
+      if (iter==dns_cache_.end())
+        return false;
+
+      const HostEntry& entry = *(*iter).second;
+      if (entry.ec!=0 && now>=entry.expire)
+        return false;
+
+      entry.last_used = now;
+      __pick(entry, endpoint, ec);
+      return true;
+    }
+
+    void __update_cache(
+        const std::string& host,
+        const std::string& service,
+        const host_entry_sp_t& entry)
+    {
+      host_service_t key = std::make_pair(host, service);
+
+      boost::unique_lock<boost::shared_mutex> guard(dns_cache_mutex_);
+      dns_cache_[key] = entry;
+    }
+
+    static HostResolverOptions __fill(const HostResolverOptions& options)
+    {
+      HostResolverOptions filled = options;
+      if (!filled.lookup)
+        filled.lookup = &resolve_host_all;
+      if (!filled.now)
+        filled.now = &system_now;
+      return filled;
+    }
+
+  public:
+    explicit Impl(const HostResolverOptions& _options)
+      : ttl_(kDefaultTtl), negative_ttl_(kDefaultNegativeTtl),
+      stopping_(false), options(__fill(_options)) {}
+
+    // return true, found in cache
+    // return false, looked up
+    bool resolve(
+        const std::string& host,
+        const std::string& service,
+        net_endpoint * endpoint,
+        int * ec)
+    {
+      time_t now = options.now();
+
+      if (options.enable_cache)
+      {
+        if (__lookup_cache(host, service, now, endpoint, ec))
+          return true;
+
+        host_entry_sp_t entry = __resolve(host, service, *endpoint, now, ttl_, negative_ttl_);
+        __pick(*entry, endpoint, ec);
+        __update_cache(host, service, entry);
+      }
+      else
+      {
+        host_entry_sp_t entry = __resolve(host, service, *endpoint, now, ttl_, negative_ttl_);
+        __pick(*entry, endpoint, ec);
+      }
+      return false;
+    }
+
+    void refresh()
+    {
+      std::vector<std::pair<host_service_t, host_entry_sp_t> > to_refresh;
+      const time_t now = options.now();
+      const int ttl = ttl_;
+      const int negative_ttl = negative_ttl_;
+      // refresh an entry when less than a quarter of its TTL is left
+      const time_t ahead = ttl / 4 + kRefreshInterval;
+      const time_t idle = ttl * kIdleTtls + kRefreshInterval;
+
+      {
+        boost::unique_lock<boost::shared_mutex> guard(dns_cache_mutex_);
+        dns_cache_t::iterator iter = dns_cache_.begin();
+        while (iter!=dns_cache_.end())
+        {
+          const HostEntry& entry = *(*iter).second;
+          if (now - entry.last_used>idle || (entry.ec!=0 && now>=entry.expire))
+            dns_cache_.erase(iter++);
+          else if (entry.ec==0 && entry.expire - now<=ahead)
+            to_refresh.push_back(*iter++);
+          else
+            ++iter;
+        }
+      }
+
+      for (size_t i=0; i<to_refresh.size(); i++)
+      {
+        const host_service_t& key = to_refresh[i].first;
+        const HostEntry& old_entry = *to_refresh[i].second;
+        host_entry_sp_t entry = __resolve(key.first, key.second,
+            old_entry.endpoints[0], now, ttl, negative_ttl);
+
+        if (entry->ec!=0)
+        {
+          // keep serving the old addresses, and retry after 'negative_ttl'
+          entry->endpoints = old_entry.endpoints;
+          entry->ec = 0;
+          entry->expire = now + negative_ttl;
+        }
+        entry->last_used = static_cast<time_t>(old_entry.last_used);
+        entry->next = static_cast<unsigned>(old_entry.next);
+
+        __update_cache(key.first, key.second, entry);
+      }
+    }
+
+    void set_ttl(int ttl, int negative_ttl)
+    {
+      ttl_ = ttl>0 ? ttl : 1;
+      negative_ttl_ = negative_ttl>0 ? negative_ttl : 1;
+    }
+
+    void clear_cache()
+    {
+      boost::unique_lock<boost::shared_mutex> guard(dns_cache_mutex_);
+      dns_cache_.clear();
+    }
+
+    // wait 'seconds' or until stop()
+    // return false, stopped
+    bool wait(int seconds)
+    {
+      boost::mutex::scoped_lock guard(stop_mutex_);
+      if (!stopping_)
+        (void)stop_cond_.timed_wait(guard, boost::posix_time::seconds(seconds));
+      return !stopping_;
+    }
+
+    void stop()
+    {
+      boost::mutex::scoped_lock guard(stop_mutex_);
+      stopping_ = true;
+      stop_cond_.notify_all();
+    }
+};
+
+/************************************************************************/
+/*HostResolver*/
+/************************************************************************/
+HostResolver::HostResolver(const HostResolverOptions& options)
+  : impl_(new Impl(options)), refresher_(NULL) {}
+
+HostResolver::~HostResolver()
+{
+  if (refresher_)
+  {
+    impl_->stop();
+    // a lookup in progress can not be woken, do not hang the exit on it,
+    // the refresher keeps the cache alive and finishes after it
+    if (!refresher_->timed_join(boost::posix_time::seconds(1)))
+      refresher_->detach();
+    delete refresher_;
+  }
+}
+
+// the thread owns 'impl' too, it may outlive the resolver
+void HostResolver::__refresh_loop(boost::shared_ptr<Impl> impl)
+{
+  while (impl->wait(kRefreshInterval))
+    impl->refresh();
+}
+
+void HostResolver::__start_refresher()
+{
+  boost::mutex::scoped_lock guard(refresher_mutex_);
+  if (refresher_==NULL)
+    refresher_ = new boost::thread(boost::bind(&HostResolver::__refresh_loop, impl_));
+}
+
+void HostResolver::resolve(const std::string& host, const std::string& service,
+    net_endpoint * endpoint, int * ec)
+{
+  if (!impl_->resolve(host, service, endpoint, ec)
+      && impl_->options.enable_cache && impl_->options.enable_refresher)
+    __start_refresher();
+}
+
+void HostResolver::refresh()
+{
+  impl_->refresh();
+}
+
+void HostResolver::set_ttl(int ttl, int negative_ttl)
+{
+  impl_->set_ttl(ttl, negative_ttl);
+}
+
+void HostResolver::clear_cache()
+{
+  impl_->clear_cache();
+}
+
+LIBREDIS_NAMESPACE_END
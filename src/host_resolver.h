@@ -0,0 +1,102 @@
+/** @file
+ * @brief a caching host resolver with a refresher thread
+ * @author yafei.zhang@langtaojin.com
+ * @date
+ * @version
+ * inner header
+ */
+#ifndef _LANGTAOJIN_LIBREDIS_HOST_RESOLVER_H_
+#define _LANGTAOJIN_LIBREDIS_HOST_RESOLVER_H_
+
+#include "redis_common.h"
+#include "os.h"
+#include <time.h>
+#include <string>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace boost
+{
+  class thread;
+}
+
+LIBREDIS_NAMESPACE_BEGIN
+
+// like resolve_host_all, 'eps[0]' is the hints
+typedef boost::function<int (const char *, const char *, net_endpoint *, int)> host_lookup_t;
+// the time in seconds, like ::time(NULL)
+typedef boost::function<time_t ()> time_source_t;
+
+struct HostResolverOptions
+{
+  bool enable_cache;
+  // a thread re-resolves entries in use before they expire,
+  // without it, call refresh()
+  bool enable_refresher;
+  // resolve_host_all and ::time by default
+  host_lookup_t lookup;
+  time_source_t now;
+
+  HostResolverOptions()
+    : enable_cache(true), enable_refresher(true) {}
+};
+
+/************************************************************************/
+/**
+ * HostResolver resolves hosts and caches the addresses.
+ * Entries live 'ttl' seconds, failures live 'negative_ttl' seconds.
+ * The refresher re-resolves entries in use before they expire,
+ * so only the first lookup of a host blocks on DNS.
+ * If a refresh fails, the old addresses are kept and retried later.
+ * Every lookup returns the next address of the host(round robin).
+ *
+ * The refresher shares the cache with the resolver, it is woken and joined
+ * on destruction, or left to finish alone if it is blocked on DNS.
+ *
+ * multi thread safe
+ */
+/************************************************************************/
+class HostResolver
+{
+  private:
+    class Impl;
+    boost::shared_ptr<Impl> impl_;
+
+    boost::mutex refresher_mutex_;
+    boost::thread * refresher_;
+
+    HostResolver(const HostResolver&);
+    HostResolver& operator=(const HostResolver&);
+
+    static void __refresh_loop(boost::shared_ptr<Impl> impl);
+    void __start_refresher();
+
+  public:
+    enum
+    {
+      kDefaultTtl = 60,
+      kDefaultNegativeTtl = 2,
+      kMaxHostAddresses = 16,
+      kRefreshInterval = 1,
+      kIdleTtls = 10
+    };
+
+    explicit HostResolver(const HostResolverOptions& options = HostResolverOptions());
+    ~HostResolver();
+
+    // '*endpoint' holds the hints, '*ec' is 0 or an errno
+    void resolve(const std::string& host, const std::string& service,
+        net_endpoint * endpoint, int * ec);
+
+    // re-resolve entries used recently and about to expire,
+    // drop entries nobody has used for a long time
+    void refresh();
+
+    void set_ttl(int ttl, int negative_ttl);
+    void clear_cache();
+};
+
+LIBREDIS_NAMESPACE_END
+
+#endif// _LANGTAOJIN_LIBREDIS_HOST_RESOLVER_H_
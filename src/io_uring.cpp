@@ -0,0 +1,440 @@
+/** @file
+ * @brief a minimal io_uring ring over raw system calls
+ * @author yafei.zhang@langtaojin.com
+ * @date
+ * @version
+ *
+ */
+#include "io_uring.h"
+#include <errno.h>
+#include <string.h>
+
+#if defined LIBREDIS_HAVE_IO_URING
+# include <linux/io_uring.h>
+# include <linux/time_types.h>
+# include <sys/mman.h>
+# include <sys/socket.h>
+# include <sys/syscall.h>
+# include <sys/uio.h>
+# include <unistd.h>
+#endif
+
+LIBREDIS_NAMESPACE_BEGIN
+
+#if defined LIBREDIS_HAVE_IO_URING
+
+namespace
+{
+  enum
+  {
+    kSend = 1,
+    kSendTimeout,
+    kRecv,
+    kRecvTimeout,
+    kCancel
+  };
+
+  inline int sys_io_uring_setup(unsigned entries, struct io_uring_params * p)
+  {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+  }
+
+  inline int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+  {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+  }
+
+  inline int sys_io_uring_register(int fd, unsigned opcode, void * arg, unsigned nr_args)
+  {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+  }
+
+  inline unsigned load_acquire(const unsigned * p)
+  {
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+  }
+
+  inline void store_release(unsigned * p, unsigned v)
+  {
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+  }
+
+  // return true, the kernel supports all opcodes we use
+  bool probe_opcodes(int ring_fd)
+  {
+    const size_t ops = IORING_OP_LAST;
+    std::vector<char> buf(sizeof(struct io_uring_probe) + ops * sizeof(struct io_uring_probe_op));
+    struct io_uring_probe * probe = (struct io_uring_probe *)&buf[0];
+
+    if (sys_io_uring_register(ring_fd, IORING_REGISTER_PROBE, probe, (unsigned)ops)==-1)
+      return false;
+
+    const int needed[] = {IORING_OP_SEND, IORING_OP_RECV, IORING_OP_READ_FIXED,
+      IORING_OP_LINK_TIMEOUT, IORING_OP_ASYNC_CANCEL};
+    for (size_t i=0; i<sizeof(needed)/sizeof(needed[0]); i++)
+    {
+      if (needed[i]>=probe->ops_len
+          || (probe->ops[needed[i]].flags & IO_URING_OP_SUPPORTED)==0)
+        return false;
+    }
+    return true;
+  }
+}
+
+IoUring::IoUring()
+: ring_fd_(-1), sq_ptr_(NULL), sq_size_(0), cq_ptr_(NULL), cq_size_(0),
+  sqes_(NULL), sqes_size_(0),
+  sq_head_(NULL), sq_tail_(NULL), sq_mask_(NULL), sq_array_(NULL),
+  cq_head_(NULL), cq_tail_(NULL), cq_mask_(NULL), cqes_(NULL),
+  to_submit_(0), fixed_registered_(false) {}
+
+IoUring::~IoUring()
+{
+  destroy();
+}
+
+int IoUring::init(unsigned entries, size_t fixed_buffer_size)
+{
+  struct io_uring_params p;
+  int err;
+
+  destroy();
+
+  memset(&p, 0, sizeof(p));
+  if ((ring_fd_ = sys_io_uring_setup(entries, &p))==-1)
+    return -1;
+
+  if (!probe_opcodes(ring_fd_))
+  {
+    destroy();
+    errno = ENOSYS;
+    return -1;
+  }
+
+  sq_size_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  cq_size_ = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP)
+  {
+    if (cq_size_>sq_size_)
+      sq_size_ = cq_size_;
+    cq_size_ = 0;
+  }
+
+  sq_ptr_ = mmap(NULL, sq_size_, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+  if (sq_ptr_==MAP_FAILED)
+  {
+    sq_ptr_ = NULL;
+    goto fail;
+  }
+
+  if (cq_size_)
+  {
+    cq_ptr_ = mmap(NULL, cq_size_, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_CQ_RING);
+    if (cq_ptr_==MAP_FAILED)
+    {
+      cq_ptr_ = NULL;
+      goto fail;
+    }
+  }
+
+  sqes_size_ = p.sq_entries * sizeof(struct io_uring_sqe);
+  sqes_ = (struct io_uring_sqe *)mmap(NULL, sqes_size_, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+  if (sqes_==MAP_FAILED)
+  {
+    sqes_ = NULL;
+    goto fail;
+  }
+
+  {
+    char * sq = (char *)sq_ptr_;
+    char * cq = cq_ptr_ ? (char *)cq_ptr_ : sq;
+    sq_head_ = (unsigned *)(sq + p.sq_off.head);
+    sq_tail_ = (unsigned *)(sq + p.sq_off.tail);
+    sq_mask_ = (unsigned *)(sq + p.sq_off.ring_mask);
+    sq_array_ = (unsigned *)(sq + p.sq_off.array);
+    cq_head_ = (unsigned *)(cq + p.cq_off.head);
+    cq_tail_ = (unsigned *)(cq + p.cq_off.tail);
+    cq_mask_ = (unsigned *)(cq + p.cq_off.ring_mask);
+    cqes_ = cq + p.cq_off.cqes;
+  }
+
+  // register the receive buffer,
+  // it may fail with a low RLIMIT_MEMLOCK, then plain RECV is used
+  fixed_buffer_.resize(fixed_buffer_size);
+  {
+    struct iovec iov;
+    iov.iov_base = &fixed_buffer_[0];
+    iov.iov_len = fixed_buffer_.size();
+    fixed_registered_ =
+      sys_io_uring_register(ring_fd_, IORING_REGISTER_BUFFERS, &iov, 1)==0;
+  }
+
+  return 0;
+
+fail:
+  err = errno;
+  destroy();
+  errno = err;
+  return -1;
+}
+
+void IoUring::destroy()
+{
+  if (sqes_)
+    (void)munmap(sqes_, sqes_size_);
+  if (cq_ptr_)
+    (void)munmap(cq_ptr_, cq_size_);
+  if (sq_ptr_)
+    (void)munmap(sq_ptr_, sq_size_);
+  if (ring_fd_!=-1)
+    (void)::close(ring_fd_);
+
+  ring_fd_ = -1;
+  sq_ptr_ = cq_ptr_ = NULL;
+  sqes_ = NULL;
+  to_submit_ = 0;
+  fixed_registered_ = false;
+}
+
+struct io_uring_sqe * IoUring::get_sqe()
+{
+  unsigned tail = *sq_tail_;
+  unsigned index = tail & *sq_mask_;
+  struct io_uring_sqe * sqe = &sqes_[index];
+
+  memset(sqe, 0, sizeof(*sqe));
+  sq_array_[index] = index;
+  store_release(sq_tail_, tail + 1);
+  to_submit_++;
+  return sqe;
+}
+
+void IoUring::prep_send(int fd, const char * buf, size_t len, uint64_t user_data, bool link)
+{
+  struct io_uring_sqe * sqe = get_sqe();
+  sqe->opcode = IORING_OP_SEND;
+  sqe->fd = fd;
+  sqe->addr = (uint64_t)(uintptr_t)buf;
+  sqe->len = (uint32_t)len;
+  sqe->msg_flags = MSG_NOSIGNAL;
+  sqe->user_data = user_data;
+  if (link)
+    sqe->flags = IOSQE_IO_LINK;
+}
+
+void IoUring::prep_recv(int fd, size_t len, uint64_t user_data, bool link)
+{
+  struct io_uring_sqe * sqe = get_sqe();
+  sqe->opcode = fixed_registered_ ? IORING_OP_READ_FIXED : IORING_OP_RECV;
+  sqe->fd = fd;
+  sqe->addr = (uint64_t)(uintptr_t)&fixed_buffer_[0];
+  sqe->len = (uint32_t)len;
+  sqe->buf_index = 0;
+  sqe->user_data = user_data;
+  if (link)
+    sqe->flags = IOSQE_IO_LINK;
+}
+
+void IoUring::prep_timeout(const void * ts, uint64_t user_data)
+{
+  struct io_uring_sqe * sqe = get_sqe();
+  sqe->opcode = IORING_OP_LINK_TIMEOUT;
+  sqe->fd = -1;
+  sqe->addr = (uint64_t)(uintptr_t)ts;
+  sqe->len = 1;
+  sqe->user_data = user_data;
+}
+
+void IoUring::prep_cancel(uint64_t target, uint64_t user_data)
+{
+  struct io_uring_sqe * sqe = get_sqe();
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->fd = -1;
+  sqe->addr = target;
+  sqe->user_data = user_data;
+}
+
+int IoUring::submit_and_wait(unsigned wait)
+{
+  int ret;
+
+  do ret = sys_io_uring_enter(ring_fd_, to_submit_, wait, IORING_ENTER_GETEVENTS);
+  while (ret==-1 && errno==EINTR);
+
+  if (ret==-1)
+    return -1;
+
+  to_submit_ -= (unsigned)ret;
+  return 0;
+}
+
+bool IoUring::peek_cqe(uint64_t * user_data, int * res)
+{
+  unsigned head = *cq_head_;
+  if (head==load_acquire(cq_tail_))
+    return false;
+
+  const struct io_uring_cqe * cqe =
+    (const struct io_uring_cqe *)cqes_ + (head & *cq_mask_);
+  *user_data = cqe->user_data;
+  *res = cqe->res;
+  store_release(cq_head_, head + 1);
+  return true;
+}
+
+int IoUring::send_recv(int fd, const char * buf, size_t len, size_t recv_len, int timeout)
+{
+  struct __kernel_timespec ts;
+  const bool timed = timeout>=0;
+  const unsigned pair = timed ? 2 : 1;
+  unsigned inflight = 0;
+  size_t sent = 0;
+  int received = 0;
+  bool recv_pending = false;
+  int err = 0;
+  uint64_t user_data;
+  int res;
+
+  if (!ready())
+  {
+    errno = EBADF;
+    return -1;
+  }
+
+  if (recv_len>fixed_buffer_.size())
+    recv_len = fixed_buffer_.size();
+
+  if (timed)
+  {
+    ts.tv_sec = timeout / 1000;
+    ts.tv_nsec = (long long)(timeout % 1000) * 1000000;
+  }
+
+  if (len)
+  {
+    prep_send(fd, buf, len, kSend, timed);
+    if (timed)
+      prep_timeout(&ts, kSendTimeout);
+    inflight += pair;
+  }
+
+  if (recv_len)
+  {
+    prep_recv(fd, recv_len, kRecv, timed);
+    if (timed)
+      prep_timeout(&ts, kRecvTimeout);
+    inflight += pair;
+    recv_pending = true;
+  }
+
+  while (inflight)
+  {
+    if (submit_and_wait(1)==-1)
+    {
+      // the ring is in an unknown state, drop it
+      err = errno;
+      destroy();
+      errno = err;
+      return -1;
+    }
+
+    while (peek_cqe(&user_data, &res))
+    {
+      inflight--;
+
+      if (user_data==kSend)
+      {
+        if (res<0)
+        {
+          err = res==-ECANCELED ? ETIMEDOUT : -res;
+        }
+        else
+        {
+          sent += (size_t)res;
+          if (sent<len && err==0)
+          {
+            // a short send, queue the rest
+            prep_send(fd, buf + sent, len - sent, kSend, timed);
+            if (timed)
+              prep_timeout(&ts, kSendTimeout);
+            inflight += pair;
+            continue;
+          }
+        }
+
+        if (err && recv_pending)
+        {
+          // do not wait for a reply to an incomplete request
+          prep_cancel(kRecv, kCancel);
+          inflight++;
+        }
+      }
+      else if (user_data==kRecv)
+      {
+        recv_pending = false;
+        if (res<0)
+        {
+          if (err==0)
+            err = res==-ECANCELED ? ETIMEDOUT : -res;
+        }
+        else if (res==0)
+        {
+          if (err==0)
+            err = ECONNRESET;
+        }
+        else
+        {
+          received = res;
+        }
+      }
+      // timeouts and cancellations only need to be reaped
+    }
+  }
+
+  if (err)
+  {
+    errno = err;
+    return -1;
+  }
+
+  return received;
+}
+
+#else// LIBREDIS_HAVE_IO_URING
+
+IoUring::IoUring()
+: ring_fd_(-1), sq_ptr_(NULL), sq_size_(0), cq_ptr_(NULL), cq_size_(0),
+  sqes_(NULL), sqes_size_(0),
+  sq_head_(NULL), sq_tail_(NULL), sq_mask_(NULL), sq_array_(NULL),
+  cq_head_(NULL), cq_tail_(NULL), cq_mask_(NULL), cqes_(NULL),
+  to_submit_(0), fixed_registered_(false) {}
+
+IoUring::~IoUring() {}
+
+int IoUring::init(unsigned entries, size_t fixed_buffer_size)
+{
+  (void)entries;
+  (void)fixed_buffer_size;
+  errno = ENOSYS;
+  return -1;
+}
+
+void IoUring::destroy() {}
+
+int IoUring::send_recv(int fd, const char * buf, size_t len, size_t recv_len, int timeout)
+{
+  (void)fd;
+  (void)buf;
+  (void)len;
+  (void)recv_len;
+  (void)timeout;
+  errno = ENOSYS;
+  return -1;
+}
+
+#endif// LIBREDIS_HAVE_IO_URING
+
+LIBREDIS_NAMESPACE_END
@@ -0,0 +1,111 @@
+/** @file
+ * @brief a minimal io_uring ring over raw system calls
+ * @author yafei.zhang@langtaojin.com
+ * @date
+ * @version
+ * inner header
+ */
+#ifndef _LANGTAOJIN_LIBREDIS_IO_URING_H_
+#define _LANGTAOJIN_LIBREDIS_IO_URING_H_
+
+#include "redis_common.h"
+#include <stddef.h>
+
+#if defined(__linux__) && defined(__has_include)
+# if __has_include(<linux/io_uring.h>)
+#  define LIBREDIS_HAVE_IO_URING 1
+# endif
+#endif
+
+struct io_uring_sqe;
+
+LIBREDIS_NAMESPACE_BEGIN
+
+/************************************************************************/
+/**
+ * IoUring is a small ring owned by one TcpClient(single thread safety).
+ * A request is sent and its reply received in one submission:
+ * SEND and READ_FIXED(into a registered buffer) are queued together,
+ * each followed by a LINK_TIMEOUT instead of poll().
+ *
+ * Without <linux/io_uring.h> or on kernels without the needed opcodes,
+ * init fails and the caller keeps using the poll() path.
+ */
+/************************************************************************/
+class IoUring
+{
+  private:
+    int ring_fd_;
+
+    void * sq_ptr_;
+    size_t sq_size_;
+    void * cq_ptr_;
+    size_t cq_size_;
+    struct io_uring_sqe * sqes_;
+    size_t sqes_size_;
+
+    unsigned * sq_head_;
+    unsigned * sq_tail_;
+    unsigned * sq_mask_;
+    unsigned * sq_array_;
+    unsigned * cq_head_;
+    unsigned * cq_tail_;
+    unsigned * cq_mask_;
+    void * cqes_;
+
+    unsigned to_submit_;
+
+    std::vector<char> fixed_buffer_;
+    bool fixed_registered_;
+
+    IoUring(const IoUring&);
+    IoUring& operator=(const IoUring&);
+
+    // return a zeroed sqe
+    struct io_uring_sqe * get_sqe();
+    void prep_send(int fd, const char * buf, size_t len, uint64_t user_data, bool link);
+    void prep_recv(int fd, size_t len, uint64_t user_data, bool link);
+    void prep_timeout(const void * ts, uint64_t user_data);
+    void prep_cancel(uint64_t target, uint64_t user_data);
+    // return 0, success
+    // return -1, failure, check errno
+    int submit_and_wait(unsigned wait);
+    bool peek_cqe(uint64_t * user_data, int * res);
+
+  public:
+    IoUring();
+    ~IoUring();
+
+    /**
+     * return 0, success
+     * return -1, failure, check errno(ENOSYS means no io_uring)
+     */
+    int init(unsigned entries, size_t fixed_buffer_size);
+    void destroy();
+
+    inline bool ready()const
+    {
+      return ring_fd_!=-1;
+    }
+
+    inline const char * fixed_buffer()const
+    {
+      return &fixed_buffer_[0];
+    }
+
+    /**
+     * send all 'len' bytes of 'buf'('len' may be 0),
+     * then if 'recv_len' is not 0, receive at most 'recv_len' bytes into fixed_buffer()
+     * both of them are bounded by 'timeout'(negative means forever)
+     *
+     * return the received bytes, or 0 if 'recv_len' is 0
+     * return -1, failure, check errno(ETIMEDOUT, ECONNRESET for EOF, ...)
+     *
+     * NOTICE: the socket should be blocking, io_uring waits for it internally
+     */
+    int send_recv(int fd, const char * buf, size_t len, size_t recv_len, int timeout);
+};
+
+LIBREDIS_NAMESPACE_END
+
+#endif// _LANGTAOJIN_LIBREDIS_IO_URING_H_
@@ -0,0 +1,273 @@
+/** @file
+ * @brief rolling latency histograms behind adaptive budgets
+ * @author yafei.zhang@langtaojin.com
+ * @date
+ * @version
+ *
+ */
+#include "latency_tracker.h"
+#include "os.h"
+#include <boost/foreach.hpp>
+#include <boost/thread/mutex.hpp>
+
+LIBREDIS_NAMESPACE_BEGIN
+
+namespace
+{
+  enum
+  {
+    kDecisionIntervalUs = 100000,// a decision lasts 100ms
+    kMinWindow = 2
+  };
+
+  boost::atomic<bool> s_enabled(false);
+  boost::atomic<int> s_percentile_per_myriad(9900);// in 1/10000
+  boost::atomic<int> s_multiplier_percent(300);
+  boost::atomic<int> s_min_ms(5);
+  boost::atomic<int> s_max_ms(1000);
+  boost::atomic<int> s_min_samples(100);
+  boost::atomic<int> s_window_s(60);
+
+  int64_t half_window_us()
+  {
+    int window = s_window_s;
+    if (window<kMinWindow)
+      window = kMinWindow;
+    return static_cast<int64_t>(window) * 1000000 / 2;
+  }
+
+  class HistogramRegistry
+  {
+    private:
+      typedef std::map<std::string, boost::shared_ptr<LatencyHistogram> > histogram_map_t;
+      histogram_map_t histograms_;
+      mutable boost::mutex mutex_;
+
+    public:
+      LatencyHistogram * get(const std::string& host, const std::string& port,
+          kCommandClass command_class)
+      {
+        std::string key(host);
+        key.append(":").append(port).append(1, static_cast<char>('0' + command_class));
+
+        boost::mutex::scoped_lock guard(mutex_);
+        boost::shared_ptr<LatencyHistogram>& histogram = histograms_[key];
+        if (!histogram)
+          histogram.reset(new LatencyHistogram(host, port, command_class));
+        return histogram.get();
+      }
+
+      void get_stats(std::vector<AdaptiveTimeoutStats> * stats)const
+      {
+        boost::mutex::scoped_lock guard(mutex_);
+        stats->clear();
+        stats->reserve(histograms_.size());
+        BOOST_FOREACH(const histogram_map_t::value_type& value, histograms_)
+        {
+          stats->push_back(AdaptiveTimeoutStats());
+          value.second->get_stats(&stats->back());
+        }
+      }
+  } s_registry;
+}
+
+/************************************************************************/
+/*LatencyHistogram*/
+/************************************************************************/
+size_t LatencyHistogram::bucket_of(int64_t us)
+{
+  if (us<4)
+    return us<0 ? 0 : static_cast<size_t>(us);
+
+  int msb = 63 - __builtin_clzll(static_cast<unsigned long long>(us));
+  size_t index = static_cast<size_t>(msb - 1) * 4 + static_cast<size_t>((us >> (msb - 2)) & 3);
+  return index<kBuckets ? index : kBuckets - 1;
+}
+
+int64_t LatencyHistogram::bucket_upper(size_t index)
+{
+  if (index<4)
+    return static_cast<int64_t>(index) + 1;
+
+  int msb = static_cast<int>(index / 4) + 1;
+  return (5 + static_cast<int64_t>(index % 4)) << (msb - 2);
+}
+
+LatencyHistogram::LatencyHistogram(const std::string& host, const std::string& port,
+    kCommandClass command_class)
+: host_(host), port_(port), command_class_(command_class),
+  timeouts_(0), timeout_ms_(0), percentile_us_(0), decided_us_(0),
+  decisions_(0), clamped_min_(0), clamped_max_(0)
+{
+  for (size_t i=0; i<kGenerations; i++)
+  {
+    epochs_[i] = -1;
+    for (size_t j=0; j<kBuckets; j++)
+      buckets_[i][j] = 0;
+  }
+}
+
+size_t LatencyHistogram::generation(int64_t now)
+{
+  int64_t epoch = now / half_window_us();
+  size_t gen = static_cast<size_t>(epoch % kGenerations);
+  int64_t old = epochs_[gen];
+
+  // the winner clears it, samples racing with clearing may be lost
+  if (old!=epoch && epochs_[gen].compare_exchange_strong(old, epoch))
+  {
+    for (size_t j=0; j<kBuckets; j++)
+      buckets_[gen][j] = 0;
+  }
+  return gen;
+}
+
+uint64_t LatencyHistogram::percentile(int64_t now, int per_myriad,
+    int64_t * percentile_us)const
+{
+  int64_t epoch = now / half_window_us();
+  uint64_t counts[kBuckets] = {0};
+  uint64_t total = 0;
+
+  for (size_t i=0; i<kGenerations; i++)
+  {
+    int64_t e = epochs_[i];
+    if (e!=epoch && e!=epoch - 1)
+      continue;
+
+    for (size_t j=0; j<kBuckets; j++)
+    {
+      uint32_t count = buckets_[i][j];
+      counts[j] += count;
+      total += count;
+    }
+  }
+
+  *percentile_us = 0;
+  if (total==0)
+    return 0;
+
+  uint64_t rank = (total * static_cast<uint64_t>(per_myriad) + 9999) / 10000;
+  uint64_t seen = 0;
+  for (size_t j=0; j<kBuckets; j++)
+  {
+    seen += counts[j];
+    if (seen>=rank)
+    {
+      *percentile_us = bucket_upper(j);
+      break;
+    }
+  }
+  return total;
+}
+
+void LatencyHistogram::record(int64_t us, bool timed_out)
+{
+  size_t gen = generation(monotonic_us());
+  buckets_[gen][bucket_of(us)]++;
+  if (timed_out)
+    timeouts_++;
+}
+
+int LatencyHistogram::timeout_ms()
+{
+  int64_t now = monotonic_us();
+  if (now - decided_us_<kDecisionIntervalUs)
+    return timeout_ms_;
+
+  decided_us_ = now;
+  decisions_++;
+
+  int64_t percentile_us;
+  uint64_t samples = percentile(now, s_percentile_per_myriad, &percentile_us);
+  percentile_us_ = percentile_us;
+  if (samples<static_cast<uint64_t>(s_min_samples))
+  {
+    timeout_ms_ = 0;
+    return 0;
+  }
+
+  int64_t timeout = (percentile_us * s_multiplier_percent / 100 + 999) / 1000;
+  int min_ms = s_min_ms;
+  int max_ms = s_max_ms;
+  if (timeout<min_ms)
+  {
+    timeout = min_ms;
+    clamped_min_++;
+  }
+  else if (timeout>max_ms)
+  {
+    timeout = max_ms;
+    clamped_max_++;
+  }
+
+  timeout_ms_ = static_cast<int>(timeout);
+  return timeout_ms_;
+}
+
+void LatencyHistogram::get_stats(AdaptiveTimeoutStats * stats)const
+{
+  int64_t percentile_us;
+
+  stats->host = host_;
+  stats->port = port_;
+  stats->command_class = command_class_;
+  stats->samples = percentile(monotonic_us(), s_percentile_per_myriad, &percentile_us);
+  stats->timeouts = timeouts_;
+  stats->percentile_us = percentile_us_;
+  stats->timeout_ms = timeout_ms_;
+  stats->decisions = decisions_;
+  stats->clamped_min = clamped_min_;
+  stats->clamped_max = clamped_max_;
+}
+
+/************************************************************************/
+/*LatencyTracker*/
+/************************************************************************/
+bool LatencyTracker::enabled()
+{
+  return s_enabled;
+}
+
+LatencyHistogram * LatencyTracker::get(const std::string& host, const std::string& port,
+    kCommandClass command_class)
+{
+  return s_registry.get(host, port, command_class);
+}
+
+void set_adaptive_timeout(const AdaptiveTimeout& adaptive)
+{
+  double percentile = adaptive.percentile;
+  if (percentile<=0.0 || percentile>=100.0)
+    percentile = 99.0;
+
+  s_percentile_per_myriad = static_cast<int>(percentile * 100.0 + 0.5);
+  s_multiplier_percent = adaptive.multiplier>0.0
+    ? static_cast<int>(adaptive.multiplier * 100.0 + 0.5) : 100;
+  s_min_ms = adaptive.min_ms>0 ? adaptive.min_ms : 1;
+  s_max_ms = adaptive.max_ms<s_min_ms ? static_cast<int>(s_min_ms) : adaptive.max_ms;
+  s_min_samples = adaptive.min_samples>0 ? adaptive.min_samples : 1;
+  s_window_s = adaptive.window_s;
+  s_enabled = adaptive.enabled;
+}
+
+AdaptiveTimeout get_adaptive_timeout()
+{
+  AdaptiveTimeout adaptive;
+  adaptive.enabled = s_enabled;
+  adaptive.percentile = s_percentile_per_myriad / 100.0;
+  adaptive.multiplier = s_multiplier_percent / 100.0;
+  adaptive.min_ms = s_min_ms;
+  adaptive.max_ms = s_max_ms;
+  adaptive.min_samples = s_min_samples;
+  adaptive.window_s = s_window_s;
+  return adaptive;
+}
+
+void get_adaptive_timeout_stats(std::vector<AdaptiveTimeoutStats> * stats)
+{
+  if (stats)
+    s_registry.get_stats(stats);
+}
+
+LIBREDIS_NAMESPACE_END
@@ -0,0 +1,86 @@
+/** @file
+ * @brief rolling latency histograms behind adaptive budgets
+ * @author yafei.zhang@langtaojin.com
+ * @date
+ * @version
+ * inner header
+ */
+#ifndef _LANGTAOJIN_LIBREDIS_LATENCY_TRACKER_H_
+#define _LANGTAOJIN_LIBREDIS_LATENCY_TRACKER_H_
+
+#include "redis_cmd.h"
+#include <boost/atomic.hpp>
+
+LIBREDIS_NAMESPACE_BEGIN
+
+/************************************************************************/
+/**
+ * LatencyHistogram keeps the call latencies of one endpoint and command class.
+ * Buckets are log-linear(4 per power of 2) in microseconds, the relative error is below 25%.
+ * It is rolling: two generations each cover half a window,
+ * the older one is dropped when a new half begins.
+ *
+ * multi thread safe, lock free
+ */
+/************************************************************************/
+class LatencyHistogram
+{
+  public:
+    enum
+    {
+      kBuckets = 108,// up to 2^28 us
+      kGenerations = 2
+    };
+
+  private:
+    const std::string host_;
+    const std::string port_;
+    const kCommandClass command_class_;
+
+    boost::atomic<uint32_t> buckets_[kGenerations][kBuckets];
+    boost::atomic<int64_t> epochs_[kGenerations];
+    boost::atomic<uint64_t> timeouts_;
+
+    // the last decision
+    boost::atomic<int> timeout_ms_;
+    boost::atomic<int64_t> percentile_us_;
+    boost::atomic<int64_t> decided_us_;// monotonic
+    boost::atomic<uint64_t> decisions_;
+    boost::atomic<uint64_t> clamped_min_;
+    boost::atomic<uint64_t> clamped_max_;
+
+    // the generation of 'now', it is cleared if it is stale
+    size_t generation(int64_t now);
+    // return the samples in the window, '*percentile_us' is the 'per_mille' latency
+    uint64_t percentile(int64_t now, int per_mille, int64_t * percentile_us)const;
+
+  public:
+    LatencyHistogram(const std::string& host, const std::string& port,
+        kCommandClass command_class);
+
+    // the bucket of 'us', the last one holds all above it
+    static size_t bucket_of(int64_t us);
+    // the exclusive upper bound of 'index'
+    static int64_t bucket_upper(size_t index);
+
+    void record(int64_t us, bool timed_out);
+
+    // return the adaptive budget in milliseconds
+    // return 0, there are not enough samples
+    int timeout_ms();
+
+    void get_stats(AdaptiveTimeoutStats * stats)const;
+};
+
+class LatencyTracker
+{
+  public:
+    static bool enabled();
+    // the histogram is never freed
+    static LatencyHistogram * get(const std::string& host, const std::string& port,
+        kCommandClass command_class);
+};
+
+LIBREDIS_NAMESPACE_END
+
+#endif// _LANGTAOJIN_LIBREDIS_LATENCY_TRACKER_H_
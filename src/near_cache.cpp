@@ -0,0 +1,554 @@
+/** @file
+ * @brief an in-process near cache of GET and HGET replies
+ * @author yafei.zhang@langtaojin.com
+ * @date
+ * @version
+ *
+ */
+#include "near_cache.h"
+#include "os.h"
+#include "redis_protocol.h"
+#include <strings.h>
+#include <list>
+#include <map>
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/foreach.hpp>
+#include <boost/functional/hash.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/unordered_map.hpp>
+
+LIBREDIS_NAMESPACE_BEGIN
+
+namespace
+{
+  enum
+  {
+    kListenIdleMs = 10,// the thread of the channel sleeps so long without messages
+    kRetryMs = 100,// and so long after failing to subscribe
+    kMaxPending = 65536// keys waiting to be published, more are not(their TTL bounds them)
+  };
+
+  struct Item
+  {
+    std::string value;
+    bool is_nil;
+    int64_t expire_us;
+
+    Item() : is_nil(false), expire_us(0) {}
+  };
+
+  typedef std::list<std::string> lru_t;
+  typedef std::map<std::string, Item> field_map_t;
+
+  // all replies cached of a key
+  struct KeyEntry
+  {
+    bool has_value;
+    Item value;// of GET
+    field_map_t fields;// of HGET
+    lru_t::iterator lru;
+
+    KeyEntry() : has_value(false) {}
+
+    size_t entries()const
+    {
+      return (has_value ? 1 : 0) + fields.size();
+    }
+  };
+
+  typedef boost::unordered_map<std::string, KeyEntry> key_map_t;
+
+  struct Shard
+  {
+    boost::mutex mutex;
+    key_map_t keys;
+    lru_t lru;// the most recently used key first
+    size_t entries;
+    // bumped by every invalidation, puts of reads begun before it are dropped
+    NearCache::stamp_t stamp;
+
+    Shard() : entries(0), stamp(0) {}
+
+    void erase(key_map_t::iterator it)
+    {
+      entries -= it->second.entries();
+      lru.erase(it->second.lru);
+      keys.erase(it);
+    }
+  };
+}
+
+/************************************************************************/
+/*NearCache::Impl*/
+/************************************************************************/
+class NearCache::Impl
+{
+  private:
+    const NearCacheOptions options_;
+    const size_t shard_count_;
+    const size_t shard_entries_;
+    Shard * shards_;
+
+    boost::atomic<uint64_t> hits_;
+    boost::atomic<uint64_t> misses_;
+    boost::atomic<uint64_t> puts_;
+    boost::atomic<uint64_t> stale_puts_;
+    boost::atomic<uint64_t> evictions_;
+    boost::atomic<uint64_t> invalidations_;
+    boost::atomic<uint64_t> published_;
+    boost::atomic<uint64_t> received_;
+    boost::atomic<uint64_t> resets_;
+
+    // keys to publish, taken by the thread of the channel
+    boost::mutex pending_mutex_;
+    string_vector_t pending_;
+    boost::atomic<bool> stopping_;
+    boost::scoped_ptr<boost::thread> thread_;
+
+    // entries and messages of the channel are of 'db:key'
+    static std::string key_of(const std::string& db, const std::string& key)
+    {
+      std::string s;
+      s.reserve(db.size() + 1 + key.size());
+      s.append(db).append(1, ':').append(key);
+      return s;
+    }
+
+    Shard& shard_of(const std::string& key)
+    {
+      return shards_[boost::hash<std::string>()(key) % shard_count_];
+    }
+
+    bool subscribe(RedisProtocol * rp)
+    {
+      rp->close();
+      if (!rp->connect())
+        return false;
+
+      RedisCommand c(SUBSCRIBE);
+      c.push_arg(options_.channel);
+      // the confirmation does not block
+      rp->set_deadline(deadline_of(options_.timeout_ms));
+      bool ret = rp->exec_command(&c);
+      rp->set_deadline(0);
+      return ret;
+    }
+
+    // return false, the connection is broken
+    bool receive(RedisProtocol * rp)
+    {
+      RedisCommand message(SUBSCRIBE);
+      rp->set_deadline(deadline_of(options_.timeout_ms));
+      bool ret = rp->read_reply(&message);
+      rp->set_deadline(0);
+      if (!ret)
+        return false;
+
+      // "message", the channel, the key
+      const RedisOutput& out = message.out;
+      if (out.is_smbulks() && out.ptr.smbulks->size()==3)
+      {
+        const smbulk_t& smb = *out.ptr.smbulks;
+        if (smb[0]->is_bulk() && *smb[0]->ptr.bulk=="message" && smb[2]->is_bulk())
+        {
+          received_++;
+          drop(*smb[2]->ptr.bulk);
+        }
+      }
+      return true;
+    }
+
+    void publish(RedisProtocol * rp)
+    {
+      string_vector_t keys;
+      {
+        boost::mutex::scoped_lock guard(pending_mutex_);
+        keys.swap(pending_);
+      }
+      if (keys.empty() || !rp->assure_connect(NULL))
+        return;
+
+      redis_command_vector_t commands;
+      BOOST_FOREACH(const std::string& key, keys)
+      {
+        RedisCommand * c = new RedisCommand(PUBLISH);
+        c->push_arg(options_.channel);
+        c->push_arg(key);
+        commands.push_back(c);
+      }
+
+      // keys failing to go out are only bounded by their TTL
+      if (rp->exec_pipeline(&commands))
+        published_ += commands.size();
+      clear_commands(&commands);
+    }
+
+    void listen()
+    {
+      RedisProtocol subscriber(options_.host, options_.port, options_.timeout_ms);
+      RedisProtocol publisher(options_.host, options_.port, options_.timeout_ms);
+      bool subscribed = false;
+
+      while (!stopping_)
+      {
+        if (!subscribed || !subscriber.is_open())
+        {
+          subscribed = subscribe(&subscriber);
+          if (!subscribed)
+          {
+            boost::this_thread::sleep(boost::posix_time::milliseconds(
+                  static_cast<int>(kRetryMs)));
+            continue;
+          }
+
+          // messages may have been lost while it was not subscribed
+          clear();
+          resets_++;
+        }
+
+        publish(&publisher);
+
+        if (!subscriber.available())
+        {
+          boost::this_thread::sleep(boost::posix_time::milliseconds(
+                static_cast<int>(kListenIdleMs)));
+          continue;
+        }
+
+        while (subscribed && !stopping_ && subscriber.available())
+          subscribed = receive(&subscriber);
+      }
+    }
+
+  public:
+    explicit Impl(const NearCacheOptions& options)
+      : options_(options),
+      shard_count_(options.shards ? options.shards : 1),
+      shard_entries_(options.max_entries>shard_count_ ? options.max_entries / shard_count_ : 1),
+      shards_(new Shard[shard_count_]),
+      hits_(0), misses_(0), puts_(0), stale_puts_(0), evictions_(0),
+      invalidations_(0), published_(0), received_(0), resets_(0),
+      stopping_(false)
+    {
+      if (!options_.channel.empty())
+        thread_.reset(new boost::thread(boost::bind(&Impl::listen, this)));
+    }
+
+    ~Impl()
+    {
+      stopping_ = true;
+      if (thread_)
+        thread_->join();
+      delete [] shards_;
+    }
+
+    bool get(const std::string& db, const std::string& _key, const std::string * field,
+        std::string * value, bool * is_nil, stamp_t * stamp)
+    {
+      const std::string key = key_of(db, _key);
+      int64_t now = monotonic_us();
+      Shard& shard = shard_of(key);
+      boost::mutex::scoped_lock guard(shard.mutex);
+      *stamp = shard.stamp;
+
+      key_map_t::iterator it = shard.keys.find(key);
+      if (it!=shard.keys.end())
+      {
+        KeyEntry& entry = it->second;
+        Item * item = NULL;
+        field_map_t::iterator fit = entry.fields.end();
+        if (field==NULL)
+        {
+          if (entry.has_value)
+            item = &entry.value;
+        }
+        else
+        {
+          fit = entry.fields.find(*field);
+          if (fit!=entry.fields.end())
+            item = &fit->second;
+        }
+
+        if (item && item->expire_us>now)
+        {
+          value->assign(item->value);
+          *is_nil = item->is_nil;
+          shard.lru.splice(shard.lru.begin(), shard.lru, entry.lru);
+          hits_++;
+          return true;
+        }
+
+        if (item)
+        {
+          // expired
+          if (field==NULL)
+            entry.has_value = false;
+          else
+            entry.fields.erase(fit);
+          shard.entries--;
+          if (entry.entries()==0)
+          {
+            shard.lru.erase(entry.lru);
+            shard.keys.erase(it);
+          }
+        }
+      }
+
+      misses_++;
+      return false;
+    }
+
+    void put(stamp_t stamp, const std::string& db, const std::string& _key,
+        const std::string * field, const std::string& value, bool is_nil)
+    {
+      const std::string key = key_of(db, _key);
+      int64_t expire_us = monotonic_us() + static_cast<int64_t>(options_.ttl_ms) * 1000;
+      Shard& shard = shard_of(key);
+      boost::mutex::scoped_lock guard(shard.mutex);
+      if (shard.stamp!=stamp)
+      {
+        stale_puts_++;
+        return;
+      }
+
+      std::pair<key_map_t::iterator, bool> ret = shard.keys.insert(
+          std::make_pair(key, KeyEntry()));
+      KeyEntry& entry = ret.first->second;
+      if (ret.second)
+      {
+        shard.lru.push_front(key);
+        entry.lru = shard.lru.begin();
+      }
+      else
+      {
+        shard.lru.splice(shard.lru.begin(), shard.lru, entry.lru);
+      }
+
+      Item * item;
+      if (field==NULL)
+      {
+        if (!entry.has_value)
+        {
+          entry.has_value = true;
+          shard.entries++;
+        }
+        item = &entry.value;
+      }
+      else
+      {
+        std::pair<field_map_t::iterator, bool> fret = entry.fields.insert(
+            std::make_pair(*field, Item()));
+        if (fret.second)
+          shard.entries++;
+        item = &fret.first->second;
+      }
+
+      item->value = value;
+      item->is_nil = is_nil;
+      item->expire_us = expire_us;
+      puts_++;
+
+      while (shard.entries>shard_entries_ && !shard.lru.empty())
+      {
+        shard.erase(shard.keys.find(shard.lru.back()));
+        evictions_++;
+      }
+    }
+
+    // invalidate 'key' without publishing it
+    void drop(const std::string& key)
+    {
+      Shard& shard = shard_of(key);
+      boost::mutex::scoped_lock guard(shard.mutex);
+      shard.stamp++;
+      invalidations_++;
+
+      key_map_t::iterator it = shard.keys.find(key);
+      if (it!=shard.keys.end())
+        shard.erase(it);
+    }
+
+    void invalidate(const std::string& db, const std::string& _key)
+    {
+      const std::string key = key_of(db, _key);
+      drop(key);
+
+      if (thread_)
+      {
+        boost::mutex::scoped_lock guard(pending_mutex_);
+        if (pending_.size()<kMaxPending)
+          pending_.push_back(key);
+      }
+    }
+
+    void clear()
+    {
+      for (size_t i=0; i<shard_count_; i++)
+      {
+        Shard& shard = shards_[i];
+        boost::mutex::scoped_lock guard(shard.mutex);
+        shard.stamp++;
+        shard.keys.clear();
+        shard.lru.clear();
+        shard.entries = 0;
+      }
+    }
+
+    NearCacheStats get_stats()
+    {
+      NearCacheStats stats;
+      stats.hits = hits_;
+      stats.misses = misses_;
+      stats.puts = puts_;
+      stats.stale_puts = stale_puts_;
+      stats.evictions = evictions_;
+      stats.invalidations = invalidations_;
+      stats.published = published_;
+      stats.received = received_;
+      stats.resets = resets_;
+      for (size_t i=0; i<shard_count_; i++)
+      {
+        Shard& shard = shards_[i];
+        boost::mutex::scoped_lock guard(shard.mutex);
+        stats.entries += shard.entries;
+      }
+      return stats;
+    }
+};
+
+/************************************************************************/
+/*NearCache*/
+/************************************************************************/
+NearCache::NearCache(const NearCacheOptions& options)
+  : impl_(new Impl(options)) {}
+
+NearCache::~NearCache()
+{
+  delete impl_;
+}
+
+bool NearCache::get(const std::string& db, const std::string& key, const std::string * field,
+    std::string * value, bool * is_nil, stamp_t * stamp)
+{
+  return impl_->get(db, key, field, value, is_nil, stamp);
+}
+
+void NearCache::put(stamp_t stamp, const std::string& db, const std::string& key,
+    const std::string * field, const std::string& value, bool is_nil)
+{
+  impl_->put(stamp, db, key, field, value, is_nil);
+}
+
+void NearCache::invalidate(const std::string& db, const std::string& key)
+{
+  impl_->invalidate(db, key);
+}
+
+void NearCache::invalidate(const std::string& db, const string_vector_t& keys)
+{
+  BOOST_FOREACH(const std::string& key, keys)
+  {
+    impl_->invalidate(db, key);
+  }
+}
+
+void NearCache::invalidate(const std::string& db, const RedisCommand * command)
+{
+  string_vector_t keys;
+  if (written_keys(command, &keys))
+    invalidate(db, keys);
+  else
+    clear();
+}
+
+void NearCache::clear()
+{
+  impl_->clear();
+}
+
+NearCacheStats NearCache::get_stats()const
+{
+  return impl_->get_stats();
+}
+
+bool NearCache::written_keys(const RedisCommand * command, string_vector_t * keys)
+{
+  // without the name of a command written by a format
+  const size_t first = command->in.first_arg();
+  string_vector_t unnamed;
+  if (first)
+    unnamed.assign(command->in.args().begin() + first, command->in.args().end());
+  const string_vector_t& args = first ? unnamed : command->in.args();
+  kCommand cmd = command->in.command();
+  keys->clear();
+
+  switch (cmd)
+  {
+    case FLUSHALL:
+    case FLUSHDB:
+      return false;
+
+    case DEL:
+      keys->assign(args.begin(), args.end());
+      return true;
+
+    case MSET:
+    case MSETNX:
+      for (size_t i=0; i<args.size(); i+=2)
+        keys->push_back(args[i]);
+      return true;
+
+    case RENAME:
+    case RENAMENX:
+      keys->assign(args.begin(), args.end());
+      return true;
+
+    case BITOP:
+      // BITOP operation destkey key ...
+      if (args.size()>1)
+        keys->push_back(args[1]);
+      return true;
+
+    case EVAL:
+    case EVALSHA:
+      {
+        // EVAL script numkeys key ... arg ...
+        int64_t numkeys;
+        if (args.size()<2
+            || !parse_int64(args[1].data(), args[1].data() + args[1].size(), &numkeys)
+            || numkeys<0 || static_cast<uint64_t>(numkeys)>args.size() - 2)
+          return false;
+        keys->assign(args.begin() + 2, args.begin() + 2 + numkeys);
+        return true;
+      }
+
+    case MIGRATE:
+      // MIGRATE host port key db timeout
+      if (args.size()>2)
+        keys->push_back(args[2]);
+      return true;
+
+    case SORT:
+      // SORT key ... STORE destination
+      for (size_t i=1; i + 1<args.size(); i++)
+      {
+        if (strcasecmp(args[i].c_str(), "STORE")==0)
+          keys->push_back(args[i + 1]);
+      }
+      return true;
+
+    case EXEC:
+    case PUBLISH:
+      return true;
+
+    default:
+      if (command_class(cmd)==kWriteCommand && !args.empty())
+        keys->push_back(args[0]);
+      return true;
+  }
+}
+
+LIBREDIS_NAMESPACE_END
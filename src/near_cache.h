@@ -0,0 +1,120 @@
+/** @file
+ * @brief an in-process near cache of GET and HGET replies
+ * @author yafei.zhang@langtaojin.com
+ * @date
+ * @version
+ *
+ */
+#ifndef _LANGTAOJIN_LIBREDIS_NEAR_CACHE_H_
+#define _LANGTAOJIN_LIBREDIS_NEAR_CACHE_H_
+
+#include "redis_cmd.h"
+
+LIBREDIS_NAMESPACE_BEGIN
+
+struct NearCacheOptions
+{
+  // shards, each has its own lock and LRU list
+  size_t shards;
+  // entries(GET values and HGET fields) of all shards,
+  // the least recently used keys of a full shard are evicted
+  size_t max_entries;
+  // an entry lives at most 'ttl_ms' milliseconds,
+  // it bounds the staleness of writes not seen(by other processes)
+  int ttl_ms;
+
+  // With 'channel', keys written through this cache are published to 'channel'
+  // on 'host':'port', and keys published there(by any process sharing it)
+  // are invalidated, by a thread of the cache.
+  std::string host;
+  std::string port;
+  std::string channel;
+  int timeout_ms;// of the connections of the thread
+
+  NearCacheOptions()
+    : shards(16), max_entries(65536), ttl_ms(1000), timeout_ms(100) {}
+};
+
+struct NearCacheStats
+{
+  uint64_t hits;
+  uint64_t misses;// expired entries included
+  uint64_t puts;
+  uint64_t stale_puts;// dropped, their keys were invalidated while they were read
+  uint64_t evictions;// keys
+  uint64_t invalidations;// keys
+  uint64_t published;// keys published to the channel
+  uint64_t received;// keys received from the channel
+  uint64_t resets;// the cache is cleared, messages of the channel may be lost
+  size_t entries;
+
+  NearCacheStats()
+    : hits(0), misses(0), puts(0), stale_puts(0), evictions(0),
+    invalidations(0), published(0), received(0), resets(0), entries(0) {}
+
+  double hit_ratio()const
+  {
+    return (hits + misses) ? static_cast<double>(hits) / (hits + misses) : 0.0;
+  }
+};
+
+/************************************************************************/
+/**
+ * NearCache keeps replies of GET and HGET in the process
+ * (see RedisBase2::set_near_cache), many clients(RedisTss) may share one.
+ *
+ * Writes(of any command, pipelines and transactions included) through clients
+ * of the cache invalidate the keys they write when their replies are read,
+ * FLUSHDB and FLUSHALL clear it.
+ * A read racing with an invalidation of its key is not cached.
+ * Writes of other processes(and expirations) are seen after 'ttl_ms' at the latest,
+ * or at once if they publish their keys to 'channel'.
+ * Server assisted invalidation(CLIENT TRACKING) needs RESP3, which is not spoken here.
+ *
+ * Entries are kept by dbs('db' is the index selected, "0" by default) and keys,
+ * clients of different dbs may share a cache, the channel carries 'db:key'.
+ *
+ * multi thread safe
+ */
+/************************************************************************/
+class NearCache
+{
+  private:
+    class Impl;
+    Impl * impl_;
+
+    NearCache(const NearCache&);
+    NearCache& operator=(const NearCache&);
+
+  public:
+    typedef uint64_t stamp_t;
+
+    explicit NearCache(const NearCacheOptions& options);
+    // the thread of the channel is stopped, clients must not use it any more
+    ~NearCache();
+
+    // the value of GET 'key'('field' is NULL) or HGET 'key' 'field' in 'db'
+    // return true, it is cached
+    // return false, it is not, pass '*stamp' to put after reading it
+    bool get(const std::string& db, const std::string& key, const std::string * field,
+        std::string * value, bool * is_nil, stamp_t * stamp);
+    void put(stamp_t stamp, const std::string& db, const std::string& key,
+        const std::string * field, const std::string& value, bool is_nil);
+
+    // invalidate 'key' of 'db' and publish it to the channel
+    void invalidate(const std::string& db, const std::string& key);
+    void invalidate(const std::string& db, const string_vector_t& keys);
+    // invalidate the keys 'command' writes in 'db'
+    void invalidate(const std::string& db, const RedisCommand * command);
+    void clear();
+
+    NearCacheStats get_stats()const;
+
+    // the keys 'command' writes
+    // return false, it writes any keys(FLUSHDB, FLUSHALL)
+    static bool written_keys(const RedisCommand * command, string_vector_t * keys);
+};
+
+LIBREDIS_NAMESPACE_END
+
+#endif// _LANGTAOJIN_LIBREDIS_NEAR_CACHE_H_
@@ -15,6 +15,8 @@
 #include <unistd.h>
 #include <signal.h>
 #include <string.h>
+#include <time.h>
+#include <stddef.h>
 
 LIBREDIS_NAMESPACE_BEGIN
 #ifdef __APPLE__
@@ -61,6 +63,40 @@ std::string ec_2_string(int ec)
   return std::string( strerror(ec));
 }
 
+int64_t monotonic_us()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+int64_t thread_cpu_ns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int64_t deadline_of(int timeout)
+{
+  if (timeout<0)
+    return 0;
+  return monotonic_us() + (int64_t)timeout * 1000;
+}
+
+int timeout_of(int64_t deadline)
+{
+  int64_t left;
+
+  if (deadline==0)
+    return -1;
+
+  left = deadline - monotonic_us();
+  if (left<=0)
+    return 0;
+  return (int)((left + 999) / 1000);
+}
+
 int available_bytes(int fd)
 {
   int value = 0;
@@ -234,17 +270,59 @@ int timed_read(int fd, void * buf, size_t len, int flags, int timeout)
   return recv(fd, buf, len, flags);
 }
 
+int spin_read(int fd, void * buf, size_t len, int flags, int timeout,
+    int spin_us, int * spin_hit)
+{
+  /* 'timeout' bounds the spin and the poll after it */
+  int64_t deadline = deadline_of(timeout);
+  int64_t spin_deadline = 0;
+  int ret;
+
+  *spin_hit = 0;
+  for (unsigned i=0; ; i++)
+  {
+    ret = recv(fd, buf, len, flags | MSG_DONTWAIT);
+    if (ret>=0)
+    {
+      *spin_hit = 1;
+      return ret;
+    }
+    /* a failure is not a hit */
+    if (errno!=EAGAIN && errno!=EWOULDBLOCK && errno!=EINTR)
+      return ret;
+
+    /* read the clock every 16 tries */
+    if ((i & 15)==0)
+    {
+      int64_t now = monotonic_us();
+      if (spin_deadline==0)
+      {
+        spin_deadline = now + spin_us;
+        if (deadline!=0 && deadline<spin_deadline)
+          spin_deadline = deadline;
+      }
+      else if (now>=spin_deadline)
+      {
+        break;
+      }
+    }
+  }
+
+  return timed_read(fd, buf, len, flags, timeout_of(deadline));
+}
+
 int timed_readn(int fd, void * cbuf, size_t len, int flags, int timeout)
 {
   int left;
   int nread;
   char * buf = (char *)cbuf;
+  int64_t deadline = deadline_of(timeout);
 
   left = (int)len;
 
   while (left>0)
   {
-    if (poll_read(fd, timeout)!=1)
+    if (poll_read(fd, timeout_of(deadline))!=1)
       break;
 
     nread = recv(fd, buf, (size_t)left, flags);
@@ -274,12 +352,13 @@ int timed_writen(int fd, const void * cbuf, size_t len, int flags, int timeout)
   int left;
   int nwrite;
   const char * buf = (const char *)cbuf;
+  int64_t deadline = deadline_of(timeout);
 
   left = (int)len;
 
   while (left>0)
   {
-    if (poll_write(fd, timeout)!=1)
+    if (poll_write(fd, timeout_of(deadline))!=1)
       break;
 
     nwrite = send(fd, buf, (size_t)left, flags);
@@ -353,4 +432,96 @@ int resolve_host(const char * host, const char * service, struct net_endpoint *
   return 0;
 }
 
+int resolve_host_all(const char * host, const char * service, struct net_endpoint * eps, int max)
+{
+  struct addrinfo hints;
+  struct addrinfo * result;
+  struct addrinfo * rp;
+  struct net_endpoint ep = eps[0];
+  int ret;
+  int n = 0;
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = ep.domain;
+  hints.ai_socktype = ep.type;
+  hints.ai_protocol = ep.protocol;
+
+  ret = getaddrinfo(host, service, &hints, &result);
+  if (ret!=0)
+  {
+    if (ret==EAI_BADFLAGS)
+      errno = EINVAL;
+    else if (ret==EAI_FAMILY)
+      errno = EPROTONOSUPPORT;/* or ESOCKTNOSUPPORT ? */
+    else if (ret==EAI_SOCKTYPE)
+      errno = ESOCKTNOSUPPORT;
+    else if (ret!=EAI_SYSTEM)
+      errno = EHOSTUNREACH;
+    return -1;
+  }
+
+  for (rp = result; rp!=NULL && n<max; rp = rp->ai_next)
+  {
+    if (rp->ai_family==AF_INET)
+    {
+      eps[n] = ep;
+      eps[n].domain = AF_INET;
+      eps[n].address.in4 = /*lint -e(740) */ *(struct sockaddr_in *)rp->ai_addr;
+      n++;
+    }
+    else if (rp->ai_family==AF_INET6)
+    {
+      eps[n] = ep;
+      eps[n].domain = AF_INET6;
+      eps[n].address.in6 = /*lint -e(740) -e(826) */ *(struct sockaddr_in6 *)rp->ai_addr;
+      n++;
+    }
+  }
+
+  freeaddrinfo(result);
+
+  if (n==0)
+  {
+    errno = EHOSTUNREACH;
+    return -1;
+  }
+  return n;
+}
+
+int resolve_unix(const char * path, struct net_endpoint * ep)
+{
+  size_t len = strlen(path);
+
+  if (len==0)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (len>=sizeof(ep->address.un.sun_path))
+  {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+
+  ep->domain = AF_UNIX;
+  ep->type = SOCK_STREAM;
+  ep->protocol = 0;
+  memset(&ep->address.un, 0, sizeof(ep->address.un));
+  ep->address.un.sun_family = AF_UNIX;
+  memcpy(ep->address.un.sun_path, path, len);
+  return 0;
+}
+
+socklen_t net_endpoint_length(const struct net_endpoint * ep)
+{
+  if (ep->domain==AF_UNIX)
+    return (socklen_t)(offsetof(struct sockaddr_un, sun_path)
+        + strlen(ep->address.un.sun_path) + 1);
+  else if (ep->domain==AF_INET6)
+    return (socklen_t)sizeof(ep->address.in6);
+  else
+    return (socklen_t)sizeof(ep->address.in4);
+}
+
 LIBREDIS_NAMESPACE_END
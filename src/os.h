@@ -12,6 +12,7 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <sys/un.h>
 
 LIBREDIS_NAMESPACE_BEGIN
 
@@ -21,6 +22,19 @@ std::string get_host_name();
 
 std::string ec_2_string(int ec);
 
+// microseconds of CLOCK_MONOTONIC
+int64_t monotonic_us();
+// nanoseconds of CPU time the calling thread has used
+int64_t thread_cpu_ns();
+
+/**
+ * a deadline is an absolute monotonic_us(), 0 means no deadline
+ * deadline_of: the deadline 'timeout' milliseconds later, 0 for a negative 'timeout'
+ * timeout_of: the milliseconds left(rounded up), 0 if it has passed, -1 for no deadline
+ */
+int64_t deadline_of(int timeout);
+int timeout_of(int64_t deadline);
+
 /************************************************************************/
 /* socket functions: */
 /* all of them will retry operations with possible EINTR */
@@ -81,12 +95,22 @@ int timed_connect(int fd,
  */
 int timed_read(int fd, void * buf, size_t len, int flags, int timeout);
 /**
+ * like timed_read, but spin on a non-blocking recv for 'spin_us' microseconds
+ * before falling back to poll, the fd must be non-blocking,
+ * 'timeout' bounds the spin and the poll after it
+ * '*spin_hit' is 1 if data(or EOF) arrived while spinning, or 0
+ */
+int spin_read(int fd, void * buf, size_t len, int flags, int timeout,
+    int spin_us, int * spin_hit);
+/**
+ * 'timeout' bounds the whole call, not each poll
  * return the read bytes
  * return 0, 'errno==ETIMEDOUT' means timeout, others meas EOF
  * return -1, failure, check errno
  */
 int timed_readn(int fd, void * buf, size_t len, int flags, int timeout);
 /**
+ * 'timeout' bounds the whole call, not each poll
  * return the written bytes
  * return 0, 'errno==ETIMEDOUT' means timeout, others meas EOF
  * return -1, failure, check errno
@@ -107,6 +131,7 @@ struct net_endpoint
   {
     struct sockaddr_in in4;
     struct sockaddr_in6 in6;
+    struct sockaddr_un un;
   } address;
 };
 /**
@@ -114,6 +139,23 @@ struct net_endpoint
  * return -1, failure, check errno
  */
 int resolve_host(const char * host, const char * service, struct net_endpoint * ep);
+/**
+ * like resolve_host, but get at most 'max' addresses into 'eps',
+ * 'eps[0]' gives domain, type and protocol as hints
+ * return the number of addresses(>0), success
+ * return -1, failure, check errno
+ */
+int resolve_host_all(const char * host, const char * service, struct net_endpoint * eps, int max);
+/**
+ * fill 'ep' with an AF_UNIX stream endpoint of 'path'
+ * return 0, success
+ * return -1, failure, check errno(ENAMETOOLONG)
+ */
+int resolve_unix(const char * path, struct net_endpoint * ep);
+/**
+ * return the length of the address in 'ep' to be passed to connect
+ */
+socklen_t net_endpoint_length(const struct net_endpoint * ep);
 
 LIBREDIS_NAMESPACE_END
 
@@ -0,0 +1,162 @@
+/** @file
+ * @brief reconnect backoff shared by all connections to an endpoint
+ * @author yafei.zhang@langtaojin.com
+ * @date
+ * @version
+ *
+ */
+#include "reconnect_backoff.h"
+#include "redis_transport.h"
+#include "os.h"
+#include <time.h>
+#include <unistd.h>
+#include <boost/atomic.hpp>
+#include <boost/format.hpp>
+#include <boost/thread/mutex.hpp>
+
+LIBREDIS_NAMESPACE_BEGIN
+
+namespace
+{
+  enum
+  {
+    kDefaultBaseMs = 100,
+    kDefaultMaxMs = 5000
+  };
+
+  const char kBackoffError[] = "EBACKOFF";
+
+  boost::atomic<int> s_base_ms(kDefaultBaseMs);
+  boost::atomic<int> s_max_ms(kDefaultMaxMs);
+
+  struct EndpointState
+  {
+    int failures;
+    int64_t next_attempt_us;// monotonic
+
+    EndpointState() : failures(0), next_attempt_us(0) {}
+  };
+
+  class BackoffRegistry
+  {
+    private:
+      typedef std::map<std::string, EndpointState> state_map_t;
+      state_map_t states_;
+      boost::mutex mutex_;
+      uint64_t random_;
+
+      static std::string key(const std::string& host, const std::string& port)
+      {
+        return host + ":" + port;
+      }
+
+      // xorshift64, called with 'mutex_' locked
+      uint64_t next_random()
+      {
+        random_ ^= random_ << 13;
+        random_ ^= random_ >> 7;
+        random_ ^= random_ << 17;
+        return random_;
+      }
+
+      // return the backoff in us after 'failures' failures
+      int64_t backoff_us(int failures)
+      {
+        int64_t base = s_base_ms;
+        int64_t max = s_max_ms;
+        int64_t backoff = base;
+
+        for (int i=1; i<failures && backoff<max; i++)
+          backoff <<= 1;
+        if (backoff>max)
+          backoff = max;
+
+        backoff *= 1000;
+        // equal jitter: [backoff/2, backoff]
+        return backoff / 2 + static_cast<int64_t>(next_random() % static_cast<uint64_t>(backoff / 2 + 1));
+      }
+
+    public:
+      BackoffRegistry()
+        : random_(static_cast<uint64_t>(::time(NULL)) * 2654435761u
+            ^ static_cast<uint64_t>(::getpid()) ^ 0x9e3779b97f4a7c15ULL) {}
+
+      bool allow(const std::string& host, const std::string& port,
+          int64_t * wait_ms, int * failures)
+      {
+        if (s_base_ms<=0)
+          return true;
+
+        boost::mutex::scoped_lock guard(mutex_);
+        state_map_t::iterator iter = states_.find(key(host, port));
+        if (iter==states_.end())
+          return true;
+
+        EndpointState& state = (*iter).second;
+        int64_t now = monotonic_us();
+        if (now>=state.next_attempt_us)
+        {
+          // let this one probe, hold the others for another backoff
+          state.next_attempt_us = now + backoff_us(state.failures);
+          return true;
+        }
+
+        *wait_ms = (state.next_attempt_us - now + 999) / 1000;
+        *failures = state.failures;
+        return false;
+      }
+
+      void on_success(const std::string& host, const std::string& port)
+      {
+        boost::mutex::scoped_lock guard(mutex_);
+        (void)states_.erase(key(host, port));
+      }
+
+      void on_failure(const std::string& host, const std::string& port)
+      {
+        if (s_base_ms<=0)
+          return;
+
+        boost::mutex::scoped_lock guard(mutex_);
+        EndpointState& state = states_[key(host, port)];
+        state.failures++;
+        state.next_attempt_us = monotonic_us() + backoff_us(state.failures);
+      }
+  } s_registry;
+}
+
+bool ReconnectBackoff::allow(const std::string& host, const std::string& port,
+    int64_t * wait_ms, int * failures)
+{
+  return s_registry.allow(host, port, wait_ms, failures);
+}
+
+void ReconnectBackoff::on_success(const std::string& host, const std::string& port)
+{
+  s_registry.on_success(host, port);
+}
+
+void ReconnectBackoff::on_failure(const std::string& host, const std::string& port)
+{
+  s_registry.on_failure(host, port);
+}
+
+std::string ReconnectBackoff::error(const std::string& host, const std::string& port,
+    int64_t wait_ms, int failures)
+{
+  return str(boost::format("%s connect %s:%s skipped, backing off %lld ms after %d failures")
+      % kBackoffError % host % port % static_cast<long long>(wait_ms) % failures);
+}
+
+void set_reconnect_backoff(int base_ms, int max_ms)
+{
+  s_base_ms = base_ms;
+  s_max_ms = max_ms<base_ms ? base_ms : max_ms;
+}
+
+bool is_backoff_error(const std::string& err)
+{
+  return err.compare(0, sizeof(kBackoffError) - 1, kBackoffError)==0;
+}
+
+LIBREDIS_NAMESPACE_END
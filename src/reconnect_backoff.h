@@ -0,0 +1,44 @@
+/** @file
+ * @brief reconnect backoff shared by all connections to an endpoint
+ * @author yafei.zhang@langtaojin.com
+ * @date
+ * @version
+ * inner header
+ */
+#ifndef _LANGTAOJIN_LIBREDIS_RECONNECT_BACKOFF_H_
+#define _LANGTAOJIN_LIBREDIS_RECONNECT_BACKOFF_H_
+
+#include "redis_common.h"
+
+LIBREDIS_NAMESPACE_BEGIN
+
+/************************************************************************/
+/**
+ * After a failed connect, an endpoint(host:port) backs off for
+ * base * 2^(failures-1) ms(capped by max) with jitter in [50%, 100%].
+ * While it backs off, connects fail fast without touching the network.
+ * When the backoff elapses, one connect is let through as a probe,
+ * others keep failing fast until it reports or another backoff elapses.
+ * A successful connect resets the endpoint.
+ *
+ * multi thread safe
+ */
+/************************************************************************/
+class ReconnectBackoff
+{
+  public:
+    // return true, go on connecting
+    // return false, fail fast, '*wait_ms' is the remaining backoff and '*failures' the failures
+    static bool allow(const std::string& host, const std::string& port,
+        int64_t * wait_ms, int * failures);
+    static void on_success(const std::string& host, const std::string& port);
+    static void on_failure(const std::string& host, const std::string& port);
+
+    // the error of a fast failure, is_backoff_error() recognizes it
+    static std::string error(const std::string& host, const std::string& port,
+        int64_t wait_ms, int failures);
+};
+
+LIBREDIS_NAMESPACE_END
+
+#endif// _LANGTAOJIN_LIBREDIS_RECONNECT_BACKOFF_H_
@@ -7,7 +7,8 @@
  */
 #include "redis.h"
 #include "redis_protocol.h"
-#include <boost/lexical_cast.hpp>
+#include <iterator>
+#include <boost/bind.hpp>
 #include <boost/format.hpp>
 
 #define CHECK_PTR_PARAM(ptr) \
@@ -16,27 +17,33 @@
 #define CHECK_EXPR(exp) \
   do {if (!(exp)) {last_error("EINVAL");return false;}} while(0)
 
-#define CHECK_STATUS_OK() \
-  do {if (c.out.is_status_ok()) return true;else {on_reply_type_error(&c);return false;}} while(0)
+#define CHECK_NOT_PIPELINED() \
+  do {if (pipeline_) {last_error("not supported in a pipeline");return false;}} while(0)
 
-#define CHECK_STATUS_PONG() \
-  do {if (c.out.is_status_pong()) return true;else {on_reply_type_error(&c);return false;}} while(0)
-
-#define GET_INTEGER_REPLY() \
-  do {if (c.out.get_i(_return)) return true;else {on_reply_type_error(&c);return false;}} while(0)
-
-#define GET_BULK_REPLY() \
+// In a Pipeline, the reply is decoded by the bound decoder when it executes.
+#define DECODE_REPLY(decoder, ...) \
   do { \
-    if (c.out.get_bulk(_return)) {*is_nil = false;return true;} \
-    else if (c.out.is_nil_bulk()) {*is_nil = true;return true;} \
-    else {on_reply_type_error(&c);return false;} \
+    if (pipeline_) return pipeline_->bind(boost::bind(&Redis2::decoder, this, _1, __VA_ARGS__)); \
+    return decoder(&c, __VA_ARGS__); \
   } while(0)
 
-#define GET_BULK_REPLY2() \
-  do {if (c.out.get_bulk(_return)) return true;else {on_reply_type_error(&c);return false;}} while(0)
+#define DECODE_REPLY0(decoder) \
+  do { \
+    if (pipeline_) return pipeline_->bind(boost::bind(&Redis2::decoder, this, _1)); \
+    return decoder(&c); \
+  } while(0)
 
-#define GET_MBULKS_REPLY() \
-  do {if (c.out.get_mbulks(_return)) return true;else {on_reply_type_error(&c);return false;}} while(0)
+#define CHECK_STATUS() DECODE_REPLY0(status_reply)
+#define CHECK_STATUS_OK() DECODE_REPLY0(status_ok_reply)
+#define CHECK_STATUS_PONG() DECODE_REPLY0(status_pong_reply)
+#define GET_STATUS_REPLY() DECODE_REPLY(status_string_reply, _return)
+#define GET_INTEGER_REPLY() DECODE_REPLY(integer_reply, _return)
+#define GET_BULK_REPLY() DECODE_REPLY(bulk_reply, _return, is_nil)
+#define GET_BULK_REPLY2() DECODE_REPLY(bulk_reply2, _return)
+#define GET_MBULKS_REPLY() DECODE_REPLY(mbulks_reply, _return)
+#define GET_DOUBLE_REPLY() DECODE_REPLY(double_reply, _return)
+#define GET_DOUBLE_REPLY2() DECODE_REPLY(double_nil_reply, _return, is_nil)
+#define GET_RANK_REPLY() DECODE_REPLY(rank_reply, _return, not_exists)
 
 LIBREDIS_NAMESPACE_BEGIN
 
@@ -55,8 +62,166 @@ void Redis2::on_reply_type_error(const RedisCommand * command)
   // no need to disconnect
 }
 
+bool Redis2::exec_or_queue(RedisCommand * command)
+{
+  if (pipeline_)
+    return pipeline_->queue(command);
+  return proto_->exec_command(command);
+}
+
+NearCache * Redis2::read_cache()const
+{
+  if (pipeline_ || proto_->get_transaction_mode())
+    return NULL;
+  return proto_->get_near_cache();
+}
+
+bool Redis2::cached_bulk_reply(RedisCommand * c, NearCache * cache, NearCache::stamp_t stamp,
+    const std::string * field, std::string * _return, bool * is_nil)
+{
+  if (!bulk_reply(c, _return, is_nil))
+    return false;
+  cache->put(stamp, proto_->get_db(), c->in.args()[0], field, *_return, *is_nil);
+  return true;
+}
+
+bool Redis2::status_reply(RedisCommand * c)
+{
+  if (c->out.is_status())
+    return true;
+  on_reply_type_error(c);
+  return false;
+}
+
+bool Redis2::status_ok_reply(RedisCommand * c)
+{
+  if (c->out.is_status_ok())
+    return true;
+  on_reply_type_error(c);
+  return false;
+}
+
+bool Redis2::status_pong_reply(RedisCommand * c)
+{
+  if (c->out.is_status_pong())
+    return true;
+  on_reply_type_error(c);
+  return false;
+}
+
+bool Redis2::status_string_reply(RedisCommand * c, std::string * _return)
+{
+  if (c->out.get_status(_return))
+    return true;
+  on_reply_type_error(c);
+  return false;
+}
+
+bool Redis2::double_value(const std::string& s, double * _return)
+{
+  if (parse_double(s, _return))
+    return true;
+  last_error("expect a double, but got " + s);
+  return false;
+}
+
+bool Redis2::pairs_decoded(const RedisCommand * command, bool failed)
+{
+  if (!failed)
+    return true;
+  last_error(str(boost::format("expect pairs in the reply of %s")
+        % command->in.command_info().command_str));
+  return false;
+}
+
+bool Redis2::integer_reply(RedisCommand * c, int64_t * _return)
+{
+  if (c->out.get_i(_return))
+    return true;
+  on_reply_type_error(c);
+  return false;
+}
+
+bool Redis2::bulk_reply(RedisCommand * c, std::string * _return, bool * is_nil)
+{
+  if (c->out.get_bulk(_return))
+  {
+    *is_nil = false;
+    return true;
+  }
+  else if (c->out.is_nil_bulk())
+  {
+    *is_nil = true;
+    return true;
+  }
+  on_reply_type_error(c);
+  return false;
+}
+
+bool Redis2::bulk_reply2(RedisCommand * c, std::string * _return)
+{
+  if (c->out.get_bulk(_return))
+    return true;
+  on_reply_type_error(c);
+  return false;
+}
+
+bool Redis2::mbulks_reply(RedisCommand * c, mbulk_t * _return)
+{
+  if (c->out.get_mbulks(_return))
+    return true;
+  on_reply_type_error(c);
+  return false;
+}
+
+bool Redis2::double_reply(RedisCommand * c, double * _return)
+{
+  std::string _return_string;
+  if (c->out.get_bulk(&_return_string))
+    return double_value(_return_string, _return);
+  on_reply_type_error(c);
+  return false;
+}
+
+bool Redis2::double_nil_reply(RedisCommand * c, double * _return, bool * is_nil)
+{
+  std::string _return_string;
+  if (c->out.get_bulk(&_return_string))
+  {
+    *is_nil = false;
+    return double_value(_return_string, _return);
+  }
+  else if (c->out.is_nil_bulk())
+  {
+    *is_nil = true;
+    return true;
+  }
+  on_reply_type_error(c);
+  return false;
+}
+
+bool Redis2::rank_reply(RedisCommand * c, int64_t * _return, bool * not_exists)
+{
+  if (c->out.get_i(_return))
+  {
+    *not_exists = false;
+    return true;
+  }
+  else if (c->out.is_nil_bulk())
+  {
+    *not_exists = true;
+    return true;
+  }
+  on_reply_type_error(c);
+  return false;
+}
+
 bool Redis2::assure_connect()
 {
+  // a Pipeline connects its Redis2 when it executes
+  if (pipeline_)
+    return true;
+
   int status;
   if (!proto_->assure_connect(&status))
     return false;
@@ -123,17 +288,68 @@ bool Redis2::get_transaction_mode()const
   return proto_->get_transaction_mode();
 }
 
+SocketStats Redis2::get_socket_stats()const
+{
+  return proto_->get_socket_stats();
+}
+
+void Redis2::set_deadline(int64_t deadline)
+{
+  proto_->set_deadline(deadline);
+}
+
+int64_t Redis2::get_deadline()const
+{
+  return proto_->get_deadline();
+}
+
+void Redis2::set_compression(const CompressionOptions& options)
+{
+  proto_->set_compression(options);
+}
+
+CompressionOptions Redis2::get_compression()const
+{
+  return proto_->get_compression();
+}
+
+void Redis2::set_near_cache(NearCache * near_cache)
+{
+  proto_->set_near_cache(near_cache);
+}
+
+NearCache * Redis2::get_near_cache()const
+{
+  return proto_->get_near_cache();
+}
+
 
 Redis2::Redis2(const std::string& host, const std::string& port, int db_index,
-    int timeout_ms)
-: db_index_(db_index), db_index_select_failure_(true)
+    int timeout_ms, RedisTransport * transport)
+: db_index_(db_index), db_index_select_failure_(true),
+  owns_proto_(true), pipeline_(NULL)
+{
+  proto_ = new RedisProtocol(host, port, timeout_ms, transport);
+}
+
+Redis2::Redis2(const std::string& host, const std::string& port, int db_index,
+    int timeout_ms, const SocketOptions& options)
+: db_index_(db_index), db_index_select_failure_(true),
+  owns_proto_(true), pipeline_(NULL)
+{
+  proto_ = new RedisProtocol(host, port, timeout_ms, options);
+}
+
+Redis2::Redis2(Redis2 * redis, Pipeline * pipeline)
+: db_index_(redis->db_index_), db_index_select_failure_(false),
+  proto_(redis->proto_), owns_proto_(false), pipeline_(pipeline)
 {
-  proto_ = new RedisProtocol(host, port, timeout_ms);
 }
 
 Redis2::~Redis2()
 {
-  delete proto_;
+  if (owns_proto_)
+    delete proto_;
   on_reset();
 }
 
@@ -161,7 +377,7 @@ bool Redis2::del(const std::string& key, int64_t * _return)
 
   RedisCommand c(DEL);
   c.push_arg(key);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_INTEGER_REPLY();
@@ -176,7 +392,7 @@ bool Redis2::del(const string_vector_t& keys, int64_t * _return)
 
   RedisCommand c(DEL);
   c.push_arg(keys);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_INTEGER_REPLY();
@@ -191,7 +407,7 @@ bool Redis2::dump(const std::string& key, std::string * _return, bool * is_nil)
 
   RedisCommand c(DUMP);
   c.push_arg(key);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_BULK_REPLY();
@@ -206,7 +422,7 @@ bool Redis2::exists(const std::string& key, int64_t * _return)
 
   RedisCommand c(EXISTS);
   c.push_arg(key);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_INTEGER_REPLY();
@@ -223,7 +439,7 @@ bool Redis2::expire(const std::string& key, int64_t seconds,
   RedisCommand c(EXPIRE);
   c.push_arg(key);
   c.push_arg(seconds);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_INTEGER_REPLY();
@@ -240,7 +456,7 @@ bool Redis2::expireat(const std::string& key, int64_t abs_seconds,
   RedisCommand c(EXPIREAT);
   c.push_arg(key);
   c.push_arg(abs_seconds);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_INTEGER_REPLY();
@@ -255,7 +471,7 @@ bool Redis2::keys(const std::string& pattern, mbulk_t * _return)
 
   RedisCommand c(KEYS);
   c.push_arg(pattern);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_MBULKS_REPLY();
@@ -271,7 +487,7 @@ bool Redis2::move(const std::string& key, int db, int64_t * _return)
   RedisCommand c(MOVE);
   c.push_arg(key);
   c.push_arg(db);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_INTEGER_REPLY();
@@ -286,7 +502,7 @@ bool Redis2::persist(const std::string& key, int64_t * _return)
 
   RedisCommand c(PERSIST);
   c.push_arg(key);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_INTEGER_REPLY();
@@ -302,7 +518,7 @@ bool Redis2::pexpire(const std::string& key, int64_t milliseconds, int64_t * _re
   RedisCommand c(PEXPIRE);
   c.push_arg(key);
   c.push_arg(milliseconds);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_INTEGER_REPLY();
@@ -318,7 +534,7 @@ bool Redis2::pexpireat(const std::string& key, int64_t abs_milliseconds, int64_t
   RedisCommand c(PEXPIREAT);
   c.push_arg(key);
   c.push_arg(abs_milliseconds);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_INTEGER_REPLY();
@@ -333,7 +549,7 @@ bool Redis2::pttl(const std::string& key, int64_t * _return)
 
   RedisCommand c(PTTL);
   c.push_arg(key);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_INTEGER_REPLY();
@@ -348,7 +564,7 @@ bool Redis2::restore(const std::string& key, int64_t ttl, const std::string& val
   c.push_arg(key);
   c.push_arg(ttl);
   c.push_arg(value);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   CHECK_STATUS_OK();
@@ -363,7 +579,7 @@ bool Redis2::randomkey(std::string * _return, bool * is_nil)
     return false;
 
   RedisCommand c(RANDOMKEY);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_BULK_REPLY();
@@ -380,7 +596,7 @@ bool Redis2::sort(const std::string& key, const string_vector_t * phrases, mbulk
   c.push_arg(key);
   if (phrases)
     c.push_arg(*phrases);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_MBULKS_REPLY();
@@ -395,7 +611,7 @@ bool Redis2::ttl(const std::string& key, int64_t * _return)
 
   RedisCommand c(TTL);
   c.push_arg(key);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_INTEGER_REPLY();
@@ -410,16 +626,10 @@ bool Redis2::type(const std::string& key, std::string * _return)
 
   RedisCommand c(TYPE);
   c.push_arg(key);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
-  if (c.out.get_status(_return))
-    return true;
-  else
-  {
-    on_reply_type_error(&c);
-    return false;
-  }
+  GET_STATUS_REPLY();
 }
 
 bool Redis2::append(const std::string& key, const std::string& value,
@@ -433,7 +643,7 @@ bool Redis2::append(const std::string& key, const std::string& value,
   RedisCommand c(APPEND);
   c.push_arg(key);
   c.push_arg(value);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_INTEGER_REPLY();
@@ -448,7 +658,7 @@ bool Redis2::decr(const std::string& key, int64_t * _return)
 
   RedisCommand c(DECR);
   c.push_arg(key);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_INTEGER_REPLY();
@@ -464,7 +674,7 @@ bool Redis2::decrby(const std::string& key, int64_t dec, int64_t * _return)
   RedisCommand c(DECRBY);
   c.push_arg(key);
   c.push_arg(dec);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_INTEGER_REPLY();
@@ -475,14 +685,21 @@ bool Redis2::get(const std::string& key, std::string * _return, bool * is_nil)
   CHECK_PTR_PARAM(_return);
   CHECK_PTR_PARAM(is_nil);
 
+  NearCache * cache = read_cache();
+  NearCache::stamp_t stamp = 0;
+  if (cache && cache->get(proto_->get_db(), key, NULL, _return, is_nil, &stamp))
+    return true;
+
   if (!assure_connect())
     return false;
 
   RedisCommand c(GET);
   c.push_arg(key);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
+  if (cache)
+    return cached_bulk_reply(&c, cache, stamp, NULL, _return, is_nil);
   GET_BULK_REPLY();
 }
 
@@ -496,7 +713,7 @@ bool Redis2::getbit(const std::string& key, int64_t offset, int64_t * _return)
   RedisCommand c(GETBIT);
   c.push_arg(key);
   c.push_arg(offset);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_INTEGER_REPLY();
@@ -515,7 +732,7 @@ bool Redis2::getrange(const std::string& key, int64_t start, int64_t end,
   c.push_arg(key);
   c.push_arg(start);
   c.push_arg(end);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_BULK_REPLY();
@@ -533,7 +750,7 @@ bool Redis2::getset(const std::string& key, const std::string& value,
   RedisCommand c(GETSET);
   c.push_arg(key);
   c.push_arg(value);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_BULK_REPLY();
@@ -548,7 +765,7 @@ bool Redis2::incr(const std::string& key, int64_t * _return)
 
   RedisCommand c(INCR);
   c.push_arg(key);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_INTEGER_REPLY();
@@ -564,7 +781,7 @@ bool Redis2::incrby(const std::string& key, int64_t inc, int64_t * _return)
   RedisCommand c(INCRBY);
   c.push_arg(key);
   c.push_arg(inc);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_INTEGER_REPLY();
@@ -580,20 +797,10 @@ bool Redis2::incrbyfloat(const std::string& key, double inc, double * _return)
   RedisCommand c(INCRBYFLOAT);
   c.push_arg(key);
   c.push_arg(inc);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
-  std::string _return_string;
-  if (c.out.get_bulk(&_return_string))
-  {
-    *_return = boost::lexical_cast<double>(_return_string);
-    return true;
-  }
-  else
-  {
-    on_reply_type_error(&c);
-    return false;
-  }
+  GET_DOUBLE_REPLY();
 }
 
 bool Redis2::mget(const string_vector_t& keys, mbulk_t * _return)
@@ -605,7 +812,7 @@ bool Redis2::mget(const string_vector_t& keys, mbulk_t * _return)
 
   RedisCommand c(MGET);
   c.push_arg(keys);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_MBULKS_REPLY();
@@ -624,7 +831,7 @@ bool Redis2::mset(const string_vector_t& keys, const string_vector_t& values)
     c.push_arg(keys[i]);
     c.push_arg(values[i]);
   }
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   CHECK_STATUS_OK();
@@ -639,7 +846,7 @@ bool Redis2::psetex(const std::string& key, int64_t milliseconds, const std::str
   c.push_arg(key);
   c.push_arg(milliseconds);
   c.push_arg(value);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   CHECK_STATUS_OK();
@@ -653,7 +860,7 @@ bool Redis2::set(const std::string& key, const std::string& value)
   RedisCommand c(SET);
   c.push_arg(key);
   c.push_arg(value);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   CHECK_STATUS_OK();
@@ -670,7 +877,7 @@ bool Redis2::setbit(const std::string& key, int64_t offset, int64_t value, int64
   c.push_arg(key);
   c.push_arg(offset);
   c.push_arg(value);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_INTEGER_REPLY();
@@ -685,7 +892,7 @@ bool Redis2::setex(const std::string& key, int64_t seconds, const std::string& v
   c.push_arg(key);
   c.push_arg(seconds);
   c.push_arg(value);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   CHECK_STATUS_OK();
@@ -701,7 +908,7 @@ bool Redis2::setnx(const std::string& key, const std::string& value, int64_t * _
   RedisCommand c(SETNX);
   c.push_arg(key);
   c.push_arg(value);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_INTEGER_REPLY();
@@ -719,7 +926,7 @@ bool Redis2::setrange(const std::string& key, int64_t offset,
   c.push_arg(key);
   c.push_arg(offset);
   c.push_arg(value);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_INTEGER_REPLY();
@@ -734,7 +941,7 @@ bool Redis2::strlen(const std::string& key, int64_t * _return)
 
   RedisCommand c(STRLEN);
   c.push_arg(key);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_INTEGER_REPLY();
@@ -750,7 +957,7 @@ bool Redis2::hdel(const std::string& key, const std::string& field, int64_t * _r
   RedisCommand c(HDEL);
   c.push_arg(key);
   c.push_arg(field);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_INTEGER_REPLY();
@@ -766,7 +973,7 @@ bool Redis2::hdel(const std::string& key, const string_vector_t& fields, int64_t
   RedisCommand c(HDEL);
   c.push_arg(key);
   c.push_arg(fields);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_INTEGER_REPLY();
@@ -782,7 +989,7 @@ bool Redis2::hexists(const std::string& key, const std::string& field, int64_t *
   RedisCommand c(HEXISTS);
   c.push_arg(key);
   c.push_arg(field);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_INTEGER_REPLY();
@@ -794,15 +1001,22 @@ bool Redis2::hget(const std::string& key, const std::string& field,
   CHECK_PTR_PARAM(_return);
   CHECK_PTR_PARAM(is_nil);
 
+  NearCache * cache = read_cache();
+  NearCache::stamp_t stamp = 0;
+  if (cache && cache->get(proto_->get_db(), key, &field, _return, is_nil, &stamp))
+    return true;
+
   if (!assure_connect())
     return false;
 
   RedisCommand c(HGET);
   c.push_arg(key);
   c.push_arg(field);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
+  if (cache)
+    return cached_bulk_reply(&c, cache, stamp, &field, _return, is_nil);
   GET_BULK_REPLY();
 }
 
@@ -815,7 +1029,7 @@ bool Redis2::hgetall(const std::string& key, mbulk_t * _return)
 
   RedisCommand c(HGETALL);
   c.push_arg(key);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_MBULKS_REPLY();
@@ -838,7 +1052,7 @@ bool Redis2::hincrby(const std::string& key, const std::string& field,
   c.push_arg(key);
   c.push_arg(field);
   c.push_arg(inc);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_INTEGER_REPLY();
@@ -856,20 +1070,10 @@ bool Redis2::hincrbyfloat(const std::string& key, const std::string& field,
   c.push_arg(key);
   c.push_arg(field);
   c.push_arg(inc);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
-  std::string _return_string;
-  if (c.out.get_bulk(&_return_string))
-  {
-    *_return = boost::lexical_cast<double>(_return_string);
-    return true;
-  }
-  else
-  {
-    on_reply_type_error(&c);
-    return false;
-  }
+  GET_DOUBLE_REPLY();
 }
 
 bool Redis2::hkeys(const std::string& key, mbulk_t * _return)
@@ -881,7 +1085,7 @@ bool Redis2::hkeys(const std::string& key, mbulk_t * _return)
 
   RedisCommand c(HKEYS);
   c.push_arg(key);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_MBULKS_REPLY();
@@ -896,7 +1100,7 @@ bool Redis2::hlen(const std::string& key, int64_t * _return)
 
   RedisCommand c(HLEN);
   c.push_arg(key);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_INTEGER_REPLY();
@@ -913,7 +1117,7 @@ bool Redis2::hmget(const std::string& key, const string_vector_t& fields,
   RedisCommand c(HMGET);
   c.push_arg(key);
   c.push_arg(fields);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_MBULKS_REPLY();
@@ -934,7 +1138,7 @@ bool Redis2::hmset(const std::string& key,
     c.push_arg(fields[i]);
     c.push_arg(values[i]);
   }
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   CHECK_STATUS_OK();
@@ -950,7 +1154,7 @@ bool Redis2::hset(const std::string& key, const std::string& field,
   c.push_arg(key);
   c.push_arg(field);
   c.push_arg(value);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_INTEGER_REPLY();
@@ -968,7 +1172,7 @@ bool Redis2::hsetnx(const std::string& key, const std::string& field,
   c.push_arg(key);
   c.push_arg(field);
   c.push_arg(value);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_INTEGER_REPLY();
@@ -983,7 +1187,7 @@ bool Redis2::hvals(const std::string& key, mbulk_t * _return)
 
   RedisCommand c(HVALS);
   c.push_arg(key);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_MBULKS_REPLY();
@@ -992,6 +1196,7 @@ bool Redis2::hvals(const std::string& key, mbulk_t * _return)
 bool Redis2::bxpop(bool is_blpop, const string_vector_t& keys, int64_t timeout,
     std::string * key, std::string * member, bool * expired)
 {
+  CHECK_NOT_PIPELINED();
   CHECK_PTR_PARAM(key);
   CHECK_PTR_PARAM(member);
   CHECK_PTR_PARAM(expired);
@@ -1044,7 +1249,7 @@ bool Redis2::lindex(const std::string& key, int64_t index, std::string * _return
   RedisCommand c(LINDEX);
   c.push_arg(key);
   c.push_arg(index);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_BULK_REPLY();
@@ -1064,7 +1269,7 @@ bool Redis2::linsert(const std::string& key, bool before,
   c.push_arg(before?"BEFORE":"AFTER");
   c.push_arg(pivot);
   c.push_arg(value);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_INTEGER_REPLY();
@@ -1079,7 +1284,7 @@ bool Redis2::llen(const std::string& key, int64_t * _return)
 
   RedisCommand c(LLEN);
   c.push_arg(key);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_INTEGER_REPLY();
@@ -1095,7 +1300,7 @@ bool Redis2::lpop(const std::string& key, std::string * _return, bool * is_nil)
 
   RedisCommand c(LPOP);
   c.push_arg(key);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_BULK_REPLY();
@@ -1111,7 +1316,7 @@ bool Redis2::lpush(const std::string& key, const std::string& value, int64_t * _
   RedisCommand c(LPUSH);
   c.push_arg(key);
   c.push_arg(value);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_INTEGER_REPLY();
@@ -1127,7 +1332,7 @@ bool Redis2::lpush(const std::string& key, const string_vector_t& values, int64_
   RedisCommand c(LPUSH);
   c.push_arg(key);
   c.push_arg(values);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_INTEGER_REPLY();
@@ -1143,7 +1348,7 @@ bool Redis2::lpushx(const std::string& key, const std::string& value, int64_t *
   RedisCommand c(LPUSHX);
   c.push_arg(key);
   c.push_arg(value);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_INTEGER_REPLY();
@@ -1160,7 +1365,7 @@ bool Redis2::lrange(const std::string& key, int64_t start, int64_t stop, mbulk_t
   c.push_arg(key);
   c.push_arg(start);
   c.push_arg(stop);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_MBULKS_REPLY();
@@ -1177,7 +1382,7 @@ bool Redis2::lrem(const std::string& key, int64_t count, const std::string& valu
   c.push_arg(key);
   c.push_arg(count);
   c.push_arg(value);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_INTEGER_REPLY();
@@ -1192,7 +1397,7 @@ bool Redis2::lset(const std::string& key, int64_t index, const std::string& valu
   c.push_arg(key);
   c.push_arg(index);
   c.push_arg(value);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   CHECK_STATUS_OK();
@@ -1207,7 +1412,7 @@ bool Redis2::ltrim(const std::string& key, int64_t start, int64_t stop)
   c.push_arg(key);
   c.push_arg(start);
   c.push_arg(stop);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   CHECK_STATUS_OK();
@@ -1223,7 +1428,7 @@ bool Redis2::rpop(const std::string& key, std::string * _return, bool * is_nil)
 
   RedisCommand c(RPOP);
   c.push_arg(key);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_BULK_REPLY();
@@ -1239,7 +1444,7 @@ bool Redis2::rpush(const std::string& key, const std::string& value, int64_t * _
   RedisCommand c(RPUSH);
   c.push_arg(key);
   c.push_arg(value);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_INTEGER_REPLY();
@@ -1255,7 +1460,7 @@ bool Redis2::rpush(const std::string& key, const string_vector_t& values, int64_
   RedisCommand c(RPUSH);
   c.push_arg(key);
   c.push_arg(values);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_INTEGER_REPLY();
@@ -1272,7 +1477,7 @@ bool Redis2::rpushx(const std::string& key, const std::string& value, int64_t *
   RedisCommand c(RPUSHX);
   c.push_arg(key);
   c.push_arg(value);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_INTEGER_REPLY();
@@ -1288,7 +1493,7 @@ bool Redis2::sadd(const std::string& key, const std::string& member, int64_t * _
   RedisCommand c(SADD);
   c.push_arg(key);
   c.push_arg(member);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_INTEGER_REPLY();
@@ -1304,7 +1509,7 @@ bool Redis2::sadd(const std::string& key, const string_vector_t& members, int64_
   RedisCommand c(SADD);
   c.push_arg(key);
   c.push_arg(members);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_INTEGER_REPLY();
@@ -1319,7 +1524,7 @@ bool Redis2::scard(const std::string& key, int64_t * _return)
 
   RedisCommand c(SCARD);
   c.push_arg(key);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_INTEGER_REPLY();
@@ -1335,7 +1540,7 @@ bool Redis2::sismember(const std::string& key, const std::string& member, int64_
   RedisCommand c(SISMEMBER);
   c.push_arg(key);
   c.push_arg(member);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_INTEGER_REPLY();
@@ -1350,7 +1555,7 @@ bool Redis2::smembers(const std::string& key, mbulk_t * _return)
 
   RedisCommand c(SMEMBERS);
   c.push_arg(key);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_MBULKS_REPLY();
@@ -1366,7 +1571,7 @@ bool Redis2::spop(const std::string& key, std::string * _return, bool * is_nil)
 
   RedisCommand c(SPOP);
   c.push_arg(key);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_BULK_REPLY();
@@ -1382,7 +1587,7 @@ bool Redis2::srandmember(const std::string& key, std::string * _return, bool * i
 
   RedisCommand c(SRANDMEMBER);
   c.push_arg(key);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_BULK_REPLY();
@@ -1398,7 +1603,7 @@ bool Redis2::srem(const std::string& key, const std::string& member, int64_t * _
   RedisCommand c(SREM);
   c.push_arg(key);
   c.push_arg(member);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_INTEGER_REPLY();
@@ -1414,7 +1619,7 @@ bool Redis2::srem(const std::string& key, const string_vector_t& members, int64_
   RedisCommand c(SREM);
   c.push_arg(key);
   c.push_arg(members);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_INTEGER_REPLY();
@@ -1432,7 +1637,7 @@ bool Redis2::zadd(const std::string& key, double score,
   c.push_arg(key);
   c.push_arg(score);
   c.push_arg(member);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_INTEGER_REPLY();
@@ -1454,7 +1659,7 @@ bool Redis2::zadd(const std::string& key, std::vector<double>& scores,
     c.push_arg(scores[i]);
     c.push_arg(members[i]);
   }
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_INTEGER_REPLY();
@@ -1469,7 +1674,7 @@ bool Redis2::zcard(const std::string& key, int64_t * _return)
 
   RedisCommand c(ZCARD);
   c.push_arg(key);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_INTEGER_REPLY();
@@ -1488,7 +1693,7 @@ bool Redis2::zcount(const std::string& key,
   c.push_arg(key);
   c.push_arg(_min);
   c.push_arg(_max);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_INTEGER_REPLY();
@@ -1506,20 +1711,10 @@ bool Redis2::zincrby(const std::string& key, double increment,
   c.push_arg(key);
   c.push_arg(increment);
   c.push_arg(member);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
-  std::string _return_string;
-  if (c.out.get_bulk(&_return_string))
-  {
-    *_return = boost::lexical_cast<double>(_return_string);
-    return true;
-  }
-  else
-  {
-    on_reply_type_error(&c);
-    return false;
-  }
+  GET_DOUBLE_REPLY();
 }
 
 bool Redis2::zxxxrange(bool rev,
@@ -1537,7 +1732,7 @@ bool Redis2::zxxxrange(bool rev,
   c.push_arg(stop);
   if (withscores)
     c.push_arg("WITHSCORES");
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_MBULKS_REPLY();
@@ -1577,7 +1772,7 @@ bool Redis2::zxxxrangebyscore(bool rev, const std::string& key,
     c.push_arg(limit->offset);
     c.push_arg(limit->count);
   }
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_MBULKS_REPLY();
@@ -1611,24 +1806,10 @@ bool Redis2::zxxxrank(bool rev, const std::string& key, const std::string& membe
   RedisCommand c(rev?ZREVRANK:ZRANK);
   c.push_arg(key);
   c.push_arg(member);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
-  if (c.out.get_i(_return))
-  {
-    *not_exists = false;
-    return true;
-  }
-  else if (c.out.is_nil_bulk())
-  {
-    *not_exists = true;
-    return true;
-  }
-  else
-  {
-    on_reply_type_error(&c);
-    return false;
-  }
+  GET_RANK_REPLY();
 }
 
 bool Redis2::zrank(const std::string& key, const std::string& member,
@@ -1654,7 +1835,7 @@ bool Redis2::zrem(const std::string& key, const std::string& member,
   RedisCommand c(ZREM);
   c.push_arg(key);
   c.push_arg(member);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_INTEGER_REPLY();
@@ -1671,7 +1852,7 @@ bool Redis2::zrem(const std::string& key, const string_vector_t& members,
   RedisCommand c(ZREM);
   c.push_arg(key);
   c.push_arg(members);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_INTEGER_REPLY();
@@ -1690,7 +1871,7 @@ bool Redis2::zremrangebyrank(const std::string& key,
   c.push_arg(key);
   c.push_arg(start);
   c.push_arg(stop);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_INTEGER_REPLY();
@@ -1709,7 +1890,7 @@ bool Redis2::zremrangebyscore(const std::string& key,
   c.push_arg(key);
   c.push_arg(_min);
   c.push_arg(_max);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_INTEGER_REPLY();
@@ -1727,36 +1908,21 @@ bool Redis2::zscore(const std::string& key, const std::string& member,
   RedisCommand c(ZSCORE);
   c.push_arg(key);
   c.push_arg(member);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
-  std::string _return_string;
-  if (c.out.get_bulk(&_return_string))
-  {
-    *_return = boost::lexical_cast<double>(_return_string);
-    *is_nil = false;
-    return true;
-  }
-  else if (c.out.is_nil_bulk())
-  {
-    *is_nil = true;
-    return true;
-  }
-  else
-  {
-    on_reply_type_error(&c);
-    return false;
-  }
+  GET_DOUBLE_REPLY2();
 }
 
 bool Redis2::select(int index)
 {
+  CHECK_NOT_PIPELINED();
   if (!proto_->assure_connect(NULL))
     return false;
 
   RedisCommand c(SELECT);
   c.push_arg(index);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   db_index_ = index;
@@ -1780,7 +1946,7 @@ bool Redis2::flushall()
     return false;
 
   RedisCommand c(FLUSHALL);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   CHECK_STATUS_OK();
@@ -1792,7 +1958,7 @@ bool Redis2::flushdb()
     return false;
 
   RedisCommand c(FLUSHDB);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   CHECK_STATUS_OK();
@@ -1806,7 +1972,7 @@ bool Redis2::rename(const std::string& key, const std::string& newkey)
   RedisCommand c(RENAME);
   c.push_arg(key);
   c.push_arg(newkey);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   CHECK_STATUS_OK();
@@ -1822,7 +1988,7 @@ bool Redis2::renamenx(const std::string& key, const std::string& newkey, int64_t
   RedisCommand c(RENAMENX);
   c.push_arg(key);
   c.push_arg(newkey);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_INTEGER_REPLY();
@@ -1843,6 +2009,7 @@ bool Redis2::brpop(const string_vector_t& keys, int64_t timeout,
 bool Redis2::brpoplpush(const std::string& source, const std::string& destination,
     int64_t timeout, std::string * member, bool * expired)
 {
+  CHECK_NOT_PIPELINED();
   CHECK_PTR_PARAM(member);
   CHECK_PTR_PARAM(expired);
 
@@ -1890,7 +2057,7 @@ bool Redis2::rpoplpush(const std::string& source, const std::string& destination
   RedisCommand c(RPOPLPUSH);
   c.push_arg(source);
   c.push_arg(destination);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_BULK_REPLY();
@@ -1905,7 +2072,7 @@ bool Redis2::sdiff(const string_vector_t& keys, mbulk_t * _return)
 
   RedisCommand c(SDIFF);
   c.push_arg(keys);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_MBULKS_REPLY();
@@ -1922,7 +2089,7 @@ bool Redis2::sdiffstore(const std::string& destination,
   RedisCommand c(SDIFFSTORE);
   c.push_arg(destination);
   c.push_arg(keys);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_INTEGER_REPLY();
@@ -1937,7 +2104,7 @@ bool Redis2::sinter(const string_vector_t& keys, mbulk_t * _return)
 
   RedisCommand c(SINTER);
   c.push_arg(keys);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_MBULKS_REPLY();
@@ -1954,7 +2121,7 @@ bool Redis2::sinterstore(const std::string& destination,
   RedisCommand c(SINTERSTORE);
   c.push_arg(destination);
   c.push_arg(keys);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_INTEGER_REPLY();
@@ -1973,7 +2140,7 @@ bool Redis2::smove(const std::string& source,
   c.push_arg(source);
   c.push_arg(destination);
   c.push_arg(member);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_INTEGER_REPLY();
@@ -1988,7 +2155,7 @@ bool Redis2::sunion(const string_vector_t& keys, mbulk_t * _return)
 
   RedisCommand c(SUNION);
   c.push_arg(keys);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_MBULKS_REPLY();
@@ -2005,7 +2172,7 @@ bool Redis2::sunionstore(const std::string& destination,
   RedisCommand c(SUNIONSTORE);
   c.push_arg(destination);
   c.push_arg(keys);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_INTEGER_REPLY();
@@ -2041,7 +2208,7 @@ bool Redis2::zxxxxxstore(bool is_zinterstore,
     c.push_arg("AGGREGATE");
     c.push_arg("MAX");
   }
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_INTEGER_REPLY();
@@ -2065,6 +2232,7 @@ bool Redis2::zunionstore(const std::string& destination,
 
 bool Redis2::exec_command(RedisCommand * command)
 {
+  CHECK_NOT_PIPELINED();
   CHECK_PTR_PARAM(command);
 
   if (!assure_connect())
@@ -2073,8 +2241,33 @@ bool Redis2::exec_command(RedisCommand * command)
   return proto_->exec_command(command);
 }
 
+bool Redis2::command_reply(RedisCommand * c, RedisCommand * command)
+{
+  command->swap(*c);
+  return true;
+}
+
+bool Redis2::exec_cmd(RedisCommand * command, const std::string& name)
+{
+  CHECK_PTR_PARAM(command);
+
+  if (command->in.command()==NOOP)
+  {
+    last_error("invalid command: " + name);
+    return false;
+  }
+
+  if (pipeline_)
+  {
+    (void)pipeline_->queue(command);
+    return pipeline_->bind(boost::bind(&Redis2::command_reply, this, _1, command));
+  }
+  return exec_command(command);
+}
+
 bool Redis2::exec_command(RedisCommand * command, const char * format, ...)
 {
+  CHECK_NOT_PIPELINED();
   CHECK_PTR_PARAM(command);
 
   if (!assure_connect())
@@ -2089,6 +2282,7 @@ bool Redis2::exec_command(RedisCommand * command, const char * format, ...)
 
 bool Redis2::exec_pipeline(redis_command_vector_t * commands)
 {
+  CHECK_NOT_PIPELINED();
   CHECK_PTR_PARAM(commands);
 
   if (!assure_connect())
@@ -2108,7 +2302,7 @@ bool Redis2::publish(const std::string& channel, const std::string& message,
   RedisCommand c(PUBLISH);
   c.push_arg(channel);
   c.push_arg(message);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_INTEGER_REPLY();
@@ -2116,11 +2310,12 @@ bool Redis2::publish(const std::string& channel, const std::string& message,
 
 bool Redis2::multi()
 {
+  CHECK_NOT_PIPELINED();
   if (!assure_connect())
     return false;
 
   RedisCommand c(MULTI);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   CHECK_STATUS_OK();
@@ -2132,7 +2327,7 @@ bool Redis2::unwatch()
     return false;
 
   RedisCommand c(UNWATCH);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   CHECK_STATUS_OK();
@@ -2145,7 +2340,7 @@ bool Redis2::watch(const string_vector_t& keys)
 
   RedisCommand c(WATCH);
   c.push_arg(keys);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   CHECK_STATUS_OK();
@@ -2153,6 +2348,7 @@ bool Redis2::watch(const string_vector_t& keys)
 
 bool Redis2::add_command(RedisCommand * command)
 {
+  CHECK_NOT_PIPELINED();
   CHECK_PTR_PARAM(command);
 
   if (!check_connect())
@@ -2162,14 +2358,18 @@ bool Redis2::add_command(RedisCommand * command)
   inner_command->swap(*command);
 
   if (!proto_->exec_command(inner_command))
+  {
+    delete inner_command;
     return false;
+  }
 
   transaction_cmds_.push_back(inner_command);
-  return false;
+  return true;
 }
 
 bool Redis2::add_command(RedisCommand * command, const char * format, ...)
 {
+  CHECK_NOT_PIPELINED();
   CHECK_PTR_PARAM(command);
 
   if (!check_connect())
@@ -2191,13 +2391,14 @@ bool Redis2::add_command(RedisCommand * command, const char * format, ...)
 
 bool Redis2::exec(redis_command_vector_t * commands)
 {
+  CHECK_NOT_PIPELINED();
   CHECK_PTR_PARAM(commands);
 
   if (!check_connect())
     return false;
 
   RedisCommand c(EXEC);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   smbulk_t smb;
@@ -2232,11 +2433,12 @@ bool Redis2::exec(redis_command_vector_t * commands)
 
 bool Redis2::discard()
 {
+  CHECK_NOT_PIPELINED();
   if (!check_connect())
     return false;
 
   RedisCommand c(DISCARD);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   if (c.out.is_status_ok())
@@ -2257,7 +2459,7 @@ bool Redis2::ping()
     return false;
 
   RedisCommand c(PING);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   CHECK_STATUS_PONG();
@@ -2269,10 +2471,10 @@ bool Redis2::bgrewriteaof()
     return false;
 
   RedisCommand c(BGREWRITEAOF);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
-  return c.out.is_status();
+  CHECK_STATUS();
 }
 
 bool Redis2::bgsave()
@@ -2281,7 +2483,7 @@ bool Redis2::bgsave()
     return false;
 
   RedisCommand c(BGSAVE);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   CHECK_STATUS_OK();
@@ -2295,7 +2497,7 @@ bool Redis2::dbsize(int64_t * _return)
     return false;
 
   RedisCommand c(DBSIZE);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_INTEGER_REPLY();
@@ -2309,7 +2511,7 @@ bool Redis2::info(std::string * _return)
     return false;
 
   RedisCommand c(INFO);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_BULK_REPLY2();
@@ -2324,7 +2526,7 @@ bool Redis2::info(const std::string& type, std::string * _return)
 
   RedisCommand c(INFO);
   c.push_arg(type);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_BULK_REPLY2();
@@ -2338,7 +2540,7 @@ bool Redis2::lastsave(int64_t * _return)
     return false;
 
   RedisCommand c(LASTSAVE);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   GET_INTEGER_REPLY();
@@ -2352,10 +2554,437 @@ bool Redis2::slaveof(const std::string& host, const std::string& port)
   RedisCommand c(SLAVEOF);
   c.push_arg(host);
   c.push_arg(port);
-  if (!proto_->exec_command(&c))
+  if (!exec_or_queue(&c))
     return false;
 
   CHECK_STATUS_OK();
 }
 
+bool Redis2::exec_command(RedisCommand * command, ReplyVisitor * visitor)
+{
+  CHECK_NOT_PIPELINED();
+  CHECK_PTR_PARAM(command);
+  CHECK_PTR_PARAM(visitor);
+
+  if (!assure_connect())
+    return false;
+
+  return proto_->exec_command(command, visitor);
+}
+
+bool Redis2::lrange(const std::string& key, int64_t start, int64_t stop,
+    ReplyVisitor * visitor)
+{
+  RedisCommand c(LRANGE);
+  c.push_arg(key);
+  c.push_arg(start);
+  c.push_arg(stop);
+  return exec_command(&c, visitor);
+}
+
+bool Redis2::hgetall(const std::string& key, ReplyVisitor * visitor)
+{
+  RedisCommand c(HGETALL);
+  c.push_arg(key);
+  return exec_command(&c, visitor);
+}
+
+bool Redis2::smembers(const std::string& key, ReplyVisitor * visitor)
+{
+  RedisCommand c(SMEMBERS);
+  c.push_arg(key);
+  return exec_command(&c, visitor);
+}
+
+bool Redis2::zrange(const std::string& key, int64_t start, int64_t stop,
+    bool withscores, ReplyVisitor * visitor)
+{
+  RedisCommand c(ZRANGE);
+  c.push_arg(key);
+  c.push_arg(start);
+  c.push_arg(stop);
+  if (withscores)
+    c.push_arg("WITHSCORES");
+  return exec_command(&c, visitor);
+}
+
+bool Redis2::exec_command(RedisCommand * command, BulkSink * sink)
+{
+  CHECK_NOT_PIPELINED();
+  CHECK_PTR_PARAM(command);
+  CHECK_PTR_PARAM(sink);
+
+  if (!assure_connect())
+    return false;
+
+  return proto_->exec_command(command, sink);
+}
+
+bool Redis2::exec_command(RedisCommand * command, BulkSource * source)
+{
+  CHECK_NOT_PIPELINED();
+  CHECK_PTR_PARAM(command);
+  CHECK_PTR_PARAM(source);
+
+  if (!assure_connect())
+    return false;
+
+  return proto_->exec_command(command, source);
+}
+
+bool Redis2::get(const std::string& key, BulkSink * sink, bool * is_nil)
+{
+  CHECK_PTR_PARAM(is_nil);
+
+  RedisCommand c(GET);
+  c.push_arg(key);
+  std::string empty;
+  return exec_command(&c, sink) && bulk_reply(&c, &empty, is_nil);
+}
+
+bool Redis2::hget(const std::string& key, const std::string& field,
+    BulkSink * sink, bool * is_nil)
+{
+  CHECK_PTR_PARAM(is_nil);
+
+  RedisCommand c(HGET);
+  c.push_arg(key);
+  c.push_arg(field);
+  std::string empty;
+  return exec_command(&c, sink) && bulk_reply(&c, &empty, is_nil);
+}
+
+bool Redis2::set(const std::string& key, BulkSource * source)
+{
+  RedisCommand c(SET);
+  c.push_arg(key);
+  return exec_command(&c, source) && status_ok_reply(&c);
+}
+
+bool Redis2::setex(const std::string& key, int64_t seconds, BulkSource * source)
+{
+  RedisCommand c(SETEX);
+  c.push_arg(key);
+  c.push_arg(seconds);
+  return exec_command(&c, source) && status_ok_reply(&c);
+}
+
+bool Redis2::hset(const std::string& key, const std::string& field,
+    BulkSource * source, int64_t * _return)
+{
+  CHECK_PTR_PARAM(_return);
+
+  RedisCommand c(HSET);
+  c.push_arg(key);
+  c.push_arg(field);
+  return exec_command(&c, source) && integer_reply(&c, _return);
+}
+
+bool Redis2::hgetall(const std::string& key, string_pair_vector_t * _return)
+{
+  CHECK_PTR_PARAM(_return);
+
+  RedisCommand c(HGETALL);
+  c.push_arg(key);
+  StringPairVisitor<string_pair_vector_t *> visitor(_return);
+  return exec_command(&c, &visitor) && pairs_decoded(&c, visitor.failed());
+}
+
+bool Redis2::hgetall(const std::string& key, string_map_t * _return)
+{
+  CHECK_PTR_PARAM(_return);
+
+  RedisCommand c(HGETALL);
+  c.push_arg(key);
+  StringPairVisitor<std::insert_iterator<string_map_t> >
+    visitor(std::inserter(*_return, _return->end()));
+  return exec_command(&c, &visitor) && pairs_decoded(&c, visitor.failed());
+}
+
+bool Redis2::zxxxrange(bool rev,
+    const std::string& key, int64_t start, int64_t stop,
+    string_score_pair_vector_t * _return)
+{
+  CHECK_PTR_PARAM(_return);
+
+  RedisCommand c(rev?ZREVRANGE:ZRANGE);
+  c.push_arg(key);
+  c.push_arg(start);
+  c.push_arg(stop);
+  c.push_arg("WITHSCORES");
+  ScorePairVisitor<string_score_pair_vector_t *> visitor(_return);
+  return exec_command(&c, &visitor) && pairs_decoded(&c, visitor.failed());
+}
+
+bool Redis2::zrange(const std::string& key, int64_t start, int64_t stop,
+    string_score_pair_vector_t * _return)
+{
+  return zxxxrange(false, key, start, stop, _return);
+}
+
+bool Redis2::zrevrange(const std::string& key, int64_t start, int64_t stop,
+    string_score_pair_vector_t * _return)
+{
+  return zxxxrange(true, key, start, stop, _return);
+}
+
+bool Redis2::zxxxrangebyscore(bool rev, const std::string& key,
+    const std::string& _min, const std::string& _max,
+    const ZRangebyscoreLimit * limit,
+    string_score_pair_vector_t * _return)
+{
+  CHECK_PTR_PARAM(_return);
+
+  RedisCommand c(rev?ZREVRANGEBYSCORE:ZRANGEBYSCORE);
+  c.push_arg(key);
+  c.push_arg(_min);
+  c.push_arg(_max);
+  c.push_arg("WITHSCORES");
+  if (limit)
+  {
+    c.push_arg("LIMIT");
+    c.push_arg(limit->offset);
+    c.push_arg(limit->count);
+  }
+  ScorePairVisitor<string_score_pair_vector_t *> visitor(_return);
+  return exec_command(&c, &visitor) && pairs_decoded(&c, visitor.failed());
+}
+
+bool Redis2::zrangebyscore(const std::string& key,
+    const std::string& _min, const std::string& _max,
+    const ZRangebyscoreLimit * limit,
+    string_score_pair_vector_t * _return)
+{
+  return zxxxrangebyscore(false, key, _min, _max, limit, _return);
+}
+
+bool Redis2::zrevrangebyscore(const std::string& key,
+    const std::string& _max, const std::string& _min,
+    const ZRangebyscoreLimit * limit,
+    string_score_pair_vector_t * _return)
+{
+  return zxxxrangebyscore(true, key, _max, _min, limit, _return);
+}
+
+/************************************************************************/
+/*value handoff*/
+/************************************************************************/
+bool Redis2::set_swap(const std::string& key, std::string * value)
+{
+  CHECK_PTR_PARAM(value);
+
+  if (!assure_connect())
+    return false;
+
+  RedisCommand c(SET);
+  c.push_arg(key);
+  c.swap_arg(value);
+  if (!exec_or_queue(&c))
+    return false;
+
+  CHECK_STATUS_OK();
+}
+
+bool Redis2::setex_swap(const std::string& key, int64_t seconds, std::string * value)
+{
+  CHECK_PTR_PARAM(value);
+
+  if (!assure_connect())
+    return false;
+
+  RedisCommand c(SETEX);
+  c.push_arg(key);
+  c.push_arg(seconds);
+  c.swap_arg(value);
+  if (!exec_or_queue(&c))
+    return false;
+
+  CHECK_STATUS_OK();
+}
+
+bool Redis2::hset_swap(const std::string& key, const std::string& field,
+    std::string * value, int64_t * _return)
+{
+  CHECK_PTR_PARAM(value);
+  CHECK_PTR_PARAM(_return);
+
+  if (!assure_connect())
+    return false;
+
+  RedisCommand c(HSET);
+  c.push_arg(key);
+  c.push_arg(field);
+  c.swap_arg(value);
+  if (!exec_or_queue(&c))
+    return false;
+
+  GET_INTEGER_REPLY();
+}
+
+bool Redis2::lpush_swap(const std::string& key, std::string * value, int64_t * _return)
+{
+  CHECK_PTR_PARAM(value);
+  CHECK_PTR_PARAM(_return);
+
+  if (!assure_connect())
+    return false;
+
+  RedisCommand c(LPUSH);
+  c.push_arg(key);
+  c.swap_arg(value);
+  if (!exec_or_queue(&c))
+    return false;
+
+  GET_INTEGER_REPLY();
+}
+
+bool Redis2::rpush_swap(const std::string& key, std::string * value, int64_t * _return)
+{
+  CHECK_PTR_PARAM(value);
+  CHECK_PTR_PARAM(_return);
+
+  if (!assure_connect())
+    return false;
+
+  RedisCommand c(RPUSH);
+  c.push_arg(key);
+  c.swap_arg(value);
+  if (!exec_or_queue(&c))
+    return false;
+
+  GET_INTEGER_REPLY();
+}
+
+/************************************************************************/
+/*Pipeline*/
+/************************************************************************/
+Pipeline::Pipeline(Redis2 * redis)
+: Redis2(redis, this), redis_(redis), transferred_(false)
+{
+}
+
+Pipeline::~Pipeline()
+{
+  clear();
+}
+
+bool Pipeline::queue(RedisCommand * command)
+{
+  RedisCommand * queued = commands_.add(NOOP);
+  queued->swap(*command);
+  decoders_.push_back(decoder_t());
+  return true;
+}
+
+bool Pipeline::bind(const decoder_t& decoder)
+{
+  decoders_.back() = decoder;
+  return true;
+}
+
+bool Pipeline::execute()
+{
+  bool ret = transfer();
+  return decode() && ret;
+}
+
+bool Pipeline::transfer()
+{
+  transferred_ = commands_.empty()
+    || (redis_->assure_connect() && proto_->exec_pipeline(commands_.commands()));
+  return transferred_;
+}
+
+bool Pipeline::decode()
+{
+  succeeded_.assign(commands_.size(), false);
+  bool ret = transferred_;
+  std::string first_error;
+  if (!ret)
+    first_error = last_error();
+
+  for (size_t i=0; i<commands_.size(); i++)
+  {
+    RedisCommand * command = commands_[i];
+    // not replied, or replied an error
+    if (command->out.reply_type==kNone || command->out.reply_type==kError)
+      continue;
+
+    if (decoders_[i](command))
+    {
+      succeeded_[i] = true;
+    }
+    else if (ret)
+    {
+      ret = false;
+      first_error = last_error();
+    }
+  }
+
+  if (!ret)
+    last_error(first_error);
+  clear();
+  return ret;
+}
+
+void Pipeline::clear()
+{
+  commands_.clear();
+  decoders_.clear();
+  transferred_ = false;
+}
+
+bool Pipeline::expire(const std::string& key, int64_t seconds, int64_t * _return)
+{
+  return Redis2::expire(key, seconds, _return);
+}
+
+bool Pipeline::expireat(const std::string& key, int64_t abs_seconds, int64_t * _return)
+{
+  return Redis2::expireat(key, abs_seconds, _return);
+}
+
+bool Pipeline::keys(const std::string& pattern, mbulk_t * _return)
+{
+  return Redis2::keys(pattern, _return);
+}
+
+bool Pipeline::get(const std::string& key, std::string * _return, bool * is_nil)
+{
+  return Redis2::get(key, _return, is_nil);
+}
+
+bool Pipeline::hdel(const std::string& key, const std::string& field, int64_t * _return)
+{
+  return Redis2::hdel(key, field, _return);
+}
+
+bool Pipeline::hdel(const std::string& key, const string_vector_t& fields, int64_t * _return)
+{
+  return Redis2::hdel(key, fields, _return);
+}
+
+bool Pipeline::hget(const std::string& key, const std::string& field,
+    std::string * _return, bool * is_nil)
+{
+  return Redis2::hget(key, field, _return, is_nil);
+}
+
+bool Pipeline::hgetall(const std::string& key, mbulk_t * _return)
+{
+  return Redis2::hgetall(key, _return);
+}
+
+bool Pipeline::hmset(const std::string& key,
+    const string_vector_t& fields, const string_vector_t& values)
+{
+  return Redis2::hmset(key, fields, values);
+}
+
+bool Pipeline::hset(const std::string& key, const std::string& field,
+    const std::string& value, int64_t * _return)
+{
+  return Redis2::hset(key, field, value, _return);
+}
+
 LIBREDIS_NAMESPACE_END
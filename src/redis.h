@@ -9,24 +9,57 @@
 #define _LANGTAOJIN_LIBREDIS_REDIS_H_
 
 #include "redis_base.h"
+#include <boost/function.hpp>
 
 LIBREDIS_NAMESPACE_BEGIN
 
 class RedisProtocol;
+class Pipeline;
 
 class Redis2 : public RedisBase2Single
 {
   private:
+    friend class Pipeline;
+
     int db_index_;
     bool db_index_select_failure_;
 
     redis_command_vector_t transaction_cmds_;
 
     RedisProtocol * proto_;
+    // a Pipeline shares the connection of its Redis2
+    bool owns_proto_;
+    // not NULL in a Pipeline: typed methods queue their commands into it
+    // and bind their decoders, replies are decoded when it executes
+    Pipeline * pipeline_;
 
     void on_reset();
     void on_reply_type_error(const RedisCommand * command);
 
+    bool exec_or_queue(RedisCommand * command);
+    // the near cache of GET and HGET, NULL in a pipeline or a transaction
+    NearCache * read_cache()const;
+    // bulk_reply, then cache the reply read since 'stamp' of GET or HGET 'field'
+    bool cached_bulk_reply(RedisCommand * c, NearCache * cache, NearCache::stamp_t stamp,
+        const std::string * field, std::string * _return, bool * is_nil);
+
+    // reply decoders of typed methods
+    bool status_reply(RedisCommand * c);
+    bool status_ok_reply(RedisCommand * c);
+    bool status_pong_reply(RedisCommand * c);
+    bool status_string_reply(RedisCommand * c, std::string * _return);
+    bool integer_reply(RedisCommand * c, int64_t * _return);
+    bool bulk_reply(RedisCommand * c, std::string * _return, bool * is_nil);
+    bool bulk_reply2(RedisCommand * c, std::string * _return);
+    bool mbulks_reply(RedisCommand * c, mbulk_t * _return);
+    bool double_reply(RedisCommand * c, double * _return);
+    bool double_nil_reply(RedisCommand * c, double * _return, bool * is_nil);
+    bool rank_reply(RedisCommand * c, int64_t * _return, bool * not_exists);
+    // hand the queued 'c' back to 'command' of cmd()
+    bool command_reply(RedisCommand * c, RedisCommand * command);
+    // execute or queue 'command' assigned by cmd()
+    bool exec_cmd(RedisCommand * command, const std::string& name);
+
     bool bxpop(
         bool is_blpop, const string_vector_t& keys, int64_t timeout,
         std::string * key, std::string * member, bool * expired);
@@ -47,6 +80,17 @@ class Redis2 : public RedisBase2Single
     bool zxxxrank(
         bool rev, const std::string& key, const std::string& member,
         int64_t * _return, bool * not_exists);
+    bool zxxxrange(
+        bool rev, const std::string& key, int64_t start, int64_t stop,
+        string_score_pair_vector_t * _return);
+    bool zxxxrangebyscore(
+        bool rev, const std::string& key,
+        const std::string& _min, const std::string& _max,
+        const ZRangebyscoreLimit * limit,
+        string_score_pair_vector_t * _return);
+    bool double_value(const std::string& s, double * _return);
+    // a visitor of 'command' decoding pairs failed or not
+    bool pairs_decoded(const RedisCommand * command, bool failed);
 
   public:
     bool assure_connect();
@@ -61,14 +105,36 @@ class Redis2 : public RedisBase2Single
     void set_blocking_mode(bool blocking_mode);
     bool get_transaction_mode()const;
 
+    // 'host' like "unix:/tmp/redis.sock" is a unix domain socket, and 'port' is ignored
+    // 'transport' is owned by Redis2, NULL means a TcpClient(see redis_transport.h)
+    Redis2(const std::string& host, const std::string& port,
+        int db_index = 0, int timeout_ms = 50,
+        RedisTransport * transport = NULL);
     Redis2(const std::string& host, const std::string& port,
-        int db_index = 0, int timeout_ms = 50);
+        int db_index, int timeout_ms,
+        const SocketOptions& options);
     virtual ~Redis2();
 
+  protected:
+    // for Pipeline
+    Redis2(Redis2 * redis, Pipeline * pipeline);
+
+  public:
     virtual void last_error(const std::string& err);
     virtual std::string last_error()const;
     virtual const char * last_c_error()const;
 
+    virtual SocketStats get_socket_stats()const;
+
+    virtual void set_deadline(int64_t deadline);
+    virtual int64_t get_deadline()const;
+
+    virtual void set_compression(const CompressionOptions& options);
+    virtual CompressionOptions get_compression()const;
+
+    virtual void set_near_cache(NearCache * near_cache);
+    virtual NearCache * get_near_cache()const;
+
     /************************************************************************/
     /*KEYS command*/
     /************************************************************************/
@@ -278,6 +344,11 @@ class Redis2 : public RedisBase2Single
     virtual bool exec_command(RedisCommand * command, const char * format, ...);
     virtual bool exec_pipeline(redis_command_vector_t * commands);
 
+    // r.cmd(&command, "SETEX", key, 10, value), see LIBREDIS_CMD_OVERLOADS
+    // In a pipeline, 'command' gets its reply in execute() if it succeeds,
+    // so it must stay valid until then.
+    LIBREDIS_CMD_OVERLOADS(exec_cmd)
+
     /************************************************************************/
     /*Pub/Sub command*/
     /************************************************************************/
@@ -312,11 +383,196 @@ class Redis2 : public RedisBase2Single
     virtual bool info(const std::string& type, std::string * _return);
     virtual bool lastsave(int64_t * _return);
     virtual bool slaveof(const std::string& host, const std::string& port);
+
+    /************************************************************************/
+    /*streaming*/
+    /************************************************************************/
+    // The elements of a multi-bulk reply go to 'visitor' as they are read,
+    // for replies too large to be held at once(see ReplyVisitor).
+    // They are not supported in a pipeline.
+    bool exec_command(RedisCommand * command, ReplyVisitor * visitor);
+    bool lrange(const std::string& key, int64_t start, int64_t stop, ReplyVisitor * visitor);
+    // fields and values alternate
+    bool hgetall(const std::string& key, ReplyVisitor * visitor);
+    bool smembers(const std::string& key, ReplyVisitor * visitor);
+    // with scores, members and scores alternate
+    bool zrange(const std::string& key, int64_t start, int64_t stop,
+        bool withscores, ReplyVisitor * visitor);
+
+    /************************************************************************/
+    /*bulk streaming*/
+    /************************************************************************/
+    // A value goes to 'sink' or comes from 'source' piece by piece,
+    // so memory stays bounded whatever its size(see BulkSink and BulkSource).
+    // They are not supported in a pipeline.
+    bool exec_command(RedisCommand * command, BulkSink * sink);
+    bool exec_command(RedisCommand * command, BulkSource * source);
+    bool get(const std::string& key, BulkSink * sink, bool * is_nil);
+    bool hget(const std::string& key, const std::string& field,
+        BulkSink * sink, bool * is_nil);
+    bool set(const std::string& key, BulkSource * source);
+    bool setex(const std::string& key, int64_t seconds, BulkSource * source);
+    bool hset(const std::string& key, const std::string& field,
+        BulkSource * source, int64_t * _return);
+
+    /************************************************************************/
+    /*typed decoding*/
+    /************************************************************************/
+    // Pairs are decoded as they are read(see StringPairVisitor and ScorePairVisitor),
+    // without an intermediate mbulk_t, and appended to '_return'.
+    // They are not supported in a pipeline.
+    bool hgetall(const std::string& key, string_pair_vector_t * _return);
+    bool hgetall(const std::string& key, string_map_t * _return);
+    // with scores
+    bool zrange(const std::string& key, int64_t start, int64_t stop,
+        string_score_pair_vector_t * _return);
+    bool zrevrange(const std::string& key, int64_t start, int64_t stop,
+        string_score_pair_vector_t * _return);
+    bool zrangebyscore(const std::string& key,
+        const std::string& _min, const std::string& _max,
+        const ZRangebyscoreLimit * limit,
+        string_score_pair_vector_t * _return);
+    bool zrevrangebyscore(const std::string& key,
+        const std::string& _max, const std::string& _min,
+        const ZRangebyscoreLimit * limit,
+        string_score_pair_vector_t * _return);
+
+    /************************************************************************/
+    /*value handoff*/
+    /************************************************************************/
+    // '*value' is swapped into the command instead of being copied and it is left empty,
+    // a large one then goes to the socket as it is(see RedisProtocol::write_command).
+    bool set_swap(const std::string& key, std::string * value);
+    bool setex_swap(const std::string& key, int64_t seconds, std::string * value);
+    bool hset_swap(const std::string& key, const std::string& field,
+        std::string * value, int64_t * _return);
+    bool lpush_swap(const std::string& key, std::string * value, int64_t * _return);
+    bool rpush_swap(const std::string& key, std::string * value, int64_t * _return);
+
+#ifdef LIBREDIS_HAS_RVALUE_REFERENCES
+    // r.set("key", std::move(value))
+    bool set(const std::string& key, std::string&& value)
+    {
+      return set_swap(key, &value);
+    }
+
+    bool setex(const std::string& key, int64_t seconds, std::string&& value)
+    {
+      return setex_swap(key, seconds, &value);
+    }
+
+    bool hset(const std::string& key, const std::string& field,
+        std::string&& value, int64_t * _return)
+    {
+      return hset_swap(key, field, &value, _return);
+    }
+
+    bool lpush(const std::string& key, std::string&& value, int64_t * _return)
+    {
+      return lpush_swap(key, &value, _return);
+    }
+
+    bool rpush(const std::string& key, std::string&& value, int64_t * _return)
+    {
+      return rpush_swap(key, &value, _return);
+    }
+#endif
 };
 
 typedef boost::shared_ptr<Redis2> redis2_sp_t;
 typedef std::vector<redis2_sp_t> redis2_sp_vector_t;
 
+/************************************************************************/
+/**
+ * Pipeline has the typed methods of Redis2(get, hmget, zadd ...).
+ * A method checks its arguments, queues its command and returns true,
+ * its outputs are filled by execute(), which sends all queued commands
+ * in one write and reads all replies, so outputs must stay valid until then.
+ *
+ * Blocking commands, transactions, select, exec_command and exec_pipeline
+ * fail with "not supported in a pipeline", cmd() is queued like the others.
+ * The non-virtual helpers of RedisBase2(int get(key, value) ...) are hidden,
+ * they would read their outputs before execute().
+ *
+ * Redis2 redis("localhost", "6379");
+ * Pipeline pipeline(&redis);
+ * std::string value;
+ * bool is_nil;
+ * int64_t len;
+ * pipeline.get("foo", &value, &is_nil);
+ * pipeline.llen("bar", &len);
+ * if (pipeline.execute()) ...
+ *
+ * It shares the connection, the errors and the deadline of 'redis',
+ * which must outlive it(single thread safety).
+ */
+/************************************************************************/
+class Pipeline : public Redis2
+{
+  private:
+    typedef boost::function<bool (RedisCommand * command)> decoder_t;
+
+    Redis2 * const redis_;
+    // recycled by clear(), so a pipeline reused does not allocate commands
+    CommandBatch commands_;
+    std::vector<decoder_t> decoders_;
+    std::vector<bool> succeeded_;
+    bool transferred_;
+
+    // for Redis2
+    friend class Redis2;
+    bool queue(RedisCommand * command);
+    bool bind(const decoder_t& decoder);
+
+  public:
+    explicit Pipeline(Redis2 * redis);
+    virtual ~Pipeline();
+
+    // the number of queued commands
+    size_t size()const
+    {
+      return commands_.size();
+    }
+
+    // return true, all commands succeeded and their outputs are filled
+    // return false, check succeeded(i) for the i-th queued command and last_error()
+    // queued commands are dropped either way
+    bool execute();
+
+    // execute() in two steps, to run pipelines of several connections concurrently:
+    // transfer() writes all and reads all replies, decode() fills the outputs
+    // return false, see execute()
+    bool transfer();
+    bool decode();
+
+    // 'index' is the order of the command in the last execute()
+    bool succeeded(size_t index)const
+    {
+      return index<succeeded_.size() && succeeded_[index];
+    }
+
+    // drop queued commands
+    void clear();
+
+    // they hide the helpers of RedisBase2 with the same names
+    virtual bool expire(const std::string& key, int64_t seconds, int64_t * _return);
+    virtual bool expireat(const std::string& key, int64_t abs_seconds, int64_t * _return);
+    virtual bool keys(const std::string& pattern, mbulk_t * _return);
+    virtual bool get(const std::string& key, std::string * _return, bool * is_nil);
+    virtual bool hdel(const std::string& key, const std::string& field, int64_t * _return);
+    virtual bool hdel(const std::string& key, const string_vector_t& fields, int64_t * _return);
+    virtual bool hget(const std::string& key, const std::string& field,
+        std::string * _return, bool * is_nil);
+    virtual bool hgetall(const std::string& key, mbulk_t * _return);
+    virtual bool hmset(const std::string& key,
+        const string_vector_t& fields, const string_vector_t& values);
+    virtual bool hset(const std::string& key, const std::string& field,
+        const std::string& value, int64_t * _return);
+};
+
+typedef boost::shared_ptr<Pipeline> pipeline_sp_t;
+typedef std::vector<pipeline_sp_t> pipeline_sp_vector_t;
+
 LIBREDIS_NAMESPACE_END
 
 #endif// _LANGTAOJIN_LIBREDIS_REDIS_H_
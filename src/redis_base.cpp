@@ -6,6 +6,7 @@
  *
  */
 #include "redis_base.h"
+#include "os.h"
 #include <assert.h>
 #include <boost/algorithm/string.hpp>
 #include <boost/format.hpp>
@@ -17,6 +18,11 @@ LIBREDIS_NAMESPACE_BEGIN
 /************************************************************************/
 RedisBase2::~RedisBase2() {}
 
+int64_t deadline_after(int budget_ms)
+{
+  return deadline_of(budget_ms<0 ? 0 : budget_ms);
+}
+
 int RedisBase2::get(const std::string& key, std::string * value)
 {
   bool is_nil;
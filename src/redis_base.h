@@ -9,6 +9,9 @@
 #define _LANGTAOJIN_LIBREDIS_REDIS_BASE_H_
 
 #include "redis_cmd.h"
+#include "redis_transport.h"
+#include "near_cache.h"
+#include "value_codec.h"
 
 LIBREDIS_NAMESPACE_BEGIN
 
@@ -92,6 +95,44 @@ class RedisBase2
     virtual std::string last_error()const = 0;
     virtual const char * last_c_error()const = 0;
 
+    // counters of the connection(s), see SocketStats, none by default
+    virtual SocketStats get_socket_stats()const
+    {
+      return SocketStats();
+    }
+
+    // End-to-end deadline of the following calls, from deadline_after(), 0 clears it.
+    // Connecting, writing, every read, retries across groups, partition fan-out
+    // and pipelines all share it, a call failing on it reports ETIMEDOUT.
+    // Without it, every call has the budget of its command class(see set_command_budget).
+    // ScopedDeadline sets it for a scope.
+    virtual void set_deadline(int64_t deadline) = 0;
+    virtual int64_t get_deadline()const = 0;
+
+    // the opt-in codec layer of the following calls(see CompressionOptions),
+    // ignored by default
+    virtual void set_compression(const CompressionOptions& options)
+    {
+      (void)options;
+    }
+    virtual CompressionOptions get_compression()const
+    {
+      return CompressionOptions();
+    }
+
+    // GET and HGET of the following calls are served by 'near_cache' when it has them,
+    // writes invalidate it(see NearCache), NULL disables it.
+    // 'near_cache' is not owned and outlives the client.
+    // It is ignored by default.
+    virtual void set_near_cache(NearCache * near_cache)
+    {
+      (void)near_cache;
+    }
+    virtual NearCache * get_near_cache()const
+    {
+      return NULL;
+    }
+
     /************************************************************************/
     /*KEYS command*/
     /************************************************************************/
@@ -543,7 +584,7 @@ class RedisBase2Multi : public RedisBase2
     std::string error_;
   public:
     RedisBase2Multi(
-        const std::string& host_list,// a host list
+        const std::string& host_list,// a host list, "unix:/path" entries are unix domain sockets
         const std::string& port_list,// a port list matching host_list or only one port
         int db_index,
         int timeout_ms);
@@ -554,6 +595,76 @@ class RedisBase2Multi : public RedisBase2
     virtual const char * last_c_error()const;
 };
 
+// the deadline 'budget_ms' milliseconds later, for RedisBase2::set_deadline
+int64_t deadline_after(int budget_ms);
+
+/************************************************************************/
+/**
+ * ScopedDeadline gives the calls of 'redis' in its scope 'budget_ms' in all.
+ * An outer deadline that is earlier stays in effect,
+ * the previous deadline is restored when it goes out of scope.
+ *
+ * {
+ *   ScopedDeadline deadline(redis, 20);
+ *   redis->get("foo", &foo, &is_nil);
+ *   redis->mget(keys, &values);
+ * }
+ */
+/************************************************************************/
+class ScopedDeadline
+{
+  private:
+    RedisBase2 * const redis_;
+    const int64_t previous_;
+
+  public:
+    ScopedDeadline(RedisBase2 * redis, int budget_ms)
+      : redis_(redis), previous_(redis->get_deadline())
+    {
+      int64_t deadline = deadline_after(budget_ms);
+      if (previous_==0 || deadline<previous_)
+        redis_->set_deadline(deadline);
+    }
+
+    ~ScopedDeadline()
+    {
+      redis_->set_deadline(previous_);
+    }
+};
+
+/************************************************************************/
+/**
+ * Without a deadline, a call fanning out to several servers, or retrying
+ * across groups, has one budget of 'command_class' in all, not one for each.
+ * FanoutDeadline gives the calls of 'redis' in its scope that budget,
+ * or 'timeout_ms' if the class has none, a deadline already set is kept.
+ */
+/************************************************************************/
+class FanoutDeadline
+{
+  private:
+    RedisBase2 * const redis_;
+    bool owned_;
+
+  public:
+    FanoutDeadline(RedisBase2 * redis, kCommandClass command_class, int timeout_ms)
+      : redis_(redis), owned_(false)
+    {
+      if (redis_->get_deadline()==0)
+      {
+        int budget = get_command_budget(command_class);
+        redis_->set_deadline(deadline_after(budget>0 ? budget : timeout_ms));
+        owned_ = true;
+      }
+    }
+
+    ~FanoutDeadline()
+    {
+      if (owned_)
+        redis_->set_deadline(0);
+    }
+};
+
 class RedisException : public std::exception
 {
   public:
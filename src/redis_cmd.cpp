@@ -6,304 +6,309 @@
  *
  */
 #include "redis_cmd.h"
+#include <assert.h>
 #include <ctype.h>// toupper
+#include <errno.h>
+#include <math.h>// signbit
+#include <stdio.h>// snprintf
+#include <stdlib.h>// strtod
+#include <string.h>// memcpy
+#include <strings.h>// strcasecmp
 #include <algorithm>
-#include <boost/assign/list_of.hpp>
+#include <boost/atomic.hpp>
 #include <boost/foreach.hpp>
-#include <boost/lexical_cast.hpp>
 
 LIBREDIS_NAMESPACE_BEGIN
 
+// The header of a command, its name as a RESP bulk, is encoded at compile time.
+// 'name_size' must be the length of the name, or it does not compile.
+#define COMMAND_INFO(command, name_size, argc, reply_type) \
+  {command, #command, argc, reply_type, \
+    "$" #name_size "\r\n" #command "\r\n", \
+    sizeof("$" #name_size "\r\n" #command "\r\n") - 1 \
+    + 0 * sizeof(char[sizeof(#command) - 1==name_size ? 1 : -1])}
+
 static const CommandInfo s_command_map[] =
 {
-  {NOOP, "NOOP", ARGC_NO_CHECKING, kNone},// place holder
-  {APPEND, "APPEND", 2, kInteger},//
-  {AUTH, "AUTH", 1, kStatus},//
-  {BGREWRITEAOF, "BGREWRITEAOF", 0, kStatus},//
-  {BGSAVE, "BGSAVE", 0, kStatus},//
-  {BITCOUNT, "BITCOUNT", -1, kInteger},//
-  {BITOP, "BITOP", -3, kInteger},//
+  COMMAND_INFO(NOOP, 4, ARGC_NO_CHECKING, kNone),// place holder
+  COMMAND_INFO(APPEND, 6, 2, kInteger),//
+  COMMAND_INFO(AUTH, 4, 1, kStatus),//
+  COMMAND_INFO(BGREWRITEAOF, 12, 0, kStatus),//
+  COMMAND_INFO(BGSAVE, 6, 0, kStatus),//
+  COMMAND_INFO(BITCOUNT, 8, -1, kInteger),//
+  COMMAND_INFO(BITOP, 5, -3, kInteger),//
   // BLPOP may block
-  {BLPOP, "BLPOP", -2, kMultiBulk},//
+  COMMAND_INFO(BLPOP, 5, -2, kMultiBulk),//
   // BRPOP may block
-  {BRPOP, "BRPOP", -2, kMultiBulk},//
+  COMMAND_INFO(BRPOP, 5, -2, kMultiBulk),//
   // BRPOPLPUSH may block
-  {BRPOPLPUSH, "BRPOPLPUSH", 3, kDepends},//
-  {CONFIG, "CONFIG", -1, kDepends},//
-  {DBSIZE, "DBSIZE", 0, kInteger},//
-  {DEBUG, "DEBUG", -1, kDepends},//
-  {DECR, "DECR", 1, kInteger},//
-  {DECRBY, "DECRBY", 2, kInteger},//
-  {DEL, "DEL", -1, kInteger},//
-  {DISCARD, "DISCARD", 0, kStatus},//
-  {DUMP, "DUMP", 1, kBulk},//
-  {ECHO, "ECHO", 1, kBulk},//
-  {EVAL, "EVAL", -2, kDepends},//
-  {EVALSHA, "EVALSHA", -2, kDepends},//
+  COMMAND_INFO(BRPOPLPUSH, 10, 3, kDepends),//
+  COMMAND_INFO(CONFIG, 6, -1, kDepends),//
+  COMMAND_INFO(DBSIZE, 6, 0, kInteger),//
+  COMMAND_INFO(DEBUG, 5, -1, kDepends),//
+  COMMAND_INFO(DECR, 4, 1, kInteger),//
+  COMMAND_INFO(DECRBY, 6, 2, kInteger),//
+  COMMAND_INFO(DEL, 3, -1, kInteger),//
+  COMMAND_INFO(DISCARD, 7, 0, kStatus),//
+  COMMAND_INFO(DUMP, 4, 1, kBulk),//
+  COMMAND_INFO(ECHO, 4, 1, kBulk),//
+  COMMAND_INFO(EVAL, 4, -2, kDepends),//
+  COMMAND_INFO(EVALSHA, 7, -2, kDepends),//
   // EXEC may return a special multi-bulk
-  {EXEC, "EXEC", 0, kSpecialMultiBulk},//
-  {EXISTS, "EXISTS", 1, kInteger},//
-  {EXPIRE, "EXPIRE", 2, kInteger},//
-  {EXPIREAT, "EXPIREAT", 2, kInteger},//
-  {FLUSHALL, "FLUSHALL", 0, kStatus},//
-  {FLUSHDB, "FLUSHDB", 0, kStatus},//
-  {GET, "GET", 1, kBulk},//
-  {GETBIT, "GETBIT", 2, kInteger},//
-  {GETRANGE, "GETRANGE", 3, kBulk},//
-  {GETSET, "GETSET", 2, kBulk},//
-  {HDEL, "HDEL", -2, kInteger},//
-  {HEXISTS, "HEXISTS", 2, kInteger},//
-  {HGET, "HGET", 2, kBulk},//
-  {HGETALL, "HGETALL", 1, kMultiBulk},//
-  {HINCRBY, "HINCRBY", 3, kInteger},//
-  {HINCRBYFLOAT, "HINCRBYFLOAT", 3, kBulk},//
-  {HKEYS, "HKEYS", 1, kMultiBulk},//
-  {HLEN, "HLEN", 1, kInteger},//
-  {HMGET, "HMGET", -2, kMultiBulk},//
-  {HMSET, "HMSET", -3, kStatus},//
-  {HSET, "HSET", 3, kInteger},//
-  {HSETNX, "HSETNX", 3, kInteger},//
-  {HVALS, "HVALS", 1, kMultiBulk},//
-  {INCR, "INCR", 1, kInteger},//
-  {INCRBY, "INCRBY", 2, kInteger},//
-  {INCRBYFLOAT, "INCRBYFLOAT", 2, kBulk},//
-  {INFO, "INFO", ARGC_NO_CHECKING, kBulk},//
-  {KEYS, "KEYS", 1, kMultiBulk},//
-  {LASTSAVE, "LASTSAVE", 0, kInteger},//
-  {LINDEX, "LINDEX", 2, kBulk},//
-  {LINSERT, "LINSERT", 4, kInteger},//
-  {LLEN, "LLEN", 1, kInteger},//
-  {LPOP, "LPOP", 1, kBulk},//
-  {LPUSH, "LPUSH", -2, kInteger},//
-  {LPUSHX, "LPUSHX", 2, kInteger},//
-  {LRANGE, "LRANGE", 3, kMultiBulk},//
-  {LREM, "LREM", 3, kInteger},//
-  {LSET, "LSET", 3, kStatus},//
-  {LTRIM, "LTRIM", 3, kStatus},//
-  {MGET, "MGET", -1, kMultiBulk},//
-  {MIGRATE, "MIGRATE", 5, kStatus},//
-  {MONITOR, "MONITOR", 0, kDepends},//
-  {MOVE, "MOVE", 2, kInteger},//
-  {MSET, "MSET", -2, kStatus},//
-  {MSETNX, "MSETNX", -2, kInteger},//
-  {MULTI, "MULTI", 0, kStatus},//
-  {OBJECT, "OBJECT", -1, kDepends},//
-  {PERSIST, "PERSIST", 1, kInteger},//
-  {PEXPIRE, "PEXPIRE", 2, kInteger},//
-  {PEXPIREAT, "PEXPIREAT", 2, kInteger},//
-  {PING, "PING", 0, kStatus},//
-  {PSETEX, "PSETEX", 3, kStatus},//
+  COMMAND_INFO(EXEC, 4, 0, kSpecialMultiBulk),//
+  COMMAND_INFO(EXISTS, 6, 1, kInteger),//
+  COMMAND_INFO(EXPIRE, 6, -2, kInteger),//
+  COMMAND_INFO(EXPIREAT, 8, -2, kInteger),//
+  COMMAND_INFO(FLUSHALL, 8, 0, kStatus),//
+  COMMAND_INFO(FLUSHDB, 7, 0, kStatus),//
+  COMMAND_INFO(GET, 3, 1, kBulk),//
+  COMMAND_INFO(GETBIT, 6, 2, kInteger),//
+  COMMAND_INFO(GETRANGE, 8, 3, kBulk),//
+  COMMAND_INFO(GETSET, 6, 2, kBulk),//
+  COMMAND_INFO(HDEL, 4, -2, kInteger),//
+  COMMAND_INFO(HEXISTS, 7, 2, kInteger),//
+  COMMAND_INFO(HGET, 4, 2, kBulk),//
+  COMMAND_INFO(HGETALL, 7, 1, kMultiBulk),//
+  COMMAND_INFO(HINCRBY, 7, 3, kInteger),//
+  COMMAND_INFO(HINCRBYFLOAT, 12, 3, kBulk),//
+  COMMAND_INFO(HKEYS, 5, 1, kMultiBulk),//
+  COMMAND_INFO(HLEN, 4, 1, kInteger),//
+  COMMAND_INFO(HMGET, 5, -2, kMultiBulk),//
+  COMMAND_INFO(HMSET, 5, -3, kStatus),//
+  COMMAND_INFO(HSET, 4, 3, kInteger),//
+  COMMAND_INFO(HSETNX, 6, 3, kInteger),//
+  COMMAND_INFO(HVALS, 5, 1, kMultiBulk),//
+  COMMAND_INFO(INCR, 4, 1, kInteger),//
+  COMMAND_INFO(INCRBY, 6, 2, kInteger),//
+  COMMAND_INFO(INCRBYFLOAT, 11, 2, kBulk),//
+  COMMAND_INFO(INFO, 4, ARGC_NO_CHECKING, kBulk),//
+  COMMAND_INFO(KEYS, 4, 1, kMultiBulk),//
+  COMMAND_INFO(LASTSAVE, 8, 0, kInteger),//
+  COMMAND_INFO(LINDEX, 6, 2, kBulk),//
+  COMMAND_INFO(LINSERT, 7, 4, kInteger),//
+  COMMAND_INFO(LLEN, 4, 1, kInteger),//
+  COMMAND_INFO(LPOP, 4, 1, kBulk),//
+  COMMAND_INFO(LPUSH, 5, -2, kInteger),//
+  COMMAND_INFO(LPUSHX, 6, 2, kInteger),//
+  COMMAND_INFO(LRANGE, 6, 3, kMultiBulk),//
+  COMMAND_INFO(LREM, 4, 3, kInteger),//
+  COMMAND_INFO(LSET, 4, 3, kStatus),//
+  COMMAND_INFO(LTRIM, 5, 3, kStatus),//
+  COMMAND_INFO(MGET, 4, -1, kMultiBulk),//
+  COMMAND_INFO(MIGRATE, 7, -5, kStatus),//
+  COMMAND_INFO(MONITOR, 7, 0, kDepends),//
+  COMMAND_INFO(MOVE, 4, 2, kInteger),//
+  COMMAND_INFO(MSET, 4, -2, kStatus),//
+  COMMAND_INFO(MSETNX, 6, -2, kInteger),//
+  COMMAND_INFO(MULTI, 5, 0, kStatus),//
+  COMMAND_INFO(OBJECT, 6, -1, kDepends),//
+  COMMAND_INFO(PERSIST, 7, 1, kInteger),//
+  COMMAND_INFO(PEXPIRE, 7, -2, kInteger),//
+  COMMAND_INFO(PEXPIREAT, 9, -2, kInteger),//
+  COMMAND_INFO(PING, 4, 0, kStatus),//
+  COMMAND_INFO(PSETEX, 6, 3, kStatus),//
   // PSUBSCRIBE ... will return a special multi-bulk,
-  {PSUBSCRIBE, "PSUBSCRIBE", -1, kSpecialMultiBulk},//
-  {PTTL, "PTTL", 1, kInteger},//
-  {PUBLISH, "PUBLISH", 2, kInteger},//
+  COMMAND_INFO(PSUBSCRIBE, 10, -1, kSpecialMultiBulk),//
+  COMMAND_INFO(PTTL, 4, 1, kInteger),//
+  COMMAND_INFO(PUBLISH, 7, 2, kInteger),//
   // PUNSUBSCRIBE will block
   // PUNSUBSCRIBE ... will return a special multi-bulk
-  {PUNSUBSCRIBE, "PUNSUBSCRIBE", ARGC_NO_CHECKING, kSpecialMultiBulk},//
-  {QUIT, "QUIT", 0, kStatus},//
-  {RANDOMKEY, "RANDOMKEY", 0, kBulk},//
-  {RENAME, "RENAME", 2, kStatus},//
-  {RENAMENX, "RENAMENX", 2, kInteger},//
-  {RESTORE, "RESTORE", 3, kStatus},//
-  {RPOP, "RPOP", 1, kBulk},//
-  {RPOPLPUSH, "RPOPLPUSH", 2, kBulk},//
-  {RPUSH, "RPUSH", -2, kInteger},//
-  {RPUSHX, "RPUSHX", 2, kInteger},//
-  {SADD, "SADD", -2, kInteger},//
-  {SAVE, "SAVE", 0, kDepends},//
-  {SCARD, "SCARD", 1, kInteger},//
-  {SCRIPT, "SCRIPT", -1, kDepends},//
-  {SDIFF, "SDIFF", -1, kMultiBulk},//
-  {SDIFFSTORE, "SDIFFSTORE", -2, kInteger},//
-  {SELECT, "SELECT", 1, kStatus},//
-  {SET, "SET", 2, kStatus},//
-  {SETBIT, "SETBIT", 3, kInteger},//
-  {SETEX, "SETEX", 3, kStatus},//
-  {SETNX, "SETNX", 2, kInteger},//
-  {SETRANGE, "SETRANGE", 3, kInteger},//
-  {SHUTDOWN, "SHUTDOWN", ARGC_NO_CHECKING, kStatus},//
-  {SINTER, "SINTER", -1, kMultiBulk},//
-  {SINTERSTORE, "SINTERSTORE", -2, kInteger},//
-  {SISMEMBER, "SISMEMBER", 2, kInteger},//
-  {SLAVEOF, "SLAVEOF", 2, kStatus},//
-  {SLOWLOG, "SLOWLOG", 1, kDepends},//
-  {SMEMBERS, "SMEMBERS", 1, kMultiBulk},//
-  {SMOVE, "SMOVE", 3, kInteger},//
-  {SORT, "SORT", -1, kMultiBulk},//
-  {SPOP, "SPOP", 1, kBulk},//
-  {SRANDMEMBER, "SRANDMEMBER", 1, kBulk},//
-  {SREM, "SREM", -2, kInteger},//
-  {STRLEN, "STRLEN", 1, kInteger},//
+  COMMAND_INFO(PUNSUBSCRIBE, 12, ARGC_NO_CHECKING, kSpecialMultiBulk),//
+  COMMAND_INFO(QUIT, 4, 0, kStatus),//
+  COMMAND_INFO(RANDOMKEY, 9, 0, kBulk),//
+  COMMAND_INFO(RENAME, 6, 2, kStatus),//
+  COMMAND_INFO(RENAMENX, 8, 2, kInteger),//
+  COMMAND_INFO(RESTORE, 7, -3, kStatus),//
+  COMMAND_INFO(RPOP, 4, 1, kBulk),//
+  COMMAND_INFO(RPOPLPUSH, 9, 2, kBulk),//
+  COMMAND_INFO(RPUSH, 5, -2, kInteger),//
+  COMMAND_INFO(RPUSHX, 6, 2, kInteger),//
+  COMMAND_INFO(SADD, 4, -2, kInteger),//
+  COMMAND_INFO(SAVE, 4, 0, kDepends),//
+  COMMAND_INFO(SCARD, 5, 1, kInteger),//
+  COMMAND_INFO(SCRIPT, 6, -1, kDepends),//
+  COMMAND_INFO(SDIFF, 5, -1, kMultiBulk),//
+  COMMAND_INFO(SDIFFSTORE, 10, -2, kInteger),//
+  COMMAND_INFO(SELECT, 6, 1, kStatus),//
+  // SET may take EX, PX, NX or XX, and reply a nil bulk with NX or XX
+  COMMAND_INFO(SET, 3, -2, kDepends),//
+  COMMAND_INFO(SETBIT, 6, 3, kInteger),//
+  COMMAND_INFO(SETEX, 5, 3, kStatus),//
+  COMMAND_INFO(SETNX, 5, 2, kInteger),//
+  COMMAND_INFO(SETRANGE, 8, 3, kInteger),//
+  COMMAND_INFO(SHUTDOWN, 8, ARGC_NO_CHECKING, kStatus),//
+  COMMAND_INFO(SINTER, 6, -1, kMultiBulk),//
+  COMMAND_INFO(SINTERSTORE, 11, -2, kInteger),//
+  COMMAND_INFO(SISMEMBER, 9, 2, kInteger),//
+  COMMAND_INFO(SLAVEOF, 7, 2, kStatus),//
+  COMMAND_INFO(SLOWLOG, 7, 1, kDepends),//
+  COMMAND_INFO(SMEMBERS, 8, 1, kMultiBulk),//
+  COMMAND_INFO(SMOVE, 5, 3, kInteger),//
+  COMMAND_INFO(SORT, 4, -1, kMultiBulk),//
+  // SPOP and SRANDMEMBER reply a multi-bulk with a count
+  COMMAND_INFO(SPOP, 4, -1, kDepends),//
+  COMMAND_INFO(SRANDMEMBER, 11, -1, kDepends),//
+  COMMAND_INFO(SREM, 4, -2, kInteger),//
+  COMMAND_INFO(STRLEN, 6, 1, kInteger),//
   // SUBSCRIBE ... will return a special multi-bulk,
-  {SUBSCRIBE, "SUBSCRIBE", -1, kSpecialMultiBulk},//
-  {SUNION, "SUNION", -1, kMultiBulk},//
-  {SUNIONSTORE, "SUNIONSTORE", -2, kInteger},//
-  {SYNC, "SYNC", ARGC_NO_CHECKING, kDepends},//
-  {TIME, "TIME", 0, kMultiBulk},//
-  {TTL, "TTL", 1, kInteger},//
-  {TYPE, "TYPE", 1, kStatus},//
+  COMMAND_INFO(SUBSCRIBE, 9, -1, kSpecialMultiBulk),//
+  COMMAND_INFO(SUNION, 6, -1, kMultiBulk),//
+  COMMAND_INFO(SUNIONSTORE, 11, -2, kInteger),//
+  COMMAND_INFO(SYNC, 4, ARGC_NO_CHECKING, kDepends),//
+  COMMAND_INFO(TIME, 4, 0, kMultiBulk),//
+  COMMAND_INFO(TTL, 3, 1, kInteger),//
+  COMMAND_INFO(TYPE, 4, 1, kStatus),//
   // UNSUBSCRIBE will block
   // UNSUBSCRIBE ... will return a special multi-bulk
-  {UNSUBSCRIBE, "UNSUBSCRIBE", ARGC_NO_CHECKING, kSpecialMultiBulk},//
-  {UNWATCH, "UNWATCH", 0, kStatus},//
-  {WATCH, "WATCH", -1, kStatus},//
-  {ZADD, "ZADD", -3, kInteger},//
-  {ZCARD, "ZCARD", 1, kInteger},//
-  {ZCOUNT, "ZCOUNT", 3, kInteger},//
-  {ZINCRBY, "ZINCRBY", 3, kBulk},//
-  {ZINTERSTORE, "ZINTERSTORE", -3, kInteger},//
-  {ZRANGE, "ZRANGE", -3, kMultiBulk},//
-  {ZRANGEBYSCORE, "ZRANGEBYSCORE", -3, kMultiBulk},//
-  {ZRANK, "ZRANK", 2, kDepends},//
-  {ZREM, "ZREM", -2, kInteger},//
-  {ZREMRANGEBYRANK, "ZREMRANGEBYRANK", 3, kInteger},//
-  {ZREMRANGEBYSCORE, "ZREMRANGEBYSCORE", 3, kInteger},//
-  {ZREVRANGE, "ZREVRANGE", -3, kMultiBulk},//
-  {ZREVRANGEBYSCORE, "ZREVRANGEBYSCORE", -3, kMultiBulk},//
-  {ZREVRANK, "ZREVRANK", 2, kDepends},//
-  {ZSCORE, "ZSCORE", 2, kBulk},//
-  {ZUNIONSTORE, "ZUNIONSTORE", -3, kInteger},//
-  {COMMAND_MAX, "COMMAND_MAX", ARGC_NO_CHECKING, kNone},// place holder
+  COMMAND_INFO(UNSUBSCRIBE, 11, ARGC_NO_CHECKING, kSpecialMultiBulk),//
+  COMMAND_INFO(UNWATCH, 7, 0, kStatus),//
+  COMMAND_INFO(WATCH, 5, -1, kStatus),//
+  COMMAND_INFO(ZADD, 4, -3, kInteger),//
+  COMMAND_INFO(ZCARD, 5, 1, kInteger),//
+  COMMAND_INFO(ZCOUNT, 6, 3, kInteger),//
+  COMMAND_INFO(ZINCRBY, 7, 3, kBulk),//
+  COMMAND_INFO(ZINTERSTORE, 11, -3, kInteger),//
+  COMMAND_INFO(ZRANGE, 6, -3, kMultiBulk),//
+  COMMAND_INFO(ZRANGEBYSCORE, 13, -3, kMultiBulk),//
+  COMMAND_INFO(ZRANK, 5, 2, kDepends),//
+  COMMAND_INFO(ZREM, 4, -2, kInteger),//
+  COMMAND_INFO(ZREMRANGEBYRANK, 15, 3, kInteger),//
+  COMMAND_INFO(ZREMRANGEBYSCORE, 16, 3, kInteger),//
+  COMMAND_INFO(ZREVRANGE, 9, -3, kMultiBulk),//
+  COMMAND_INFO(ZREVRANGEBYSCORE, 16, -3, kMultiBulk),//
+  COMMAND_INFO(ZREVRANK, 8, 2, kDepends),//
+  COMMAND_INFO(ZSCORE, 6, 2, kBulk),//
+  COMMAND_INFO(ZUNIONSTORE, 11, -3, kInteger),//
+  COMMAND_INFO(COMMAND_MAX, 11, ARGC_NO_CHECKING, kNone),// place holder
 };
 
-typedef std::map<std::string, kCommand> command_rev_map_t;
-command_rev_map_t s_command_rev_map = /*lint --e(64) */boost::assign::map_list_of
-("APPEND",APPEND)
-("AUTH",AUTH)
-("BGREWRITEAOF",BGREWRITEAOF)
-("BGSAVE",BGSAVE)
-("BITCOUNT",BITCOUNT)
-("BITOP",BITOP)
-("BLPOP",BLPOP)
-("BRPOP",BRPOP)
-("BRPOPLPUSH",BRPOPLPUSH)
-("CONFIG",CONFIG)
-("DBSIZE",DBSIZE)
-("DEBUG",DEBUG)
-("DECR",DECR)
-("DECRBY",DECRBY)
-("DEL",DEL)
-("DISCARD",DISCARD)
-("DUMP",DUMP)
-("ECHO",ECHO)
-("EVAL",EVAL)
-("EVALSHA",EVALSHA)
-("EXEC",EXEC)
-("EXISTS",EXISTS)
-("EXPIRE",EXPIRE)
-("EXPIREAT",EXPIREAT)
-("FLUSHALL",FLUSHALL)
-("FLUSHDB",FLUSHDB)
-("GET",GET)
-("GETBIT",GETBIT)
-("GETRANGE",GETRANGE)
-("GETSET",GETSET)
-("HDEL",HDEL)
-("HEXISTS",HEXISTS)
-("HGET",HGET)
-("HGETALL",HGETALL)
-("HINCRBY",HINCRBY)
-("HINCRBYFLOAT",HINCRBYFLOAT)
-("HKEYS",HKEYS)
-("HLEN",HLEN)
-("HMGET",HMGET)
-("HMSET",HMSET)
-("HSET",HSET)
-("HSETNX",HSETNX)
-("HVALS",HVALS)
-("INCR",INCR)
-("INCRBY",INCRBY)
-("INCRBYFLOAT",INCRBYFLOAT)
-("INFO",INFO)
-("KEYS",KEYS)
-("LASTSAVE",LASTSAVE)
-("LINDEX",LINDEX)
-("LINSERT",LINSERT)
-("LLEN",LLEN)
-("LPOP",LPOP)
-("LPUSH",LPUSH)
-("LPUSHX",LPUSHX)
-("LRANGE",LRANGE)
-("LREM",LREM)
-("LSET",LSET)
-("LTRIM",LTRIM)
-("MGET",MGET)
-("MIGRATE",MIGRATE)
-("MONITOR",MONITOR)
-("MOVE",MOVE)
-("MSET",MSET)
-("MSETNX",MSETNX)
-("MULTI",MULTI)
-("OBJECT",OBJECT)
-("PERSIST",PERSIST)
-("PEXPIRE",PEXPIRE)
-("PEXPIREAT",PEXPIREAT)
-("PING",PING)
-("PSETEX",PSETEX)
-("PSUBSCRIBE",PSUBSCRIBE)
-("PTTL",PTTL)
-("PUBLISH",PUBLISH)
-("PUNSUBSCRIBE",PUNSUBSCRIBE)
-("QUIT",QUIT)
-("RANDOMKEY",RANDOMKEY)
-("RENAME",RENAME)
-("RENAMENX",RENAMENX)
-("RESTORE",RESTORE)
-("RPOP",RPOP)
-("RPOPLPUSH",RPOPLPUSH)
-("RPUSH",RPUSH)
-("RPUSHX",RPUSHX)
-("SADD",SADD)
-("SAVE",SAVE)
-("SCARD",SCARD)
-("SCRIPT",SCRIPT)
-("SDIFF",SDIFF)
-("SDIFFSTORE",SDIFFSTORE)
-("SELECT",SELECT)
-("SET",SET)
-("SETBIT",SETBIT)
-("SETEX",SETEX)
-("SETNX",SETNX)
-("SETRANGE",SETRANGE)
-("SHUTDOWN",SHUTDOWN)
-("SINTER",SINTER)
-("SINTERSTORE",SINTERSTORE)
-("SISMEMBER",SISMEMBER)
-("SLAVEOF",SLAVEOF)
-("SLOWLOG",SLOWLOG)
-("SMEMBERS",SMEMBERS)
-("SMOVE",SMOVE)
-("SORT",SORT)
-("SPOP",SPOP)
-("SRANDMEMBER",SRANDMEMBER)
-("SREM",SREM)
-("STRLEN",STRLEN)
-("SUBSCRIBE",SUBSCRIBE)
-("SUNION",SUNION)
-("SUNIONSTORE",SUNIONSTORE)
-("SYNC",SYNC)
-("TTL",TTL)
-("TIME",TIME)
-("TYPE",TYPE)
-("UNSUBSCRIBE",UNSUBSCRIBE)
-("UNWATCH",UNWATCH)
-("WATCH",WATCH)
-("ZADD",ZADD)
-("ZCARD",ZCARD)
-("ZCOUNT",ZCOUNT)
-("ZINCRBY",ZINCRBY)
-("ZINTERSTORE",ZINTERSTORE)
-("ZRANGE",ZRANGE)
-("ZRANGEBYSCORE",ZRANGEBYSCORE)
-("ZRANK",ZRANK)
-("ZREM",ZREM)
-("ZREMRANGEBYRANK",ZREMRANGEBYRANK)
-("ZREMRANGEBYSCORE",ZREMRANGEBYSCORE)
-("ZREVRANGE",ZREVRANGE)
-("ZREVRANGEBYSCORE",ZREVRANGEBYSCORE)
-("ZREVRANK",ZREVRANK)
-("ZSCORE",ZSCORE)
-("ZUNIONSTORE",ZUNIONSTORE);
+#undef COMMAND_INFO
+
+namespace
+{
+  /**
+   * CommandLookup finds a kCommand by its case-insensitive name
+   * with a perfect hash(hash and displace), built once:
+   * a name goes to one of kBuckets buckets, the seed of its bucket
+   * puts it into a slot no other name takes.
+   */
+  class CommandLookup
+  {
+    private:
+      enum
+      {
+        kBuckets = 64,
+        kSlots = 256,
+        kMaxSeed = 65536
+      };
+
+      uint32_t seeds_[kBuckets];
+      kCommand slots_[kSlots];
+
+      class BucketLarger
+      {
+        private:
+          const std::vector<std::vector<kCommand> > * buckets_;
+
+        public:
+          explicit BucketLarger(const std::vector<std::vector<kCommand> > * buckets)
+            : buckets_(buckets) {}
+
+          bool operator()(size_t a, size_t b)const
+          {
+            return (*buckets_)[a].size()>(*buckets_)[b].size();
+          }
+      };
+
+      static uint32_t hash(const char * name, size_t size, uint32_t seed)
+      {
+        // FNV-1a over upper-cased letters
+        uint32_t h = 2166136261u ^ (seed * 16777619u);
+        for (size_t i=0; i<size; i++)
+        {
+          unsigned char c = static_cast<unsigned char>(name[i]);
+          if (c>='a' && c<='z')
+            c = static_cast<unsigned char>(c - 'a' + 'A');
+          h = (h ^ c) * 16777619u;
+        }
+        return h;
+      }
+
+      static uint32_t hash(const std::string& name, uint32_t seed)
+      {
+        return hash(name.data(), name.size(), seed);
+      }
+
+    public:
+      CommandLookup()
+      {
+        std::vector<std::vector<kCommand> > buckets(kBuckets);
+        for (int i=NOOP + 1; i<COMMAND_MAX; i++)
+        {
+          kCommand command = static_cast<kCommand>(i);
+          buckets[hash(s_command_map[i].command_str, 0) % kBuckets].push_back(command);
+        }
+
+        std::vector<size_t> order;
+        for (size_t b=0; b<kBuckets; b++)
+          order.push_back(b);
+        std::stable_sort(order.begin(), order.end(), BucketLarger(&buckets));
+
+        std::fill(slots_, slots_ + kSlots, NOOP);
+        std::fill(seeds_, seeds_ + kBuckets, 0u);
+        BOOST_FOREACH(size_t b, order)
+        {
+          const std::vector<kCommand>& bucket = buckets[b];
+          if (bucket.empty())
+            break;
+
+          uint32_t seed = 1;
+          for (; seed<kMaxSeed; seed++)
+          {
+            std::vector<size_t> taken;
+            BOOST_FOREACH(kCommand command, bucket)
+            {
+              size_t slot = hash(s_command_map[command].command_str, seed) % kSlots;
+              if (slots_[slot]!=NOOP
+                  || std::find(taken.begin(), taken.end(), slot)!=taken.end())
+                break;
+              taken.push_back(slot);
+            }
+
+            if (taken.size()==bucket.size())
+            {
+              for (size_t i=0; i<taken.size(); i++)
+                slots_[taken[i]] = bucket[i];
+              break;
+            }
+          }
+          assert(seed<kMaxSeed);
+          seeds_[b] = seed;
+        }
+      }
+
+      // return NOOP if 'name' is not a command
+      kCommand find(const std::string& name)const
+      {
+        uint32_t seed = seeds_[hash(name, 0) % kBuckets];
+        kCommand command = slots_[hash(name, seed) % kSlots];
+        const std::string& command_str = s_command_map[command].command_str;
+        if (command==NOOP || command_str.size()!=name.size())
+          return NOOP;
+
+        for (size_t i=0; i<name.size(); i++)
+        {
+          if (::toupper(static_cast<unsigned char>(name[i]))!=command_str[i])
+            return NOOP;
+        }
+        return command;
+      }
+
+  };
+
+  // after s_command_map, which it is built from
+  const CommandLookup s_command_lookup;
+}
 
 
 /************************************************************************/
@@ -524,17 +529,414 @@ uint32_t time33_hash_32(const std::string& key)
   return time33_hash_32(key.c_str(), key.size());
 }
 
+// write the digits of 'u' after 'sign'(if any) into 'buf'
+static size_t format_digits(uint64_t u, char sign, char buf[kInt64Chars])
+{
+  char tmp[kInt64Chars];
+  char * end = tmp + sizeof(tmp);
+  char * p = end;
+  do
+  {
+    *--p = static_cast<char>('0' + u % 10);
+    u /= 10;
+  } while (u);
+  if (sign)
+    *--p = sign;
+
+  size_t size = static_cast<size_t>(end - p);
+  memcpy(buf, p, size);
+  buf[size] = '\0';
+  return size;
+}
+
+size_t format_int64(int64_t i, char buf[kInt64Chars])
+{
+  // negate as unsigned, the minimum has no positive counterpart
+  if (i<0)
+    return format_digits(0 - static_cast<uint64_t>(i), '-', buf);
+  return format_digits(static_cast<uint64_t>(i), '\0', buf);
+}
+
+size_t format_uint64(uint64_t u, char buf[kInt64Chars])
+{
+  return format_digits(u, '\0', buf);
+}
+
+size_t format_double(double d, char buf[kDoubleChars])
+{
+  // integers are most scores, 2^53 keeps them exact
+  if (d>=-9007199254740992.0 && d<=9007199254740992.0
+      && d==static_cast<double>(static_cast<int64_t>(d))
+      && !(d==0.0 && signbit(d)))
+    return format_int64(static_cast<int64_t>(d), buf);
+
+  int size = 0;
+  for (int precision=15; precision<=17; precision++)
+  {
+    size = snprintf(buf, kDoubleChars, "%.*g", precision, d);
+    double back;
+    if (d!=d || (parse_double(buf, buf + size, &back) && back==d))
+      break;
+  }
+  return static_cast<size_t>(size);
+}
+
+bool parse_int64(const char * begin, const char * end, int64_t * i)
+{
+  const char * p = begin;
+  bool negative = (p!=end && *p=='-');
+  if (negative || (p!=end && *p=='+'))
+    p++;
+  if (p==end)
+    return false;
+
+  // 2^63 - 1, or 2^63 for the minimum
+  const uint64_t limit = (static_cast<uint64_t>(1) << 63) - (negative ? 0 : 1);
+  uint64_t u = 0;
+  for (; p!=end; p++)
+  {
+    if (*p<'0' || *p>'9')
+      return false;
+    uint64_t digit = static_cast<uint64_t>(*p - '0');
+    if (u>(limit - digit) / 10)
+      return false;
+    u = u * 10 + digit;
+  }
+
+  *i = negative ? static_cast<int64_t>(0 - u) : static_cast<int64_t>(u);
+  return true;
+}
+
+bool parse_double(const char * begin, const char * end, double * d)
+{
+  static const double pow10[] =
+  {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+    1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20,
+    1e21, 1e22
+  };
+
+  const char * p = begin;
+  if (p==end)
+    return false;
+
+  // fast path: both the mantissa(<2^53) and 10^fraction are exact doubles,
+  // so one division rounds correctly
+  bool negative = (*p=='-');
+  if (negative || *p=='+')
+    p++;
+
+  uint64_t mantissa = 0;
+  int digits = 0, fraction = 0;
+  bool dot = false;
+  for (; p!=end; p++)
+  {
+    if (*p>='0' && *p<='9')
+    {
+      mantissa = mantissa * 10 + static_cast<uint64_t>(*p - '0');
+      if (++digits>15)
+        break;
+      if (dot)
+        fraction++;
+    }
+    else if (*p=='.' && !dot)
+    {
+      dot = true;
+    }
+    else
+    {
+      break;
+    }
+  }
+
+  if (p==end && digits)
+  {
+    double value = static_cast<double>(mantissa) / pow10[fraction];
+    *d = negative ? -value : value;
+    return true;
+  }
+
+  // exponents, long mantissas, inf and nan, strtod needs a NUL
+  char buf[64];
+  size_t size = static_cast<size_t>(end - begin);
+  if (size>=sizeof(buf))
+    return false;
+  memcpy(buf, begin, size);
+  buf[size] = '\0';
+
+  char * stop;
+  errno = 0;
+  double value = strtod(buf, &stop);
+  if (stop!=buf + size || errno==ERANGE)
+    return false;
+  *d = value;
+  return true;
+}
+
+bool parse_double(const std::string& s, double * d)
+{
+  return parse_double(s.data(), s.data() + s.size(), d);
+}
+
+kCommandClass command_class(kCommand command)
+{
+  switch (command)
+  {
+    case BLPOP:
+    case BRPOP:
+    case BRPOPLPUSH:
+    case MONITOR:
+    case PSUBSCRIBE:
+    case SUBSCRIBE:
+      return kBlockingCommand;
+
+    case DEBUG:
+    case FLUSHALL:
+    case FLUSHDB:
+    case KEYS:
+    case MIGRATE:
+    case SAVE:
+    case SCRIPT:
+    case SHUTDOWN:
+    case SORT:
+    case SYNC:
+      return kSlowCommand;
+
+    case APPEND:
+    case BITOP:
+    case DECR:
+    case DECRBY:
+    case DEL:
+    case EVAL:
+    case EVALSHA:
+    case EXEC:
+    case EXPIRE:
+    case EXPIREAT:
+    case GETSET:
+    case HDEL:
+    case HINCRBY:
+    case HINCRBYFLOAT:
+    case HMSET:
+    case HSET:
+    case HSETNX:
+    case INCR:
+    case INCRBY:
+    case INCRBYFLOAT:
+    case LINSERT:
+    case LPOP:
+    case LPUSH:
+    case LPUSHX:
+    case LREM:
+    case LSET:
+    case LTRIM:
+    case MOVE:
+    case MSET:
+    case MSETNX:
+    case PERSIST:
+    case PEXPIRE:
+    case PEXPIREAT:
+    case PSETEX:
+    case PUBLISH:
+    case RENAME:
+    case RENAMENX:
+    case RESTORE:
+    case RPOP:
+    case RPOPLPUSH:
+    case RPUSH:
+    case RPUSHX:
+    case SADD:
+    case SDIFFSTORE:
+    case SET:
+    case SETBIT:
+    case SETEX:
+    case SETNX:
+    case SETRANGE:
+    case SINTERSTORE:
+    case SMOVE:
+    case SPOP:
+    case SREM:
+    case SUNIONSTORE:
+    case ZADD:
+    case ZINCRBY:
+    case ZINTERSTORE:
+    case ZREM:
+    case ZREMRANGEBYRANK:
+    case ZREMRANGEBYSCORE:
+    case ZUNIONSTORE:
+      return kWriteCommand;
+
+    default:
+      return kReadCommand;
+  }
+}
+
+bool command_keys(const RedisCommand * command, string_vector_t * keys)
+{
+  const string_vector_t& all = command->in.args();
+  const size_t first = command->in.first_arg();
+  const size_t argc = all.size()>first ? all.size() - first : 0;
+  // the i-th argument
+#define ARG(i) all[first + (i)]
+  keys->clear();
+
+  switch (command->in.command())
+  {
+    case NOOP:
+    case AUTH:
+    case BGREWRITEAOF:
+    case BGSAVE:
+    case CONFIG:
+    case DBSIZE:
+    case DEBUG:
+    case DISCARD:
+    case ECHO:
+    case EXEC:
+    case FLUSHALL:
+    case FLUSHDB:
+    case INFO:
+    case KEYS:
+    case LASTSAVE:
+    case MONITOR:
+    case MULTI:
+    case PING:
+    case PSUBSCRIBE:
+    case PUBLISH:
+    case PUNSUBSCRIBE:
+    case QUIT:
+    case RANDOMKEY:
+    case SAVE:
+    case SCRIPT:
+    case SELECT:
+    case SHUTDOWN:
+    case SLAVEOF:
+    case SLOWLOG:
+    case SUBSCRIBE:
+    case SYNC:
+    case TIME:
+    case UNSUBSCRIBE:
+    case UNWATCH:
+      break;
+
+    case DEL:
+    case EXISTS:
+    case MGET:
+    case RENAME:
+    case RENAMENX:
+    case RPOPLPUSH:
+    case SDIFF:
+    case SDIFFSTORE:
+    case SINTER:
+    case SINTERSTORE:
+    case SUNION:
+    case SUNIONSTORE:
+    case WATCH:
+      for (size_t i=0; i<argc; i++)
+        keys->push_back(ARG(i));
+      break;
+
+    case BLPOP:
+    case BRPOP:
+      // BLPOP key ... timeout
+      for (size_t i=0; i + 1<argc; i++)
+        keys->push_back(ARG(i));
+      break;
+
+    case BRPOPLPUSH:
+    case SMOVE:
+      // SMOVE source destination member
+      for (size_t i=0; i<2 && i<argc; i++)
+        keys->push_back(ARG(i));
+      break;
+
+    case MSET:
+    case MSETNX:
+      for (size_t i=0; i<argc; i+=2)
+        keys->push_back(ARG(i));
+      break;
+
+    case BITOP:
+      // BITOP operation destkey key ...
+      for (size_t i=1; i<argc; i++)
+        keys->push_back(ARG(i));
+      break;
+
+    case EVAL:
+    case EVALSHA:
+    case ZINTERSTORE:
+    case ZUNIONSTORE:
+      {
+        // EVAL script numkeys key ...
+        // ZUNIONSTORE destination numkeys key ...
+        int64_t numkeys;
+        if (argc<2
+            || !parse_int64(ARG(1).data(), ARG(1).data() + ARG(1).size(), &numkeys)
+            || numkeys<0 || static_cast<uint64_t>(numkeys)>argc - 2)
+          return false;
+        if (command->in.command()==ZINTERSTORE || command->in.command()==ZUNIONSTORE)
+          keys->push_back(ARG(0));
+        for (size_t i=0; i<static_cast<size_t>(numkeys); i++)
+          keys->push_back(ARG(2 + i));
+      }
+      break;
+
+    case MIGRATE:
+      // MIGRATE host port key db timeout
+      if (argc>2)
+        keys->push_back(ARG(2));
+      break;
+
+    case OBJECT:
+      // OBJECT subcommand key
+      if (argc>1)
+        keys->push_back(ARG(1));
+      break;
+
+    case SORT:
+      // SORT key ... STORE destination
+      if (argc>0)
+        keys->push_back(ARG(0));
+      for (size_t i=1; i + 1<argc; i++)
+      {
+        if (strcasecmp(ARG(i).c_str(), "STORE")==0)
+          keys->push_back(ARG(i + 1));
+      }
+      break;
+
+    default:
+      if (argc>0)
+        keys->push_back(ARG(0));
+      break;
+  }
+#undef ARG
+  return !keys->empty();
+}
+
+static boost::atomic<int> s_command_budgets[kCommandClassMax];
+
+void set_command_budget(kCommandClass command_class, int budget_ms)
+{
+  if (command_class<kCommandClassMax)
+    s_command_budgets[command_class] = budget_ms<0 ? 0 : budget_ms;
+}
+
+int get_command_budget(kCommandClass command_class)
+{
+  if (command_class<kCommandClassMax)
+    return s_command_budgets[command_class];
+  return 0;
+}
+
 /************************************************************************/
 /*RedisInput*/
 /************************************************************************/
 RedisInput::RedisInput()
-  : command_(NOOP), command_info_(&s_command_map[NOOP]) {}
+  : command_(NOOP), command_info_(&s_command_map[NOOP]), named_(false) {}
 
 RedisInput::RedisInput(kCommand cmd)
-  : command_(cmd), command_info_(&s_command_map[cmd]) {}
+  : command_(cmd), command_info_(&s_command_map[cmd]), named_(false) {}
 
 RedisInput::RedisInput(const std::string& cmd)
-  : command_(NOOP), command_info_(&s_command_map[NOOP])
+  : command_(NOOP), command_info_(&s_command_map[NOOP]), named_(false)
 {
   set_command(cmd);
 }
@@ -547,86 +949,116 @@ void RedisInput::set_command(kCommand cmd)
 
 void RedisInput::set_command(const std::string& cmd)
 {
-  std::string upper_cmd = cmd;
-  for (size_t i=0; i<upper_cmd.size(); i++)
-  {
-    char& c = upper_cmd[i];
-    c = static_cast<char>(::toupper(c));
-  }
-
-  command_rev_map_t::const_iterator iter
-    = s_command_rev_map.find(upper_cmd);
-
-  if (iter!=s_command_rev_map.end())
-    set_command(iter->second);
-  else
-    set_command(NOOP);
+  set_command(s_command_lookup.find(cmd));
 }
 
 void RedisInput::swap(RedisInput& other)
 {
   std::swap(command_, other.command_);
   std::swap(command_info_, other.command_info_);
+  std::swap(named_, other.named_);
   args_.swap(other.args_);
 }
 
 void RedisInput::clear_arg()
 {
   args_.clear();
+  named_ = false;
+}
+
+void RedisInput::recycle()
+{
+  // no more spares than arguments are kept,
+  // arguments swapped in(see swap_arg) do not take spares
+  for (size_t i=0; i<args_.size() && spare_args_.size()<args_.size(); i++)
+  {
+    spare_args_.push_back(std::string());
+    spare_args_.back().swap(args_[i]);
+  }
+  args_.clear();
+  named_ = false;
+}
+
+std::string& RedisInput::new_arg()
+{
+  args_.push_back(std::string());
+  if (!spare_args_.empty())
+  {
+    args_.back().swap(spare_args_.back());
+    spare_args_.pop_back();
+    args_.back().clear();
+  }
+  return args_.back();
 }
 
 void RedisInput::push_arg(const std::string& s)
 {
-  args_.push_back(s);
+  new_arg().assign(s);
 }
 
 void RedisInput::push_arg(const char * s)
 {
   if (s)
-    args_.push_back(s);
+    new_arg().assign(s);
+}
+
+void RedisInput::push_arg(const char * data, size_t size)
+{
+  new_arg().assign(data, size);
+}
+
+void RedisInput::swap_arg(std::string * s)
+{
+  args_.push_back(std::string());
+  args_.back().swap(*s);
 }
 
 void RedisInput::push_arg(const string_vector_t& sv)
 {
   BOOST_FOREACH(const std::string& s, sv)
   {
-    args_.push_back(s);
+    push_arg(s);
   }
 }
 
 void RedisInput::push_arg(int64_t i)
 {
-  args_.push_back(boost::lexical_cast<std::string>(i));
+  char buf[kInt64Chars];
+  new_arg().assign(buf, format_int64(i, buf));
 }
 
 void RedisInput::push_arg(size_t i)
 {
-  args_.push_back(boost::lexical_cast<std::string>(i));
+  char buf[kInt64Chars];
+  new_arg().assign(buf, format_uint64(i, buf));
 }
 
 void RedisInput::push_arg(int i)
 {
-  args_.push_back(boost::lexical_cast<std::string>(i));
+  push_arg(static_cast<int64_t>(i));
 }
 
 void RedisInput::push_arg(const std::vector<int64_t>& iv)
 {
+  args_.reserve(args_.size() + iv.size());
   BOOST_FOREACH(int64_t i, iv)
   {
-    args_.push_back(boost::lexical_cast<std::string>(i));
+    push_arg(i);
   }
 }
 
 void RedisInput::push_arg(double d)
 {
-  args_.push_back(boost::lexical_cast<std::string>(d));
+  char buf[kDoubleChars];
+  new_arg().assign(buf, format_double(d, buf));
 }
 
 void RedisInput::push_arg(const std::vector<double>& dv)
 {
+  args_.reserve(args_.size() + dv.size());
   BOOST_FOREACH(double d, dv)
   {
-    args_.push_back(boost::lexical_cast<std::string>(d));
+    push_arg(d);
   }
 }
 
@@ -634,7 +1066,7 @@ void RedisInput::push_arg(const std::vector<double>& dv)
 /*RedisOutput*/
 /************************************************************************/
   RedisOutput::RedisOutput()
-: reply_type(kNone)
+: reply_type(kNone), spare_string_(NULL), spare_i_(NULL)
 {
   ptr.status = NULL;
 }
@@ -642,6 +1074,67 @@ void RedisInput::push_arg(const std::vector<double>& dv)
 RedisOutput::~RedisOutput()
 {
   clear();
+  delete spare_string_;
+  delete spare_i_;
+}
+
+void RedisOutput::recycle()
+{
+  std::string * s = NULL;
+  switch (reply_type)
+  {
+    case kStatus:
+      s = ptr.status;
+      ptr.status = NULL;
+      break;
+    case kError:
+      s = ptr.error;
+      ptr.error = NULL;
+      break;
+    case kBulk:
+      s = ptr.bulk;
+      ptr.bulk = NULL;
+      break;
+    case kInteger:
+      if (spare_i_==NULL)
+      {
+        spare_i_ = ptr.i;
+        ptr.i = NULL;
+      }
+      break;
+    default:
+      break;
+  }
+
+  if (s && spare_string_==NULL)
+  {
+    s->clear();
+    spare_string_ = s;
+  }
+  else
+  {
+    delete s;
+  }
+  clear();
+}
+
+std::string * RedisOutput::new_string(const std::string& s)
+{
+  if (spare_string_==NULL)
+    return new std::string(s);
+
+  std::string * ret = spare_string_;
+  spare_string_ = NULL;
+  ret->assign(s);
+  return ret;
+}
+
+int64_t * RedisOutput::new_i(int64_t i)
+{
+  int64_t * ret = spare_i_ ? spare_i_ : new int64_t;
+  spare_i_ = NULL;
+  *ret = i;
+  return ret;
 }
 
 void RedisOutput::clear()
@@ -693,6 +1186,7 @@ void RedisOutput::clear()
     default:
       ptr.status = NULL;
   }
+  reply_type = kNone;
 }
 
 bool RedisOutput::get_mbulks(string_vector_t * mb)
@@ -715,6 +1209,72 @@ void RedisOutput::swap(RedisOutput& other)
   std::swap(reply_type, other.reply_type);
 }
 
+void RedisOutput::copy(const RedisOutput& other)
+{
+  clear();
+  switch (other.reply_type)
+  {
+    case kStatus:
+      if (other.ptr.status)
+        set_status(*other.ptr.status);
+      break;
+    case kError:
+      if (other.ptr.error)
+        set_error(*other.ptr.error);
+      break;
+    case kInteger:
+      if (other.ptr.i)
+        set_i(*other.ptr.i);
+      break;
+    case kBulk:
+      if (other.ptr.bulk)
+        set_bulk(*other.ptr.bulk);
+      else
+        set_nil_bulk();
+      break;
+    case kMultiBulk:
+      if (other.ptr.mbulks)
+      {
+        mbulk_t mbulks;
+        mbulks.reserve(other.ptr.mbulks->size());
+        BOOST_FOREACH(const std::string * bulk, *other.ptr.mbulks)
+        {
+          mbulks.push_back(bulk ? new std::string(*bulk) : NULL);
+        }
+        set_mbulks(&mbulks);
+      }
+      else
+      {
+        set_nil_mbulks();
+      }
+      break;
+    case kSpecialMultiBulk:
+      if (other.ptr.smbulks)
+      {
+        smbulk_t smbulks;
+        smbulks.reserve(other.ptr.smbulks->size());
+        BOOST_FOREACH(const RedisOutput * output, *other.ptr.smbulks)
+        {
+          RedisOutput * child = NULL;
+          if (output)
+          {
+            child = new RedisOutput;
+            child->copy(*output);
+          }
+          smbulks.push_back(child);
+        }
+        set_smbulks(&smbulks);
+      }
+      else
+      {
+        set_nil_smbulks();
+      }
+      break;
+    default:
+      break;
+  }
+}
+
 /************************************************************************/
 /*RedisCommand*/
 /************************************************************************/
@@ -733,4 +1293,50 @@ void RedisCommand::swap(RedisCommand& other)
   out.swap(other.out);
 }
 
+void RedisCommand::assign(const std::string& cmd)
+{
+  in.set_command(cmd);
+  in.clear_arg();
+  out.clear();
+}
+
+void RedisCommand::recycle()
+{
+  in.recycle();
+  out.recycle();
+}
+
+/************************************************************************/
+/*CommandBatch*/
+/************************************************************************/
+CommandBatch::~CommandBatch()
+{
+  clear_commands(&pool_);
+}
+
+RedisCommand * CommandBatch::add(kCommand command)
+{
+  if (commands_.size()==pool_.size())
+    pool_.push_back(new RedisCommand);
+
+  RedisCommand * c = pool_[commands_.size()];
+  c->in.set_command(command);
+  commands_.push_back(c);
+  return c;
+}
+
+RedisCommand * CommandBatch::add(const std::string& command)
+{
+  RedisCommand * c = add(NOOP);
+  c->in.set_command(command);
+  return c;
+}
+
+void CommandBatch::clear()
+{
+  BOOST_FOREACH(RedisCommand * c, commands_)
+    c->recycle();
+  commands_.clear();
+}
+
 LIBREDIS_NAMESPACE_END
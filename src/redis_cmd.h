@@ -9,6 +9,11 @@
 #define _LANGTAOJIN_LIBREDIS_REDIS_CMD_H_
 
 #include "redis_common.h"
+#include <boost/preprocessor/cat.hpp>
+#include <boost/preprocessor/repetition/enum_binary_params.hpp>
+#include <boost/preprocessor/repetition/enum_params.hpp>
+#include <boost/preprocessor/repetition/repeat.hpp>
+#include <boost/preprocessor/repetition/repeat_from_to.hpp>
 
 // an 'ECHO' macro may be disturbing
 #ifdef ECHO
@@ -230,6 +235,10 @@ struct CommandInfo
   int argc;
 
   kReplyType reply_type;
+
+  // the name as a RESP bulk("$3\r\nSET\r\n"), encoded at compile time
+  const char * header;
+  size_t header_size;
 };
 
 /************************************************************************/
@@ -244,6 +253,8 @@ typedef std::vector<RedisCommand *> redis_command_vector_t;
 typedef std::pair<std::string, std::string> string_pair_t;
 typedef std::vector<string_pair_t> string_pair_vector_t;
 typedef std::map<std::string, std::string> string_map_t;
+typedef std::pair<std::string, double> string_score_pair_t;
+typedef std::vector<string_score_pair_t> string_score_pair_vector_t;
 typedef std::vector<size_t> size_t_vector_t;
 typedef std::vector<size_t_vector_t> size_t_vector_vector_t;
 
@@ -273,6 +284,120 @@ uint32_t time33_hash_32(const std::string& key);
 
 typedef uint32_t (*key_hasher) (const std::string& key);
 
+/************************************************************************/
+/*numeric conversion, no allocation*/
+/************************************************************************/
+enum
+{
+  kInt64Chars = 21,// "-9223372036854775808" or "18446744073709551615", and a NUL
+  kDoubleChars = 32
+};
+
+// write the number into 'buf', return the length(without NUL)
+// 'd' is written with the fewest significant digits(up to 17) reading back exactly
+size_t format_int64(int64_t i, char buf[kInt64Chars]);
+size_t format_uint64(uint64_t u, char buf[kInt64Chars]);
+size_t format_double(double d, char buf[kDoubleChars]);
+
+// the whole [begin, end) must be a number, overflows fail
+bool parse_int64(const char * begin, const char * end, int64_t * i);
+// parse a reply double("3.5", "-1e10", "inf" ...)
+// plain decimals of up to 15 digits are converted exactly without strtod
+bool parse_double(const char * begin, const char * end, double * d);
+bool parse_double(const std::string& s, double * d);
+
+/************************************************************************/
+/*command classes and their default budgets*/
+/************************************************************************/
+enum kCommandClass
+{
+  kReadCommand = 0,
+  kWriteCommand,
+  kSlowCommand,// KEYS, SORT, FLUSHALL and other long-running commands
+  kBlockingCommand,// BLPOP, SUBSCRIBE and other blocking commands
+  kCommandClassMax// placeholder
+};
+
+kCommandClass command_class(kCommand command);
+
+// the keys 'command' accesses(the name of a command written by a format skipped)
+// return false, it accesses no key(KEYS, SELECT, PING and the like) or its arguments are invalid
+bool command_keys(const RedisCommand * command, string_vector_t * keys);
+
+// The default end-to-end budget in milliseconds of a command(or a pipeline,
+// with the largest budget of its commands) when no deadline is set
+// (see RedisBase2::set_deadline): writing it and reading the whole reply.
+// 0(by default) means the 'timeout_ms' of the client,
+// except for kBlockingCommand, where it means to block.
+void set_command_budget(kCommandClass command_class, int budget_ms);
+int get_command_budget(kCommandClass command_class);
+
+// Adaptive budgets(off by default): a command of a class without a budget gets
+// 'multiplier' times the 'percentile' latency observed in the last 'window_s' seconds
+// for its endpoint and class, clamped to ['min_ms', 'max_ms'].
+// Until 'min_samples' latencies are observed, it is the 'timeout_ms' of the client.
+// Calls timing out are observed too, so budgets grow with a slowing server.
+// Pipelines and blocking commands are not adaptive.
+struct AdaptiveTimeout
+{
+  bool enabled;
+  double percentile;// in (0, 100)
+  double multiplier;
+  int min_ms;
+  int max_ms;
+  int min_samples;
+  int window_s;
+
+  AdaptiveTimeout()
+    : enabled(false), percentile(99.0), multiplier(3.0),
+    min_ms(5), max_ms(1000), min_samples(100), window_s(60) {}
+};
+
+void set_adaptive_timeout(const AdaptiveTimeout& adaptive);
+AdaptiveTimeout get_adaptive_timeout();
+
+// the adaptive budget of an endpoint and a command class
+struct AdaptiveTimeoutStats
+{
+  std::string host;
+  std::string port;
+  kCommandClass command_class;
+  uint64_t samples;// latencies in the window
+  uint64_t timeouts;// calls timing out since the start
+  int64_t percentile_us;// the 'percentile' latency of the last decision
+  int timeout_ms;// the last decision, 0 means not enough samples
+  uint64_t decisions;// decisions since the start
+  uint64_t clamped_min;// decisions clamped to 'min_ms'
+  uint64_t clamped_max;// decisions clamped to 'max_ms'
+};
+
+void get_adaptive_timeout_stats(std::vector<AdaptiveTimeoutStats> * stats);
+
+// Read coalescing(off by default): concurrent identical reads(the same command,
+// GET, HGETALL and other reads of keys, with the same arguments
+// to the same endpoint and db) of all clients in the process share one call,
+// the first one executes it and the others wait for copies of its reply.
+// A read begun after a write of any of its keys through a client of the process
+// does not share calls begun before the write.
+// A shared call failing makes the ones waiting for it call on their own.
+// Pipelines, transactions, visitors and bulk streaming are not coalesced.
+void set_read_coalescing(bool enabled);
+bool get_read_coalescing();
+
+struct ReadCoalescingStats
+{
+  uint64_t leaders;// calls executed for others to share
+  uint64_t coalesced;// calls sharing the reply of another one
+  uint64_t fallbacks;// calls sharing a failed one, then calling on their own
+  uint64_t timeouts;// calls waiting for another one past their deadline
+  uint64_t detached;// calls not shared any more after writes of their keys
+
+  ReadCoalescingStats()
+    : leaders(0), coalesced(0), fallbacks(0), timeouts(0), detached(0) {}
+};
+
+ReadCoalescingStats get_read_coalescing_stats();
+
 /************************************************************************/
 /*smart pointers for mbulk_t,smbulk_t and redis_command_vector_t*/
 /************************************************************************/
@@ -352,6 +477,13 @@ class RedisInput
     kCommand command_;
     const CommandInfo * command_info_;
     string_vector_t args_;
+    // strings of recycled arguments, reused with their capacity
+    string_vector_t spare_args_;
+    // args_[0] is the name of the command(a command written by a format)
+    bool named_;
+
+    // an empty argument at the end, a spare one if there is any
+    std::string& new_arg();
 
   public:
     RedisInput();
@@ -382,9 +514,33 @@ class RedisInput
       return args_;
     }
 
+    // the index of the first argument after the name of the command
+    size_t first_arg()const
+    {
+      return named_ ? 1 : 0;
+    }
+
+    // args()[0] is the name of the command, cleared with the arguments
+    void set_named(bool named)
+    {
+      named_ = named;
+    }
+
     void clear_arg();
+    // clear arguments, but keep their strings for the next ones
+    void recycle();
     void push_arg(const std::string& s);
     void push_arg(const char * s);
+    // a borrowed span, binary safe, copied once
+    void push_arg(const char * data, size_t size);
+    // take the content of '*s' without copying, '*s' is left empty
+    void swap_arg(std::string * s);
+#ifdef LIBREDIS_HAS_RVALUE_REFERENCES
+    void push_arg(std::string&& s)
+    {
+      swap_arg(&s);
+    }
+#endif
     void push_arg(const string_vector_t& sv);
     void push_arg(int64_t i);
     void push_arg(size_t i);
@@ -434,34 +590,35 @@ struct RedisOutput
   ~RedisOutput();
 
   void clear();
+  // clear, but keep a status, error, bulk or integer holder for the next reply
+  void recycle();
 
   // setters
   void set_status(const std::string& s)
   {
     clear();
-    ptr.status = new std::string(s);
+    ptr.status = new_string(s);
     reply_type = kStatus;
   }
 
   void set_error(const std::string& e)
   {
     clear();
-    ptr.error = new std::string(e);
+    ptr.error = new_string(e);
     reply_type = kError;
   }
 
   void set_i(int64_t _i)
   {
     clear();
-    ptr.i = new int64_t;
-    *ptr.i = _i;
+    ptr.i = new_i(_i);
     reply_type = kInteger;
   }
 
   void set_bulk(const std::string& b)
   {
     clear();
-    ptr.bulk = new std::string(b);
+    ptr.bulk = new_string(b);
     reply_type = kBulk;
   }
 
@@ -668,6 +825,16 @@ struct RedisOutput
   }
 
   void swap(RedisOutput& other);
+  // a deep copy of 'other'
+  void copy(const RedisOutput& other);
+
+  private:
+  // holders kept by recycle() for the next reply
+  std::string * spare_string_;
+  int64_t * spare_i_;
+
+  std::string * new_string(const std::string& s);
+  int64_t * new_i(int64_t i);
 };
 
 /************************************************************************/
@@ -682,6 +849,10 @@ struct RedisCommand
   explicit RedisCommand(kCommand cmd);
   explicit RedisCommand(const std::string& cmd);
   void swap(RedisCommand& other);
+  // make it a new 'cmd' without arguments or output
+  void assign(const std::string& cmd);
+  // clear it for reuse, keeping the capacity of arguments and output
+  void recycle();
 
   const kCommand& command()const
   {
@@ -718,6 +889,23 @@ struct RedisCommand
     in.push_arg(s);
   }
 
+  void push_arg(const char * data, size_t size)
+  {
+    in.push_arg(data, size);
+  }
+
+  void swap_arg(std::string * s)
+  {
+    in.swap_arg(s);
+  }
+
+#ifdef LIBREDIS_HAS_RVALUE_REFERENCES
+  void push_arg(std::string&& s)
+  {
+    in.swap_arg(&s);
+  }
+#endif
+
   void push_arg(const string_vector_t& sv)
   {
     in.push_arg(sv);
@@ -754,6 +942,254 @@ struct RedisCommand
   }
 };
 
+/************************************************************************/
+/**
+ * CommandBatch owns commands for exec_pipeline and reuses them:
+ * clear() recycles them(RedisCommand::recycle) instead of freeing them,
+ * so a batch of the same shape run again and again does not allocate
+ * commands, argument strings or scalar reply holders once it is warm.
+ *
+ * CommandBatch batch;
+ * for (;;)
+ * {
+ *   batch.clear();
+ *   batch.add(GET)->push_arg("foo");
+ *   batch.add(INCR)->push_arg("bar");
+ *   if (r.exec_pipeline(batch.commands())) ...
+ * }
+ */
+/************************************************************************/
+class CommandBatch
+{
+  private:
+    // all commands ever added, owned and never freed before destruction
+    redis_command_vector_t pool_;
+    // the first size() of 'pool_'
+    redis_command_vector_t commands_;
+
+    CommandBatch(const CommandBatch&);
+    CommandBatch& operator=(const CommandBatch&);
+
+  public:
+    CommandBatch() {}
+    ~CommandBatch();
+
+    // a recycled(or new) command at the end
+    RedisCommand * add(kCommand command);
+    RedisCommand * add(const std::string& command);
+
+    size_t size()const
+    {
+      return commands_.size();
+    }
+
+    bool empty()const
+    {
+      return commands_.empty();
+    }
+
+    RedisCommand * operator[](size_t i)const
+    {
+      return commands_[i];
+    }
+
+    // for exec_pipeline, it must not be resized by callers
+    redis_command_vector_t * commands()
+    {
+      return &commands_;
+    }
+
+    // recycle all commands
+    void clear();
+};
+
+/************************************************************************/
+/**
+ * Typed variadic commands, binary safe:
+ *
+ * RedisCommand c;
+ * r.cmd(&c, "SETEX", key, 10, value);
+ *
+ * Each argument goes through RedisInput::push_arg(strings, integers, doubles
+ * and their vectors) and is sent as one RESP bulk as it is,
+ * nothing is formatted or split on spaces.
+ * The reply is in 'c.out'. Unknown commands fail, and so do argument numbers
+ * the command table rejects.
+ *
+ * LIBREDIS_CMD_OVERLOADS(exec) defines cmd() of up to LIBREDIS_CMD_MAX_ARGS - 1
+ * arguments in a class, they assign 'command' and return exec(command, name).
+ */
+/************************************************************************/
+#define LIBREDIS_CMD_MAX_ARGS 16
+
+#define LIBREDIS_CMD_PUSH_ARG(z, n, unused) command->in.push_arg(BOOST_PP_CAT(a, n));
+
+#define LIBREDIS_CMD_OVERLOAD(z, n, exec) \
+  template <BOOST_PP_ENUM_PARAMS_Z(z, n, class A)> \
+  bool cmd(RedisCommand * command, const std::string& name, \
+      BOOST_PP_ENUM_BINARY_PARAMS_Z(z, n, const A, & a)) \
+  { \
+    if (command) \
+    { \
+      command->assign(name); \
+      BOOST_PP_REPEAT_ ## z(n, LIBREDIS_CMD_PUSH_ARG, ~) \
+    } \
+    return exec(command, name); \
+  }
+
+#define LIBREDIS_CMD_OVERLOADS(exec) \
+  bool cmd(RedisCommand * command, const std::string& name) \
+  { \
+    if (command) \
+      command->assign(name); \
+    return exec(command, name); \
+  } \
+  BOOST_PP_REPEAT_FROM_TO(1, LIBREDIS_CMD_MAX_ARGS, LIBREDIS_CMD_OVERLOAD, exec)
+
+/************************************************************************/
+/**
+ * ReplyVisitor receives the elements of a multi-bulk reply as they are read,
+ * so only one element is held at a time instead of the whole reply.
+ * When it stops early, the rest of the reply is still read(and dropped)
+ * to keep the connection usable.
+ */
+/************************************************************************/
+class ReplyVisitor
+{
+  public:
+    virtual ~ReplyVisitor() {}
+
+    // the number of elements, -1 means a nil multi-bulk, called before any element
+    virtual void on_size(int64_t size)
+    {
+      (void)size;
+    }
+
+    // the 'index'-th element, 'bulk' is NULL for a nil element,
+    // it is reused for the next one, so it may be swapped away
+    // return false, stop visiting
+    virtual bool on_element(int64_t index, std::string * bulk) = 0;
+};
+
+// put a decoded pair to 'out', pairs are swapped into vectors without copying
+template <class OutputIterator, class Pair>
+inline void put_pair(OutputIterator * out, Pair * pair)
+{
+  *(*out)++ = *pair;
+}
+
+template <class Pair>
+inline void put_pair(std::vector<Pair> ** out, Pair * pair)
+{
+  (*out)->push_back(Pair());
+  std::swap((*out)->back(), *pair);
+}
+
+/************************************************************************/
+/**
+ * Visitors decoding alternating elements into pairs as they are read.
+ * StringPairVisitor: fields and values(HGETALL) into string_pair_t.
+ * ScorePairVisitor: members and scores(WITHSCORES) into string_score_pair_t,
+ * scores are parsed once with parse_double.
+ * 'OutputIterator' is an output iterator, or a vector pointer appended to.
+ * A nil element, an odd number of elements or a bad score make failed() true.
+ *
+ * std::map<std::string, std::string> m;
+ * StringPairVisitor<std::insert_iterator<std::map<std::string, std::string> > >
+ *   visitor(std::inserter(m, m.end()));
+ * redis.hgetall("foo", &visitor);
+ */
+/************************************************************************/
+template <class OutputIterator>
+class StringPairVisitor : public ReplyVisitor
+{
+  private:
+    OutputIterator out_;
+    string_pair_t pair_;
+    bool failed_;
+
+  public:
+    explicit StringPairVisitor(OutputIterator out) : out_(out), failed_(false) {}
+
+    virtual void on_size(int64_t size)
+    {
+      if (size>0 && size % 2)
+        failed_ = true;
+    }
+
+    virtual bool on_element(int64_t index, std::string * bulk)
+    {
+      if (bulk==NULL)
+      {
+        failed_ = true;
+        return false;
+      }
+
+      if (index % 2==0)
+      {
+        pair_.first.swap(*bulk);
+      }
+      else
+      {
+        pair_.second.swap(*bulk);
+        put_pair(&out_, &pair_);
+      }
+      return true;
+    }
+
+    bool failed()const
+    {
+      return failed_;
+    }
+};
+
+template <class OutputIterator>
+class ScorePairVisitor : public ReplyVisitor
+{
+  private:
+    OutputIterator out_;
+    string_score_pair_t pair_;
+    bool failed_;
+
+  public:
+    explicit ScorePairVisitor(OutputIterator out) : out_(out), failed_(false) {}
+
+    virtual void on_size(int64_t size)
+    {
+      if (size>0 && size % 2)
+        failed_ = true;
+    }
+
+    virtual bool on_element(int64_t index, std::string * bulk)
+    {
+      if (bulk==NULL)
+      {
+        failed_ = true;
+        return false;
+      }
+
+      if (index % 2==0)
+      {
+        pair_.first.swap(*bulk);
+      }
+      else
+      {
+        if (!parse_double(*bulk, &pair_.second))
+        {
+          failed_ = true;
+          return false;
+        }
+        put_pair(&out_, &pair_);
+      }
+      return true;
+    }
+
+    bool failed()const
+    {
+      return failed_;
+    }
+};
+
 LIBREDIS_NAMESPACE_END
 
 #endif// _LANGTAOJIN_LIBREDIS_REDIS_CMD_H_
@@ -28,4 +28,10 @@
 
 #include <boost/shared_ptr.hpp>
 
+// move-aware overloads(std::string&&) are compiled as C++11 or later,
+// swap_arg() and the swapping methods work with any standard
+#if __cplusplus>=201103L
+# define LIBREDIS_HAS_RVALUE_REFERENCES 1
+#endif
+
 #endif// _LANGTAOJIN_LIBREDIS_REDIS_COMMON_H_
@@ -7,8 +7,10 @@
  *
  */
 #include "redis_partition.h"
+#include "fanout_executor.h"
 #include "os.h"
 #include <assert.h>
+#include <boost/bind.hpp>
 #include <boost/foreach.hpp>
 #include <boost/format.hpp>
 
@@ -20,24 +22,34 @@
 
 #define FOR_EACH_GROUP_WRITE(func, key, ...) \
   do { \
+    FanoutDeadline fanout_deadline(this, kWriteCommand, timeout_ms_); \
     size_t_vector_t index_v; \
     if (!__get_key_client(key, &index_v)) \
     return false; \
-    bool ret; \
+    if (index_v.size()==1) \
+    { \
+      if (redis2_sp_vector_[index_v[0]]->func(__VA_ARGS__)) \
+        return true; \
+      __set_index_error(index_v[0]); \
+      return false; \
+    } \
+    /* groups run concurrently, outputs are filled in group order */ \
+    pipeline_sp_vector_t pipelines; \
     BOOST_FOREACH(size_t host_index, index_v) \
     { \
-      ret = redis2_sp_vector_[host_index]->func(__VA_ARGS__); \
-      if (!ret) \
+      pipelines.push_back(pipeline_sp_t(new Pipeline(redis2_sp_vector_[host_index].get()))); \
+      if (!pipelines.back()->func(__VA_ARGS__)) \
       { \
         __set_index_error(host_index); \
         return false; \
       } \
     } \
-    return true; \
+    return __exec_group_pipelines(index_v, &pipelines); \
   } while (0)
 
 #define FOR_EACH_GROUP_READ(func, key, ...) \
   do { \
+    FanoutDeadline fanout_deadline(this, kReadCommand, timeout_ms_); \
     size_t_vector_t index_v; \
     if (!__get_key_client(key, &index_v)) \
     return false; \
@@ -53,6 +65,21 @@
 
 LIBREDIS_NAMESPACE_BEGIN
 
+// the class of the largest default budget in 'commands'
+static kCommandClass __get_pipeline_class(const redis_command_vector_t& commands)
+{
+  kCommandClass ret = kReadCommand;
+  BOOST_FOREACH(const RedisCommand * command, commands)
+  {
+    kCommandClass c = command_class(command->in.command());
+    if (c==kSlowCommand)
+      return kSlowCommand;
+    if (c==kWriteCommand)
+      ret = kWriteCommand;
+  }
+  return ret;
+}
+
 static inline size_t __get_seed()
 {
   return static_cast<size_t>(get_thread_id());
@@ -84,7 +111,7 @@ bool Redis2P::inner_init()
   for (size_t i=0 ; i<hosts_.size(); i++)
   {
     redis2_sp_vector_.push_back(redis2_sp_t(
-          new Redis2(hosts_[i], ports_[i], db_index_, timeout_ms_)));
+          new Redis2(hosts_[i], ports_[i], db_index_, timeout_ms_, socket_options_)));
   }
 
   return true;
@@ -140,6 +167,7 @@ bool Redis2P::__get_keys_client(const string_vector_t& keys,
   {
     // get one client in one group
     size_t seed = __get_seed();
+    index_v->resize(keys.size());
     for (size_t i=0; i<keys.size(); i++)
     {
       host_index = __get_key_host_index(keys[i]);
@@ -220,16 +248,102 @@ size_t Redis2P::__get_key_host_index(const std::string& key)const
   return (static_cast<size_t>(hash_fn_(key)) % (redis2_sp_vector_.size() / groups_));
 }
 
+bool Redis2P::__get_command_host_index(const RedisCommand& command, size_t * host_index)
+{
+  string_vector_t keys;
+  if (!command_keys(&command, &keys))
+  {
+    last_error(str(boost::format("%s has no key to route by")
+          % command.in.command_info().command_str));
+    return false;
+  }
+
+  *host_index = __get_key_host_index(keys[0]);
+  for (size_t i=1; i<keys.size(); i++)
+  {
+    if (__get_key_host_index(keys[i])!=*host_index)
+    {
+      last_error(str(boost::format("keys of %s are on different hosts")
+            % command.in.command_info().command_str));
+      return false;
+    }
+  }
+  return true;
+}
+
+bool Redis2P::__is_replied(const RedisCommand& command, size_t host_index)const
+{
+  if (command.out.reply_type==kNone)
+    return false;
+  // an error reply, or a failure without a broken connection
+  return command.out.reply_type!=kError || redis2_sp_vector_[host_index]->is_open();
+}
+
+void Redis2P::__exec_pipelines(std::vector<redis_command_vector_t> * pipelines)
+{
+  std::vector<FanoutExecutor::task_t> tasks;
+  for (size_t i=0; i<pipelines->size(); i++)
+  {
+    if (!(*pipelines)[i].empty())
+      tasks.push_back(boost::bind(&Redis2::exec_pipeline,
+            redis2_sp_vector_[i].get(), &(*pipelines)[i]));
+  }
+  FanoutExecutor::run(tasks);
+}
+
+bool Redis2P::__exec_group_pipelines(const size_t_vector_t& index_v,
+    pipeline_sp_vector_t * pipelines)
+{
+  std::vector<FanoutExecutor::task_t> tasks;
+  BOOST_FOREACH(pipeline_sp_t& pipeline, *pipelines)
+  {
+    tasks.push_back(boost::bind(&Pipeline::transfer, pipeline.get()));
+  }
+  FanoutExecutor::run(tasks);
+
+  bool ret = true;
+  for (size_t i=0; i<pipelines->size(); i++)
+  {
+    if (!(*pipelines)[i]->decode() && ret)
+    {
+      __set_index_error(index_v[i]);
+      ret = false;
+    }
+  }
+  return ret;
+}
+
+bool Redis2P::__fanout(const size_t_vector_t& index_v,
+    const std::vector<FanoutExecutor::task_t>& tasks, const std::vector<char>& rets)
+{
+  FanoutExecutor::run(tasks);
+
+  bool ret = true;
+  for (size_t i=0; i<index_v.size(); i++)
+  {
+    if (!rets[i] && ret)
+    {
+      __set_index_error(index_v[i]);
+      ret = false;
+    }
+  }
+  return ret;
+}
+
 Redis2P::Redis2P(const std::string& host_list,
     const std::string& port_list,
     int db_index,
     int timeout_ms,
     int partitions,
-    key_hasher fn)
+    key_hasher fn,
+    const SocketOptions& options)
 : RedisBase2Multi(host_list, port_list, db_index, timeout_ms),
   partitions_(static_cast<size_t>(partitions)),
   hash_fn_(fn),
-  groups_(0)
+  groups_(0),
+  socket_options_(options),
+  deadline_(0),
+  near_cache_(NULL)
 {
   if (!inner_init())
   {
@@ -241,6 +355,58 @@ Redis2P::~Redis2P()
 {
 }
 
+SocketStats Redis2P::get_socket_stats()const
+{
+  SocketStats stats;
+  BOOST_FOREACH(const redis2_sp_t& redis, redis2_sp_vector_)
+  {
+    stats += redis->get_socket_stats();
+  }
+  return stats;
+}
+
+void Redis2P::set_deadline(int64_t deadline)
+{
+  deadline_ = deadline;
+  BOOST_FOREACH(redis2_sp_t& redis, redis2_sp_vector_)
+  {
+    redis->set_deadline(deadline);
+  }
+}
+
+int64_t Redis2P::get_deadline()const
+{
+  return deadline_;
+}
+
+void Redis2P::set_compression(const CompressionOptions& options)
+{
+  compression_ = options;
+  BOOST_FOREACH(redis2_sp_t& redis, redis2_sp_vector_)
+  {
+    redis->set_compression(options);
+  }
+}
+
+CompressionOptions Redis2P::get_compression()const
+{
+  return compression_;
+}
+
+void Redis2P::set_near_cache(NearCache * near_cache)
+{
+  near_cache_ = near_cache;
+  BOOST_FOREACH(redis2_sp_t& redis, redis2_sp_vector_)
+  {
+    redis->set_near_cache(near_cache);
+  }
+}
+
+NearCache * Redis2P::get_near_cache()const
+{
+  return near_cache_;
+}
+
 bool Redis2P::get_key_client(const std::string& key, redis2_sp_vector_t * redis_clients)
 {
   CHECK_PTR_PARAM(redis_clients);
@@ -294,35 +460,32 @@ bool Redis2P::del(const string_vector_t& keys, int64_t * _return)
 {
   CHECK_PTR_PARAM(_return);
 
-  size_t_vector_vector_t index_vv;
-  if (!__get_keys_client(keys, &index_vv))
+  redis_command_vector_t commands;
+  ClearGuard<redis_command_vector_t> commands_guard(&commands);
+  BOOST_FOREACH(const std::string& key, keys)
+  {
+    commands.push_back(new RedisCommand(DEL));
+    commands.back()->push_arg(key);
+  }
+
+  if (!exec_pipeline(&commands))
     return false;
 
-  int64_t deleted = 0;
+  int64_t deleted;
   int64_t total_deleted = 0;
-  bool ret = true;
-
-  // convert multi-del to del to multi redis instance
-  // for each key
-  for (size_t i=0; i<index_vv.size(); i++)
+  BOOST_FOREACH(RedisCommand * command, commands)
   {
-    const size_t_vector_t& index_v = index_vv[i];
-    // for each group
-    for (size_t j=0; j<index_v.size(); j++)
+    if (!command->out.get_i(&deleted))
     {
-      ret = redis2_sp_vector_[index_v[j]]->del(keys[i], &deleted);
-      if (!ret)
-      {
-        __set_index_error(index_v[j]);
-        return false;
-      }
+      error_ = str(boost::format("expect %s, but got %s")
+          % to_string(kInteger) % to_string(command->out.reply_type));
+      return false;
     }
     total_deleted += deleted;
   }
 
-  if (ret)
-    *_return = total_deleted;
-  return ret;
+  *_return = total_deleted;
+  return true;
 }
 
 bool Redis2P::dump(const std::string& key, std::string * _return, bool * is_nil)
@@ -354,29 +517,31 @@ bool Redis2P::keys(const std::string& pattern, mbulk_t * _return)
 {
   CHECK_PTR_PARAM(_return);
 
+  FanoutDeadline fanout_deadline(this, kSlowCommand, timeout_ms_);
   clear_mbulks(_return);
-  mbulk_t mb;
 
   size_t_vector_t index_v;
   if (!__get_group_client(&index_v))
     return false;
 
-  // for each host
-  bool ret;
-  BOOST_FOREACH(size_t host_index, index_v)
+  // for each host concurrently
+  std::vector<mbulk_t> mbs(index_v.size());
+  std::vector<char> rets(index_v.size(), 0);
+  std::vector<FanoutExecutor::task_t> tasks;
+  for (size_t i=0; i<index_v.size(); i++)
   {
-    clear_mbulks(&mb);
-    ret = redis2_sp_vector_[host_index]->keys(pattern, &mb);
-    if (!ret)
-    {
-      clear_mbulks(_return);
-      __set_index_error(host_index);
-      return false;
-    }
+    tasks.push_back(store_result(boost::bind(&Redis2::keys,
+            redis2_sp_vector_[index_v[i]].get(), boost::cref(pattern), &mbs[i]), &rets[i]));
+  }
 
-    append_mbulks(_return, &mb);
+  bool ret = __fanout(index_v, tasks, rets);
+  for (size_t i=0; i<mbs.size(); i++)
+  {
+    if (ret)
+      append_mbulks(_return, &mbs[i]);
+    clear_mbulks(&mbs[i]);
   }
-  return true;
+  return ret;
 }
 
 bool Redis2P::move(const std::string& key, int db, int64_t * _return)
@@ -419,6 +584,7 @@ bool Redis2P::randomkey(std::string * _return, bool * is_nil)
   CHECK_PTR_PARAM(_return);
   CHECK_PTR_PARAM(is_nil);
 
+  FanoutDeadline fanout_deadline(this, kReadCommand, timeout_ms_);
   size_t_vector_t index_v;
   if (!__get_group_client(&index_v))
     return false;
@@ -523,31 +689,36 @@ bool Redis2P::mget(const string_vector_t& keys, mbulk_t * _return)
   CHECK_PTR_PARAM(_return);
 
   clear_mbulks(_return);
-  _return->reserve(keys.size());
-
-  bool ret;
-  std::string value;
-  std::string * tmp_value;
-  bool is_nil;
 
-  // convert mget to get to multi redis instance
+  // convert mget to get in pipelines of multi redis instance
+  redis_command_vector_t commands;
+  ClearGuard<redis_command_vector_t> commands_guard(&commands);
   BOOST_FOREACH(const std::string& key, keys)
   {
-    ret = get(key, &value, &is_nil);
-    if (!ret)
-    {
-      clear_mbulks(_return);
-      return false;
-    }
-    else if (is_nil)
+    commands.push_back(new RedisCommand(GET));
+    commands.back()->push_arg(key);
+  }
+
+  if (!exec_pipeline(&commands))
+    return false;
+
+  _return->reserve(keys.size());
+  BOOST_FOREACH(RedisCommand * command, commands)
+  {
+    if (command->out.is_nil_bulk())
     {
       _return->push_back(NULL);
+      continue;
     }
-    else
+
+    std::string * value = new std::string;
+    _return->push_back(value);
+    if (!command->out.get_bulk(value))
     {
-      tmp_value = new std::string;
-      tmp_value->swap(value);
-      _return->push_back(tmp_value);
+      clear_mbulks(_return);
+      error_ = str(boost::format("expect %s, but got %s")
+          % to_string(kBulk) % to_string(command->out.reply_type));
+      return false;
     }
   }
   assert(keys.size()==_return->size());
@@ -558,14 +729,25 @@ bool Redis2P::mset(const string_vector_t& keys, const string_vector_t& values)
 {
   CHECK_EXPR(keys.size()==values.size());
 
-  bool ret;
-
-  // convert mset to set to multi redis instance
+  // convert mset to set in pipelines of multi redis instance
+  redis_command_vector_t commands;
+  ClearGuard<redis_command_vector_t> commands_guard(&commands);
   for (size_t i=0; i<keys.size(); i++)
   {
-    ret = set(keys[i], values[i]);
-    if (!ret)
+    commands.push_back(new RedisCommand(SET));
+    commands.back()->push_arg(keys[i]);
+    commands.back()->push_arg(values[i]);
+  }
+
+  if (!exec_pipeline(&commands))
+    return false;
+
+  BOOST_FOREACH(RedisCommand * command, commands)
+  {
+    if (!command->out.is_status_ok())
     {
+      error_ = str(boost::format("expect %s, but got %s")
+          % to_string(kStatus) % to_string(command->out.reply_type));
       return false;
     }
   }
@@ -975,41 +1157,182 @@ bool Redis2P::zscore(const std::string& key, const std::string& member,
 
 bool Redis2P::select(int index)
 {
-  bool ret = true;
-  BOOST_FOREACH(redis2_sp_t& sp, redis2_sp_vector_)
+  FanoutDeadline fanout_deadline(this, kReadCommand, timeout_ms_);
+
+  // for each host concurrently
+  size_t_vector_t index_v(redis2_sp_vector_.size());
+  std::vector<char> rets(redis2_sp_vector_.size(), 0);
+  std::vector<FanoutExecutor::task_t> tasks;
+  for (size_t i=0; i<redis2_sp_vector_.size(); i++)
   {
-    if (!sp->select(index))
-    {
-      __set_host_error(*sp);
-      ret = false;
-    }
+    index_v[i] = i;
+    tasks.push_back(store_result(boost::bind(&Redis2::select, redis2_sp_vector_[i].get(), index), &rets[i]));
   }
-  return ret;
+  return __fanout(index_v, tasks, rets);
 }
 
 bool Redis2P::flushall()
 {
-  bool ret = true;
-  BOOST_FOREACH(redis2_sp_t& sp, redis2_sp_vector_)
+  FanoutDeadline fanout_deadline(this, kSlowCommand, timeout_ms_);
+
+  // for each host concurrently
+  size_t_vector_t index_v(redis2_sp_vector_.size());
+  std::vector<char> rets(redis2_sp_vector_.size(), 0);
+  std::vector<FanoutExecutor::task_t> tasks;
+  for (size_t i=0; i<redis2_sp_vector_.size(); i++)
   {
-    if (!sp->flushall())
-    {
-      __set_host_error(*sp);
-      ret = false;
-    }
+    index_v[i] = i;
+    tasks.push_back(store_result(boost::bind(&Redis2::flushall, redis2_sp_vector_[i].get()), &rets[i]));
   }
-  return ret;
+  return __fanout(index_v, tasks, rets);
 }
 
 bool Redis2P::flushdb()
 {
+  FanoutDeadline fanout_deadline(this, kSlowCommand, timeout_ms_);
+
+  // for each host concurrently
+  size_t_vector_t index_v(redis2_sp_vector_.size());
+  std::vector<char> rets(redis2_sp_vector_.size(), 0);
+  std::vector<FanoutExecutor::task_t> tasks;
+  for (size_t i=0; i<redis2_sp_vector_.size(); i++)
+  {
+    index_v[i] = i;
+    tasks.push_back(store_result(boost::bind(&Redis2::flushdb, redis2_sp_vector_[i].get()), &rets[i]));
+  }
+  return __fanout(index_v, tasks, rets);
+}
+
+bool Redis2P::exec_pipeline(redis_command_vector_t * commands)
+{
+  CHECK_PTR_PARAM(commands);
+  size_t size = commands->size();
+  // routed by the keys, nothing is executed if any can not be
+  size_t_vector_t host_v(size);
+  for (size_t i=0; i<size; i++)
+  {
+    RedisCommand * command = (*commands)[i];
+    CHECK_PTR_PARAM(command);
+    CHECK_EXPR(command_class(command->in.command())!=kBlockingCommand);
+    if (!__get_command_host_index(*command, &host_v[i]))
+    {
+      command->out.set_error(error_);
+      return false;
+    }
+  }
+
+  if (commands->empty())
+    return true;
+
+  FanoutDeadline fanout_deadline(this, __get_pipeline_class(*commands), timeout_ms_);
+  size_t host_num = redis2_sp_vector_.size() / groups_;
+  size_t seed = __get_seed();
+  size_t index;
+
+  std::vector<redis_command_vector_t> pipelines(redis2_sp_vector_.size());
+  // where each command goes
+  size_t_vector_t index_v(size);
+  // writes to the other groups are executed on copies
+  redis_command_vector_t replicas;
+  size_t_vector_t replica_of;
+  size_t_vector_t replica_index_v;
+  ClearGuard<redis_command_vector_t> replicas_guard(&replicas);
+
+  for (size_t i=0; i<size; i++)
+  {
+    RedisCommand * command = (*commands)[i];
+    size_t host_index = host_v[i];
+    command->out.clear();
+
+    if (command_class(command->in.command())==kReadCommand)
+    {
+      // one client in one group
+      index = host_index + host_num * (seed % groups_);
+      index_v[i] = index;
+      pipelines[index].push_back(command);
+      continue;
+    }
+
+    // clients in all groups
+    for (size_t j=0; j<groups_; j++)
+    {
+      index = host_index + host_num * ((seed + j) % groups_);
+      if (j==0)
+      {
+        index_v[i] = index;
+        pipelines[index].push_back(command);
+      }
+      else
+      {
+        RedisCommand * replica = new RedisCommand;
+        replica->in = command->in;
+        replicas.push_back(replica);
+        replica_of.push_back(i);
+        replica_index_v.push_back(index);
+        pipelines[index].push_back(replica);
+      }
+    }
+  }
+
+  __exec_pipelines(&pipelines);
+
+  // reads failing on a host move on to the next group
+  for (size_t round=1; round<groups_; round++)
+  {
+    bool retry = false;
+    for (size_t i=0; i<pipelines.size(); i++)
+      pipelines[i].clear();
+
+    for (size_t i=0; i<size; i++)
+    {
+      RedisCommand * command = (*commands)[i];
+      if (command_class(command->in.command())!=kReadCommand
+          || __is_replied(*command, index_v[i]))
+        continue;
+
+      index = (index_v[i] + host_num) % redis2_sp_vector_.size();
+      index_v[i] = index;
+      pipelines[index].push_back(command);
+      retry = true;
+    }
+
+    if (!retry)
+      break;
+    __exec_pipelines(&pipelines);
+  }
+
+  // a write fails if it fails in any group
+  for (size_t i=0; i<replicas.size(); i++)
+  {
+    RedisCommand * command = (*commands)[replica_of[i]];
+    if (replicas[i]->out.reply_type!=kError && replicas[i]->out.reply_type!=kNone)
+      continue;
+    if (command->out.reply_type==kError || command->out.reply_type==kNone)
+      continue;
+
+    index_v[replica_of[i]] = replica_index_v[i];
+    if (replicas[i]->out.reply_type==kError)
+      command->out.set_error(*replicas[i]->out.ptr.error);
+    else
+      command->out.clear();
+  }
+
   bool ret = true;
-  BOOST_FOREACH(redis2_sp_t& sp, redis2_sp_vector_)
+  for (size_t i=0; i<size; i++)
   {
-    if (!sp->flushdb())
+    RedisOutput& out = (*commands)[i]->out;
+    if (out.reply_type!=kError && out.reply_type!=kNone)
+      continue;
+
+    // not replied, it has the error of its host
+    if (out.reply_type==kNone)
+      out.set_error(redis2_sp_vector_[index_v[i]]->last_error());
+
+    if (ret)
     {
-      __set_host_error(*sp);
       ret = false;
+      error_ = str(boost::format("[%s:%s] %s")
+          % hosts_[index_v[i]] % ports_[index_v[i]] % *out.ptr.error);
     }
   }
   return ret;
@@ -14,6 +14,12 @@
 
 LIBREDIS_NAMESPACE_BEGIN
 
+// Redis2P runs the per-host calls of one operation(keys, flushall, flushdb, select,
+// writes to several groups, mget, mset, del and pipelines), and RedisRuntime
+// the pipelines of its shards, concurrently on up to 'threads' threads
+// (16 by default) shared by the process, 0 runs them one by one in the calling thread.
+void set_fanout_threads(int threads);
+
 class Redis2P : public RedisBase2Multi
 {
   private:
@@ -30,25 +36,60 @@ class Redis2P : public RedisBase2Multi
     void __set_host_error(const Redis2& host);
 
     size_t __get_key_host_index(const std::string& key)const;
+    // the host index of all keys of 'command'
+    // return false, it has no key or its keys are on different hosts
+    bool __get_command_host_index(const RedisCommand& command, size_t * host_index);
+
+    // 'command' executed on 'host_index' has a reply(maybe an error reply)
+    bool __is_replied(const RedisCommand& command, size_t host_index)const;
+    // run the pipelines of all hosts concurrently, '(*pipelines)[i]' for host i
+    void __exec_pipelines(std::vector<redis_command_vector_t> * pipelines);
+    // run the pipelines of 'index_v' concurrently and fill their outputs in order
+    bool __exec_group_pipelines(const size_t_vector_t& index_v,
+        pipeline_sp_vector_t * pipelines);
+    // run 'tasks' concurrently, 'tasks[i]' calls 'index_v[i]' and returns into 'rets[i]'
+    // return false, the error is the first failure's
+    bool __fanout(const size_t_vector_t& index_v,
+        const std::vector<boost::function<void ()> >& tasks, const std::vector<char>& rets);
 
 
     const size_t partitions_;
     const key_hasher hash_fn_;
     size_t groups_;
+    const SocketOptions socket_options_;
+    int64_t deadline_;
+    CompressionOptions compression_;
+    NearCache * near_cache_;
 
     redis2_sp_vector_t redis2_sp_vector_;
     // std::set<size_t> invalid_redis_;
 
   public:
     Redis2P(
-        const std::string& host_list,// a host list
+        const std::string& host_list,// a host list, "unix:/path" entries are unix domain sockets
         const std::string& port_list,// a port list matching host_list or only one port
         int db_index = 0,
         int timeout_ms = 50,
         int partitions = 1,
-        key_hasher fn = time33_hash_32);
+        key_hasher fn = time33_hash_32,
+        const SocketOptions& options = SocketOptions());
     virtual ~Redis2P();
 
+    // the sum of all inner clients
+    virtual SocketStats get_socket_stats()const;
+
+    // it applies to all inner clients
+    virtual void set_deadline(int64_t deadline);
+    virtual int64_t get_deadline()const;
+
+    // it applies to all inner clients
+    virtual void set_compression(const CompressionOptions& options);
+    virtual CompressionOptions get_compression()const;
+
+    // it applies to all inner clients
+    virtual void set_near_cache(NearCache * near_cache);
+    virtual NearCache * get_near_cache()const;
+
     // retrieve the inner Redis2 client, whose ownership is still in Redis2P by key
     bool get_key_client(const std::string& key, redis2_sp_vector_t * redis_clients);
     // retrieve the inner Redis2 client, whose ownership is still in Redis2P by index
@@ -213,6 +254,20 @@ class Redis2P : public RedisBase2Multi
     /************************************************************************/
     virtual bool flushall();
     virtual bool flushdb();
+
+    /************************************************************************/
+    /*pipeline*/
+    /************************************************************************/
+    // Every command in 'commands' is routed by its keys(see command_keys),
+    // which must be on one host, keyless commands(KEYS, SELECT, PING...) are rejected:
+    // a read goes to one group and moves on to the next group if its host fails,
+    // others go to all groups like writes.
+    // One pipeline runs for each host, all hosts run concurrently.
+    // Blocking commands are not supported.
+    // return true, all commands succeeded, replies are in 'out' in submission order
+    // return false, failed commands have their errors in 'out',
+    // the others have their replies, last_error() is the first failure
+    bool exec_pipeline(redis_command_vector_t * commands);
 };
 
 LIBREDIS_NAMESPACE_END
@@ -7,13 +7,16 @@
  */
 #include "redis_protocol.h"
 #include "tcp_client.h"
+#include "reconnect_backoff.h"
+#include "latency_tracker.h"
+#include "near_cache.h"
+#include "single_flight.h"
 #include "os.h"
 #include <assert.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <errno.h>
 #include <algorithm>
-#include <sstream>
 #include <boost/algorithm/string.hpp>
 #include <boost/format.hpp>
 #include <boost/foreach.hpp>
@@ -27,21 +30,70 @@ LIBREDIS_NAMESPACE_BEGIN
 
 static const std::string s_redis_line_end("\r\n");
 
-  RedisProtocol::RedisProtocol(const std::string& host, const std::string& port, int timeout)
-: host_(host), port_(port), timeout_(timeout), blocking_mode_(false), transaction_mode_(false)
+// append "<prefix><size>\r\n"
+static void append_header(std::string * request, char prefix, size_t size)
 {
-  tcp_client_ = new TcpClient;
+  char buf[kInt64Chars];
+  request->append(1, prefix);
+  request->append(buf, format_uint64(size, buf));
+  request->append(s_redis_line_end);
+}
+
+static void append_bulk(std::string * request, const std::string& arg)
+{
+  append_header(request, '$', arg.size());
+  request->append(arg);
+  request->append(s_redis_line_end);
+}
+
+// arguments this large are written as they are instead of being copied into the request
+static const size_t s_direct_arg_size = 64 * 1024;
+
+// the encoded size of 'args', a little more is fine
+static size_t encoded_size(const string_vector_t& args, bool direct)
+{
+  size_t size = 16;
+  BOOST_FOREACH(const std::string& arg, args)
+    size += (direct && arg.size()>=s_direct_arg_size ? 0 : arg.size()) + 16;
+  return size;
+}
+
+  RedisProtocol::RedisProtocol(const std::string& host, const std::string& port, int timeout,
+      RedisTransport * transport)
+: host_(host), port_(port), transport_(transport), timeout_(timeout),
+  deadline_(0), call_deadline_(0), in_call_(false),
+  call_begin_us_(0), call_latency_(NULL), call_ec_(0),
+  blocking_mode_(false), transaction_mode_(false),
+  near_cache_(NULL), queued_all_(false), db_("0")
+{
+  for (size_t i=0; i<kCommandClassMax; i++)
+    latencies_[i] = NULL;
+
+  if (transport_==NULL)
+    transport_ = new TcpClient;
+}
+
+  RedisProtocol::RedisProtocol(const std::string& host, const std::string& port, int timeout,
+      const SocketOptions& options)
+: host_(host), port_(port), transport_(new TcpClient(options)), timeout_(timeout),
+  deadline_(0), call_deadline_(0), in_call_(false),
+  call_begin_us_(0), call_latency_(NULL), call_ec_(0),
+  blocking_mode_(false), transaction_mode_(false),
+  near_cache_(NULL), queued_all_(false), db_("0")
+{
+  for (size_t i=0; i<kCommandClassMax; i++)
+    latencies_[i] = NULL;
 }
 
 RedisProtocol::~RedisProtocol()
 {
   close();
-  delete tcp_client_;
+  delete transport_;
 }
 
 bool RedisProtocol::assure_connect(int * status)
 {
-  if (tcp_client_->is_open())
+  if (transport_->is_open())
   {
     if (status)
       *status = 0;
@@ -63,33 +115,69 @@ bool RedisProtocol::assure_connect(int * status)
 bool RedisProtocol::connect()
 {
   int ec;
-  tcp_client_->connect(host_, port_, timeout_, &ec);
+  int64_t wait_ms;
+  int failures;
+
+  int timeout = timeout_;
+  if (deadline_)
+  {
+    int left = timeout_of(deadline_);
+    if (left==0)
+    {
+      close();
+      error_ = str(boost::format("connect %s:%s failed, %s, deadline exceeded")
+          % host_ % port_ % ec_2_string(ETIMEDOUT));
+      return false;
+    }
+    if (left<timeout)
+      timeout = left;
+  }
+
+  if (!ReconnectBackoff::allow(host_, port_, &wait_ms, &failures))
+  {
+    close();
+    error_ = ReconnectBackoff::error(host_, port_, wait_ms, failures);
+    return false;
+  }
+
+  transport_->connect(host_, port_, timeout, &ec);
 
   if (ec)
   {
+    ReconnectBackoff::on_failure(host_, port_);
     close();
     error_ = str(boost::format("connect %s:%s failed, %s")
         % host_ % port_ % ec_2_string(ec));
     return false;
   }
+
+  ReconnectBackoff::on_success(host_, port_);
   return true;
 }
 
 void RedisProtocol::close()
 {
-  tcp_client_->close();
+  transport_->close();
   blocking_mode_ = false;
   transaction_mode_ = false;
+  queued_commands_.clear();
+  // a new connection begins with db 0
+  db_ = "0";
 }
 
 bool RedisProtocol::available()const
 {
-  return tcp_client_->available();
+  return transport_->available();
 }
 
 bool RedisProtocol::is_open()const
 {
-  return tcp_client_->is_open();
+  return transport_->is_open();
+}
+
+SocketStats RedisProtocol::get_socket_stats()const
+{
+  return transport_->get_socket_stats();
 }
 
 bool RedisProtocol::check_connect()
@@ -102,28 +190,198 @@ bool RedisProtocol::check_connect()
   return true;
 }
 
-bool RedisProtocol::exec_command(RedisCommand * command)
+int RedisProtocol::call_budget(kCommandClass command_class)const
 {
-  CHECK_PTR_PARAM(command);
+  int budget = get_command_budget(command_class);
+  if (budget>0)
+    return budget;
+  if (command_class==kBlockingCommand || blocking_mode_)
+    return -1;
+  return timeout_;
+}
 
-  if (!write_command(command))
+bool RedisProtocol::begin_call(int budget, LatencyHistogram * latency)
+{
+  if (in_call_)
     return false;
 
-  if (!read_reply(command))
-    return false;
+  in_call_ = true;
+  call_deadline_ = deadline_ ? deadline_ : deadline_of(budget);
+  call_latency_ = latency;
+  call_ec_ = 0;
+  if (call_latency_)
+    call_begin_us_ = monotonic_us();
   return true;
 }
 
-bool RedisProtocol::exec_commandv(RedisCommand * command, const char * format, va_list ap)
+bool RedisProtocol::begin_command(kCommandClass command_class)
+{
+  if (in_call_)
+    return false;
+
+  int budget = call_budget(command_class);
+  if (budget<0 || !LatencyTracker::enabled())
+    return begin_call(budget, NULL);
+
+  LatencyHistogram *& latency = latencies_[command_class];
+  if (latency==NULL)
+    latency = LatencyTracker::get(host_, port_, command_class);
+
+  if (get_command_budget(command_class)==0)
+  {
+    int adaptive = latency->timeout_ms();
+    if (adaptive>0)
+      budget = adaptive;
+  }
+  return begin_call(budget, latency);
+}
+
+void RedisProtocol::end_call(bool began, bool ok)
+{
+  if (!began)
+    return;
+
+  // Calls timing out are observed with the time they waited,
+  // other failures tell nothing about the latency.
+  if (call_latency_ && (ok || call_ec_==ETIMEDOUT))
+    call_latency_->record(monotonic_us() - call_begin_us_, !ok);
+
+  in_call_ = false;
+  call_deadline_ = 0;
+  call_latency_ = NULL;
+}
+
+int RedisProtocol::io_timeout(bool reading)const
+{
+  if (call_deadline_)
+    return timeout_of(call_deadline_);
+  return (reading && blocking_mode_) ? -1 : timeout_;
+}
+
+bool RedisProtocol::check_deadline(RedisCommand * command)
+{
+  if (call_deadline_==0 || timeout_of(call_deadline_)>0)
+    return true;
+
+  // nothing is written, no need to disconnect
+  error_ = str(boost::format("write %s:%s failed, %s, deadline exceeded")
+      % host_ % port_ % ec_2_string(ETIMEDOUT));
+  command->out.set_error(error_);
+  return false;
+}
+
+bool RedisProtocol::exec_command(RedisCommand * command)
 {
   CHECK_PTR_PARAM(command);
 
-  if (!write_commandv(command, format, ap))
+  bool began = begin_command(command_class(command->in.command()));
+  bool ret;
+  if (began && SingleFlight::enabled() && !transaction_mode_ && !blocking_mode_
+      && SingleFlight::coalescible(command->in.command()) && !command->in.args().empty())
+    ret = exec_coalesced(command);
+  else
+    ret = write_command(command) && read_reply(command);
+  end_call(began, ret);
+  return ret;
+}
+
+bool RedisProtocol::exec_coalesced(RedisCommand * command)
+{
+  std::string request;
+  // nothing is written, no need to disconnect
+  if (!encode_command(command, &request))
     return false;
 
-  if (!read_reply(command))
+  // replies are decompressed or not
+  std::string id = host_ + ":" + port_ + "/" + db_
+    + (compression_.decompress ? "+" : "-") + request;
+  string_vector_t keys;
+  SingleFlight::read_keys(command, &keys);
+  flight_sp_t flight;
+  if (SingleFlight::join(id, keys, &flight))
+  {
+    switch (flight->wait(call_deadline_, &command->out))
+    {
+      case 1:
+        return true;
+      case -1:
+        SingleFlight::on_timeout();
+        call_ec_ = ETIMEDOUT;
+        error_ = str(boost::format("read %s:%s failed, %s, waiting for a coalesced call")
+            % host_ % port_ % ec_2_string(ETIMEDOUT));
+        command->out.set_error(error_);
+        return false;
+      default:
+        // the shared call failed, its error may not be ours
+        SingleFlight::on_fallback();
+        return check_deadline(command) && write_request(request, command)
+          && read_reply(command);
+    }
+  }
+
+  bool ret = check_deadline(command) && write_request(request, command)
+    && read_reply(command);
+  SingleFlight::land(id, flight, ret, command->out);
+  return ret;
+}
+
+bool RedisProtocol::exec_command(RedisCommand * command, ReplyVisitor * visitor)
+{
+  CHECK_PTR_PARAM(command);
+  CHECK_PTR_PARAM(visitor);
+
+  bool began = begin_command(command_class(command->in.command()));
+  bool ret = write_command(command) && read_multi_bulk_visit(command, visitor);
+  end_call(began, ret);
+  return ret;
+}
+
+bool RedisProtocol::exec_command(RedisCommand * command, BulkSink * sink)
+{
+  CHECK_PTR_PARAM(command);
+  CHECK_PTR_PARAM(sink);
+
+  bool began = begin_command(command_class(command->in.command()));
+  bool ret = write_command(command) && read_bulk_to(command, sink);
+  end_call(began, ret);
+  return ret;
+}
+
+bool RedisProtocol::exec_command(RedisCommand * command, BulkSource * source)
+{
+  CHECK_PTR_PARAM(command);
+  CHECK_PTR_PARAM(source);
+
+  bool began = begin_command(command_class(command->in.command()));
+  bool ret = write_command(command, source) && read_reply(command);
+  end_call(began, ret);
+  return ret;
+}
+
+bool RedisProtocol::exec_cmd(RedisCommand * command, const std::string& name)
+{
+  CHECK_PTR_PARAM(command);
+
+  if (command->in.command()==NOOP)
+  {
+    // no need to disconnect for client error
+    error_ = str(boost::format("invalid command: %s") % name);
+    command->out.set_error(error_);
     return false;
-  return true;
+  }
+  return exec_command(command);
+}
+
+bool RedisProtocol::exec_commandv(RedisCommand * command, const char * format, va_list ap)
+{
+  CHECK_PTR_PARAM(command);
+
+  // the command is known after parsing 'format',
+  // so it has the read budget and it is not observed
+  bool began = begin_call(call_budget(kReadCommand), NULL);
+  bool ret = write_commandv(command, format, ap) && read_reply(command);
+  end_call(began, ret);
+  return ret;
 }
 
 bool RedisProtocol::exec_command(RedisCommand * command, const char * format, ...)
@@ -142,42 +400,83 @@ bool RedisProtocol::exec_pipeline(redis_command_vector_t * commands)
   CHECK_PTR_PARAM(commands);
 
   size_t size = commands->size();
+  // the largest budget of the commands
+  int budget = 0;
   for (size_t i=0; i<size; i++)
   {
-    if (!write_command((*commands)[i]))
-      return false;
-
-    // To avoid being disconnected,
-    // check the status of connection between each pair of operations.
-    if (!tcp_client_->is_open())
+    int b = call_budget(command_class((*commands)[i]->in.command()));
+    if (b<0)
     {
-      close();
-      error_ = "connection has been broken during this pipeline operation";
-      return false;
+      budget = -1;
+      break;
     }
+    if (b>budget)
+      budget = b;
   }
 
+  bool began = begin_call(budget, NULL);
+  bool ret = __exec_pipeline(commands);
+  end_call(began, ret);
+  return ret;
+}
+
+bool RedisProtocol::__exec_pipeline(redis_command_vector_t * commands)
+{
+  size_t size = commands->size();
+  if (size==0)
+    return true;
+
+  // all commands go out in one write
+  std::string request;
   for (size_t i=0; i<size; i++)
   {
-    if (!read_reply((*commands)[i]))
+    // nothing is written, no need to disconnect
+    if (!encode_command((*commands)[i], &request))
       return false;
-    if (!tcp_client_->is_open())
+  }
+
+  if (!check_deadline((*commands)[0]))
+    return false;
+
+  if (!write_request(request, (*commands)[0]))
+  {
+    // a part of them may have been written and done
+    invalidate_unread(commands, 0);
+    return false;
+  }
+
+  // Read all replies, error replies do not stop it,
+  // or the replies left behind would be taken by the next command.
+  bool ret = true;
+  std::string first_error;
+  for (size_t i=0; i<size; i++)
+  {
+    if (read_reply((*commands)[i]))
+      continue;
+
+    if (!transport_->is_open())
     {
-      close();
-      error_ = "connection has been broken during this pipeline operation";
+      // the ones after it were written and may have been done
+      invalidate_unread(commands, i + 1);
       return false;
     }
+
+    if (ret)
+    {
+      ret = false;
+      first_error = error_;
+    }
   }
 
-  return true;
+  if (!ret)
+    error_ = first_error;
+  return ret;
 }
 
-bool RedisProtocol::write_command(RedisCommand * command)
+bool RedisProtocol::encode_command(RedisCommand * command, std::string * request,
+    direct_args_t * direct, BulkSource * source)
 {
-  CHECK_PTR_PARAM(command);
-
-  std::stringstream ss;
-  int given_argc = static_cast<int>(command->in.args().size());
+  int given_argc = static_cast<int>(command->in.args().size()) + (source ? 1 : 0);
 
   if (!check_argc(command, given_argc))
     return false;
@@ -191,22 +490,99 @@ bool RedisProtocol::write_command(RedisCommand * command)
    * $<number of bytes of argument N> CR LF
    * <argument data> CR LF
    */
-  ss << "*" << (given_argc+1) << s_redis_line_end;
+  const CommandInfo& info = command->in.command_info();
+  request->reserve(request->size() + info.header_size
+      + encoded_size(command->in.args(), direct!=NULL));
+  append_header(request, '*', static_cast<size_t>(given_argc + 1));
 
-  // write command
-  ss << "$" << command->in.command_info().command_str.size() << s_redis_line_end;
-  ss << command->in.command_info().command_str << s_redis_line_end;
+  // write command, its header is encoded already
+  request->append(info.header, info.header_size);
 
   // write args
-  BOOST_FOREACH(const std::string& arg, command->in.args())
+  const kCommand cmd = command->in.command();
+  const bool compress = compression_.codec!=kNoCodec;
+  std::string compressed;
+  for (size_t i=0; i<command->in.args().size(); i++)
   {
-    ss << "$" << arg.size() << s_redis_line_end << arg << s_redis_line_end;
+    const std::string& arg = command->in.args()[i];
+    if (compress && is_value_arg(cmd, i) && encode_value(compression_, arg, &compressed))
+      append_bulk(request, compressed);
+    else if (direct && arg.size()>=s_direct_arg_size)
+    {
+      append_header(request, '$', arg.size());
+      direct->push_back(std::make_pair(request->size(), &arg));
+      request->append(s_redis_line_end);
+    }
+    else
+    {
+      append_bulk(request, arg);
+    }
   }
 
+  if (source)
+    append_header(request, '$', source->size());
+  return true;
+}
+
+bool RedisProtocol::write_command(RedisCommand * command)
+{
+  CHECK_PTR_PARAM(command);
+
+  std::string request;
+  direct_args_t direct;
+  if (!encode_command(command, &request, &direct))
+    return false;
+
+  bool began = begin_call(call_budget(command_class(command->in.command())), NULL);
+  bool ret = check_deadline(command);
+  size_t offset = 0;
+  for (size_t i=0; ret && i<direct.size(); i++)
+  {
+    ret = write_request(request.substr(offset, direct[i].first - offset), command)
+      && write_request(*direct[i].second, command);
+    offset = direct[i].first;
+  }
+  if (ret)
+    ret = write_request(offset ? request.substr(offset) : request, command);
+  end_call(began, ret);
+  return ret;
+}
+
+bool RedisProtocol::write_command(RedisCommand * command, BulkSource * source)
+{
+  std::string request;
+  if (!encode_command(command, &request, NULL, source))
+    return false;
+
+  bool began = begin_call(call_budget(command_class(command->in.command())), NULL);
+  bool ret = check_deadline(command) && write_request(request, command);
+  if (ret)
+  {
+    int ec;
+    transport_->write_from(source, io_timeout(false), &ec);
+    if (ec)
+    {
+      call_ec_ = ec;
+      close();
+      error_ = str(boost::format("write %s:%s failed, %s")
+          % host_ % port_ % ec_2_string(ec));
+      command->out.set_error(error_);
+      ret = false;
+    }
+  }
+  if (ret)
+    ret = write_request(s_redis_line_end, command);
+  end_call(began, ret);
+  return ret;
+}
+
+bool RedisProtocol::write_request(const std::string& request, RedisCommand * command)
+{
   int ec;
-  tcp_client_->write(ss.str(), timeout_, &ec);
+  transport_->write(request, io_timeout(false), &ec);
   if (ec)
   {
+    call_ec_ = ec;
     close();
     error_ = str(boost::format("write %s:%s failed, %s")
         % host_ % port_ % ec_2_string(ec));
@@ -248,8 +624,8 @@ bool RedisProtocol::write_commandv(RedisCommand * command, const char * format,
   (void)boost::split(command->in.args(), buf, boost::is_any_of(" "));
   (void)command->in.args().erase(std::remove_if(command->in.args().begin(),
         command->in.args().end(), is_empty_string()), command->in.args().end());
+  command->in.set_named(true);
 
-  std::stringstream ss;
   int given_argc = static_cast<int>(command->in.args().size());
   if (given_argc==0)
   {
@@ -282,25 +658,18 @@ bool RedisProtocol::write_commandv(RedisCommand * command, const char * format,
    * $<number of bytes of argument N> CR LF
    * <argument data> CR LF
    */
-  ss << "*" << given_argc << s_redis_line_end;
+  std::string request;
+  request.reserve(encoded_size(command->in.args(), false));
+  append_header(&request, '*', static_cast<size_t>(given_argc));
 
   // write command and args
   BOOST_FOREACH(const std::string& arg, command->in.args())
-  {
-    ss << "$" << arg.size() << s_redis_line_end << arg << s_redis_line_end;
-  }
+    append_bulk(&request, arg);
 
-  int ec;
-  tcp_client_->write(ss.str(), timeout_, &ec);
-  if (ec)
-  {
-    close();
-    error_ = str(boost::format("write %s:%s failed, %s")
-        % host_ % port_ % ec_2_string(ec));
-    command->out.set_error(error_);
-    return false;
-  }
-  return true;
+  bool began = begin_call(call_budget(command_class(command->in.command())), NULL);
+  bool ret = check_deadline(command) && write_request(request, command);
+  end_call(began, ret);
+  return ret;
 }
 
 bool RedisProtocol::write_command(RedisCommand * command, const char * format, ...)
@@ -315,7 +684,67 @@ bool RedisProtocol::write_command(RedisCommand * command, const char * format, .
 bool RedisProtocol::read_reply(RedisCommand * command)
 {
   CHECK_PTR_PARAM(command);
-  return __read_reply(command, &command->out, true);
+
+  bool began = begin_call(call_budget(command_class(command->in.command())), NULL);
+  bool ret = __read_reply(command, &command->out, true);
+  end_call(began, ret);
+
+  if (ret && command->in.command()==SELECT && command->out.is_status_ok())
+    db_ = command->in.args()[command->in.first_arg()];
+
+  // a failed write may have been done
+  if (near_cache_ || SingleFlight::enabled())
+    invalidate_reads(command);
+  return ret;
+}
+
+void RedisProtocol::invalidate_unread(const redis_command_vector_t * commands, size_t from)
+{
+  if (!near_cache_ && !SingleFlight::enabled())
+    return;
+
+  for (size_t i=from; i<commands->size(); i++)
+    invalidate_reads((*commands)[i]);
+}
+
+void RedisProtocol::invalidate_reads(const RedisCommand * command)
+{
+  kCommand cmd = command->in.command();
+  string_vector_t keys;
+  bool all = false;
+  if (cmd==EXEC || cmd==DISCARD)
+  {
+    // readers may have read the values before it was executed
+    if (cmd==EXEC)
+    {
+      keys.swap(queued_keys_);
+      all = queued_all_;
+    }
+    queued_keys_.clear();
+    queued_all_ = false;
+  }
+  else
+  {
+    all = !NearCache::written_keys(command, &keys);
+    if (transaction_mode_)
+    {
+      queued_keys_.insert(queued_keys_.end(), keys.begin(), keys.end());
+      queued_all_ = queued_all_ || all;
+    }
+  }
+
+  if (all)
+  {
+    if (near_cache_)
+      near_cache_->clear();
+    SingleFlight::detach_all();
+  }
+  else if (!keys.empty())
+  {
+    if (near_cache_)
+      near_cache_->invalidate(db_, keys);
+    SingleFlight::detach(keys);
+  }
 }
 
 bool RedisProtocol::__read_reply(RedisCommand * command, RedisOutput * output,
@@ -381,9 +810,14 @@ bool RedisProtocol::__read_reply(RedisCommand * command, RedisOutput * output,
         output->set_status(buf.substr(1));
 
         if (!transaction_mode_ && cmd==MULTI)
+        {
           transaction_mode_ = true;
+          queued_commands_.clear();
+        }
         else if (transaction_mode_ && cmd==DISCARD)
           transaction_mode_ = false;
+        else if (transaction_mode_ && &command->out==output)
+          queued_commands_.push_back(cmd);
 
         return true;
       }
@@ -430,6 +864,13 @@ bool RedisProtocol::__read_reply(RedisCommand * command, RedisOutput * output,
         std::string * out_bulk;
         if (read_bulk_2(buf, &bulk, &out_bulk))
         {
+          if (out_bulk && !decompress_values(command, out_bulk))
+          {
+            // no need to disconnect, the reply is read
+            output->set_error(error_);
+            return false;
+          }
+
           if (out_bulk)
             output->set_bulk(*out_bulk);
           else// nil
@@ -459,6 +900,13 @@ bool RedisProtocol::__read_reply(RedisCommand * command, RedisOutput * output,
         mbulk_t * out_mbulks;
         if (read_multi_bulk_2(buf, &mbulks, &out_mbulks))
         {
+          if (out_mbulks && !decompress_values(command, out_mbulks))
+          {
+            clear_mbulks(out_mbulks);
+            output->set_error(error_);
+            return false;
+          }
+
           if (out_mbulks)
             output->set_mbulks(out_mbulks);
           else// nil
@@ -509,8 +957,19 @@ bool RedisProtocol::__read_reply(RedisCommand * command, RedisOutput * output,
         }
 
         if (transaction_mode_ && cmd==EXEC && &command->out==output)
+        {
           transaction_mode_ = false;
 
+          std::vector<kCommand> queued;
+          queued.swap(queued_commands_);
+          if (!decompress_values(command, queued, output))
+          {
+            // no need to disconnect, the reply is read
+            output->set_error(error_);
+            return false;
+          }
+        }
+
         return true;
       }
     default:
@@ -524,14 +983,201 @@ bool RedisProtocol::__read_reply(RedisCommand * command, RedisOutput * output,
   return false;
 }
 
+bool RedisProtocol::read_multi_bulk_visit(RedisCommand * command, ReplyVisitor * visitor)
+{
+  std::string header;
+  RedisOutput * output = &command->out;
+  if (!read_line(&header))
+  {
+    output->set_error(error_);
+    return false;
+  }
+  assert(!header.empty());
+
+  switch (header[0])
+  {
+    case '-':
+      // no need to disconnect
+      error_ = header.substr(1);
+      output->set_error(error_);
+      return false;
+
+    case '+':
+      if (transaction_mode_)
+      {
+        // QUEUED
+        output->set_status(header.substr(1));
+        queued_commands_.push_back(command->in.command());
+        return true;
+      }
+      break;
+
+    case '*':
+      {
+        int64_t size;
+        if (!parse_integer(header, &size) || size<-1)
+        {
+          close();
+          error_ = str(boost::format("read %s:%s failed, integer error : %s")
+              % host_ % port_ % header);
+          output->set_error(error_);
+          return false;
+        }
+
+        visitor->on_size(size);
+
+        // one element at a time
+        bool visiting = true;
+        bool corrupt = false;
+        kValueReply values = compression_.decompress
+          ? value_reply(command->in.command()) : kNoValue;
+        std::string bulk;
+        for (int64_t i=0; i<size; i++)
+        {
+          if (!read_line(&header))
+          {
+            output->set_error(error_);
+            return false;
+          }
+
+          std::string * out_bulk;
+          if (header[0]!='$')
+          {
+            close();
+            error_ = str(boost::format("read %s:%s failed, reply type error $")
+                % host_ % port_);
+            output->set_error(error_);
+            return false;
+          }
+
+          if (!read_bulk_2(header, &bulk, &out_bulk))
+          {
+            output->set_error(error_);
+            return false;
+          }
+
+          if (out_bulk && visiting && (values==kAllValues || (values==kOddValues && (i & 1)))
+              && !decompress_values(command, out_bulk))
+          {
+            // the rest is still read
+            visiting = false;
+            corrupt = true;
+          }
+
+          if (visiting)
+            visiting = visitor->on_element(i, out_bulk);
+        }
+
+        if (corrupt)
+        {
+          output->set_error(error_);
+          return false;
+        }
+
+        mbulk_t mbulks;
+        output->set_mbulks(&mbulks);
+        return true;
+      }
+
+    default:
+      break;
+  }
+
+  close();
+  error_ = str(boost::format("read %s:%s failed, reply type error %c")
+      % host_ % port_ % header[0]);
+  output->set_error(error_);
+  return false;
+}
+
+bool RedisProtocol::read_bulk_to(RedisCommand * command, BulkSink * sink)
+{
+  std::string header;
+  RedisOutput * output = &command->out;
+  if (!read_line(&header))
+  {
+    output->set_error(error_);
+    return false;
+  }
+  assert(!header.empty());
+
+  switch (header[0])
+  {
+    case '-':
+      // no need to disconnect
+      error_ = header.substr(1);
+      output->set_error(error_);
+      return false;
+
+    case '+':
+      if (transaction_mode_)
+      {
+        // QUEUED
+        output->set_status(header.substr(1));
+        queued_commands_.push_back(command->in.command());
+        return true;
+      }
+      break;
+
+    case '$':
+      {
+        int64_t size;
+        if (!parse_integer(header, &size) || size<-1)
+        {
+          close();
+          error_ = str(boost::format("read %s:%s failed, integer error : %s")
+              % host_ % port_ % header);
+          output->set_error(error_);
+          return false;
+        }
+
+        if (size>0 && compression_.decompress
+            && value_reply(command->in.command())!=kNoValue)
+          return read_decompressed_to(command, static_cast<size_t>(size), sink);
+
+        sink->on_size(size);
+        if (size==-1)
+        {
+          output->set_nil_bulk();
+          return true;
+        }
+
+        int ec;
+        transport_->read_to(static_cast<size_t>(size), s_redis_line_end, sink,
+            io_timeout(true), &ec);
+        if (ec)
+        {
+          call_ec_ = ec;
+          close();
+          error_ = str(boost::format("read %s:%s failed, %s")
+              % host_ % port_ % ec_2_string(ec));
+          output->set_error(error_);
+          return false;
+        }
+
+        output->set_bulk(std::string());
+        return true;
+      }
+
+    default:
+      break;
+  }
+
+  close();
+  error_ = str(boost::format("read %s:%s failed, reply type error %c")
+      % host_ % port_ % header[0]);
+  output->set_error(error_);
+  return false;
+}
+
 bool RedisProtocol::read_line(std::string * line)
 {
   int ec;
-  *line = tcp_client_->read_line(s_redis_line_end,
-      blocking_mode_?(-1):timeout_, &ec);
+  *line = transport_->read_line(s_redis_line_end, io_timeout(true), &ec);
 
   if (ec)
   {
+    call_ec_ = ec;
     close();
     error_ = str(boost::format("read %s:%s failed, %s")
         % host_ % port_ % ec_2_string(ec));
@@ -551,11 +1197,11 @@ bool RedisProtocol::read_line(std::string * line)
 bool RedisProtocol::read(size_t count, std::string * line)
 {
   int ec;
-  *line = tcp_client_->read(count, s_redis_line_end,
-      blocking_mode_?(-1):timeout_, &ec);
+  *line = transport_->read(count, s_redis_line_end, io_timeout(true), &ec);
 
   if (ec)
   {
+    call_ec_ = ec;
     close();
     error_ = str(boost::format("read %s:%s failed, %s")
         % host_ % port_ % ec_2_string(ec));
@@ -698,16 +1344,131 @@ bool RedisProtocol::read_bulk(std::string ** bulk)
   }
 }
 
-bool RedisProtocol::parse_integer(const std::string& line, int64_t * i)
+bool RedisProtocol::read_decompressed_to(RedisCommand * command, size_t size, BulkSink * sink)
 {
-  assert(!line.empty());
+  RedisOutput * output = &command->out;
+  std::string bulk;
+  if (!read(size, &bulk))
+  {
+    output->set_error(error_);
+    return false;
+  }
 
-  *i = strtol(line.c_str()+1, NULL, 10);
-  if (errno==EINVAL || errno==ERANGE)
+  if (bulk.size()!=size)
+  {
+    close();
+    error_ = str(boost::format("read %s:%s failed, unexpected reply %s")
+        % host_ % port_ % bulk);
+    output->set_error(error_);
     return false;
+  }
+
+  if (!decompress_values(command, &bulk))
+  {
+    // no need to disconnect, the reply is read
+    output->set_error(error_);
+    return false;
+  }
+
+  sink->on_size(static_cast<int64_t>(bulk.size()));
+  if (!sink->on_data(bulk.data(), bulk.size()))
+  {
+    call_ec_ = ECANCELED;
+    close();
+    error_ = str(boost::format("read %s:%s failed, %s")
+        % host_ % port_ % ec_2_string(ECANCELED));
+    output->set_error(error_);
+    return false;
+  }
+
+  output->set_bulk(std::string());
+  return true;
+}
+
+bool RedisProtocol::decompress_values(const RedisCommand * command, std::string * bulk)
+{
+  if (!compression_.decompress || value_reply(command->in.command())==kNoValue)
+    return true;
+
+  return decompress_bulk(command, bulk);
+}
+
+bool RedisProtocol::decompress_bulk(const RedisCommand * command, std::string * bulk)
+{
+  std::string raw;
+  int ret = decode_value(*bulk, &raw);
+  if (ret==-1)
+  {
+    error_ = str(boost::format("decompress the reply of %s from %s:%s failed")
+        % command->in.command_info().command_str % host_ % port_);
+    return false;
+  }
+
+  if (ret==1)
+    bulk->swap(raw);
   return true;
 }
 
+bool RedisProtocol::decompress_values(const RedisCommand * command, mbulk_t * mbulks)
+{
+  kValueReply values = compression_.decompress ? value_reply(command->in.command()) : kNoValue;
+  if (values==kNoValue)
+    return true;
+
+  for (size_t i=(values==kOddValues ? 1 : 0); i<mbulks->size(); i+=(values==kOddValues ? 2 : 1))
+  {
+    if ((*mbulks)[i] && !decompress_values(command, (*mbulks)[i]))
+      return false;
+  }
+  return true;
+}
+
+bool RedisProtocol::decompress_values(const RedisCommand * command,
+    const std::vector<kCommand>& queued, RedisOutput * output)
+{
+  smbulk_t * replies = output->ptr.smbulks;
+  if (!compression_.decompress || replies==NULL || replies->size()!=queued.size())
+    return true;
+
+  for (size_t i=0; i<replies->size(); i++)
+  {
+    RedisOutput * reply = (*replies)[i];
+    kValueReply values = value_reply(queued[i]);
+    if (values==kBulkValue && reply->is_bulk() && reply->ptr.bulk)
+    {
+      std::string bulk = *reply->ptr.bulk;
+      if (!decompress_bulk(command, &bulk))
+        return false;
+      reply->set_bulk(bulk);
+    }
+    else if ((values==kAllValues || values==kOddValues)
+        && reply->reply_type==kSpecialMultiBulk && reply->ptr.smbulks)
+    {
+      // the elements of a multi-bulk in EXEC are outputs too
+      smbulk_t& elements = *reply->ptr.smbulks;
+      for (size_t j=(values==kOddValues ? 1 : 0); j<elements.size(); j+=(values==kOddValues ? 2 : 1))
+      {
+        if (!elements[j]->is_bulk() || elements[j]->ptr.bulk==NULL)
+          continue;
+
+        std::string bulk = *elements[j]->ptr.bulk;
+        if (!decompress_bulk(command, &bulk))
+          return false;
+        elements[j]->set_bulk(bulk);
+      }
+    }
+  }
+  return true;
+}
+
+bool RedisProtocol::parse_integer(const std::string& line, int64_t * i)
+{
+  assert(!line.empty());
+
+  // skip the type byte
+  return parse_int64(line.data() + 1, line.data() + line.size(), i);
+}
+
 bool RedisProtocol::check_argc(RedisCommand * command, int given_argc)
 {
   bool err = false;
@@ -9,17 +9,26 @@
 #define _LANGTAOJIN_LIBREDIS_REDIS_PROTOCOL_H_
 
 #include "redis_cmd.h"
+#include "redis_transport.h"
+#include "value_codec.h"
 
 LIBREDIS_NAMESPACE_BEGIN
 
-class TcpClient;
+class LatencyHistogram;
+class NearCache;
 
 class RedisProtocol
 {
   public:
     // all 'timeout' are in milliseconds
-    // 'timeout' is used for TCP connecting, sending and receiving
-    RedisProtocol(const std::string& host, const std::string& port, int timeout);
+    // 'timeout' bounds connecting, and every call(writing a command
+    // and reading its whole reply) unless a command budget or a deadline is set
+    // 'transport' is owned by RedisProtocol, NULL means a TcpClient
+    RedisProtocol(const std::string& host, const std::string& port, int timeout,
+        RedisTransport * transport = NULL);
+    // a TcpClient with 'options'
+    RedisProtocol(const std::string& host, const std::string& port, int timeout,
+        const SocketOptions& options);
     ~RedisProtocol();
 
     // 'status' is optional
@@ -33,6 +42,8 @@ class RedisProtocol
     bool is_open()const;
     bool check_connect();
 
+    SocketStats get_socket_stats()const;
+
     std::string get_host()const
     {
       return host_;
@@ -73,18 +84,75 @@ class RedisProtocol
       return transaction_mode_;
     }
 
+    // see RedisBase2::set_deadline
+    void set_deadline(int64_t deadline)
+    {
+      deadline_ = deadline;
+    }
+
+    // see RedisBase2::set_compression
+    void set_compression(const CompressionOptions& options)
+    {
+      compression_ = options;
+    }
+
+    CompressionOptions get_compression()const
+    {
+      return compression_;
+    }
+
+    // see RedisBase2::set_near_cache
+    void set_near_cache(NearCache * near_cache)
+    {
+      near_cache_ = near_cache;
+    }
+
+    NearCache * get_near_cache()const
+    {
+      return near_cache_;
+    }
+
+    // the index of the db selected, "0" after connecting
+    const std::string& get_db()const
+    {
+      return db_;
+    }
+
+    int64_t get_deadline()const
+    {
+      return deadline_;
+    }
+
     // execute 'command'
     bool exec_command(RedisCommand * command);
     // execute 'command' with 'format' and 'ap'
     // NOTICE: format string is textual without spaces,
     // binary data or string with spaces does not work!!!
+    // cmd() below does.
     bool exec_commandv(RedisCommand * command, const char * format, va_list ap);
     bool exec_command(RedisCommand * command, const char * format, ...);
 
-    // execute 'commands' in pipeline mode: write all and read all
+    // rp.cmd(&command, "SETEX", key, 10, value), see LIBREDIS_CMD_OVERLOADS
+    LIBREDIS_CMD_OVERLOADS(exec_cmd)
+
+    // execute 'command' whose reply is a multi-bulk,
+    // its elements go to 'visitor' and 'command->out' is left an empty multi-bulk
+    bool exec_command(RedisCommand * command, ReplyVisitor * visitor);
+
+    // execute 'command' whose reply is a bulk, it goes to 'sink' piece by piece
+    // and 'command->out' is left an empty bulk(or a nil bulk)
+    bool exec_command(RedisCommand * command, BulkSink * sink);
+
+    // execute 'command' with one more argument, the last one, written from 'source'
+    bool exec_command(RedisCommand * command, BulkSource * source);
+
+    // execute 'commands' in pipeline mode: write all in one write and read all
+    // return false, the first error is in 'last_error()',
+    // commands replying errors have them in 'out', the others have their replies
     bool exec_pipeline(redis_command_vector_t * commands);
 
     // like exec_command(v), but only write command to redis server
+    // arguments of 64KB or more are written from 'command' as they are, not copied
     bool write_command(RedisCommand * command);
     bool write_commandv(RedisCommand * command, const char * format, va_list ap);
     bool write_command(RedisCommand * command, const char * format, ...);
@@ -94,7 +162,39 @@ class RedisProtocol
     bool read(size_t count, std::string * line);
 
   private:
+    // the budget of 'command_class' in milliseconds, -1 means to block
+    int call_budget(kCommandClass command_class)const;
+    // A call(a command or a pipeline) runs until 'call_deadline_':
+    // 'deadline_' if it is set, or 'budget' from now.
+    // Its latency is recorded into 'latency' if it is not NULL.
+    // return true, a call begins, end it with end_call
+    // return false, it is inside a running call
+    bool begin_call(int budget, LatencyHistogram * latency);
+    // begin_call for exec_command, with an adaptive budget if it is enabled
+    bool begin_command(kCommandClass command_class);
+    void end_call(bool began, bool ok);
+    // the timeout of the next write or read
+    int io_timeout(bool reading)const;
+    // fail a write that can not finish before the deadline
+    bool check_deadline(RedisCommand * command);
+    bool write_request(const std::string& request, RedisCommand * command);
+    // (offset in the request, argument) of arguments written as they are
+    typedef std::vector<std::pair<size_t, const std::string *> > direct_args_t;
+    // append the request of 'command' to '*request',
+    // with 'direct', large arguments are left out and go to it,
+    // with 'source', it is the last argument, only its header is appended
+    bool encode_command(RedisCommand * command, std::string * request,
+        direct_args_t * direct = NULL, BulkSource * source = NULL);
+    bool write_command(RedisCommand * command, BulkSource * source);
+    // execute 'command' assigned by cmd()
+    bool exec_cmd(RedisCommand * command, const std::string& name);
+
+    bool __exec_pipeline(redis_command_vector_t * commands);
     bool __read_reply(RedisCommand * command, RedisOutput * output, bool check_reply_type);
+    bool read_multi_bulk_visit(RedisCommand * command, ReplyVisitor * visitor);
+    bool read_bulk_to(RedisCommand * command, BulkSink * sink);
+    // read a value bulk of 'size' bytes, and give it to 'sink' decompressed
+    bool read_decompressed_to(RedisCommand * command, size_t size, BulkSink * sink);
     // _2 means part 2
     // In part 1 we invoke read_line to read the first line.
     // In part 2 we pass the header by.
@@ -104,6 +204,23 @@ class RedisProtocol
     // '*bulk' is out on heap or NULL (nil object).
     bool read_bulk(std::string ** bulk);
 
+    // decompress the tagged values in the reply of 'command'(see CompressionOptions)
+    // return false, one is corrupt
+    bool decompress_values(const RedisCommand * command, std::string * bulk);
+    bool decompress_values(const RedisCommand * command, mbulk_t * mbulks);
+    // the replies in 'output' of EXEC('command'), by the 'queued' commands
+    bool decompress_values(const RedisCommand * command,
+        const std::vector<kCommand>& queued, RedisOutput * output);
+    bool decompress_bulk(const RedisCommand * command, std::string * bulk);
+
+    // execute a read shared by concurrent identical ones(see set_read_coalescing)
+    bool exec_coalesced(RedisCommand * command);
+    // invalidate cached(NearCache) and in-flight(SingleFlight) reads of the keys
+    // 'command' writes, those of a transaction again when it is executed
+    void invalidate_reads(const RedisCommand * command);
+    // invalidate_reads() of 'commands' from 'from', whose replies are not read
+    void invalidate_unread(const redis_command_vector_t * commands, size_t from);
+
     static bool parse_integer(const std::string& line, int64_t * i);
 
     bool check_argc(RedisCommand * command, int given_argc);
@@ -112,9 +229,19 @@ class RedisProtocol
     const std::string host_;
     const std::string port_;
     std::string error_;
-    TcpClient * tcp_client_;
+    RedisTransport * transport_;
     int timeout_;
 
+    int64_t deadline_;
+    int64_t call_deadline_;
+    bool in_call_;
+
+    // adaptive budgets(see set_adaptive_timeout)
+    int64_t call_begin_us_;
+    LatencyHistogram * call_latency_;
+    int call_ec_;
+    LatencyHistogram * latencies_[kCommandClassMax];
+
     // Commands like BLPOP,SUBSCRIBE may block clients,
     // so in reading operations 'timeout_' is not used.
     bool blocking_mode_;
@@ -123,6 +250,19 @@ class RedisProtocol
     // After DISCARD or EXEC, set 'transaction_mode_' false
     // In transaction mode, common commands' replies are status code.
     bool transaction_mode_;
+
+    CompressionOptions compression_;
+    // the commands queued in the transaction, their replies in EXEC are decompressed by them
+    std::vector<kCommand> queued_commands_;
+
+    NearCache * near_cache_;
+    // keys written by the queued commands of the transaction
+    string_vector_t queued_keys_;
+    // one of them writes any keys
+    bool queued_all_;
+
+    // the selected db
+    std::string db_;
 };
 
 LIBREDIS_NAMESPACE_END
@@ -0,0 +1,647 @@
+/** @file
+ * @brief RedisRuntime : a thread-per-core shared-nothing client runtime
+ * @author yafei.zhang@langtaojin.com
+ * @date
+ * @version
+ *
+ */
+#include "redis_runtime.h"
+#include "redis.h"
+#include "fanout_executor.h"
+#include <assert.h>
+#include <boost/algorithm/string.hpp>
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/foreach.hpp>
+#include <boost/format.hpp>
+#include <boost/lockfree/spsc_queue.hpp>
+#include <boost/thread.hpp>
+
+LIBREDIS_NAMESPACE_BEGIN
+
+namespace
+{
+  enum
+  {
+    // loop iterations without work before a core parks itself
+    kSpinLoops = 64,
+    // a parked core wakes up at least every kParkTimeout ms
+    kParkTimeout = 10
+  };
+
+  struct RuntimeTask
+  {
+    // NULL means a plain task
+    RedisCommand * command;
+    RedisRuntime::callback_t callback;
+    RedisRuntime::task_t task;
+
+    RuntimeTask() : command(NULL) {}
+  };
+
+  typedef boost::lockfree::spsc_queue<RuntimeTask *> task_queue_t;
+  typedef std::vector<RuntimeTask *> task_vector_t;
+
+  struct SyncWaiter
+  {
+    boost::mutex lock;
+    boost::condition_variable cond;
+    bool done;
+    bool ok;
+
+    SyncWaiter() : done(false), ok(false) {}
+
+    void on_done(RedisCommand * /* command */, bool _ok)
+    {
+      boost::mutex::scoped_lock guard(lock);
+      ok = _ok;
+      done = true;
+      cond.notify_one();
+    }
+
+    bool wait()
+    {
+      boost::mutex::scoped_lock guard(lock);
+      while (!done)
+        cond.wait(guard);
+      return ok;
+    }
+  };
+
+  inline const std::string * first_arg(const RedisCommand * command)
+  {
+    if (command->args().empty())
+      return NULL;
+    return &command->args()[0];
+  }
+
+  void fail_task(RuntimeTask * t, const std::string& error)
+  {
+    if (t->command)
+    {
+      t->command->out.set_error(error);
+      if (t->callback)
+        t->callback(t->command, false);
+    }
+    delete t;
+  }
+
+  /************************************************************************/
+  /*RuntimeCore*/
+  /************************************************************************/
+  class RuntimeCore
+  {
+    private:
+      const void * const owner_;
+      const size_t index_;
+      const key_hasher hash_fn_;
+
+      // inbound_[i] is fed by core i only,
+      // inbound_[cores] is the external lane guarded by 'external_lock_'
+      std::vector<task_queue_t *> inbound_;
+      boost::mutex external_lock_;
+
+      // touched by the core thread only
+      redis2_sp_vector_t shards_;
+      std::vector<task_vector_t> pending_;
+      task_vector_t ready_;
+
+      boost::atomic<bool> stop_;
+      // set when the core thread stops taking tasks,
+      // pushes in progress are counted by 'pushers_' and drained before it exits
+      boost::atomic<bool> closed_;
+      boost::atomic<size_t> pushers_;
+      boost::atomic<bool> parked_;
+      boost::mutex park_lock_;
+      boost::condition_variable park_cond_;
+      boost::thread thread_;
+
+      static __thread RuntimeCore * current_;
+
+      bool drain();
+      void run_ready();
+      bool flush_pending();
+      void park();
+      void fail_all(const std::string& error);
+      void close();
+      void run();
+
+    public:
+      RuntimeCore(const void * owner, size_t index, size_t cores, size_t queue_size,
+          const string_vector_t& hosts, const string_vector_t& ports,
+          int db_index, int timeout_ms, key_hasher fn);
+      ~RuntimeCore();
+
+      static RuntimeCore * current()
+      {
+        return current_;
+      }
+
+      const void * owner()const
+      {
+        return owner_;
+      }
+
+      size_t index()const
+      {
+        return index_;
+      }
+
+      size_t shard_of(const RedisCommand * command)const
+      {
+        const std::string * key = first_arg(command);
+        if (key==NULL)
+          return 0;
+        return static_cast<size_t>(hash_fn_(*key)) % shards_.size();
+      }
+
+      void start();
+      void stop();
+
+      // called from any thread, 'lane' is the source core or the external lane
+      // return false, the core is stopped, 't' is not taken
+      bool push(size_t lane, RuntimeTask * t);
+      // called from the core thread only
+      void push_local(RuntimeTask * t);
+      bool exec_local(RedisCommand * command);
+  };
+
+  __thread RuntimeCore * RuntimeCore::current_ = NULL;
+
+  RuntimeCore::RuntimeCore(const void * owner, size_t index, size_t cores, size_t queue_size,
+      const string_vector_t& hosts, const string_vector_t& ports,
+      int db_index, int timeout_ms, key_hasher fn)
+    : owner_(owner), index_(index), hash_fn_(fn),
+    stop_(false), closed_(false), pushers_(0), parked_(false)
+  {
+    for (size_t i=0; i<=cores; i++)
+      inbound_.push_back(new task_queue_t(queue_size));
+
+    for (size_t i=0; i<hosts.size(); i++)
+    {
+      shards_.push_back(redis2_sp_t(
+            new Redis2(hosts[i], ports[i], db_index, timeout_ms)));
+    }
+    pending_.resize(shards_.size());
+  }
+
+  RuntimeCore::~RuntimeCore()
+  {
+    stop();
+    BOOST_FOREACH(task_queue_t * q, inbound_)
+    {
+      delete q;
+    }
+  }
+
+  void RuntimeCore::start()
+  {
+    thread_ = boost::thread(boost::bind(&RuntimeCore::run, this));
+  }
+
+  void RuntimeCore::stop()
+  {
+    if (!thread_.joinable())
+      return;
+
+    stop_ = true;
+    {
+      boost::mutex::scoped_lock guard(park_lock_);
+      park_cond_.notify_one();
+    }
+    thread_.join();
+  }
+
+  bool RuntimeCore::push(size_t lane, RuntimeTask * t)
+  {
+    assert(lane<inbound_.size());
+
+    pushers_++;
+    if (closed_)
+    {
+      pushers_--;
+      return false;
+    }
+
+    if (lane==inbound_.size() - 1)
+    {
+      boost::mutex::scoped_lock guard(external_lock_);
+      while (!inbound_[lane]->push(t))
+        boost::this_thread::yield();
+    }
+    else
+    {
+      while (!inbound_[lane]->push(t))
+        boost::this_thread::yield();
+    }
+
+    pushers_--;
+
+    if (parked_)
+    {
+      boost::mutex::scoped_lock guard(park_lock_);
+      park_cond_.notify_one();
+    }
+    return true;
+  }
+
+  void RuntimeCore::push_local(RuntimeTask * t)
+  {
+    assert(current_==this);
+
+    if (t->command)
+      pending_[shard_of(t->command)].push_back(t);
+    else
+      ready_.push_back(t);
+  }
+
+  bool RuntimeCore::exec_local(RedisCommand * command)
+  {
+    assert(current_==this);
+    return shards_[shard_of(command)]->exec_command(command);
+  }
+
+  bool RuntimeCore::drain()
+  {
+    bool got = false;
+    RuntimeTask * t;
+
+    BOOST_FOREACH(task_queue_t * q, inbound_)
+    {
+      while (q->pop(t))
+      {
+        push_local(t);
+        got = true;
+      }
+    }
+    return got;
+  }
+
+  void RuntimeCore::run_ready()
+  {
+    // tasks may post or submit more, which land in the next iteration
+    task_vector_t ready;
+    ready.swap(ready_);
+
+    BOOST_FOREACH(RuntimeTask * t, ready)
+    {
+      if (t->task)
+        t->task();
+      delete t;
+    }
+  }
+
+  bool RuntimeCore::flush_pending()
+  {
+    std::vector<task_vector_t> tasks(pending_.size());
+    std::vector<redis_command_vector_t> commands(pending_.size());
+    std::vector<char> rets(pending_.size(), 0);
+    std::vector<FanoutExecutor::task_t> pipelines;
+    size_t_vector_t index_v;
+
+    for (size_t i=0; i<pending_.size(); i++)
+    {
+      if (pending_[i].empty())
+        continue;
+
+      tasks[i].swap(pending_[i]);
+      commands[i].reserve(tasks[i].size());
+      BOOST_FOREACH(RuntimeTask * t, tasks[i])
+      {
+        // reset the reply, so that unanswered commands can be told apart
+        RedisOutput empty;
+        t->command->out.swap(empty);
+        commands[i].push_back(t->command);
+      }
+      pipelines.push_back(store_result(boost::bind(&Redis2::exec_pipeline,
+              shards_[i].get(), &commands[i]), &rets[i]));
+      index_v.push_back(i);
+    }
+
+    if (index_v.empty())
+      return false;
+
+    // shards are written and read concurrently, one round trip in all
+    FanoutExecutor::run(pipelines);
+
+    BOOST_FOREACH(size_t i, index_v)
+    {
+      if (!rets[i])
+      {
+        Redis2& shard = *shards_[i];
+        // replies after the failed one may still be on the wire
+        shard.close();
+        std::string error = str(boost::format("[%s:%s] %s")
+            % shard.get_host() % shard.get_port() % shard.last_error());
+        BOOST_FOREACH(RedisCommand * command, commands[i])
+        {
+          if (command->out.reply_type==kNone)
+            command->out.set_error(error);
+        }
+      }
+
+      BOOST_FOREACH(RuntimeTask * t, tasks[i])
+      {
+        if (t->callback)
+          t->callback(t->command, !t->command->out.is_error());
+        delete t;
+      }
+    }
+    return true;
+  }
+
+  void RuntimeCore::park()
+  {
+    boost::mutex::scoped_lock guard(park_lock_);
+    parked_ = true;
+
+    // re-check after publishing 'parked_', or a push may be missed
+    bool empty = true;
+    BOOST_FOREACH(task_queue_t * q, inbound_)
+    {
+      if (q->read_available())
+      {
+        empty = false;
+        break;
+      }
+    }
+
+    if (empty && !stop_)
+      park_cond_.timed_wait(guard,
+          boost::posix_time::milliseconds(static_cast<int>(kParkTimeout)));
+    parked_ = false;
+  }
+
+  void RuntimeCore::fail_all(const std::string& error)
+  {
+    (void)drain();
+    BOOST_FOREACH(RuntimeTask * t, ready_)
+    {
+      delete t;
+    }
+    ready_.clear();
+
+    BOOST_FOREACH(task_vector_t& tasks, pending_)
+    {
+      BOOST_FOREACH(RuntimeTask * t, tasks)
+      {
+        fail_task(t, error);
+      }
+      tasks.clear();
+    }
+  }
+
+  void RuntimeCore::close()
+  {
+    closed_ = true;
+
+    // pushes seen in progress may wait for room in a full lane,
+    // so keep draining until none is left, later ones see 'closed_'
+    for (;;)
+    {
+      bool busy = pushers_!=0;
+      fail_all("runtime stopped");
+      if (!busy)
+        break;
+      boost::this_thread::yield();
+    }
+  }
+
+  void RuntimeCore::run()
+  {
+    current_ = this;
+    int idle = 0;
+
+    while (!stop_)
+    {
+      bool got = drain();
+      run_ready();
+      got = flush_pending() || got;
+
+      if (got)
+        idle = 0;
+      else if (++idle<kSpinLoops)
+        boost::this_thread::yield();
+      else
+      {
+        park();
+        idle = 0;
+      }
+    }
+
+    close();
+    current_ = NULL;
+  }
+}
+
+/************************************************************************/
+/*RedisRuntime::Impl*/
+/************************************************************************/
+class RedisRuntime::Impl
+{
+  private:
+    const key_hasher hash_fn_;
+    std::vector<RuntimeCore *> cores_;
+    boost::atomic<bool> stopped_;
+
+    RuntimeCore * current()const
+    {
+      RuntimeCore * core = RuntimeCore::current();
+      if (core && core->owner()==this)
+        return core;
+      return NULL;
+    }
+
+    size_t lane()const
+    {
+      RuntimeCore * core = current();
+      return core ? core->index() : cores_.size();
+    }
+
+  public:
+    Impl(const std::string& host_list, const std::string& port_list,
+        int db_index, int timeout_ms, size_t cores, size_t queue_size, key_hasher fn)
+      : hash_fn_(fn), stopped_(false)
+    {
+      string_vector_t hosts, ports;
+      (void)boost::split(hosts, host_list, boost::is_any_of(","));
+      (void)boost::split(ports, port_list, boost::is_any_of(","));
+
+      if (hosts.size()!=ports.size() && ports.size()!=1)
+      {
+        throw RedisException(str(boost::format(
+                "the number of hosts and ports do not match: %lu vs %lu")
+              % hosts.size() % ports.size()));
+      }
+
+      if (ports.size()==1 && hosts.size()!=1)
+        ports.insert(ports.end(), hosts.size() - 1, ports[0]);
+
+      if (cores==0)
+        cores = boost::thread::hardware_concurrency();
+      if (cores==0)
+        cores = 1;
+
+      if (queue_size==0)
+        throw RedisException("the size of queue must be not zero");
+
+      for (size_t i=0; i<cores; i++)
+      {
+        cores_.push_back(new RuntimeCore(this, i, cores, queue_size,
+              hosts, ports, db_index, timeout_ms, fn));
+      }
+
+      BOOST_FOREACH(RuntimeCore * core, cores_)
+      {
+        core->start();
+      }
+    }
+
+    ~Impl()
+    {
+      stop();
+      BOOST_FOREACH(RuntimeCore * core, cores_)
+      {
+        delete core;
+      }
+    }
+
+    size_t cores()const
+    {
+      return cores_.size();
+    }
+
+    int current_core()const
+    {
+      RuntimeCore * core = current();
+      return core ? static_cast<int>(core->index()) : -1;
+    }
+
+    size_t key_core(const std::string& key)const
+    {
+      return static_cast<size_t>(hash_fn_(key)) % cores_.size();
+    }
+
+    void post(size_t core, const task_t& task)
+    {
+      assert(core<cores_.size());
+
+      RuntimeTask * t = new RuntimeTask;
+      t->task = task;
+
+      if (stopped_)
+      {
+        delete t;
+        return;
+      }
+
+      RuntimeCore * self = current();
+      if (self && self->index()==core)
+        self->push_local(t);
+      else if (!cores_[core]->push(lane(), t))
+        delete t;
+    }
+
+    void submit(RedisCommand * command, const callback_t& callback)
+    {
+      RuntimeTask * t = new RuntimeTask;
+      t->command = command;
+      t->callback = callback;
+
+      if (stopped_)
+      {
+        fail_task(t, "runtime stopped");
+        return;
+      }
+
+      RuntimeCore * self = current();
+      if (self)
+      {
+        self->push_local(t);
+        return;
+      }
+
+      const std::string * key = first_arg(command);
+      size_t core = key ? key_core(*key) : 0;
+      if (!cores_[core]->push(lane(), t))
+        fail_task(t, "runtime stopped");
+    }
+
+    bool exec_command(RedisCommand * command)
+    {
+      RuntimeCore * self = current();
+      if (self)
+        return self->exec_local(command);
+
+      SyncWaiter waiter;
+      submit(command, boost::bind(&SyncWaiter::on_done, &waiter, _1, _2));
+      return waiter.wait();
+    }
+
+    void stop()
+    {
+      stopped_ = true;
+      BOOST_FOREACH(RuntimeCore * core, cores_)
+      {
+        core->stop();
+      }
+    }
+};
+
+/************************************************************************/
+/*RedisRuntime*/
+/************************************************************************/
+RedisRuntime::RedisRuntime(const std::string& host_list,
+    const std::string& port_list,
+    int db_index,
+    int timeout_ms,
+    size_t cores,
+    size_t queue_size,
+    key_hasher fn)
+{
+  impl_ = new Impl(host_list, port_list, db_index, timeout_ms, cores, queue_size, fn);
+}
+
+RedisRuntime::~RedisRuntime()
+{
+  delete impl_;
+}
+
+size_t RedisRuntime::cores()const
+{
+  return impl_->cores();
+}
+
+int RedisRuntime::current_core()const
+{
+  return impl_->current_core();
+}
+
+size_t RedisRuntime::key_core(const std::string& key)const
+{
+  return impl_->key_core(key);
+}
+
+void RedisRuntime::post(size_t core, const task_t& task)
+{
+  impl_->post(core, task);
+}
+
+void RedisRuntime::submit(RedisCommand * command, const callback_t& callback)
+{
+  impl_->submit(command, callback);
+}
+
+bool RedisRuntime::exec_command(RedisCommand * command)
+{
+  if (command==NULL)
+    return false;
+  return impl_->exec_command(command);
+}
+
+void RedisRuntime::stop()
+{
+  impl_->stop();
+}
+
+LIBREDIS_NAMESPACE_END
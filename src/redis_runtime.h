@@ -0,0 +1,84 @@
+/** @file
+ * @brief RedisRuntime : a thread-per-core shared-nothing client runtime
+ * @author yafei.zhang@langtaojin.com
+ * @date
+ * @version
+ *
+ */
+#ifndef _LANGTAOJIN_LIBREDIS_REDIS_RUNTIME_H_
+#define _LANGTAOJIN_LIBREDIS_REDIS_RUNTIME_H_
+
+#include "redis_cmd.h"
+#include <boost/function.hpp>
+
+LIBREDIS_NAMESPACE_BEGIN
+
+/************************************************************************/
+/**
+ * Every core is a thread running an event loop, which owns its own
+ * connections to every shard of 'host_list'. Nothing is shared between cores:
+ * 1.commands submitted on a core are executed by the connections of that core,
+ *   and all commands submitted during one loop iteration to the same shard
+ *   are sent in one pipeline. Pipelines of different shards are executed
+ *   concurrently(see set_fanout_threads), the core waits for all of them.
+ * 2.callbacks and tasks run on the core they were submitted on.
+ * 3.cross-core requests go through SPSC queues, one per (source, target) pair.
+ *   Threads that are not cores share one extra lane per core, which is
+ *   serialized by a mutex.
+ *
+ * Keys are routed like Redis2P with one group: hash(key) % shards.
+ * Commands without arguments go to the first shard.
+ */
+/************************************************************************/
+class RedisRuntime
+{
+  private:
+    class Impl;
+    Impl * impl_;
+
+    RedisRuntime(const RedisRuntime&);
+    RedisRuntime& operator=(const RedisRuntime&);
+
+  public:
+    typedef boost::function<void ()> task_t;
+    // 'ok' is false if the command failed, the error is in 'command->out'
+    typedef boost::function<void (RedisCommand * command, bool ok)> callback_t;
+
+    // 'cores' being zero means the number of hardware threads
+    // 'queue_size' is the capacity of every SPSC queue
+    RedisRuntime(
+        const std::string& host_list,// a host list
+        const std::string& port_list,// a port list matching host_list or only one port
+        int db_index = 0,
+        int timeout_ms = 50,
+        size_t cores = 0,
+        size_t queue_size = 4096,
+        key_hasher fn = time33_hash_32);
+    ~RedisRuntime();
+
+    size_t cores()const;
+    // return the index of the core running the calling thread
+    // return -1, the calling thread is not a core of this runtime
+    int current_core()const;
+    // return the core owning 'key' for callers who want to keep related keys together
+    size_t key_core(const std::string& key)const;
+
+    // run 'task' on 'core'
+    void post(size_t core, const task_t& task);
+
+    // On a core, 'command' is queued on the calling core and 'callback' runs there.
+    // On other threads, 'command' is forwarded to key_core() of its first argument.
+    // 'command' must be alive until 'callback' is invoked.
+    void submit(RedisCommand * command, const callback_t& callback);
+
+    // Synchronous execution like RedisProtocol::exec_command.
+    // On a core it blocks that core's loop, prefer submit() there.
+    bool exec_command(RedisCommand * command);
+
+    // stop all cores, pending commands fail with "runtime stopped"
+    void stop();
+};
+
+LIBREDIS_NAMESPACE_END
+
+#endif// _LANGTAOJIN_LIBREDIS_REDIS_RUNTIME_H_
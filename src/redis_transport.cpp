@@ -0,0 +1,259 @@
+/** @file
+ * @brief redis transports: the byte streams under RedisProtocol
+ * @author yafei.zhang@langtaojin.com
+ * @date
+ * @version
+ *
+ */
+#include "redis_transport.h"
+#include "os.h"
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+
+LIBREDIS_NAMESPACE_BEGIN
+
+namespace
+{
+  enum
+  {
+    kBulkPieceSize = 65536
+  };
+}
+
+/************************************************************************/
+/*sinks and sources*/
+/************************************************************************/
+bool FdSink::on_data(const char * data, size_t size)
+{
+  while (size)
+  {
+    ssize_t ret = ::write(fd_, data, size);
+    if (ret==-1 && errno==EINTR)
+      continue;
+    if (ret<=0)
+      return false;
+
+    data += ret;
+    size -= static_cast<size_t>(ret);
+  }
+  return true;
+}
+
+ssize_t MemorySource::read(char * buf, size_t size)
+{
+  size = std::min(size, size_ - offset_);
+  ::memcpy(buf, data_ + offset_, size);
+  offset_ += size;
+  return static_cast<ssize_t>(size);
+}
+
+ssize_t FdSource::read(char * buf, size_t size)
+{
+  size = std::min(size, size_ - read_);
+  ssize_t ret;
+  do ret = ::pread(fd_, buf, size, offset_ + static_cast<off_t>(read_));
+  while (ret==-1 && errno==EINTR);
+
+  if (ret>0)
+    read_ += static_cast<size_t>(ret);
+  return ret;
+}
+
+/************************************************************************/
+/*RedisTransport*/
+/************************************************************************/
+void RedisTransport::read_to(size_t size,
+    const std::string& delim,
+    BulkSink * sink,
+    int timeout,
+    int * ec)
+{
+  // 'timeout' bounds the whole read
+  const int64_t deadline = deadline_of(timeout);
+  std::string piece;
+
+  while (size)
+  {
+    piece = read(std::min(size, static_cast<size_t>(kBulkPieceSize)), "",
+        timeout_of(deadline), ec);
+    if (*ec)
+      return;
+
+    if (!sink->on_data(piece.data(), piece.size()))
+    {
+      *ec = ECANCELED;
+      close();
+      return;
+    }
+    size -= piece.size();
+  }
+
+  (void)read(0, delim, timeout_of(deadline), ec);
+}
+
+void RedisTransport::write_from(BulkSource * source,
+    int timeout,
+    int * ec)
+{
+  const int64_t deadline = deadline_of(timeout);
+  std::string piece;
+  size_t size = source->size();
+
+  *ec = 0;
+  while (size)
+  {
+    piece.resize(std::min(size, static_cast<size_t>(kBulkPieceSize)));
+    ssize_t count = source->read(&piece[0], piece.size());
+    if (count<=0)
+    {
+      *ec = (count==0 || errno==0) ? EIO : errno;
+      close();
+      return;
+    }
+
+    piece.resize(static_cast<size_t>(count));
+    write(piece, timeout_of(deadline), ec);
+    if (*ec)
+      return;
+    size -= piece.size();
+  }
+}
+
+/************************************************************************/
+/*MemoryTransport*/
+/************************************************************************/
+MemoryTransport::MemoryTransport(const std::string& replies, bool loop)
+: replies_(replies), offset_(0), loop_(loop), open_(false),
+  capture_(false), written_bytes_(0), writes_(0),
+  connect_error_(0), connects_(0), read_delay_ms_(0) {}
+
+MemoryTransport::~MemoryTransport() {}
+
+bool MemoryTransport::prepare(size_t size)
+{
+  if (offset_==replies_.size() && loop_)
+    offset_ = 0;
+
+  return replies_.size() - offset_>=size;
+}
+
+bool MemoryTransport::delay(int timeout, int * ec)
+{
+  if (read_delay_ms_<=0)
+    return true;
+
+  if (timeout>=0 && timeout<read_delay_ms_)
+  {
+    ::usleep(static_cast<useconds_t>(timeout) * 1000);
+    *ec = ETIMEDOUT;
+    close();
+    return false;
+  }
+
+  ::usleep(static_cast<useconds_t>(read_delay_ms_) * 1000);
+  return true;
+}
+
+void MemoryTransport::connect(const std::string& ip_or_host,
+    const std::string& port_or_service,
+    int timeout,
+    int * ec)
+{
+  (void)ip_or_host;
+  (void)port_or_service;
+  (void)timeout;
+  close();
+  connects_++;
+  *ec = connect_error_;
+  open_ = connect_error_==0;
+}
+
+void MemoryTransport::write(const std::string& line,
+    int timeout,
+    int * ec)
+{
+  (void)timeout;
+  if (!open_)
+  {
+    *ec = ENOTCONN;
+    return;
+  }
+
+  if (capture_)
+    written_.append(line);
+  written_bytes_ += line.size();
+  writes_++;
+  *ec = 0;
+}
+
+std::string MemoryTransport::read(size_t size,
+    const std::string& delim,
+    int timeout,
+    int * ec)
+{
+  const size_t expect = size + delim.size();
+
+  if (open_ && !delay(timeout, ec))
+    return std::string();
+
+  if (!open_ || !prepare(expect))
+  {
+    *ec = open_ ? ENODATA : ENOTCONN;
+    close();
+    return std::string();
+  }
+
+  std::string line(replies_, offset_, size);
+  offset_ += expect;
+  *ec = 0;
+  return line;
+}
+
+std::string MemoryTransport::read_line(const std::string& delim,
+    int timeout,
+    int * ec)
+{
+  size_t pos;
+
+  if (open_ && !delay(timeout, ec))
+    return std::string();
+
+  if (!open_ || !prepare(1)
+      || (pos = replies_.find(delim, offset_))==std::string::npos)
+  {
+    *ec = open_ ? ENODATA : ENOTCONN;
+    close();
+    return std::string();
+  }
+
+  std::string line(replies_, offset_, pos - offset_);
+  offset_ = pos + delim.size();
+  *ec = 0;
+  return line;
+}
+
+void MemoryTransport::close()
+{
+  open_ = false;
+  offset_ = 0;
+}
+
+bool MemoryTransport::is_open()const
+{
+  return open_;
+}
+
+bool MemoryTransport::available()const
+{
+  return open_ && (offset_<replies_.size() || (loop_ && !replies_.empty()));
+}
+
+void MemoryTransport::reset(const std::string& replies)
+{
+  replies_ = replies;
+  offset_ = 0;
+}
+
+LIBREDIS_NAMESPACE_END
@@ -0,0 +1,459 @@
+/** @file
+ * @brief redis transports: the byte streams under RedisProtocol
+ * @author yafei.zhang@langtaojin.com
+ * @date
+ * @version
+ *
+ */
+#ifndef _LANGTAOJIN_LIBREDIS_REDIS_TRANSPORT_H_
+#define _LANGTAOJIN_LIBREDIS_REDIS_TRANSPORT_H_
+
+#include "redis_common.h"
+#include <sys/types.h>
+#include <boost/function.hpp>
+
+LIBREDIS_NAMESPACE_BEGIN
+
+enum kIoBackend
+{
+  kPollBackend,// poll() and then send() or recv()
+  kUringBackend// io_uring, it falls back to kPollBackend where io_uring is unavailable
+};
+
+// the backend of TcpClients connecting afterwards, kPollBackend by default
+void set_default_io_backend(kIoBackend backend);
+kIoBackend get_default_io_backend();
+
+// Host names are resolved once and cached for 'ttl' seconds(60 by default),
+// failures for 'negative_ttl' seconds(2 by default).
+// Hosts in use are refreshed in the background before they expire,
+// and connections are spread over all of their addresses.
+void set_dns_cache_ttl(int ttl, int negative_ttl);
+void clear_dns_cache();
+
+// After a failed connect, all connections to that host:port back off
+// exponentially from 'base_ms' up to 'max_ms'(100 and 5000 by default) with jitter,
+// and fail fast meanwhile with an error is_backoff_error() recognizes.
+// 'base_ms' being 0 disables it.
+void set_reconnect_backoff(int base_ms, int max_ms);
+bool is_backoff_error(const std::string& err);
+
+/************************************************************************/
+/**
+ * SocketOptions is a per-connection profile for TcpClient,
+ * it can be passed to RedisProtocol, Redis2, Redis2P and RedisTss.
+ * It is applied to every new socket before connecting,
+ * options the platform rejects are ignored.
+ */
+/************************************************************************/
+struct SocketOptions
+{
+  kIoBackend io_backend;
+
+  // TCP only: disable Nagle's algorithm, so small writes are not held back
+  bool tcp_nodelay;
+  // SO_SNDBUF and SO_RCVBUF in bytes, 0 leaves the system defaults
+  int send_buffer;
+  int recv_buffer;
+  // TCP only: kernel keepalive, the others are in seconds and 0 leaves the system defaults
+  bool keepalive;
+  int keepalive_idle;
+  int keepalive_interval;
+  int keepalive_count;
+  // TCP only: TCP_USER_TIMEOUT, how long written data may stay unacknowledged
+  // before the connection is dropped, 0 leaves the system default
+  int user_timeout_ms;
+
+  // busy-poll read mode(kPollBackend only):
+  // spin on a non-blocking recv for 'spin_us' microseconds before poll(),
+  // it trades CPU for the wakeup latency of poll(), 0 disables it
+  int spin_us;
+  // SO_BUSY_POLL in microseconds, 0 leaves it alone,
+  // it is ignored where it is not supported or not permitted
+  int busy_poll_us;
+
+  SocketOptions()
+    : io_backend(get_default_io_backend()),
+    tcp_nodelay(true), send_buffer(0), recv_buffer(0),
+    keepalive(false), keepalive_idle(0), keepalive_interval(0), keepalive_count(0),
+    user_timeout_ms(0),
+    spin_us(0), busy_poll_us(0) {}
+};
+
+// per-connection counters, they survive reconnections
+struct SocketStats
+{
+  uint64_t reads;// reads from the socket
+  uint64_t spin_hits;// reads satisfied while spinning
+  uint64_t spin_misses;// reads falling back to poll() after spinning
+  bool busy_poll;// SO_BUSY_POLL is set on the current socket
+
+  SocketStats()
+    : reads(0), spin_hits(0), spin_misses(0), busy_poll(false) {}
+
+  SocketStats& operator+=(const SocketStats& other)
+  {
+    reads += other.reads;
+    spin_hits += other.spin_hits;
+    spin_misses += other.spin_misses;
+    busy_poll = busy_poll || other.busy_poll;
+    return *this;
+  }
+};
+
+/************************************************************************/
+/**
+ * BulkSink takes a bulk piece by piece as it is read, BulkSource gives one
+ * piece by piece as it is written, so a large value is never held as a whole
+ * (see RedisProtocol::exec_command, Redis2::get and Redis2::set).
+ * Where TcpClient can, bytes move between the socket and their fd() in the kernel:
+ * splice() for a sink and sendfile() for a source.
+ * A sink or a source is used by one call.
+ */
+/************************************************************************/
+class BulkSink
+{
+  public:
+    virtual ~BulkSink() {}
+
+    // the size of the bulk, -1 means nil, called before any data
+    virtual void on_size(int64_t size)
+    {
+      (void)size;
+    }
+
+    // return false, the read fails and the connection is closed
+    virtual bool on_data(const char * data, size_t size) = 0;
+
+    // a file descriptor taking the data instead of on_data(), -1 means none
+    virtual int fd()const
+    {
+      return -1;
+    }
+};
+
+class BulkSource
+{
+  public:
+    virtual ~BulkSource() {}
+
+    virtual size_t size()const = 0;
+
+    // copy the next bytes to 'buf', return the number of them
+    // return 0 or -1, failure, check errno
+    virtual ssize_t read(char * buf, size_t size) = 0;
+
+    // all bytes in memory, NULL means none
+    virtual const char * data()const
+    {
+      return NULL;
+    }
+
+    // a file descriptor and the offset of all bytes in it, -1 means none
+    virtual int fd(off_t * offset)const
+    {
+      (void)offset;
+      return -1;
+    }
+};
+
+// write to 'fd' at its file offset, 'fd' is not closed
+class FdSink : public BulkSink
+{
+  private:
+    const int fd_;
+
+  public:
+    explicit FdSink(int fd) : fd_(fd) {}
+
+    virtual bool on_data(const char * data, size_t size);
+
+    virtual int fd()const
+    {
+      return fd_;
+    }
+};
+
+class CallbackSink : public BulkSink
+{
+  public:
+    // return false, stop reading
+    typedef boost::function<bool (const char * data, size_t size)> callback_t;
+
+  private:
+    callback_t callback_;
+
+  public:
+    explicit CallbackSink(const callback_t& callback) : callback_(callback) {}
+
+    virtual bool on_data(const char * data, size_t size)
+    {
+      return callback_(data, size);
+    }
+};
+
+// 'size' bytes at 'data'(an mmap()ed file for example), they live until written
+class MemorySource : public BulkSource
+{
+  private:
+    const char * const data_;
+    const size_t size_;
+    size_t offset_;
+
+  public:
+    MemorySource(const char * data, size_t size)
+      : data_(data), size_(size), offset_(0) {}
+
+    virtual size_t size()const
+    {
+      return size_;
+    }
+
+    virtual ssize_t read(char * buf, size_t size);
+
+    virtual const char * data()const
+    {
+      return data_;
+    }
+};
+
+// 'size' bytes of 'fd' from 'offset', they are read by pread(),
+// the file offset of 'fd' is not changed and 'fd' is not closed
+class FdSource : public BulkSource
+{
+  private:
+    const int fd_;
+    const off_t offset_;
+    const size_t size_;
+    size_t read_;
+
+  public:
+    FdSource(int fd, off_t offset, size_t size)
+      : fd_(fd), offset_(offset), size_(size), read_(0) {}
+
+    virtual size_t size()const
+    {
+      return size_;
+    }
+
+    virtual ssize_t read(char * buf, size_t size);
+
+    virtual int fd(off_t * offset)const
+    {
+      *offset = offset_;
+      return fd_;
+    }
+};
+
+class CallbackSource : public BulkSource
+{
+  public:
+    // like BulkSource::read
+    typedef boost::function<ssize_t (char * buf, size_t size)> callback_t;
+
+  private:
+    const size_t size_;
+    callback_t callback_;
+
+  public:
+    CallbackSource(size_t size, const callback_t& callback)
+      : size_(size), callback_(callback) {}
+
+    virtual size_t size()const
+    {
+      return size_;
+    }
+
+    virtual ssize_t read(char * buf, size_t size)
+    {
+      return callback_(buf, size);
+    }
+};
+
+/************************************************************************/
+/**
+ * A transport carries RESP bytes for one RedisProtocol(single thread safety).
+ * The default one is TcpClient(TCP and "unix:/path" endpoints).
+ * With kUringBackend, TcpClient holds written bytes until the next read or close,
+ * and sends them with that read in one io_uring submission.
+ *
+ * all 'timeout' are in milliseconds, a negative value means to block
+ * all 'ec' are errno values, 0 means success
+ * a failed operation closes the transport
+ */
+/************************************************************************/
+class RedisTransport
+{
+  public:
+    virtual ~RedisTransport() {}
+
+    virtual void connect(
+        const std::string& ip_or_host,
+        const std::string& port_or_service,
+        int timeout,
+        int * ec) = 0;
+
+    virtual void write(
+        const std::string& line,
+        int timeout,
+        int * ec) = 0;
+
+    // read 'size' bytes followed by 'delim', return the 'size' bytes
+    virtual std::string read(
+        size_t size,
+        const std::string& delim,
+        int timeout,
+        int * ec) = 0;
+
+    // read until 'delim', return the line without 'delim'
+    virtual std::string read_line(
+        const std::string& delim,
+        int timeout,
+        int * ec) = 0;
+
+    // read 'size' bytes followed by 'delim', the 'size' bytes go to 'sink' piece by piece,
+    // the default one reads pieces with read()
+    virtual void read_to(
+        size_t size,
+        const std::string& delim,
+        BulkSink * sink,
+        int timeout,
+        int * ec);
+
+    // write all bytes of 'source', the default one writes pieces with write()
+    virtual void write_from(
+        BulkSource * source,
+        int timeout,
+        int * ec);
+
+    virtual void close() = 0;
+
+    virtual bool is_open()const = 0;
+
+    virtual bool available()const = 0;
+
+    virtual SocketStats get_socket_stats()const
+    {
+      return SocketStats();
+    }
+};
+
+/************************************************************************/
+/**
+ * MemoryTransport does no I/O. Reads replay 'replies', a canned RESP byte stream,
+ * and writes are counted and dropped(or captured).
+ * It is used to measure encoding and parsing alone, and to run network-free tests.
+ *
+ * When 'loop' is true, the stream restarts after its last byte is consumed,
+ * so 'replies' must end on a reply boundary.
+ * When it is false, reading past the end fails with ENODATA.
+ * Closing rewinds the stream.
+ */
+/************************************************************************/
+class MemoryTransport : public RedisTransport
+{
+  private:
+    std::string replies_;
+    size_t offset_;
+    bool loop_;
+    bool open_;
+
+    bool capture_;
+    std::string written_;
+    uint64_t written_bytes_;
+    uint64_t writes_;
+
+    int connect_error_;
+    uint64_t connects_;
+    int read_delay_ms_;
+
+    // make at least 'size' bytes readable from 'offset_'
+    bool prepare(size_t size);
+    // wait 'read_delay_ms_' before a read
+    // return false, 'timeout' is shorter, '*ec' is ETIMEDOUT
+    bool delay(int timeout, int * ec);
+
+  public:
+    explicit MemoryTransport(const std::string& replies, bool loop = true);
+    virtual ~MemoryTransport();
+
+    virtual void connect(
+        const std::string& ip_or_host,
+        const std::string& port_or_service,
+        int timeout,
+        int * ec);
+
+    virtual void write(
+        const std::string& line,
+        int timeout,
+        int * ec);
+
+    virtual std::string read(
+        size_t size,
+        const std::string& delim,
+        int timeout,
+        int * ec);
+
+    virtual std::string read_line(
+        const std::string& delim,
+        int timeout,
+        int * ec);
+
+    virtual void close();
+
+    virtual bool is_open()const;
+
+    virtual bool available()const;
+
+    // replace the canned stream and rewind
+    void reset(const std::string& replies);
+
+    // keep written bytes in 'written()', it is off by default
+    void set_capture(bool capture)
+    {
+      capture_ = capture;
+    }
+
+    const std::string& written()const
+    {
+      return written_;
+    }
+
+    void clear_written()
+    {
+      written_.clear();
+    }
+
+    uint64_t written_bytes()const
+    {
+      return written_bytes_;
+    }
+
+    uint64_t writes()const
+    {
+      return writes_;
+    }
+
+    // connects fail with 'ec', 0(the default) lets them succeed
+    void set_connect_error(int ec)
+    {
+      connect_error_ = ec;
+    }
+
+    // connects tried, failed ones included
+    uint64_t connects()const
+    {
+      return connects_;
+    }
+
+    // every read waits 'ms' first, like a server taking so long,
+    // one with a shorter timeout times out, 0(the default) means none
+    void set_read_delay(int ms)
+    {
+      read_delay_ms_ = ms;
+    }
+};
+
+LIBREDIS_NAMESPACE_END
+
+#endif// _LANGTAOJIN_LIBREDIS_REDIS_TRANSPORT_H_
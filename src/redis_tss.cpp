@@ -25,12 +25,14 @@ class RedisTss::Impl
     Impl(const std::string& host, int port,
         int db_index, int partitions,
         int timeout_ms, kRedisClientType type,
-        size_t pool_size, size_t /* check_interval */);
+        size_t pool_size, size_t /* check_interval */,
+        const SocketOptions& options);
 
     Impl(const std::string& host, const std::string& port,
         int db_index, int partitions,
         int timeout_ms, kRedisClientType type,
-        size_t pool_size, size_t /* check_interval */);
+        size_t pool_size, size_t /* check_interval */,
+        const SocketOptions& options);
 
     ~Impl();
 
@@ -45,6 +47,7 @@ class RedisTss::Impl
     const int partitions_;
     const kRedisClientType type_;
     const size_t pool_size_;
+    const SocketOptions socket_options_;
 
     std::vector<std::string> redis_hosts_;
 
@@ -88,10 +91,11 @@ class RedisTss::Impl
         switch (type_)
         {
           case kNormal:
-            redis_ptr = new Redis2(host_, port_, db_index_, timeout_ms_);
+            redis_ptr = new Redis2(host_, port_, db_index_, timeout_ms_, socket_options_);
             break;
           case kPartition:
-            redis_ptr = new Redis2P(host_, port_, db_index_, timeout_ms_, partitions_);
+            redis_ptr = new Redis2P(host_, port_, db_index_, timeout_ms_, partitions_,
+                time33_hash_32, socket_options_);
             break;
         }
       }
@@ -119,11 +123,13 @@ class RedisTss::Impl
 RedisTss::Impl::Impl(const std::string& host, int port,
     int db_index, int partitions,
     int timeout_ms, kRedisClientType type,
-    size_t pool_size, size_t /* check_interval */)
+    size_t pool_size, size_t /* check_interval */,
+    const SocketOptions& options)
 : host_(host), port_(boost::lexical_cast<std::string>(port)),
   db_index_(db_index), timeout_ms_(timeout_ms),
   partitions_(partitions), type_(type),
   pool_size_(pool_size),
+  socket_options_(options),
   client_(boost::bind(&RedisTss::Impl::put_free_redis, this, _1))
 {
   inner_init();
@@ -132,11 +138,13 @@ RedisTss::Impl::Impl(const std::string& host, int port,
 RedisTss::Impl::Impl(const std::string& host, const std::string& port,
     int db_index, int partitions,
     int timeout_ms, kRedisClientType type,
-    size_t pool_size, size_t /* check_interval */)
+    size_t pool_size, size_t /* check_interval */,
+    const SocketOptions& options)
 : host_(host), port_(port),
   db_index_(db_index), timeout_ms_(timeout_ms),
   partitions_(partitions), type_(type),
   pool_size_(pool_size),
+  socket_options_(options),
   client_(boost::bind(&RedisTss::Impl::put_free_redis, this, _1))
 {
   inner_init();
@@ -192,19 +200,21 @@ void RedisTss::Impl::inner_init()
 RedisTss::RedisTss(const std::string& host, int port,
     int db_index, int partitions,
     int timeout_ms, kRedisClientType type,
-    size_t pool_size, size_t check_interval)
+    size_t pool_size, size_t check_interval,
+    const SocketOptions& options)
 {
   impl_ = new Impl(host, port, db_index, partitions, timeout_ms, type,
-      pool_size, check_interval);
+      pool_size, check_interval, options);
 }
 
 RedisTss::RedisTss(const std::string& host, const std::string& port,
     int db_index, int partitions,
     int timeout_ms, kRedisClientType type,
-    size_t pool_size, size_t check_interval)
+    size_t pool_size, size_t check_interval,
+    const SocketOptions& options)
 {
   impl_ = new Impl(host, port, db_index, partitions, timeout_ms, type,
-      pool_size, check_interval);
+      pool_size, check_interval, options);
 }
 
 RedisTss::~RedisTss()
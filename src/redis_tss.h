@@ -33,15 +33,19 @@ class RedisTss
 
   public:
     // 'check_interval' is not used now
+    // 'host' is a host list as Redis2P, "unix:/path" entries are unix domain sockets
+    // 'options' applies to every connection of the pool
     RedisTss(const std::string& host, int port,
         int db_index = 0, int partitions = 1,
         int timeout_ms = 50, kRedisClientType type = kPartition,
-        size_t pool_size = 100, size_t check_interval = 120);
+        size_t pool_size = 100, size_t check_interval = 120,
+        const SocketOptions& options = SocketOptions());
 
     RedisTss(const std::string& host, const std::string& port,
         int db_index = 0, int partitions = 1,
         int timeout_ms = 50, kRedisClientType type = kPartition,
-        size_t pool_size = 100, size_t check_interval = 120);
+        size_t pool_size = 100, size_t check_interval = 120,
+        const SocketOptions& options = SocketOptions());
 
     ~RedisTss();
 
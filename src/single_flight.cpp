@@ -0,0 +1,278 @@
+/** @file
+ * @brief calls in flight shared by concurrent identical reads
+ * @author yafei.zhang@langtaojin.com
+ * @date
+ * @version
+ *
+ */
+#include "single_flight.h"
+#include "os.h"
+#include <boost/atomic.hpp>
+#include <boost/foreach.hpp>
+#include <boost/functional/hash.hpp>
+#include <boost/unordered_map.hpp>
+#include <algorithm>
+
+LIBREDIS_NAMESPACE_BEGIN
+
+namespace
+{
+  enum
+  {
+    kShards = 64
+  };
+
+  typedef boost::unordered_map<std::string, flight_sp_t> flight_map_t;
+
+  struct Shard
+  {
+    boost::mutex mutex;
+    flight_map_t flights;// by their ids
+  };
+
+  boost::atomic<bool> s_enabled(false);
+  Shard s_shards[kShards];
+
+  boost::atomic<uint64_t> s_leaders(0);
+  boost::atomic<uint64_t> s_coalesced(0);
+  boost::atomic<uint64_t> s_fallbacks(0);
+  boost::atomic<uint64_t> s_timeouts(0);
+  boost::atomic<uint64_t> s_detached(0);
+
+  Shard& shard_of(const std::string& key)
+  {
+    return s_shards[boost::hash<std::string>()(key) % kShards];
+  }
+
+  // with the lock of 'shard' held
+  void detach_key(Shard * shard, const std::string * key)
+  {
+    flight_map_t::iterator it = shard->flights.begin();
+    while (it!=shard->flights.end())
+    {
+      const string_vector_t& keys = it->second->keys;
+      if (key==NULL || std::find(keys.begin(), keys.end(), *key)!=keys.end())
+      {
+        it->second->detached = true;
+        it = shard->flights.erase(it);
+        s_detached++;
+      }
+      else
+      {
+        ++it;
+      }
+    }
+  }
+}
+
+/************************************************************************/
+/*Flight*/
+/************************************************************************/
+void Flight::land(bool ok, const RedisOutput& out, bool shared)
+{
+  boost::mutex::scoped_lock guard(mutex_);
+  if (ok && shared)
+    out_.copy(out);
+  ok_ = ok;
+  done_ = true;
+  landed_.notify_all();
+}
+
+int Flight::wait(int64_t deadline, RedisOutput * out)
+{
+  {
+    boost::mutex::scoped_lock guard(mutex_);
+    while (!done_)
+    {
+      if (deadline==0)
+      {
+        landed_.wait(guard);
+        continue;
+      }
+
+      int left = timeout_of(deadline);
+      if (left==0)
+        return -1;
+      (void)landed_.timed_wait(guard, boost::posix_time::milliseconds(left));
+    }
+  }
+
+  if (!ok_)
+    return 0;
+
+  // it is not changed any more
+  out->copy(out_);
+  return 1;
+}
+
+/************************************************************************/
+/*SingleFlight*/
+/************************************************************************/
+bool SingleFlight::enabled()
+{
+  return s_enabled;
+}
+
+bool SingleFlight::coalescible(kCommand command)
+{
+  switch (command)
+  {
+    case BITCOUNT:
+    case EXISTS:
+    case GET:
+    case GETBIT:
+    case GETRANGE:
+    case HEXISTS:
+    case HGET:
+    case HGETALL:
+    case HKEYS:
+    case HLEN:
+    case HMGET:
+    case HVALS:
+    case LINDEX:
+    case LLEN:
+    case LRANGE:
+    case MGET:
+    case PTTL:
+    case SCARD:
+    case SISMEMBER:
+    case SMEMBERS:
+    case STRLEN:
+    case TTL:
+    case TYPE:
+    case ZCARD:
+    case ZCOUNT:
+    case ZRANGE:
+    case ZRANGEBYSCORE:
+    case ZRANK:
+    case ZREVRANGE:
+    case ZREVRANGEBYSCORE:
+    case ZREVRANK:
+    case ZSCORE:
+      return true;
+    default:
+      return false;
+  }
+}
+
+void SingleFlight::read_keys(const RedisCommand * command, string_vector_t * keys)
+{
+  const string_vector_t& args = command->in.args();
+  switch (command->in.command())
+  {
+    case EXISTS:
+    case MGET:
+      keys->assign(args.begin(), args.end());
+      break;
+    default:
+      keys->assign(1, args[0]);
+      break;
+  }
+}
+
+bool SingleFlight::join(const std::string& id, const string_vector_t& keys, flight_sp_t * flight)
+{
+  {
+    Shard& shard = shard_of(keys[0]);
+    boost::mutex::scoped_lock guard(shard.mutex);
+
+    flight_map_t::iterator it = shard.flights.find(id);
+    if (it!=shard.flights.end() && !it->second->detached)
+    {
+      *flight = it->second;
+      (*flight)->followers++;
+      s_coalesced++;
+      return true;
+    }
+
+    flight->reset(new Flight(keys));
+    shard.flights[id] = *flight;
+    s_leaders++;
+  }
+
+  // in the shards of the other keys too, so that writes of them detach it,
+  // it is not called before this returns
+  for (size_t i=1; i<keys.size(); i++)
+  {
+    Shard& shard = shard_of(keys[i]);
+    boost::mutex::scoped_lock guard(shard.mutex);
+    shard.flights[id] = *flight;
+  }
+  return false;
+}
+
+void SingleFlight::land(const std::string& id, const flight_sp_t& flight,
+    bool ok, const RedisOutput& out)
+{
+  size_t followers = 0;
+  for (size_t i=0; i<flight->keys.size(); i++)
+  {
+    Shard& shard = shard_of(flight->keys[i]);
+    boost::mutex::scoped_lock guard(shard.mutex);
+    flight_map_t::iterator it = shard.flights.find(id);
+    if (it!=shard.flights.end() && it->second==flight)
+      shard.flights.erase(it);
+    // nobody joins it any more
+    if (i==0)
+      followers = flight->followers;
+  }
+  flight->land(ok, out, followers!=0);
+}
+
+void SingleFlight::detach(const string_vector_t& keys)
+{
+  if (!s_enabled)
+    return;
+
+  BOOST_FOREACH(const std::string& key, keys)
+  {
+    Shard& shard = shard_of(key);
+    boost::mutex::scoped_lock guard(shard.mutex);
+    detach_key(&shard, &key);
+  }
+}
+
+void SingleFlight::detach_all()
+{
+  if (!s_enabled)
+    return;
+
+  for (size_t i=0; i<kShards; i++)
+  {
+    boost::mutex::scoped_lock guard(s_shards[i].mutex);
+    detach_key(&s_shards[i], NULL);
+  }
+}
+
+void SingleFlight::on_fallback()
+{
+  s_fallbacks++;
+}
+
+void SingleFlight::on_timeout()
+{
+  s_timeouts++;
+}
+
+void set_read_coalescing(bool enabled)
+{
+  s_enabled = enabled;
+}
+
+bool get_read_coalescing()
+{
+  return s_enabled;
+}
+
+ReadCoalescingStats get_read_coalescing_stats()
+{
+  ReadCoalescingStats stats;
+  stats.leaders = s_leaders;
+  stats.coalesced = s_coalesced;
+  stats.fallbacks = s_fallbacks;
+  stats.timeouts = s_timeouts;
+  stats.detached = s_detached;
+  return stats;
+}
+
+LIBREDIS_NAMESPACE_END
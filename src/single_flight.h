@@ -0,0 +1,87 @@
+/** @file
+ * @brief calls in flight shared by concurrent identical reads
+ * @author yafei.zhang@langtaojin.com
+ * @date
+ * @version
+ * inner header
+ */
+#ifndef _LANGTAOJIN_LIBREDIS_SINGLE_FLIGHT_H_
+#define _LANGTAOJIN_LIBREDIS_SINGLE_FLIGHT_H_
+
+#include "redis_cmd.h"
+#include <boost/atomic.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+LIBREDIS_NAMESPACE_BEGIN
+
+// a call in flight, executed by its leader and shared by the others
+class Flight
+{
+  private:
+    boost::mutex mutex_;
+    boost::condition_variable landed_;
+    bool done_;
+    bool ok_;
+    RedisOutput out_;
+
+  public:
+    // the keys the call reads, it is in the shards of all of them
+    const string_vector_t keys;
+    // guarded by the shard of 'keys[0]', where it is joined
+    size_t followers;
+    // a write of one of 'keys' is done, it is not joined any more
+    boost::atomic<bool> detached;
+
+    explicit Flight(const string_vector_t& _keys)
+      : done_(false), ok_(false), keys(_keys), followers(0), detached(false) {}
+
+    // the reply is copied only if the call is shared
+    void land(bool ok, const RedisOutput& out, bool shared);
+
+    // wait until it lands or 'deadline'(0 means no deadline)
+    // return 1, it succeeded, its reply is copied into '*out'
+    // return 0, it failed, call on your own
+    // return -1, 'deadline' passes
+    int wait(int64_t deadline, RedisOutput * out);
+};
+
+typedef boost::shared_ptr<Flight> flight_sp_t;
+
+/************************************************************************/
+/**
+ * SingleFlight is the table of calls in flight(see set_read_coalescing),
+ * sharded by the keys they read, a read of several keys(MGET) is in the shards of all.
+ * Flights are identified by their endpoints, dbs and requests.
+ *
+ * multi thread safe
+ */
+/************************************************************************/
+class SingleFlight
+{
+  public:
+    static bool enabled();
+    // reads of keys which may be coalesced
+    static bool coalescible(kCommand command);
+    // the keys 'command'(a coalescible one with arguments) reads
+    static void read_keys(const RedisCommand * command, string_vector_t * keys);
+
+    // return true, '*flight' is led by another call, wait for it
+    // return false, the caller leads '*flight', land it with land()
+    static bool join(const std::string& id, const string_vector_t& keys, flight_sp_t * flight);
+    static void land(const std::string& id, const flight_sp_t& flight,
+        bool ok, const RedisOutput& out);
+
+    // flights of 'keys'(or all) are not joined any more, they began before writes of them
+    static void detach(const string_vector_t& keys);
+    static void detach_all();
+
+    // counters of the waiting calls
+    static void on_fallback();
+    static void on_timeout();
+};
+
+LIBREDIS_NAMESPACE_END
+
+#endif// _LANGTAOJIN_LIBREDIS_SINGLE_FLIGHT_H_
@@ -7,10 +7,18 @@
  */
 #include "tcp_client.h"
 #include "os.h"
+#include "host_resolver.h"
+#include "io_uring.h"
+#include <netinet/tcp.h>
 #include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#if defined(__linux__)
+# include <sys/sendfile.h>
+#endif
 #include <time.h>
 #include <string.h>
-#include <boost/thread/shared_mutex.hpp>
+#include <algorithm>
 
 LIBREDIS_NAMESPACE_BEGIN
 
@@ -24,110 +32,21 @@ namespace
     kConnectTimeoutProportion = 5,
     kMinConnectTimeout = 10,
 
-    kCheckOpenInterval = 180
-  };
-
-  /************************************************************************/
-  /* HostResolver(multi thread safe) */
-  /************************************************************************/
-  class HostResolver
-  {
-    private:
-      typedef std::pair<std::string, std::string> host_service_t;
-      struct HostEntry
-      {
-        net_endpoint endpoint;
-        int ec;
-      };
-      typedef std::map<host_service_t, HostEntry> dns_cache_t;
-
-      dns_cache_t dns_cache_;
-      mutable boost::shared_mutex dns_cache_mutex_;
-      const bool enable_cache_;
-
-    private:
-      static void __resolve(
-          const std::string& host,
-          const std::string& service,
-          net_endpoint * endpoint,
-          int * ec)
-      {
-        int ret = resolve_host(host.c_str(), service.c_str(), endpoint);
-        if (ret!=0)
-          *ec = errno;
-        else
-          *ec = 0;
-      }
-
-      // return true, found in cache
-      // return false, not found in cache
-      bool __lookup_cache(
-          const std::string& host,
-          const std::string& service,
-          net_endpoint * endpoint,
-          int * ec)const
-      {
-        host_service_t key = std::make_pair(host, service);
-        dns_cache_t::const_iterator iter;
+    kCheckOpenInterval = 180,
 
-        boost::shared_lock<boost::shared_mutex> guard(dns_cache_mutex_);
+    kUringEntries = 8,
+    kUringBufferSize = 16384,
 
-        iter = dns_cache_.find(key);
-        if (iter==dns_cache_.end())
-          return false;
-
-        *endpoint = (*iter).second.endpoint;
-        *ec = (*iter).second.ec;
-        return true;
-      }
-
-      void __update_cache(
-          const std::string& host,
-          const std::string& service,
-          const net_endpoint& endpoint,
-          int ec)
-      {
-        host_service_t key = std::make_pair(host, service);
-        HostEntry host_entry;
-        host_entry.endpoint = endpoint;
-        host_entry.ec = ec;
-
-        boost::unique_lock<boost::shared_mutex> guard(dns_cache_mutex_);
-        dns_cache_[key] = host_entry;
-      }
+    kPieceSize = 65536,// a pipe holds 64KB by default
+    kSendPieceSize = 1048576
+  };
 
-    public:
-      explicit HostResolver(bool enable_cache = true)
-        : enable_cache_(enable_cache) {}
+  volatile kIoBackend s_default_io_backend = kPollBackend;
 
-      ~HostResolver() {}
+  const char kUnixPrefix[] = "unix:";
+  const size_t kUnixPrefixLength = sizeof(kUnixPrefix) - 1;
 
-      void resolve(
-          const std::string& host,
-          const std::string& service,
-          net_endpoint * endpoint,
-          int * ec)
-      {
-        if (enable_cache_)
-        {
-          if (__lookup_cache(host, service, endpoint, ec))
-            return;
-
-          __resolve(host, service, endpoint, ec);
-          __update_cache(host, service, *endpoint, *ec);
-        }
-        else
-        {
-          __resolve(host, service, endpoint, ec);
-        }
-      }
-
-      void clear_cache()
-      {
-        boost::unique_lock<boost::shared_mutex> guard(dns_cache_mutex_);
-        dns_cache_.clear();
-      }
-  } s_host_resolver;
+  HostResolver s_host_resolver;
 
   /************************************************************************/
   /* TcpClientBuffer */
@@ -238,21 +157,17 @@ namespace
         to_read_ += size;
       }
 
-      std::string consume(size_t size)
+      void consume(size_t size)
       {
         assert(size);
         assert(read_size()>=size);
 
-        char * read = read_;
         read_ += size;
-        std::string ret(read, size);
 
         if (read_size()==0 && total_size()>=kMaxBufferSize)
           drain();
         else if (read_size()==0)
           read_ = to_read_ = begin();
-
-        return ret;
       }
 
       inline void drain()
@@ -272,9 +187,253 @@ class TcpClient::Impl
     TcpClientBuffer buffer_;
     mutable time_t last_check_open_time_;
 
+    const SocketOptions options_;
+    SocketStats stats_;
+    IoUring ring_;
+    // with io_uring, written bytes wait here to be sent with the next read
+    std::string pending_write_;
+    int pending_write_timeout_;
+
+    // return the read bytes
+    // return 0 or -1, failure, check errno
+    int fill_buffer(size_t hint, int timeout)
+    {
+      stats_.reads++;
+
+      if (!ring_.ready())
+      {
+        buffer_.prepare(hint);
+        std::pair<char *, size_t> to_read_buf = buffer_.get_to_read_buffer();
+        if (options_.spin_us<=0)
+          return timed_read(fd_, to_read_buf.first, to_read_buf.second, 0, timeout);
+
+        int spin_hit;
+        int count = spin_read(fd_, to_read_buf.first, to_read_buf.second, 0, timeout,
+            options_.spin_us, &spin_hit);
+        if (spin_hit)
+          stats_.spin_hits++;
+        else
+          stats_.spin_misses++;
+        return count;
+      }
+
+      int count = ring_.send_recv(fd_, pending_write_.data(), pending_write_.size(),
+          kUringBufferSize, timeout);
+      pending_write_.clear();
+      if (count<=0)
+        return count;
+
+      buffer_.prepare(static_cast<size_t>(count));
+      ::memcpy(buffer_.get_to_read_buffer().first, ring_.fixed_buffer(), static_cast<size_t>(count));
+      return count;
+    }
+
+    // return true, all pending bytes are sent
+    bool flush_pending_write(int timeout)
+    {
+      if (pending_write_.empty())
+        return true;
+
+      int ret = ring_.send_recv(fd_, pending_write_.data(), pending_write_.size(), 0, timeout);
+      pending_write_.clear();
+      return ret==0;
+    }
+
+    // move '*left' bytes from the socket to the fd() of 'sink' through a pipe,
+    // they are not copied to user space
+    // return 1, all are moved
+    // return 0, splice() is not taken, '*left' bytes are left to read
+    // return -1, failure, check errno
+    int splice_to(BulkSink * sink, size_t * left, int64_t deadline)
+    {
+#if defined(__linux__)
+      int pipefd[2];
+      if (::pipe(pipefd)==-1)
+        return 0;
+
+      int ret = 1;
+      bool spliced = false;
+      while (ret==1 && *left)
+      {
+        ssize_t in = ::splice(fd_, NULL, pipefd[1], NULL,
+            std::min(*left, static_cast<size_t>(kPieceSize)), SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (in==-1 && (errno==EAGAIN || errno==EINTR))
+        {
+          stats_.reads++;
+          if (errno==EAGAIN && poll_read(fd_, timeout_of(deadline))!=1)
+            ret = -1;
+          continue;
+        }
+        if (in<=0)
+        {
+          if (in==0)
+            errno = ECONNRESET;
+          ret = -1;
+          break;
+        }
+        *left -= static_cast<size_t>(in);
+
+        size_t in_pipe = static_cast<size_t>(in);
+        while (in_pipe)
+        {
+          ssize_t out = ::splice(pipefd[0], NULL, sink->fd(), NULL, in_pipe, SPLICE_F_MOVE);
+          if (out>0)
+          {
+            in_pipe -= static_cast<size_t>(out);
+            spliced = true;
+            continue;
+          }
+          if (out==-1 && errno==EINTR)
+            continue;
+
+          if (out==-1 && errno==EINVAL && !spliced)
+          {
+            // the fd does not take splice(), hand the piped bytes to on_data()
+            std::vector<char> piped(in_pipe);
+            ssize_t count;
+            do count = ::read(pipefd[0], &piped[0], in_pipe);
+            while (count==-1 && errno==EINTR);
+            ret = (count==static_cast<ssize_t>(in_pipe) && sink->on_data(&piped[0], in_pipe)) ? 0 : -1;
+          }
+          else
+          {
+            ret = -1;
+          }
+          if (ret==-1)
+            errno = ECANCELED;
+          break;
+        }
+      }
+
+      (void)safe_close(pipefd[0]);
+      (void)safe_close(pipefd[1]);
+      return ret;
+#else
+      (void)sink;
+      (void)left;
+      (void)deadline;
+      return 0;
+#endif
+    }
+
+    // send '*left' bytes of 'in_fd' from 'offset'
+    // return true, all are sent or sendfile() is not taken('*left' bytes are left to send)
+    // return false, failure, check errno
+    bool sendfile_from(int in_fd, off_t offset, size_t * left, int64_t deadline)
+    {
+#if defined(__linux__)
+      bool sent = false;
+      while (*left)
+      {
+        ssize_t count = ::sendfile(fd_, in_fd, &offset,
+            std::min(*left, static_cast<size_t>(kSendPieceSize)));
+        if (count>0)
+        {
+          *left -= static_cast<size_t>(count);
+          sent = true;
+          continue;
+        }
+        if (count==-1 && errno==EINTR)
+          continue;
+        if (count==-1 && errno==EAGAIN)
+        {
+          if (poll_write(fd_, timeout_of(deadline))!=1)
+            return false;
+          continue;
+        }
+        if (count==-1 && (errno==EINVAL || errno==ENOSYS) && !sent)
+          return true;
+
+        if (count==0)
+          errno = EIO;// the file is shorter than said
+        return false;
+      }
+#else
+      (void)in_fd;
+      (void)offset;
+      (void)left;
+      (void)deadline;
+#endif
+      return true;
+    }
+
+    // apply 'options_' to a new socket before connecting,
+    // failures are ignored, the socket works with the defaults
+    void set_options(int fd, int domain)
+    {
+      int value;
+
+      if (options_.send_buffer>0)
+      {
+        value = options_.send_buffer;
+        (void)setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &value, sizeof(value));
+      }
+
+      if (options_.recv_buffer>0)
+      {
+        value = options_.recv_buffer;
+        (void)setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &value, sizeof(value));
+      }
+
+      stats_.busy_poll = false;
+#if defined SO_BUSY_POLL
+      if (options_.busy_poll_us>0)
+      {
+        value = options_.busy_poll_us;
+        stats_.busy_poll =
+          setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &value, sizeof(value))==0;
+      }
+#endif
+
+      if (domain!=AF_INET && domain!=AF_INET6)
+        return;
+
+      if (options_.tcp_nodelay)
+      {
+        value = 1;
+        (void)setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &value, sizeof(value));
+      }
+
+      if (options_.keepalive)
+      {
+        value = 1;
+        (void)setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &value, sizeof(value));
+#if defined TCP_KEEPIDLE
+        if (options_.keepalive_idle>0)
+        {
+          value = options_.keepalive_idle;
+          (void)setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &value, sizeof(value));
+        }
+#endif
+#if defined TCP_KEEPINTVL
+        if (options_.keepalive_interval>0)
+        {
+          value = options_.keepalive_interval;
+          (void)setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &value, sizeof(value));
+        }
+#endif
+#if defined TCP_KEEPCNT
+        if (options_.keepalive_count>0)
+        {
+          value = options_.keepalive_count;
+          (void)setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &value, sizeof(value));
+        }
+#endif
+      }
+
+#if defined TCP_USER_TIMEOUT
+      if (options_.user_timeout_ms>0)
+      {
+        value = options_.user_timeout_ms;
+        (void)setsockopt(fd, IPPROTO_TCP, TCP_USER_TIMEOUT, &value, sizeof(value));
+      }
+#endif
+    }
+
   public:
-    Impl()
-      : fd_(-1), last_check_open_time_(0) {}
+    explicit Impl(const SocketOptions& options)
+      : fd_(-1), last_check_open_time_(0),
+      options_(options), pending_write_timeout_(0) {}
 
     ~Impl()
     {
@@ -291,13 +450,25 @@ class TcpClient::Impl
 
       // resolve host
       net_endpoint endpoint;
-      // It is only IPv4, because redis-server binds a v4 address.
-      endpoint.domain = AF_INET;
-      endpoint.type = SOCK_STREAM;
-      endpoint.protocol = IPPROTO_TCP;
-      s_host_resolver.resolve(ip_or_host, port_or_service, &endpoint, ec);
-      if (*ec!=0)
-        return;
+      if (ip_or_host.compare(0, kUnixPrefixLength, kUnixPrefix)==0)
+      {
+        // "unix:/path/to/redis.sock", 'port_or_service' is ignored
+        if (resolve_unix(ip_or_host.c_str() + kUnixPrefixLength, &endpoint)==-1)
+        {
+          *ec = errno;
+          return;
+        }
+      }
+      else
+      {
+        // It is only IPv4, because redis-server binds a v4 address.
+        endpoint.domain = AF_INET;
+        endpoint.type = SOCK_STREAM;
+        endpoint.protocol = IPPROTO_TCP;
+        s_host_resolver.resolve(ip_or_host, port_or_service, &endpoint, ec);
+        if (*ec!=0)
+          return;
+      }
 
       // create socket
       int fd;
@@ -307,9 +478,10 @@ class TcpClient::Impl
         return;
       }
 
-      // It is only IPv4, because redis-server binds a v4 address.
-      struct sockaddr * addr = /*lint -e(740) */(struct sockaddr * )&endpoint.address.in4;
-      socklen_t addrlen = sizeof(endpoint.address.in4);
+      set_options(fd, endpoint.domain);
+
+      struct sockaddr * addr = /*lint -e(740) */(struct sockaddr * )&endpoint.address;
+      socklen_t addrlen = net_endpoint_length(&endpoint);
 
       // adjust timeout
       timeout /= kConnectTimeoutProportion;
@@ -324,6 +496,15 @@ class TcpClient::Impl
         return;
       }
 
+      if (options_.io_backend==kUringBackend)
+      {
+        // io_uring waits for the socket itself, so it is blocking.
+        // Without io_uring, stay on the poll() path.
+        if ((ring_.ready() || ring_.init(kUringEntries, kUringBufferSize)==0)
+            && set_block(fd)==-1)
+          ring_.destroy();
+      }
+
       fd_ = fd;
       ::time(&last_check_open_time_);
       *ec = 0;
@@ -334,6 +515,22 @@ class TcpClient::Impl
         int timeout,
         int * ec)
     {
+      if (ring_.ready())
+      {
+        pending_write_.append(line);
+        pending_write_timeout_ = timeout;
+        if (pending_write_.size()<kMaxBufferSize || flush_pending_write(timeout))
+        {
+          ::time(&last_check_open_time_);
+          *ec = 0;
+          return;
+        }
+
+        *ec = errno;
+        close();
+        return;
+      }
+
       if (timed_writen(fd_, &line[0], line.size(), 0, timeout)
           !=static_cast<int>(line.size()))
       {
@@ -357,6 +554,8 @@ class TcpClient::Impl
       const size_t delim_size = delim.size();
       size_t expect = size + delim_size;
       size_t to_read = expect - buffer_.read_size();
+      // 'timeout' bounds the whole read, however many polls it takes
+      const int64_t deadline = deadline_of(timeout);
       int count;
 
       for (;;)
@@ -366,19 +565,17 @@ class TcpClient::Impl
         {
           std::pair<const char *, size_t> read_buf = buffer_.get_read_buffer();
           (void)line.assign(read_buf.first, read_buf.first + expect - delim_size);
-          (void)buffer_.consume(expect);
+          buffer_.consume(expect);
           *ec = 0;
           return line;
         }
 
         // try to read
-        buffer_.prepare(to_read);
-        std::pair<char *, size_t> to_read_buf = buffer_.get_to_read_buffer();
-        count = timed_read(fd_, to_read_buf.first, to_read_buf.second, 0, timeout);
+        count = fill_buffer(to_read, timeout_of(deadline));
         if (count<=0)
         {
-          close();
           *ec = errno;
+          close();
           return std::string();
         }
 
@@ -400,6 +597,7 @@ class TcpClient::Impl
       const char * search_curr;
       size_t search_offset = 0;
       size_t to_consume;
+      const int64_t deadline = deadline_of(timeout);
       int count;
 
       for (;;)
@@ -420,7 +618,7 @@ class TcpClient::Impl
               // find delim in buffer_, grep it and return
               to_consume = static_cast<size_t>(search_curr - search_begin) + delim_size;
               (void)line.assign(read_buf.first, read_buf.first + to_consume - delim_size);
-              (void)buffer_.consume(to_consume);
+              buffer_.consume(to_consume);
               *ec = 0;
               return line;
             }
@@ -428,13 +626,11 @@ class TcpClient::Impl
         }
 
         // try read
-        buffer_.prepare();
-        std::pair<char *, size_t> to_read_buf = buffer_.get_to_read_buffer();
-        count = timed_read(fd_, to_read_buf.first, to_read_buf.second, 0, timeout);
+        count = fill_buffer(kDefaultBufferSize, timeout_of(deadline));
         if (count<=0)
         {
-          close();
           *ec = errno;
+          close();
           return std::string();
         }
 
@@ -443,8 +639,136 @@ class TcpClient::Impl
       }
     }
 
+    // return false, not handled here, use the piece by piece way of RedisTransport
+    bool read_to(
+        size_t size,
+        const std::string& delim,
+        BulkSink * sink,
+        int timeout,
+        int * ec)
+    {
+      if (ring_.ready())
+        return false;
+
+      const int64_t deadline = deadline_of(timeout);
+      size_t left = size;
+
+      // buffered bytes first
+      size_t buffered = std::min(left, buffer_.read_size());
+      if (buffered)
+      {
+        if (!sink->on_data(buffer_.get_read_buffer().first, buffered))
+        {
+          *ec = ECANCELED;
+          close();
+          return true;
+        }
+        buffer_.consume(buffered);
+        left -= buffered;
+      }
+
+      if (left && sink->fd()!=-1 && splice_to(sink, &left, deadline)==-1)
+      {
+        *ec = errno;
+        close();
+        return true;
+      }
+
+      // the rest through a bounded piece
+      std::vector<char> piece(left ? std::min(left, static_cast<size_t>(kPieceSize)) : 0);
+      while (left)
+      {
+        stats_.reads++;
+        int count = timed_read(fd_, &piece[0], std::min(left, piece.size()), 0,
+            timeout_of(deadline));
+        if (count<=0)
+        {
+          *ec = count==0 ? ECONNRESET : errno;
+          close();
+          return true;
+        }
+
+        if (!sink->on_data(&piece[0], static_cast<size_t>(count)))
+        {
+          *ec = ECANCELED;
+          close();
+          return true;
+        }
+        left -= static_cast<size_t>(count);
+      }
+
+      (void)read(0, delim, timeout_of(deadline), ec);
+      return true;
+    }
+
+    // return false, not handled here, use the piece by piece way of RedisTransport
+    bool write_from(
+        BulkSource * source,
+        int timeout,
+        int * ec)
+    {
+      if (ring_.ready())
+        return false;
+
+      const int64_t deadline = deadline_of(timeout);
+      size_t left = source->size();
+      const char * data = source->data();
+      off_t offset;
+      int in_fd = source->fd(&offset);
+      bool ok = true;
+
+      if (data)
+      {
+        // the kernel copies from 'data' directly
+        for (; ok && left; )
+        {
+          size_t size = std::min(left, static_cast<size_t>(kSendPieceSize));
+          ok = timed_writen(fd_, data, size, 0, timeout_of(deadline))==static_cast<int>(size);
+          data += size;
+          left -= size;
+        }
+      }
+      else
+      {
+        if (in_fd!=-1)
+          ok = sendfile_from(in_fd, offset, &left, deadline);
+
+        std::vector<char> piece(left ? std::min(left, static_cast<size_t>(kPieceSize)) : 0);
+        while (ok && left)
+        {
+          ssize_t count = source->read(&piece[0], std::min(left, piece.size()));
+          if (count<=0)
+          {
+            if (count==0 || errno==0)
+              errno = EIO;
+            ok = false;
+            break;
+          }
+
+          ok = timed_writen(fd_, &piece[0], static_cast<size_t>(count), 0, timeout_of(deadline))
+            ==static_cast<int>(count);
+          left -= static_cast<size_t>(count);
+        }
+      }
+
+      if (!ok)
+      {
+        *ec = errno ? errno : EIO;
+        close();
+        return true;
+      }
+
+      ::time(&last_check_open_time_);
+      *ec = 0;
+      return true;
+    }
+
     inline void close()
     {
+      if (fd_!=-1 && ring_.ready())
+        (void)flush_pending_write(pending_write_timeout_);
+      pending_write_.clear();
+
       if (fd_!=-1)
       {
         safe_close(fd_);
@@ -472,6 +796,11 @@ class TcpClient::Impl
       return true;
     }
 
+    inline SocketStats get_socket_stats()const
+    {
+      return stats_;
+    }
+
     inline bool available()const
     {
       if (buffer_.read_size()!=0)
@@ -488,9 +817,34 @@ class TcpClient::Impl
 /************************************************************************/
 /*TcpClient*/
 /************************************************************************/
+void set_default_io_backend(kIoBackend backend)
+{
+  s_default_io_backend = backend;
+}
+
+kIoBackend get_default_io_backend()
+{
+  return s_default_io_backend;
+}
+
+void set_dns_cache_ttl(int ttl, int negative_ttl)
+{
+  s_host_resolver.set_ttl(ttl, negative_ttl);
+}
+
+void clear_dns_cache()
+{
+  s_host_resolver.clear_cache();
+}
+
 TcpClient::TcpClient()
 {
-  impl_ = new Impl;
+  impl_ = new Impl(SocketOptions());
+}
+
+TcpClient::TcpClient(const SocketOptions& options)
+{
+  impl_ = new Impl(options);
 }
 
 TcpClient::~TcpClient()
@@ -528,6 +882,24 @@ std::string TcpClient::read_line(const std::string& delim,
   return impl_->read_line(delim, timeout, ec);
 }
 
+void TcpClient::read_to(size_t size,
+    const std::string& delim,
+    BulkSink * sink,
+    int timeout,
+    int * ec)
+{
+  if (!impl_->read_to(size, delim, sink, timeout, ec))
+    RedisTransport::read_to(size, delim, sink, timeout, ec);
+}
+
+void TcpClient::write_from(BulkSource * source,
+    int timeout,
+    int * ec)
+{
+  if (!impl_->write_from(source, timeout, ec))
+    RedisTransport::write_from(source, timeout, ec);
+}
+
 void TcpClient::close()
 {
   impl_->close();
@@ -543,4 +915,9 @@ bool TcpClient::available()const
   return impl_->available();
 }
 
+SocketStats TcpClient::get_socket_stats()const
+{
+  return impl_->get_socket_stats();
+}
+
 LIBREDIS_NAMESPACE_END
@@ -8,12 +8,12 @@
 #ifndef _LANGTAOJIN_LIBREDIS_TCP_CLIENT_H_
 #define _LANGTAOJIN_LIBREDIS_TCP_CLIENT_H_
 
-#include "redis_common.h"
+#include "redis_transport.h"
 
 LIBREDIS_NAMESPACE_BEGIN
 
 // single thread safety
-class TcpClient
+class TcpClient : public RedisTransport
 {
   private:
     class Impl;
@@ -21,39 +21,58 @@ class TcpClient
 
   public:
     TcpClient();
-    ~TcpClient();
+    explicit TcpClient(const SocketOptions& options);
+    virtual ~TcpClient();
 
     // all 'timeout' are in milliseconds
     // all 'ec' are got from errno
-    void connect(
+    // 'ip_or_host' like "unix:/tmp/redis.sock" connects to a unix domain socket,
+    // and 'port_or_service' is ignored
+    virtual void connect(
         const std::string& ip_or_host,
         const std::string& port_or_service,
         int timeout,
         int * ec);
 
-    void write(
+    virtual void write(
         const std::string& line,
         int timeout,
         int * ec);
 
     // if 'timeout' is negative, block to read
-    std::string read(
+    virtual std::string read(
         size_t size,
         const std::string& delim,
         int timeout,
         int * ec);
 
     // if 'timeout' is negative, block to read until 'delim'
-    std::string read_line(
+    virtual std::string read_line(
         const std::string& delim,
         int timeout,
         int * ec);
 
-    void close();
+    // splice() to the fd() of 'sink' where it can
+    virtual void read_to(
+        size_t size,
+        const std::string& delim,
+        BulkSink * sink,
+        int timeout,
+        int * ec);
+
+    // sendfile() from the fd() of 'source' where it can
+    virtual void write_from(
+        BulkSource * source,
+        int timeout,
+        int * ec);
+
+    virtual void close();
+
+    virtual bool is_open()const;
 
-    bool is_open()const;
+    virtual bool available()const;
 
-    bool available()const;
+    virtual SocketStats get_socket_stats()const;
 };
 
 LIBREDIS_NAMESPACE_END
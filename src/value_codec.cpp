@@ -0,0 +1,394 @@
+/** @file
+ * @brief value compression: codecs, tagged values and their counters
+ * @author yafei.zhang@langtaojin.com
+ * @date
+ * @version
+ *
+ */
+#include "value_codec.h"
+#include "os.h"
+#include <string.h>
+#include <boost/atomic.hpp>
+
+LIBREDIS_NAMESPACE_BEGIN
+
+namespace
+{
+  enum
+  {
+    kTagSize = 8,// "\xffRZ", the codec, the raw size
+    kMaxRawSize = 0x7fffffff,
+
+    // LZ4 block format
+    kMinMatch = 4,
+    kLastLiterals = 5,// the last 5 bytes are literals
+    kMatchLimit = 12,// a match starts 12 bytes before the end at the latest
+    kMaxOffset = 65535,
+    kMaxExpansion = 255,// a byte of a block is 255 bytes at most(a byte of a match length)
+    kHashBits = 12
+  };
+
+  const char kTagMagic[] = "\xffRZ";
+  const size_t kTagMagicSize = sizeof(kTagMagic) - 1;
+
+  inline uint32_t read32(const uint8_t * p)
+  {
+    uint32_t u;
+    ::memcpy(&u, p, sizeof(u));
+    return u;
+  }
+
+  inline uint32_t hash32(uint32_t u)
+  {
+    return (u * 2654435761U) >> (32 - kHashBits);
+  }
+
+  // a length of 15 or more goes on in bytes of 255 and a last one below it
+  inline void append_length(std::string * out, size_t length)
+  {
+    for (; length>=255; length -= 255)
+      out->append(1, static_cast<char>(255));
+    out->append(1, static_cast<char>(length));
+  }
+
+  void append_sequence(std::string * out, const uint8_t * literals, size_t literal_size,
+      size_t offset, size_t match_size)
+  {
+    size_t match_code = match_size ? match_size - kMinMatch : 0;
+    uint8_t token = static_cast<uint8_t>(((literal_size<15 ? literal_size : 15) << 4)
+        | (match_code<15 ? match_code : 15));
+    out->append(1, static_cast<char>(token));
+    if (literal_size>=15)
+      append_length(out, literal_size - 15);
+    out->append(reinterpret_cast<const char *>(literals), literal_size);
+
+    // the last sequence has only literals
+    if (match_size==0)
+      return;
+
+    out->append(1, static_cast<char>(offset & 0xff));
+    out->append(1, static_cast<char>(offset >> 8));
+    if (match_code>=15)
+      append_length(out, match_code - 15);
+  }
+
+  /************************************************************************/
+  /*Lz4Codec*/
+  /************************************************************************/
+  // a greedy single-pass LZ4 block compressor, readable by any LZ4 decoder
+  class Lz4Codec : public ValueCodec
+  {
+    public:
+      virtual const char * name()const
+      {
+        return "lz4";
+      }
+
+      virtual bool compress(const char * data, size_t size, std::string * out)
+      {
+        const uint8_t * src = reinterpret_cast<const uint8_t *>(data);
+        uint32_t table[1 << kHashBits];
+        ::memset(table, 0, sizeof(table));
+
+        size_t anchor = 0;
+        size_t i = 0;
+        while (i + kMatchLimit<size)
+        {
+          uint32_t seq = read32(src + i);
+          uint32_t h = hash32(seq);
+          size_t candidate = table[h];
+          table[h] = static_cast<uint32_t>(i);
+
+          if (candidate>=i || i - candidate>kMaxOffset || read32(src + candidate)!=seq)
+          {
+            // skip faster over data not matching
+            i += 1 + ((i - anchor) >> 6);
+            continue;
+          }
+
+          while (i>anchor && candidate>0 && src[i - 1]==src[candidate - 1])
+          {
+            i--;
+            candidate--;
+          }
+
+          size_t match_size = kMinMatch;
+          size_t max_size = size - kLastLiterals - i;
+          while (match_size<max_size && src[i + match_size]==src[candidate + match_size])
+            match_size++;
+
+          append_sequence(out, src + anchor, i - anchor, i - candidate, match_size);
+          i += match_size;
+          anchor = i;
+        }
+
+        append_sequence(out, src + anchor, size - anchor, 0, 0);
+        return true;
+      }
+
+      virtual bool decompress(const char * data, size_t size,
+          size_t raw_size, std::string * out)
+      {
+        // a corrupt 'raw_size' does not allocate
+        if (raw_size>size * kMaxExpansion)
+          return false;
+
+        const uint8_t * src = reinterpret_cast<const uint8_t *>(data);
+        size_t base = out->size();
+        out->resize(base + raw_size);
+        uint8_t * dst = reinterpret_cast<uint8_t *>(&(*out)[0]) + base;
+        size_t ip = 0;
+        size_t op = 0;
+
+        for (;;)
+        {
+          if (ip>=size)
+            return false;
+
+          uint8_t token = src[ip++];
+          size_t literal_size = token >> 4;
+          if (literal_size==15)
+          {
+            uint8_t b;
+            do
+            {
+              if (ip>=size)
+                return false;
+              b = src[ip++];
+              literal_size += b;
+            } while (b==255);
+          }
+
+          if (literal_size>size - ip || literal_size>raw_size - op)
+            return false;
+          ::memcpy(dst + op, src + ip, literal_size);
+          ip += literal_size;
+          op += literal_size;
+
+          if (ip==size)
+            return op==raw_size;
+
+          if (size - ip<2)
+            return false;
+          size_t offset = src[ip] | (static_cast<size_t>(src[ip + 1]) << 8);
+          ip += 2;
+          if (offset==0 || offset>op)
+            return false;
+
+          size_t match_size = token & 15;
+          if (match_size==15)
+          {
+            uint8_t b;
+            do
+            {
+              if (ip>=size)
+                return false;
+              b = src[ip++];
+              match_size += b;
+            } while (b==255);
+          }
+          match_size += kMinMatch;
+          if (match_size>raw_size - op)
+            return false;
+
+          // matches may overlap themselves
+          const uint8_t * match = dst + op - offset;
+          if (offset>=match_size)
+          {
+            ::memcpy(dst + op, match, match_size);
+          }
+          else
+          {
+            for (size_t j=0; j<match_size; j++)
+              dst[op + j] = match[j];
+          }
+          op += match_size;
+        }
+      }
+  };
+
+  /************************************************************************/
+  /*registry*/
+  /************************************************************************/
+  struct CodecSlot
+  {
+    boost::atomic<ValueCodec *> codec;
+    boost::atomic<uint64_t> compressed;
+    boost::atomic<uint64_t> skipped;
+    boost::atomic<uint64_t> raw_bytes;
+    boost::atomic<uint64_t> compressed_bytes;
+    boost::atomic<uint64_t> compress_cpu_ns;
+    boost::atomic<uint64_t> decompressed;
+    boost::atomic<uint64_t> decompress_cpu_ns;
+    boost::atomic<uint64_t> failures;
+
+    CodecSlot()
+      : codec(NULL), compressed(0), skipped(0), raw_bytes(0), compressed_bytes(0),
+      compress_cpu_ns(0), decompressed(0), decompress_cpu_ns(0), failures(0) {}
+  };
+
+  class CodecRegistry
+  {
+    private:
+      CodecSlot slots_[kCodecMax];
+
+    public:
+      CodecRegistry()
+      {
+        slots_[kLz4Codec].codec = new Lz4Codec;
+      }
+
+      // NULL, 'id' is out of range
+      CodecSlot * get(int id)
+      {
+        return (id>kNoCodec && id<kCodecMax) ? &slots_[id] : NULL;
+      }
+  } s_registry;
+
+  void tag_value(std::string * out, kCodec codec, size_t raw_size)
+  {
+    out->assign(kTagMagic, kTagMagicSize);
+    out->append(1, static_cast<char>(codec));
+    for (size_t i=0; i<4; i++)
+      out->append(1, static_cast<char>((raw_size >> (i * 8)) & 0xff));
+  }
+}
+
+void register_codec(kCodec id, ValueCodec * codec)
+{
+  CodecSlot * slot = s_registry.get(id);
+  if (slot)
+    slot->codec = codec;
+}
+
+void get_codec_stats(std::vector<CodecStats> * stats)
+{
+  if (stats==NULL)
+    return;
+
+  stats->clear();
+  for (int id=kNoCodec + 1; id<kCodecMax; id++)
+  {
+    CodecSlot * slot = s_registry.get(id);
+    ValueCodec * codec = slot->codec;
+    if (codec==NULL)
+      continue;
+
+    stats->push_back(CodecStats());
+    CodecStats& s = stats->back();
+    s.codec = static_cast<kCodec>(id);
+    s.name = codec->name();
+    s.compressed = slot->compressed;
+    s.skipped = slot->skipped;
+    s.raw_bytes = slot->raw_bytes;
+    s.compressed_bytes = slot->compressed_bytes;
+    s.compress_cpu_ns = slot->compress_cpu_ns;
+    s.decompressed = slot->decompressed;
+    s.decompress_cpu_ns = slot->decompress_cpu_ns;
+    s.failures = slot->failures;
+  }
+}
+
+bool is_value_arg(kCommand command, size_t index)
+{
+  switch (command)
+  {
+    case SET:
+    case SETNX:
+    case GETSET:
+      return index==1;
+    case SETEX:
+    case PSETEX:
+    case HSETNX:
+      return index==2;
+    case HSET:
+    case HMSET:
+      return index>=2 && (index & 1)==0;
+    case MSET:
+    case MSETNX:
+      return (index & 1)==1;
+    default:
+      return false;
+  }
+}
+
+kValueReply value_reply(kCommand command)
+{
+  switch (command)
+  {
+    case GET:
+    case GETSET:
+    case HGET:
+      return kBulkValue;
+    case MGET:
+    case HMGET:
+    case HVALS:
+      return kAllValues;
+    case HGETALL:
+      return kOddValues;
+    default:
+      return kNoValue;
+  }
+}
+
+bool encode_value(const CompressionOptions& options, const std::string& value,
+    std::string * out)
+{
+  if (value.size()<options.min_size || value.size()>kMaxRawSize)
+    return false;
+
+  CodecSlot * slot = s_registry.get(options.codec);
+  ValueCodec * codec = slot ? static_cast<ValueCodec *>(slot->codec) : NULL;
+  if (codec==NULL)
+    return false;
+
+  int64_t begin = thread_cpu_ns();
+  tag_value(out, options.codec, value.size());
+  bool ret = codec->compress(value.data(), value.size(), out) && out->size()<value.size();
+  slot->compress_cpu_ns += static_cast<uint64_t>(thread_cpu_ns() - begin);
+
+  if (!ret)
+  {
+    slot->skipped++;
+    return false;
+  }
+
+  slot->compressed++;
+  slot->raw_bytes += value.size();
+  slot->compressed_bytes += out->size();
+  return true;
+}
+
+int decode_value(const std::string& value, std::string * out)
+{
+  if (value.size()<kTagSize || value.compare(0, kTagMagicSize, kTagMagic)!=0)
+    return 0;
+
+  const uint8_t * tag = reinterpret_cast<const uint8_t *>(value.data());
+  CodecSlot * slot = s_registry.get(tag[kTagMagicSize]);
+  ValueCodec * codec = slot ? static_cast<ValueCodec *>(slot->codec) : NULL;
+  if (codec==NULL)
+    return -1;
+
+  size_t raw_size = 0;
+  for (size_t i=0; i<4; i++)
+    raw_size |= static_cast<size_t>(tag[kTagMagicSize + 1 + i]) << (i * 8);
+
+  int64_t begin = thread_cpu_ns();
+  out->clear();
+  bool ret = raw_size<=kMaxRawSize
+    && codec->decompress(value.data() + kTagSize, value.size() - kTagSize, raw_size, out)
+    && out->size()==raw_size;
+  slot->decompress_cpu_ns += static_cast<uint64_t>(thread_cpu_ns() - begin);
+
+  if (!ret)
+  {
+    slot->failures++;
+    return -1;
+  }
+
+  slot->decompressed++;
+  return 1;
+}
+
+LIBREDIS_NAMESPACE_END
@@ -0,0 +1,132 @@
+/** @file
+ * @brief value compression: codecs, tagged values and their counters
+ * @author yafei.zhang@langtaojin.com
+ * @date
+ * @version
+ *
+ */
+#ifndef _LANGTAOJIN_LIBREDIS_VALUE_CODEC_H_
+#define _LANGTAOJIN_LIBREDIS_VALUE_CODEC_H_
+
+#include "redis_cmd.h"
+
+LIBREDIS_NAMESPACE_BEGIN
+
+enum kCodec
+{
+  kNoCodec = 0,
+  kLz4Codec = 1,// built in, the LZ4 block format
+  kZstdCodec = 2,// not built in, register a ValueCodec over libzstd
+  kCodecMax = 16// placeholder
+};
+
+/************************************************************************/
+/**
+ * CompressionOptions is the opt-in codec layer of a client
+ * (see RedisBase2::set_compression), it is off by default.
+ *
+ * Values(of SET, SETEX, PSETEX, SETNX, GETSET, MSET, MSETNX, HSET, HSETNX and HMSET)
+ * of 'min_size' bytes or more are compressed with 'codec' as they are written,
+ * unless they do not get smaller.
+ * A compressed value is tagged: "\xffRZ", the codec(1 byte),
+ * the raw size(4 bytes, little endian) and the compressed bytes.
+ * UTF-8 text(JSON for example) never begins with 0xff.
+ *
+ * With 'decompress', tagged values(replies of GET, GETSET, HGET, MGET, HMGET,
+ * HVALS and HGETALL) are decompressed as they are read, whatever 'codec' is,
+ * in the replies of EXEC too, untagged(legacy) ones are left as they are.
+ * A value read into a BulkSink is read whole and decompressed before it goes to the sink.
+ * Values streamed with BulkSource and replies of
+ * other commands(GETRANGE, APPEND, lists, sets ...) are the stored bytes.
+ */
+/************************************************************************/
+struct CompressionOptions
+{
+  kCodec codec;
+  size_t min_size;
+  bool decompress;
+
+  CompressionOptions()
+    : codec(kNoCodec), min_size(1024), decompress(false) {}
+
+  explicit CompressionOptions(kCodec _codec, size_t _min_size = 1024)
+    : codec(_codec), min_size(_min_size), decompress(true) {}
+};
+
+// A codec is called by many threads at once.
+class ValueCodec
+{
+  public:
+    virtual ~ValueCodec() {}
+
+    virtual const char * name()const = 0;
+
+    // append the compressed 'size' bytes of 'data' to '*out'
+    // return false, failure, the value is written as it is
+    virtual bool compress(const char * data, size_t size, std::string * out) = 0;
+
+    // append the 'raw_size' bytes decompressed from 'data' to '*out'
+    // return false, 'data' is corrupt
+    virtual bool decompress(const char * data, size_t size,
+        size_t raw_size, std::string * out) = 0;
+};
+
+// 'codec' replaces the one of 'id'(kLz4Codec is built in), it is never freed
+void register_codec(kCodec id, ValueCodec * codec);
+
+// process-wide counters of a registered codec
+struct CodecStats
+{
+  kCodec codec;
+  std::string name;
+  uint64_t compressed;// values compressed
+  uint64_t skipped;// values not getting smaller, written as they are
+  uint64_t raw_bytes;// bytes of compressed values before compression
+  uint64_t compressed_bytes;// and after, with tags
+  uint64_t compress_cpu_ns;// thread CPU time compressing, skipped values included
+  uint64_t decompressed;
+  uint64_t decompress_cpu_ns;
+  uint64_t failures;// corrupt values
+
+  CodecStats()
+    : codec(kNoCodec), compressed(0), skipped(0), raw_bytes(0), compressed_bytes(0),
+    compress_cpu_ns(0), decompressed(0), decompress_cpu_ns(0), failures(0) {}
+
+  // raw bytes per compressed byte, 0 means none is compressed
+  double ratio()const
+  {
+    return compressed_bytes ? static_cast<double>(raw_bytes) / compressed_bytes : 0.0;
+  }
+};
+
+void get_codec_stats(std::vector<CodecStats> * stats);
+
+/************************************************************************/
+/*tagged values, RedisProtocol applies them*/
+/************************************************************************/
+// the values of 'command', its arguments(not counting the name) or its reply
+bool is_value_arg(kCommand command, size_t index);
+
+enum kValueReply
+{
+  kNoValue,
+  kBulkValue,// the bulk
+  kAllValues,// all elements
+  kOddValues// elements 1, 3, 5 ...(values of field-value pairs)
+};
+
+kValueReply value_reply(kCommand command);
+
+// compress 'value' into '*out'(tagged) with 'options'
+// return false, it is written as it is
+bool encode_value(const CompressionOptions& options, const std::string& value,
+    std::string * out);
+
+// return 1, 'value' is tagged and decompressed into '*out'
+// return 0, it is not tagged
+// return -1, it is tagged but corrupt(or its codec is not registered)
+int decode_value(const std::string& value, std::string * out);
+
+LIBREDIS_NAMESPACE_END
+
+#endif// _LANGTAOJIN_LIBREDIS_VALUE_CODEC_H_
@@ -8,16 +8,28 @@
 #include <redis_common.h>
 #include <os.h>
 #include <redis_protocol.h>
+#include <redis_transport.h>
 #include <redis_cmd.h>
 #include <redis_base.h>
 #include <redis.h>
 #include <redis_partition.h>
 #include <redis_tss.h>
+#include <single_flight.h>
+#include <host_resolver.h>
+#include <reconnect_backoff.h>
+#include <latency_tracker.h>
+#include <counter_aggregator.h>
+#include <redis_runtime.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fstream>
 #include <iostream>
 #include <boost/program_options.hpp>
+#include <boost/algorithm/string.hpp>
 #include <boost/assign/std/vector.hpp>
 #include <boost/bind.hpp>
 #include <boost/date_time/microsec_time_clock.hpp>
+#include <boost/lexical_cast.hpp>
 #include <boost/thread.hpp>
 
 USING_LIBREDIS_NAMESPACE
@@ -97,15 +109,101 @@ namespace
     cout << "redis version: " << s_redis_version << endl;
   }
 
+  // resident pages of the process, 0 if it is unknown
+  size_t resident_pages()
+  {
+    std::ifstream statm("/proc/self/statm");
+    size_t size = 0, resident = 0;
+    if (!(statm >> size >> resident))
+      return 0;
+    return resident;
+  }
+
   int os_test()
   {
     cout << "os_test..." << endl;
     cout << "thread id: " << get_thread_id() << endl;
     cout << "host name: " << get_host_name() << endl;
+
+    // spin_read: 'timeout' bounds the spin too, a failure is not a hit
+    int fds[2];
+    char c;
+    int hit;
+    VERIFY(socketpair(AF_UNIX, SOCK_STREAM, 0, fds)==0);
+    VERIFY(set_nonblock(fds[0])==0);
+    int64_t begin = monotonic_us();
+    VERIFY(spin_read(fds[0], &c, 1, 0, 20, 200000, &hit)==-1 && hit==0);
+    VERIFY(monotonic_us() - begin<150000);
+    VERIFY(write(fds[1], "x", 1)==1);
+    VERIFY(spin_read(fds[0], &c, 1, 0, 20, 1000, &hit)==1 && hit==1 && c=='x');
+    (void)safe_close(fds[0]);
+    (void)safe_close(fds[1]);
+    VERIFY(spin_read(fds[0], &c, 1, 0, 20, 1000, &hit)==-1 && hit==0);
+
     cout << "os_test ok" << endl;
     return 0;
   }
 
+  // accept one connection on 'listen_fd' and reply "+PONG" to what it sends
+  void pong_once(int listen_fd)
+  {
+    int fd = accept(listen_fd, NULL, NULL);
+    if (fd==-1)
+      return;
+    char buf[64];
+    if (read(fd, buf, sizeof(buf))>0 && write(fd, "+PONG\r\n", 7)==7)
+      (void)read(fd, buf, sizeof(buf));
+    (void)safe_close(fd);
+  }
+
+  int unix_socket_test()
+  {
+    cout << "unix_socket_test..." << endl;
+
+    // path length limits
+    net_endpoint ep;
+    const size_t max_path = sizeof(ep.address.un.sun_path) - 1;
+    errno = 0;
+    VERIFY(resolve_unix("", &ep)==-1 && errno==EINVAL);
+    errno = 0;
+    VERIFY(resolve_unix(std::string(max_path + 1, 'x').c_str(), &ep)==-1 && errno==ENAMETOOLONG);
+    std::string longest = "/" + std::string(max_path - 1, 'x');
+    VERIFY(resolve_unix(longest.c_str(), &ep)==0 && ep.domain==AF_UNIX);
+    VERIFY(longest==ep.address.un.sun_path);
+    VERIFY(net_endpoint_length(&ep)==offsetof(struct sockaddr_un, sun_path) + max_path + 1);
+
+    // "unix:" hosts, the port is ignored
+    Redis2 empty("unix:", port, 0, timeout);
+    VERIFY(!empty.ping() && empty.last_error().find(strerror(EINVAL))!=std::string::npos);
+    Redis2 too_long("unix:" + longest + "x", port, 0, timeout);
+    VERIFY(!too_long.ping()
+        && too_long.last_error().find(strerror(ENAMETOOLONG))!=std::string::npos);
+    Redis2 missing("unix:/nonexistent/libredis.sock", port, 0, timeout);
+    VERIFY(!missing.ping() && missing.last_error().find(strerror(ENOENT))!=std::string::npos);
+
+    std::string path = "/tmp/libredis_test_" + boost::lexical_cast<std::string>(getpid()) + ".sock";
+    VERIFY(resolve_unix(path.c_str(), &ep)==0);
+    int listen_fd = socket(ep.domain, ep.type, ep.protocol);
+    VERIFY(listen_fd!=-1);
+    (void)unlink(path.c_str());
+    VERIFY(bind(listen_fd, (const struct sockaddr *)&ep.address.un, net_endpoint_length(&ep))==0);
+    VERIFY(listen(listen_fd, 1)==0);
+
+    boost::thread server(boost::bind(pong_once, listen_fd));
+    Redis2 r("unix:" + path, "", 0, timeout);
+    VERIFY_MSG(r.ping(), r);
+    r.close();
+    server.join();
+    (void)safe_close(listen_fd);
+
+    // nobody listens on the path any more
+    VERIFY(!r.ping() && r.last_error().find(strerror(ECONNREFUSED))!=std::string::npos);
+    (void)unlink(path.c_str());
+
+    cout << "unix_socket_test ok" << endl;
+    return 0;
+  }
+
   int protocol_test()
   {
     cout << "protocol_test..." << endl;
@@ -232,6 +330,1494 @@ namespace
     return 0;
   }
 
+  int reconnect_backoff_test()
+  {
+    cout << "reconnect_backoff_test..." << endl;
+
+    int64_t wait_ms;
+    int failures;
+    set_reconnect_backoff(100, 400);
+
+    // base * 2^(failures-1) with jitter in [50%, 100%], capped by max
+    for (int f=1; f<=5; f++)
+    {
+      ReconnectBackoff::on_failure("memory", "growth");
+      VERIFY(!ReconnectBackoff::allow("memory", "growth", &wait_ms, &failures));
+      int64_t backoff = std::min(100 << (f - 1), 400);
+      VERIFY(failures==f && wait_ms>=backoff / 2 && wait_ms<=backoff);
+    }
+    ReconnectBackoff::on_success("memory", "growth");
+    VERIFY(ReconnectBackoff::allow("memory", "growth", &wait_ms, &failures));
+
+    // the jitter spreads endpoints failing together
+    int64_t min_wait = 100, max_wait = 0;
+    for (int i=0; i<50; i++)
+    {
+      std::string port = "jitter" + boost::lexical_cast<std::string>(i);
+      ReconnectBackoff::on_failure("memory", port);
+      VERIFY(!ReconnectBackoff::allow("memory", port, &wait_ms, &failures));
+      min_wait = std::min(min_wait, wait_ms);
+      max_wait = std::max(max_wait, wait_ms);
+      ReconnectBackoff::on_success("memory", port);
+    }
+    VERIFY(min_wait>=50 && max_wait<=100 && max_wait - min_wait>=20);
+
+    // a max below the base is the base, the default max is 5 s
+    set_reconnect_backoff(100, 0);
+    for (int f=1; f<=10; f++)
+      ReconnectBackoff::on_failure("memory", "cap");
+    VERIFY(!ReconnectBackoff::allow("memory", "cap", &wait_ms, &failures));
+    VERIFY(failures==10 && wait_ms<=100);
+    ReconnectBackoff::on_success("memory", "cap");
+    set_reconnect_backoff(100, 5000);
+    for (int f=1; f<=10; f++)
+      ReconnectBackoff::on_failure("memory", "cap");
+    VERIFY(!ReconnectBackoff::allow("memory", "cap", &wait_ms, &failures));
+    VERIFY(wait_ms>=2500 && wait_ms<=5000);
+    ReconnectBackoff::on_success("memory", "cap");
+
+    // a client fails fast while it backs off, then probes, and a success resets it
+    set_reconnect_backoff(20, 80);
+    MemoryTransport * transport = new MemoryTransport("+OK\r\n");
+    transport->set_connect_error(ECONNREFUSED);
+    Redis2 r("memory", "backoff", 0, timeout, transport);
+
+    VERIFY(!r.set("key", "value"));
+    uint64_t connects = transport->connects();
+    VERIFY(connects>0 && !is_backoff_error(r.last_error()));
+    VERIFY(!r.set("key", "value"));
+    VERIFY(transport->connects()==connects && is_backoff_error(r.last_error()));
+
+    boost::this_thread::sleep(boost::posix_time::milliseconds(30));
+    VERIFY(!r.set("key", "value"));
+    VERIFY(transport->connects()>connects);
+    connects = transport->connects();
+    VERIFY(!r.set("key", "value"));
+    VERIFY(transport->connects()==connects && is_backoff_error(r.last_error()));
+
+    transport->set_connect_error(0);
+    boost::this_thread::sleep(boost::posix_time::milliseconds(90));
+    VERIFY_MSG(r.set("key", "value"), r);
+    VERIFY(ReconnectBackoff::allow("memory", "backoff", &wait_ms, &failures));
+
+    set_reconnect_backoff(100, 5000);
+
+    cout << "reconnect_backoff_test ok" << endl;
+    return 0;
+  }
+
+  // 'count' latencies of 'us' and one of 'outlier_us'(0 means none)
+  void record_latencies(LatencyHistogram * histogram, int count, int64_t us, int64_t outlier_us)
+  {
+    for (int i=0; i<count; i++)
+      histogram->record(us, false);
+    if (outlier_us)
+      histogram->record(outlier_us, true);
+  }
+
+  int latency_histogram_test()
+  {
+    cout << "latency_histogram_test..." << endl;
+
+    // log-linear buckets, 4 per power of 2, below 25% relative error
+    VERIFY(LatencyHistogram::bucket_of(-1)==0 && LatencyHistogram::bucket_of(3)==3);
+    VERIFY(LatencyHistogram::bucket_of(4)==4 && LatencyHistogram::bucket_upper(4)==5);
+    VERIFY(LatencyHistogram::bucket_of(static_cast<int64_t>(1) << 40)
+        ==LatencyHistogram::kBuckets - 1);
+    for (int64_t us=0; us<(static_cast<int64_t>(1) << 28); us+=1 + us / 7)
+    {
+      size_t b = LatencyHistogram::bucket_of(us);
+      VERIFY(us<LatencyHistogram::bucket_upper(b));
+      VERIFY(b==0 || us>=LatencyHistogram::bucket_upper(b - 1));
+      VERIFY(us<4 || LatencyHistogram::bucket_upper(b) - us<=us / 4);
+    }
+
+    // p99 * 3, in [5, 1000] ms, of 100 samples at least
+    const AdaptiveTimeout saved = get_adaptive_timeout();
+    AdaptiveTimeout adaptive;
+    set_adaptive_timeout(adaptive);
+    AdaptiveTimeoutStats stats;
+
+    {
+      // not enough samples
+      LatencyHistogram histogram("memory", "latency", kReadCommand);
+      record_latencies(&histogram, 99, 2000, 0);
+      VERIFY(histogram.timeout_ms()==0);
+      histogram.get_stats(&stats);
+      VERIFY(stats.samples==99 && stats.decisions==1 && stats.timeout_ms==0);
+    }
+
+    {
+      // 2000us is in [1792, 2048), the budget is 2048us * 3
+      LatencyHistogram histogram("memory", "latency", kReadCommand);
+      record_latencies(&histogram, 100, 2000, 0);
+      VERIFY(histogram.timeout_ms()==7);
+      histogram.get_stats(&stats);
+      VERIFY(stats.percentile_us==2048 && stats.clamped_min==0 && stats.clamped_max==0);
+      // a decision lasts a while
+      record_latencies(&histogram, 100, 100000, 0);
+      VERIFY(histogram.timeout_ms()==7);
+    }
+
+    {
+      // the outlier is above p99, the budget is clamped to min_ms
+      LatencyHistogram histogram("memory", "latency", kReadCommand);
+      record_latencies(&histogram, 99, 100, 500000);
+      VERIFY(histogram.timeout_ms()==adaptive.min_ms);
+      histogram.get_stats(&stats);
+      VERIFY(stats.percentile_us==112 && stats.clamped_min==1 && stats.timeouts==1);
+    }
+
+    {
+      // p99.99 takes the outlier, the budget is clamped to max_ms
+      adaptive.percentile = 99.99;
+      set_adaptive_timeout(adaptive);
+      LatencyHistogram histogram("memory", "latency", kReadCommand);
+      record_latencies(&histogram, 99, 100, 500000);
+      VERIFY(histogram.timeout_ms()==adaptive.max_ms);
+      histogram.get_stats(&stats);
+      VERIFY(stats.percentile_us>500000 && stats.clamped_max==1);
+      adaptive.percentile = 99.0;
+    }
+
+    {
+      // samples leave after two halves of the window
+      adaptive.window_s = 2;
+      set_adaptive_timeout(adaptive);
+      LatencyHistogram histogram("memory", "latency", kReadCommand);
+      record_latencies(&histogram, 100, 2000, 0);
+      histogram.get_stats(&stats);
+      VERIFY(stats.samples==100);
+      boost::this_thread::sleep(boost::posix_time::milliseconds(2100));
+      histogram.get_stats(&stats);
+      VERIFY(stats.samples==0);
+      VERIFY(histogram.timeout_ms()==0);
+    }
+
+    set_adaptive_timeout(saved);
+
+    cout << "latency_histogram_test ok" << endl;
+    return 0;
+  }
+
+  // write a byte to 'fd' every 'interval_ms', 'count' times
+  void trickle(int fd, int count, int interval_ms)
+  {
+    for (int i=0; i<count; i++)
+    {
+      boost::this_thread::sleep(boost::posix_time::milliseconds(interval_ms));
+      if (write(fd, "x", 1)!=1)
+        return;
+    }
+  }
+
+  int deadline_test()
+  {
+    cout << "deadline_test..." << endl;
+
+    VERIFY(deadline_of(-1)==0 && timeout_of(0)==-1);
+    int64_t deadline = deadline_of(50);
+    VERIFY(timeout_of(deadline)>0 && timeout_of(deadline)<=50);
+    VERIFY(timeout_of(monotonic_us() - 1)==0);
+
+    // 'timeout' bounds the whole timed_readn or timed_writen, not each poll
+    int fds[2];
+    char buf[16];
+    VERIFY(socketpair(AF_UNIX, SOCK_STREAM, 0, fds)==0);
+    boost::thread writer(boost::bind(trickle, fds[1], 10, 20));
+    int64_t begin = monotonic_us();
+    int n = timed_readn(fds[0], buf, 10, 0, 100);
+    int64_t elapsed = monotonic_us() - begin;
+    writer.join();
+    VERIFY(n>0 && n<10 && elapsed>=90000 && elapsed<180000);
+
+    VERIFY(set_nonblock(fds[0])==0);
+    std::string large(8 * 1024 * 1024, 'x');
+    begin = monotonic_us();
+    n = timed_writen(fds[0], large.data(), large.size(), 0, 50);
+    elapsed = monotonic_us() - begin;
+    VERIFY(n>0 && static_cast<size_t>(n)<large.size() && elapsed>=45000 && elapsed<150000);
+    (void)safe_close(fds[0]);
+    (void)safe_close(fds[1]);
+
+    // an expired deadline fails the call before the write
+    MemoryTransport * transport = new MemoryTransport("+OK\r\n");
+    Redis2 r("memory", "deadline", 0, timeout, transport);
+    VERIFY_MSG(r.set("key", "value"), r);
+    uint64_t writes = transport->writes();
+    r.set_deadline(deadline_after(0));
+    VERIFY(!r.set("key", "value"));
+    VERIFY(transport->writes()==writes && strstr(r.last_c_error(), "deadline exceeded"));
+    r.set_deadline(0);
+
+    // a pipeline has one budget, not one for each command
+    MemoryTransport * slow_transport = new MemoryTransport("+OK\r\n");
+    Redis2 slow("memory", "deadline", 0, 100, slow_transport);
+    slow_transport->set_read_delay(40);
+    VERIFY_MSG(slow.set("key", "value"), slow);
+    redis_command_vector_t commands;
+    for (int i=0; i<3; i++)
+    {
+      commands.push_back(new RedisCommand(SET));
+      commands.back()->push_arg("key");
+      commands.back()->push_arg("value");
+    }
+    VERIFY(!slow.exec_pipeline(&commands));
+    VERIFY(commands[0]->out.is_status_ok() && commands[1]->out.is_status_ok());
+    VERIFY(!commands[2]->out.is_status_ok());
+    clear_commands(&commands);
+
+    // so do the calls in a FanoutDeadline, a deadline set before is kept
+    transport->set_read_delay(40);
+    {
+      FanoutDeadline fanout_deadline(&r, kReadCommand, 100);
+      VERIFY(r.get_deadline()!=0);
+      VERIFY_MSG(r.set("key", "value"), r);
+      VERIFY_MSG(r.set("key", "value"), r);
+      VERIFY(!r.set("key", "value"));
+    }
+    VERIFY(r.get_deadline()==0);
+    {
+      ScopedDeadline scoped_deadline(&r, 1000);
+      deadline = r.get_deadline();
+      {
+        FanoutDeadline fanout_deadline(&r, kReadCommand, 100);
+        VERIFY(r.get_deadline()==deadline);
+      }
+      VERIFY(r.get_deadline()==deadline);
+    }
+    VERIFY(r.get_deadline()==0);
+
+    cout << "deadline_test ok" << endl;
+    return 0;
+  }
+
+  int memory_transport_test()
+  {
+    cout << "memory_transport_test..." << endl;
+
+    std::string bulk;
+    int64_t i;
+    mbulk_t mbulks;
+    MemoryTransport * transport = new MemoryTransport(
+        "+OK\r\n"
+        "$5\r\nvalue\r\n"
+        ":42\r\n"
+        "*2\r\n$1\r\na\r\n$-1\r\n", false);
+    transport->set_capture(true);
+    Redis2 r("memory", "0", 0, timeout, transport);
+
+    VERIFY_MSG(r.set("key", "value"), r);
+    VERIFY(transport->written()=="*3\r\n$3\r\nSET\r\n$3\r\nkey\r\n$5\r\nvalue\r\n");
+    transport->clear_written();
+
+    bool is_nil;
+    VERIFY_MSG(r.get("key", &bulk, &is_nil), r);
+    VERIFY(!is_nil && bulk=="value");
+    VERIFY(transport->written()=="*2\r\n$3\r\nGET\r\n$3\r\nkey\r\n");
+
+    VERIFY_MSG(r.incr("key", &i), r);
+    VERIFY(i==42);
+
+    string_vector_t keys;
+    keys += "a", "b";
+    VERIFY_MSG(r.mget(keys, &mbulks), r);
+    VERIFY(mbulks.size()==2 && mbulks[0] && *mbulks[0]=="a" && mbulks[1]==NULL);
+    clear_mbulks(&mbulks);
+
+    // the canned stream is exhausted
+    VERIFY(!r.get("key", &bulk, &is_nil));
+    VERIFY(transport->writes()==5);
+
+    cout << "memory_transport_test ok" << endl;
+    return 0;
+  }
+
+  class CountingVisitor : public ReplyVisitor
+  {
+    public:
+      int64_t size;
+      string_vector_t elements;
+      size_t limit;
+
+      explicit CountingVisitor(size_t _limit) : size(0), limit(_limit) {}
+
+      virtual void on_size(int64_t _size)
+      {
+        size = _size;
+      }
+
+      virtual bool on_element(int64_t index, std::string * bulk)
+      {
+        (void)index;
+        elements.push_back(bulk ? *bulk : "(nil)");
+        return elements.size()<limit;
+      }
+  };
+
+  int stream_test()
+  {
+    cout << "stream_test..." << endl;
+
+    std::string bulk;
+    bool is_nil;
+    MemoryTransport * transport = new MemoryTransport(
+        "*3\r\n$1\r\na\r\n$-1\r\n$1\r\nc\r\n"
+        "*3\r\n$1\r\na\r\n$1\r\nb\r\n$1\r\nc\r\n"
+        "$5\r\nvalue\r\n", false);
+    Redis2 r("memory", "0", 0, timeout, transport);
+
+    CountingVisitor all(100);
+    VERIFY_MSG(r.lrange("list", 0, -1, &all), r);
+    VERIFY(all.size==3 && all.elements.size()==3 && all.elements[1]=="(nil)");
+
+    // stop early, the rest is drained
+    CountingVisitor first(1);
+    VERIFY_MSG(r.smembers("set", &first), r);
+    VERIFY(first.size==3 && first.elements.size()==1 && first.elements[0]=="a");
+
+    VERIFY_MSG(r.get("key", &bulk, &is_nil), r);
+    VERIFY(bulk=="value");
+
+    cout << "stream_test ok" << endl;
+    return 0;
+  }
+
+  bool append_to(std::string * bulk, const char * data, size_t size)
+  {
+    bulk->append(data, size);
+    return true;
+  }
+
+  // a temporary file holding 'content'
+  int temp_file(const std::string& content, std::string * path)
+  {
+    char name[] = "/tmp/libredis_test_XXXXXX";
+    int fd = mkstemp(name);
+    if (fd==-1)
+      return -1;
+    *path = name;
+    if (!content.empty()
+        && ::write(fd, content.data(), content.size())!=static_cast<ssize_t>(content.size()))
+      return -1;
+    return fd;
+  }
+
+  int bulk_stream_test()
+  {
+    cout << "bulk_stream_test..." << endl;
+
+    std::string bulk;
+    bool is_nil;
+
+    // pieces through the default way of RedisTransport
+    {
+      MemoryTransport * transport = new MemoryTransport("+OK\r\n$5\r\nvalue\r\n$-1\r\n", false);
+      transport->set_capture(true);
+      Redis2 r("memory", "0", 0, timeout, transport);
+
+      MemorySource source("value", 5);
+      VERIFY_MSG(r.set("key", &source), r);
+      VERIFY(transport->written()=="*3\r\n$3\r\nSET\r\n$3\r\nkey\r\n$5\r\nvalue\r\n");
+
+      CallbackSink sink(boost::bind(append_to, &bulk, _1, _2));
+      VERIFY_MSG(r.get("key", &sink, &is_nil), r);
+      VERIFY(!is_nil && bulk=="value");
+      VERIFY_MSG(r.get("nil", &sink, &is_nil), r);
+      VERIFY(is_nil);
+    }
+
+    // files through the socket, with sendfile() and splice()
+    {
+      std::string large(300 * 1024, '\0');
+      for (size_t i=0; i<large.size(); i++)
+        large[i] = static_cast<char>(i * 7 + i / 251);
+
+      std::string in_path, out_path;
+      int in_fd = temp_file(large, &in_path);
+      int out_fd = temp_file("", &out_path);
+      VERIFY(in_fd!=-1 && out_fd!=-1);
+
+      Redis2 r(host, port, db_index, timeout);
+      FdSource source(in_fd, 0, large.size());
+      VERIFY_MSG(r.set("bulk_stream", &source), r);
+
+      FdSink sink(out_fd);
+      VERIFY_MSG(r.get("bulk_stream", &sink, &is_nil), r);
+      VERIFY(!is_nil);
+
+      std::string copy(large.size() + 1, '\0');
+      VERIFY(::pread(out_fd, &copy[0], copy.size(), 0)==static_cast<ssize_t>(large.size()));
+      copy.resize(large.size());
+      VERIFY(copy==large);
+
+      // the connection is still in step
+      VERIFY_MSG(r.get("bulk_stream", &bulk, &is_nil), r);
+      VERIFY(bulk==large);
+
+      (void)::close(in_fd);
+      (void)::close(out_fd);
+      (void)::unlink(in_path.c_str());
+      (void)::unlink(out_path.c_str());
+    }
+
+    cout << "bulk_stream_test ok" << endl;
+    return 0;
+  }
+
+  int command_table_test()
+  {
+    cout << "command_table_test..." << endl;
+
+    for (int i=NOOP + 1; i<COMMAND_MAX; i++)
+    {
+      const CommandInfo& info = RedisInput(static_cast<kCommand>(i)).command_info();
+      std::string name = boost::algorithm::to_lower_copy(info.command_str);
+      VERIFY(RedisInput(name).command()==i);
+      VERIFY(RedisInput(info.command_str).command()==i);
+      VERIFY(std::string(info.header, info.header_size)
+          =="$" + boost::lexical_cast<std::string>(name.size()) + "\r\n"
+          + info.command_str + "\r\n");
+    }
+    VERIFY(RedisInput("").command()==NOOP);
+    VERIFY(RedisInput("SETT").command()==NOOP);
+    VERIFY(RedisInput("noop").command()==NOOP);
+    VERIFY(RedisInput("COMMAND_MAX").command()==NOOP);
+
+    cout << "command_table_test ok" << endl;
+    return 0;
+  }
+
+  int compression_test()
+  {
+    cout << "compression_test..." << endl;
+
+    std::string json;
+    for (int i=0; i<200; i++)
+      json += "{\"id\":" + boost::lexical_cast<std::string>(i) + ",\"name\":\"item\",\"tags\":[\"a\",\"b\"]},";
+    std::string encoded, decoded;
+    std::string bulk;
+    bool is_nil;
+
+    // tagged values
+    CompressionOptions options(kLz4Codec, 64);
+    VERIFY(encode_value(options, json, &encoded));
+    VERIFY(encoded.size()<json.size() / 4 && encoded.compare(0, 3, "\xffRZ")==0);
+    VERIFY(decode_value(encoded, &decoded)==1 && decoded==json);
+    VERIFY(decode_value(json, &decoded)==0);
+    VERIFY(!encode_value(options, "short", &encoded));
+    encoded.resize(encoded.size() - 1);
+    VERIFY(decode_value(encoded, &decoded)==-1);
+    // a raw size the block can not expand to
+    VERIFY(encode_value(options, json, &encoded));
+    encoded.replace(4, 4, "\xff\xff\xff\x7f");
+    std::string corrupt;
+    VERIFY(decode_value(encoded, &corrupt)==-1 && corrupt.capacity()<json.size());
+
+    std::string noise(4096, '\0');
+    uint64_t x = 1;
+    for (size_t i=0; i<noise.size(); i++)
+    {
+      x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+      noise[i] = static_cast<char>(x >> 56);
+    }
+    VERIFY(!encode_value(options, noise, &encoded));
+
+    // a compressing client and a legacy one
+    Redis2 r(host, port, db_index, timeout);
+    Redis2 legacy(host, port, db_index, timeout);
+    r.set_compression(options);
+    VERIFY(r.get_compression().codec==kLz4Codec);
+
+    VERIFY_MSG(r.set("compressed", json), r);
+    VERIFY_MSG(legacy.get("compressed", &bulk, &is_nil), legacy);
+    VERIFY(bulk.size()<json.size() && bulk.compare(0, 3, "\xffRZ")==0);
+    VERIFY_MSG(r.get("compressed", &bulk, &is_nil), r);
+    VERIFY(!is_nil && bulk==json);
+
+    VERIFY_MSG(legacy.set("raw", json), legacy);
+    mbulk_t mbulks;
+    string_vector_t keys;
+    keys.push_back("compressed");
+    keys.push_back("raw");
+    VERIFY_MSG(r.mget(keys, &mbulks), r);
+    VERIFY(mbulks.size()==2 && *mbulks[0]==json && *mbulks[1]==json);
+    clear_mbulks(&mbulks);
+
+    string_vector_t fields(1, "field"), values(1, json);
+    VERIFY_MSG(r.hmset("compressed_hash", fields, values), r);
+    string_pair_vector_t pairs;
+    VERIFY_MSG(r.hgetall("compressed_hash", &pairs), r);
+    VERIFY(pairs.size()==1 && pairs[0].first=="field" && pairs[0].second==json);
+
+    // replies in EXEC, by the queued commands
+    RedisCommand get_c(GET), mget_c(MGET), hgetall_c(HGETALL);
+    get_c.push_arg("compressed");
+    mget_c.push_arg(keys);
+    hgetall_c.push_arg("compressed_hash");
+    VERIFY_MSG(r.multi(), r);
+    VERIFY_MSG(r.add_command(&get_c), r);
+    VERIFY_MSG(r.add_command(&mget_c), r);
+    VERIFY_MSG(r.add_command(&hgetall_c), r);
+    redis_command_vector_t commands;
+    VERIFY_MSG(r.exec(&commands), r);
+    VERIFY(commands.size()==3);
+    VERIFY(commands[0]->out.is_bulk() && *commands[0]->out.ptr.bulk==json);
+    VERIFY(commands[1]->out.is_mbulks() && commands[1]->out.ptr.mbulks->size()==2);
+    VERIFY(*(*commands[1]->out.ptr.mbulks)[0]==json && *(*commands[1]->out.ptr.mbulks)[1]==json);
+    VERIFY(commands[2]->out.is_mbulks() && commands[2]->out.ptr.mbulks->size()==2);
+    VERIFY(*(*commands[2]->out.ptr.mbulks)[0]=="field" && *(*commands[2]->out.ptr.mbulks)[1]==json);
+    clear_commands(&commands);
+
+    // into a sink
+    bulk.clear();
+    CallbackSink sink(boost::bind(append_to, &bulk, _1, _2));
+    VERIFY_MSG(r.get("compressed", &sink, &is_nil), r);
+    VERIFY(!is_nil && bulk==json);
+    bulk.clear();
+    VERIFY_MSG(r.hget("compressed_hash", "field", &sink, &is_nil), r);
+    VERIFY(!is_nil && bulk==json);
+    bulk.clear();
+    VERIFY_MSG(legacy.get("compressed", &sink, &is_nil), legacy);
+    VERIFY(bulk.compare(0, 3, "\xffRZ")==0);
+
+    std::vector<CodecStats> stats;
+    get_codec_stats(&stats);
+    VERIFY(!stats.empty() && stats[0].codec==kLz4Codec && stats[0].name=="lz4");
+    VERIFY(stats[0].compressed>=2 && stats[0].decompressed>=3 && stats[0].ratio()>4.0);
+
+    cout << "compression_test ok" << endl;
+    return 0;
+  }
+
+  int near_cache_test()
+  {
+    cout << "near_cache_test..." << endl;
+
+    NearCacheOptions options;
+    options.shards = 2;
+    options.max_entries = 4;
+    options.ttl_ms = 200;
+    NearCache cache(options);
+    Redis2 r(host, port, db_index, timeout);
+    Redis2 other(host, port, db_index, timeout);
+    r.set_near_cache(&cache);
+    VERIFY(r.get_near_cache()==&cache);
+    std::string value;
+    bool is_nil;
+    int64_t deleted;
+
+    // hits, and invalidations of local writes
+    VERIFY_MSG(r.set("near", "1"), r);
+    VERIFY_MSG(r.get("near", &value, &is_nil), r);
+    VERIFY_MSG(other.set("near", "2"), other);
+    VERIFY_MSG(r.get("near", &value, &is_nil), r);
+    VERIFY(!is_nil && value=="1");
+    VERIFY(cache.get_stats().hits==1 && cache.get_stats().misses==1);
+    VERIFY_MSG(r.set("near", "3"), r);
+    VERIFY_MSG(r.get("near", &value, &is_nil), r);
+    VERIFY(value=="3");
+
+    VERIFY_MSG(r.hset("near_hash", "f", "1", &deleted), r);
+    VERIFY_MSG(r.hget("near_hash", "f", &value, &is_nil), r);
+    VERIFY_MSG(r.hget("near_hash", "g", &value, &is_nil), r);
+    VERIFY(is_nil);
+    VERIFY_MSG(r.hget("near_hash", "g", &value, &is_nil), r);
+    VERIFY(is_nil && cache.get_stats().hits==2);
+    VERIFY_MSG(r.hset("near_hash", "g", "2", &deleted), r);
+    VERIFY_MSG(r.hget("near_hash", "g", &value, &is_nil), r);
+    VERIFY(!is_nil && value=="2");
+
+    // writes of other processes are seen after the TTL
+    VERIFY_MSG(other.set("near", "4"), other);
+    boost::this_thread::sleep(boost::posix_time::milliseconds(options.ttl_ms + 50));
+    VERIFY_MSG(r.get("near", &value, &is_nil), r);
+    VERIFY(value=="4");
+
+    // transactions and pipelines
+    VERIFY_MSG(r.multi(), r);
+    RedisCommand c(SET);
+    c.push_arg("near");
+    c.push_arg("5");
+    VERIFY_MSG(r.add_command(&c), r);
+    redis_command_vector_t commands;
+    VERIFY_MSG(r.exec(&commands), r);
+    clear_commands(&commands);
+    VERIFY_MSG(r.get("near", &value, &is_nil), r);
+    VERIFY(value=="5");
+
+    Pipeline pipeline(&r);
+    VERIFY_MSG(pipeline.del("near", &deleted), pipeline);
+    VERIFY_MSG(pipeline.execute(), pipeline);
+    VERIFY_MSG(r.get("near", &value, &is_nil), r);
+    VERIFY(is_nil);
+
+    // a bounded size
+    for (int i=0; i<8; i++)
+      VERIFY_MSG(r.get("near_" + boost::lexical_cast<std::string>(i), &value, &is_nil), r);
+    NearCacheStats stats = cache.get_stats();
+    VERIFY(stats.entries<=4 && stats.evictions>0);
+
+    // writes published to the channel
+    options.channel = "near_cache_test";
+    options.host = host;
+    options.port = port;
+    options.ttl_ms = 60000;
+    NearCache cache1(options), cache2(options);
+    Redis2 r1(host, port, db_index, timeout), r2(host, port, db_index, timeout);
+    r1.set_near_cache(&cache1);
+    r2.set_near_cache(&cache2);
+    for (int i=0; i<100 && cache2.get_stats().resets==0; i++)
+      boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+
+    VERIFY_MSG(r2.get("near", &value, &is_nil), r2);
+    VERIFY_MSG(r1.set("near", "6"), r1);
+    for (int i=0; i<100 && (cache2.get_stats().received==0 || cache1.get_stats().published==0); i++)
+      boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+    VERIFY(cache1.get_stats().published==1);
+    VERIFY_MSG(r2.get("near", &value, &is_nil), r2);
+    VERIFY(!is_nil && value=="6");
+
+    // a pipeline broken when its replies are read, the commands after it may be done
+    {
+      NearCache dropped(options);
+      Redis2 m("memory", "0", 0, timeout, new MemoryTransport("$1\r\n1\r\n+OK\r\n", false));
+      m.set_near_cache(&dropped);
+      VERIFY_MSG(m.get("near_dropped", &value, &is_nil), m);
+      NearCache::stamp_t stamp;
+      VERIFY(dropped.get("0", "near_dropped", NULL, &value, &is_nil, &stamp));
+
+      CommandBatch batch;
+      batch.add(SET)->push_arg("a");
+      batch[0]->push_arg("1");
+      batch.add(SET)->push_arg("b");
+      batch[1]->push_arg("1");
+      batch.add(SET)->push_arg("near_dropped");
+      batch[2]->push_arg("2");
+      VERIFY(!m.exec_pipeline(batch.commands()));
+      VERIFY(!dropped.get("0", "near_dropped", NULL, &value, &is_nil, &stamp));
+    }
+
+    // commands written by formats, and entries of dbs
+    {
+      NearCache formatted(options);
+      Redis2 m("memory", "0", 0, timeout, new MemoryTransport(
+            "$1\r\na\r\n+OK\r\n$1\r\nb\r\n+OK\r\n$1\r\nc\r\n+OK\r\n", false));
+      m.set_near_cache(&formatted);
+      VERIFY_MSG(m.get("k", &value, &is_nil), m);
+      VERIFY(value=="a");
+      RedisCommand c;
+      VERIFY_MSG(m.exec_command(&c, "SET k b"), m);
+      VERIFY_MSG(m.get("k", &value, &is_nil), m);
+      VERIFY(value=="b");
+
+      VERIFY_MSG(m.select(1), m);
+      VERIFY_MSG(m.get("k", &value, &is_nil), m);
+      VERIFY(value=="c");
+      VERIFY_MSG(m.select(0), m);
+      VERIFY_MSG(m.get("k", &value, &is_nil), m);
+      VERIFY(value=="b");
+    }
+
+    cout << "near_cache_test ok" << endl;
+    return 0;
+  }
+
+  // a fake DNS: "good" has 2 addresses(127.0.0.'generation' and .100),
+  // "bad" fails, a lookup sleeps 'delay_ms'
+  struct FakeDns
+  {
+    boost::atomic<int> lookups;
+    boost::atomic<int> generation;
+    boost::atomic<bool> failing;
+    boost::atomic<int> delay_ms;
+    time_t now;
+
+    FakeDns() : lookups(0), generation(1), failing(false), delay_ms(0), now(1000) {}
+
+    int lookup(const char * host, const char *, net_endpoint * eps, int max)
+    {
+      lookups++;
+      if (delay_ms)
+        boost::this_thread::sleep(boost::posix_time::milliseconds(static_cast<int>(delay_ms)));
+      if (failing || strcmp(host, "good")!=0 || max<2)
+      {
+        errno = EHOSTUNREACH;
+        return -1;
+      }
+      eps[1] = eps[0];
+      eps[0].domain = eps[1].domain = AF_INET;
+      memset(&eps[0].address.in4, 0, sizeof(eps[0].address.in4));
+      memset(&eps[1].address.in4, 0, sizeof(eps[1].address.in4));
+      eps[0].address.in4.sin_family = eps[1].address.in4.sin_family = AF_INET;
+      eps[0].address.in4.sin_addr.s_addr = htonl(0x7f000000 | generation);
+      eps[1].address.in4.sin_addr.s_addr = htonl(0x7f000064);
+      return 2;
+    }
+
+    time_t get_now()const
+    {
+      return now;
+    }
+  };
+
+  // the last byte of the address 'resolver' gives, -errno on failure
+  int resolve_last_byte(HostResolver& resolver, const char * host)
+  {
+    net_endpoint ep;
+    int ec;
+    memset(&ep, 0, sizeof(ep));
+    ep.domain = AF_INET;
+    ep.type = SOCK_STREAM;
+    resolver.resolve(host, "6379", &ep, &ec);
+    if (ec)
+      return -ec;
+    return static_cast<int>(ntohl(ep.address.in4.sin_addr.s_addr) & 0xff);
+  }
+
+  int host_resolver_test()
+  {
+    cout << "host_resolver_test..." << endl;
+
+    FakeDns dns;
+    HostResolverOptions options;
+    options.enable_refresher = false;
+    options.lookup = boost::bind(&FakeDns::lookup, &dns, _1, _2, _3, _4);
+    options.now = boost::bind(&FakeDns::get_now, &dns);
+
+    {
+      HostResolver resolver(options);
+      resolver.set_ttl(60, 2);
+
+      // round robin, one lookup
+      VERIFY(resolve_last_byte(resolver, "good")==1);
+      VERIFY(resolve_last_byte(resolver, "good")==100);
+      VERIFY(resolve_last_byte(resolver, "good")==1);
+      VERIFY(resolve_last_byte(resolver, "good")==100);
+      VERIFY(dns.lookups==1);
+
+      // not refreshed while most of the TTL is left
+      dns.generation = 2;
+      dns.now += 30;
+      resolver.refresh();
+      VERIFY(dns.lookups==1);
+      VERIFY(resolve_last_byte(resolver, "good")==1);
+
+      // refreshed before it expires, the order goes on
+      dns.now += 20;
+      resolver.refresh();
+      VERIFY(dns.lookups==2);
+      VERIFY(resolve_last_byte(resolver, "good")==100);
+      VERIFY(resolve_last_byte(resolver, "good")==2);
+
+      // a failed refresh keeps the old addresses
+      dns.failing = true;
+      dns.now += 60;
+      resolver.refresh();
+      VERIFY(dns.lookups==3);
+      VERIFY(resolve_last_byte(resolver, "good")==100);
+      VERIFY(resolve_last_byte(resolver, "good")==2);
+      dns.failing = false;
+
+      // a failure is cached for the negative TTL
+      VERIFY(resolve_last_byte(resolver, "bad")==-EHOSTUNREACH);
+      VERIFY(resolve_last_byte(resolver, "bad")==-EHOSTUNREACH);
+      VERIFY(dns.lookups==4);
+      dns.now += 1;
+      VERIFY(resolve_last_byte(resolver, "bad")==-EHOSTUNREACH);
+      VERIFY(dns.lookups==4);
+      dns.now += 1;
+      VERIFY(resolve_last_byte(resolver, "bad")==-EHOSTUNREACH);
+      VERIFY(dns.lookups==5);
+
+      // idle entries are dropped
+      dns.now += 60 * HostResolver::kIdleTtls + 2;
+      resolver.refresh();
+      int lookups = dns.lookups;
+      VERIFY(resolve_last_byte(resolver, "good")==2);
+      VERIFY(dns.lookups==lookups + 1);
+    }
+
+    {
+      // the refresher is woken and joined on destruction
+      FakeDns real_time_dns;
+      options = HostResolverOptions();
+      options.lookup = boost::bind(&FakeDns::lookup, &real_time_dns, _1, _2, _3, _4);
+      boost::posix_time::ptime start = boost::posix_time::microsec_clock::local_time();
+      {
+        HostResolver resolver(options);
+        VERIFY(resolve_last_byte(resolver, "good")==1);
+      }
+      VERIFY((boost::posix_time::microsec_clock::local_time() - start).total_milliseconds()<500);
+    }
+
+    {
+      // a refresher blocked on a lookup is left behind, it still owns the cache
+      boost::shared_ptr<FakeDns> slow_dns(new FakeDns);
+      options = HostResolverOptions();
+      options.lookup = boost::bind(&FakeDns::lookup, slow_dns, _1, _2, _3, _4);
+      {
+        HostResolver resolver(options);
+        resolver.set_ttl(1, 1);
+        VERIFY(resolve_last_byte(resolver, "good")==1);
+        slow_dns->delay_ms = 2500;
+        // the refresher looks "good" up in a second
+        boost::this_thread::sleep(boost::posix_time::milliseconds(1500));
+      }
+      VERIFY(slow_dns->lookups==2);
+    }
+
+    cout << "host_resolver_test ok" << endl;
+    return 0;
+  }
+
+  void coalescing_test_thread(RedisTss * r, int * failed)
+  {
+    RedisBase2 * redis_handle = r->get(kThreadSpecific);
+    std::string value;
+    bool is_nil;
+    string_pair_vector_t pairs;
+    for (int i=0; i<50; i++)
+    {
+      pairs.clear();
+      if (!redis_handle->get("coalesced", &value, &is_nil) || value!="1"
+          || !redis_handle->hgetall("coalesced_hash", &pairs) || pairs.size()!=2)
+        (*failed)++;
+    }
+  }
+
+  int coalescing_test()
+  {
+    cout << "coalescing_test..." << endl;
+
+    Redis2 r(host, port, db_index, timeout);
+    VERIFY_MSG(r.set("coalesced", "1"), r);
+    string_vector_t fields, values;
+    fields += "a", "b";
+    values += "1", "2";
+    VERIFY_MSG(r.hmset("coalesced_hash", fields, values), r);
+
+    set_read_coalescing(true);
+    VERIFY(get_read_coalescing());
+    {
+      RedisTss tss(host, port, db_index, 1, timeout, kNormal);
+      std::vector<int> failed(8, 0);
+      boost::thread_group tg;
+      for (size_t i=0; i<failed.size(); i++)
+        tg.create_thread(boost::bind(coalescing_test_thread, &tss, &failed[i]));
+      tg.join_all();
+      for (size_t i=0; i<failed.size(); i++)
+        VERIFY(failed[i]==0);
+    }
+
+    // a read after a write does not share a call begun before it
+    std::string value;
+    bool is_nil;
+    VERIFY_MSG(r.set("coalesced", "2"), r);
+    VERIFY_MSG(r.get("coalesced", &value, &is_nil), r);
+    VERIFY(value=="2");
+    set_read_coalescing(false);
+
+    ReadCoalescingStats stats = get_read_coalescing_stats();
+    VERIFY(stats.leaders + stats.coalesced==8 * 50 * 2 + 1);
+    VERIFY(stats.coalesced>0 && stats.timeouts==0);
+
+    // a write of any key of a read detaches it
+    set_read_coalescing(true);
+    string_vector_t keys, written;
+    keys += "coalesced", "coalesced_2";
+    written += "coalesced_2";
+    flight_sp_t leader, flight;
+    VERIFY(!SingleFlight::join("mget", keys, &leader));
+    VERIFY(SingleFlight::join("mget", keys, &flight) && flight==leader);
+    SingleFlight::detach(written);
+    VERIFY(!SingleFlight::join("mget", keys, &flight) && flight!=leader);
+    SingleFlight::land("mget", leader, false, RedisOutput());
+    SingleFlight::land("mget", flight, false, RedisOutput());
+    VERIFY(!SingleFlight::join("mget", keys, &flight));
+    SingleFlight::land("mget", flight, false, RedisOutput());
+    set_read_coalescing(false);
+
+    cout << "coalescing_test ok" << endl;
+    return 0;
+  }
+
+  void counter_aggregator_test_thread(CounterAggregator * aggregator)
+  {
+    for (int i=0; i<1000; i++)
+    {
+      aggregator->incrby("counter", 1);
+      aggregator->hincrby("counter_hash", "f", 2);
+      aggregator->zincrby("counter_zset", 0.5, "m");
+    }
+  }
+
+  int counter_aggregator_test()
+  {
+    cout << "counter_aggregator_test..." << endl;
+
+    Redis2 r(host, port, db_index, timeout);
+    string_vector_t keys;
+    keys += "counter", "counter_hash", "counter_zset";
+    int64_t deleted;
+    VERIFY_MSG(r.del(keys, &deleted), r);
+
+    std::string value;
+    bool is_nil;
+    double score;
+    {
+      Redis2 writer(host, port, db_index, timeout);
+      CounterAggregatorOptions options;
+      options.flush_interval_ms = 20;
+      CounterAggregator aggregator(&writer, options);
+      boost::thread_group tg;
+      for (int i=0; i<4; i++)
+        tg.create_thread(boost::bind(counter_aggregator_test_thread, &aggregator));
+      tg.join_all();
+      VERIFY(aggregator.stop());
+
+      CounterAggregatorStats stats = aggregator.get_stats();
+      VERIFY(stats.increments==4 * 1000 * 3 && stats.pending==0 && stats.failed==0);
+      VERIFY(stats.merged>0 && stats.commands<stats.increments);
+
+      VERIFY_MSG(r.get("counter", &value, &is_nil), r);
+      VERIFY(value=="4000");
+      VERIFY_MSG(r.hget("counter_hash", "f", &value, &is_nil), r);
+      VERIFY(value=="8000");
+      VERIFY_MSG(r.zscore("counter_zset", "m", &score, &is_nil), r);
+      VERIFY(!is_nil && score==2000.0);
+    }
+
+    // written behind within the interval
+    {
+      Redis2 writer(host, port, db_index, timeout);
+      CounterAggregatorOptions options;
+      options.flush_interval_ms = 20;
+      CounterAggregator aggregator(&writer, options);
+      aggregator.incrby("counter", 5);
+      aggregator.incrby("counter", -5);
+      aggregator.incrby("counter", 1);
+      for (int i=0; i<100 && aggregator.get_stats().flushes==0; i++)
+        boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+      VERIFY_MSG(r.get("counter", &value, &is_nil), r);
+      VERIFY(value=="4001");
+    }
+
+    cout << "counter_aggregator_test ok" << endl;
+    return 0;
+  }
+
+  uint64_t socket_reads(const redis2_sp_t& client)
+  {
+    return client->get_socket_stats().reads;
+  }
+
+  int partition_pipeline_test()
+  {
+    cout << "partition_pipeline_test..." << endl;
+
+    // two partitions on one server, told apart by their clients
+    Redis2P r(host + "," + host, port + "," + port, db_index, timeout, 2);
+    redis2_sp_vector_t clients[2], key_clients;
+    VERIFY_MSG(r.get_index_client(0, &clients[0]), r);
+    VERIFY_MSG(r.get_index_client(1, &clients[1]), r);
+
+    // keys[i] and keys[i + 2] are on host i
+    std::string keys[4];
+    for (int i=0; keys[0].empty() || keys[1].empty() || keys[2].empty() || keys[3].empty(); i++)
+    {
+      std::string key = "route_" + boost::lexical_cast<std::string>(i);
+      key_clients.clear();
+      VERIFY_MSG(r.get_key_client(key, &key_clients), r);
+      int h = key_clients[0]==clients[0][0] ? 0 : 1;
+      if (keys[h].empty())
+        keys[h] = key;
+      else if (keys[h + 2].empty())
+        keys[h + 2] = key;
+    }
+
+    CommandBatch batch;
+    for (int h=0; h<2; h++)
+    {
+      uint64_t reads0 = socket_reads(clients[0][0]), reads1 = socket_reads(clients[1][0]);
+      batch.clear();
+      batch.add(SET)->push_arg(keys[h]);
+      batch[0]->push_arg("v");
+      batch.add(MGET)->push_arg(keys[h]);
+      batch[1]->push_arg(keys[h + 2]);
+      VERIFY_MSG(r.exec_pipeline(batch.commands()), r);
+      VERIFY(batch[1]->out.is_mbulks() && batch[1]->out.ptr.mbulks->size()==2);
+      VERIFY((socket_reads(clients[0][0])>reads0)==(h==0));
+      VERIFY((socket_reads(clients[1][0])>reads1)==(h==1));
+    }
+
+    // keys on different hosts, and keyless commands
+    uint64_t reads = socket_reads(clients[0][0]) + socket_reads(clients[1][0]);
+    batch.clear();
+    batch.add(GET)->push_arg(keys[0]);
+    batch.add(MGET)->push_arg(keys[0]);
+    batch[1]->push_arg(keys[1]);
+    VERIFY(!r.exec_pipeline(batch.commands()));
+    VERIFY(batch[1]->out.is_error() && r.last_error().find("different hosts")!=std::string::npos);
+    batch.clear();
+    batch.add(RENAME)->push_arg(keys[0]);
+    batch[0]->push_arg(keys[1]);
+    VERIFY(!r.exec_pipeline(batch.commands()));
+    batch.clear();
+    batch.add(KEYS)->push_arg("*");
+    VERIFY(!r.exec_pipeline(batch.commands()));
+    VERIFY(batch[0]->out.is_error());
+    VERIFY(socket_reads(clients[0][0]) + socket_reads(clients[1][0])==reads);
+
+    // reads move on to the next group when a host fails, writes go to all groups
+    Redis2P failover(host + "," + host, port + ",1", db_index, timeout, 1);
+    std::string value;
+    for (int i=0; i<8; i++)
+    {
+      batch.clear();
+      batch.add(GET)->push_arg(keys[0]);
+      VERIFY_MSG(failover.exec_pipeline(batch.commands()), failover);
+      VERIFY(batch[0]->out.get_bulk(&value) && value=="v");
+    }
+    batch.clear();
+    batch.add(SET)->push_arg(keys[0]);
+    batch[0]->push_arg("v");
+    VERIFY(!failover.exec_pipeline(batch.commands()));
+    VERIFY(batch[0]->out.is_error());
+
+    cout << "partition_pipeline_test ok" << endl;
+    return 0;
+  }
+
+  int fanout_test()
+  {
+    cout << "fanout_test..." << endl;
+
+    std::string hosts2 = host + "," + host, ports2 = port + "," + port;
+    // two partitions in two groups, all on one server
+    Redis2P r(hosts2 + "," + hosts2, ports2 + "," + ports2, db_index, timeout, 2);
+    // the same partitions in one group, to count replies
+    Redis2P one(hosts2, ports2, db_index, timeout, 2);
+    // the second group is down
+    Redis2P half(hosts2 + "," + hosts2, ports2 + ",1,1", db_index, timeout, 2);
+
+    string_vector_t keys, values;
+    for (int i=0; i<8; i++)
+    {
+      keys.push_back("fanout_" + boost::lexical_cast<std::string>(i));
+      values.push_back("v" + boost::lexical_cast<std::string>(i));
+    }
+
+    for (int threads=0; threads<=4; threads+=4)
+    {
+      set_fanout_threads(threads);
+
+      VERIFY_MSG(r.select(db_index), r);
+      VERIFY_MSG(r.flushdb(), r);
+      VERIFY_MSG(r.mset(keys, values), r);
+
+      mbulk_t mb;
+      ClearGuard<mbulk_t> mb_guard(&mb);
+      VERIFY_MSG(r.mget(keys, &mb), r);
+      VERIFY(mb.size()==keys.size());
+      for (size_t i=0; i<mb.size(); i++)
+        VERIFY(mb[i] && *mb[i]==values[i]);
+
+      // both hosts of a group are the server, every key is listed twice
+      VERIFY_MSG(r.keys("fanout_*", &mb), r);
+      VERIFY(mb.size()==2 * keys.size());
+
+      // a write of one key goes to both groups through their pipelines
+      int64_t n = 0;
+      VERIFY_MSG(r.incr("fanout_counter", &n), r);
+      VERIFY(n==1 || n==2);
+      std::string value;
+      bool is_nil;
+      VERIFY_MSG(one.get("fanout_counter", &value, &is_nil), one);
+      VERIFY(value=="2");
+
+      VERIFY_MSG(one.del(keys, &n), one);
+      VERIFY(n==static_cast<int64_t>(keys.size()));
+      VERIFY_MSG(one.mget(keys, &mb), one);
+      VERIFY(mb.size()==keys.size());
+      for (size_t i=0; i<mb.size(); i++)
+        VERIFY(mb[i]==NULL);
+
+      // partial failure: reads fail over, writes and fanouts report the host down
+      VERIFY(!half.set("fanout_half", "v"));
+      VERIFY(half.last_error().find(":1]")!=std::string::npos);
+      VERIFY_MSG(one.get("fanout_half", &value, &is_nil), one);
+      VERIFY(value=="v");
+      VERIFY_MSG(half.get("fanout_half", &value, &is_nil), half);
+      VERIFY(value=="v");
+
+      VERIFY(!half.mset(keys, values));
+      VERIFY_MSG(half.mget(keys, &mb), half);
+      VERIFY(mb.size()==keys.size());
+      for (size_t i=0; i<mb.size(); i++)
+        VERIFY(mb[i] && *mb[i]==values[i]);
+      VERIFY(!half.del(keys, &n));
+
+      VERIFY(!half.select(db_index));
+      VERIFY(half.last_error().find(":1]")!=std::string::npos);
+      VERIFY(!half.flushdb());
+      VERIFY(half.last_error().find(":1]")!=std::string::npos);
+      VERIFY(!half.flushall());
+      VERIFY(half.last_error().find(":1]")!=std::string::npos);
+      // flushes went on on the group up
+      VERIFY_MSG(one.get("fanout_half", &value, &is_nil), one);
+      VERIFY(is_nil);
+    }
+    set_fanout_threads(16);
+
+    cout << "fanout_test ok" << endl;
+    return 0;
+  }
+
+  struct RuntimeReplies
+  {
+    boost::atomic<int> ok;
+    boost::atomic<int> stopped;
+    boost::atomic<int> other;
+
+    RuntimeReplies() : ok(0), stopped(0), other(0) {}
+
+    int total()const
+    {
+      return ok + stopped + other;
+    }
+
+    void on_done(RedisCommand * command, bool _ok)
+    {
+      if (_ok)
+        ok++;
+      else if (command->out.is_error() && *command->out.ptr.error=="runtime stopped")
+        stopped++;
+      else
+        other++;
+    }
+  };
+
+  // submit INCR of "runtime_<i % 8>" 'count' times or until '*done'
+  void runtime_pusher(RedisRuntime * rt, RuntimeReplies * replies,
+      int count, const boost::atomic<bool> * done, boost::atomic<int> * pushed)
+  {
+    CommandBatch batch;
+    for (int i=0; i<count && !*done; i++)
+    {
+      RedisCommand * c = batch.add(INCR);
+      c->push_arg("runtime_" + boost::lexical_cast<std::string>(i % 8));
+      rt->submit(c, boost::bind(&RuntimeReplies::on_done, replies, _1, _2));
+      (*pushed)++;
+    }
+    // callbacks may still refer to 'batch'
+    while (replies->total()<*pushed)
+      boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+  }
+
+  int runtime_test()
+  {
+    cout << "runtime_test..." << endl;
+
+    Redis2 r(host, port, db_index, timeout);
+    RedisCommand command;
+    for (int k=0; k<8; k++)
+    {
+      int64_t n;
+      VERIFY_MSG(r.del("runtime_" + boost::lexical_cast<std::string>(k), &n), r);
+    }
+
+    {
+      // pushes from several threads to both cores and both shards
+      RedisRuntime rt(host + "," + host, port, db_index, timeout, 2);
+      RuntimeReplies replies;
+      boost::atomic<bool> done(false);
+      boost::atomic<int> pushed(0);
+      boost::thread_group tg;
+      for (int i=0; i<4; i++)
+        tg.create_thread(boost::bind(runtime_pusher, &rt, &replies, 200, &done, &pushed));
+      tg.join_all();
+      VERIFY(replies.ok==800 && replies.total()==800);
+
+      int64_t sum = 0;
+      for (int k=0; k<8; k++)
+      {
+        command.in.set_command(GET);
+        command.in.clear_arg();
+        command.push_arg("runtime_" + boost::lexical_cast<std::string>(k));
+        VERIFY(rt.exec_command(&command));
+        std::string value;
+        VERIFY(command.out.get_bulk(&value));
+        sum += boost::lexical_cast<int64_t>(value);
+      }
+      VERIFY(sum==800);
+
+      // pushes racing stop() either succeed or fail with "runtime stopped",
+      // every one is called back once
+      RuntimeReplies late;
+      pushed = 0;
+      for (int i=0; i<4; i++)
+        tg.create_thread(boost::bind(runtime_pusher, &rt, &late, 1000000, &done, &pushed));
+      boost::this_thread::sleep(boost::posix_time::milliseconds(20));
+      rt.stop();
+      int after_stop = pushed;
+      boost::this_thread::sleep(boost::posix_time::milliseconds(5));
+      done = true;
+      tg.join_all();
+      VERIFY(late.total()==pushed && late.other==0);
+      VERIFY(late.ok>0 && late.ok<=after_stop);
+      VERIFY(late.stopped>=pushed - after_stop);
+
+      // and after it, too
+      RuntimeReplies after;
+      command.in.set_command(INCR);
+      command.in.clear_arg();
+      command.push_arg("runtime_0");
+      rt.submit(&command, boost::bind(&RuntimeReplies::on_done, &after, _1, _2));
+      VERIFY(after.stopped==1 && after.total()==1);
+      VERIFY(!rt.exec_command(&command) && command.out.is_error());
+    }
+
+    cout << "runtime_test ok" << endl;
+    return 0;
+  }
+
+  int typed_decoding_test()
+  {
+    cout << "typed_decoding_test..." << endl;
+
+    double d;
+    VERIFY(parse_double("3.25", &d) && d==3.25);
+    VERIFY(parse_double("-0.1", &d) && d==-0.1);
+    VERIFY(parse_double("1e3", &d) && d==1000.0);
+    VERIFY(parse_double("12345678901234567890", &d) && d==12345678901234567890.0);
+    VERIFY(parse_double("inf", &d) && d>1e308);
+    VERIFY(!parse_double("", &d) && !parse_double("1.5x", &d) && !parse_double("-", &d));
+
+    char buf[kDoubleChars];
+    int64_t i;
+    VERIFY(std::string(buf, format_int64(-9223372036854775807LL - 1, buf))=="-9223372036854775808");
+    VERIFY(std::string(buf, format_uint64(18446744073709551615ULL, buf))=="18446744073709551615");
+    VERIFY(std::string(buf, format_double(0.1, buf))=="0.1");
+    VERIFY(std::string(buf, format_double(-42.0, buf))=="-42");
+    VERIFY(parse_double(buf, buf + format_double(1.0 / 3, buf), &d) && d==1.0 / 3);
+    std::string line("-9223372036854775808");
+    VERIFY(parse_int64(line.data(), line.data() + line.size(), &i) && i==-9223372036854775807LL - 1);
+    line = "9223372036854775808";
+    VERIFY(!parse_int64(line.data(), line.data() + line.size(), &i));
+    line = "12a";
+    VERIFY(!parse_int64(line.data(), line.data() + line.size(), &i));
+
+    MemoryTransport * transport = new MemoryTransport(
+        "*4\r\n$1\r\na\r\n$1\r\n1\r\n$1\r\nb\r\n$1\r\n2\r\n"
+        "*4\r\n$1\r\na\r\n$1\r\n1\r\n$1\r\nb\r\n$1\r\n2\r\n"
+        "*4\r\n$1\r\nx\r\n$3\r\n1.5\r\n$1\r\ny\r\n$4\r\n-inf\r\n"
+        "*2\r\n$1\r\nx\r\n$3\r\nbad\r\n"
+        "*1\r\n$1\r\nx\r\n", false);
+    Redis2 r("memory", "0", 0, timeout, transport);
+
+    string_pair_vector_t pairs;
+    VERIFY_MSG(r.hgetall("hash", &pairs), r);
+    VERIFY(pairs.size()==2 && pairs[1].first=="b" && pairs[1].second=="2");
+
+    string_map_t fields;
+    VERIFY_MSG(r.hgetall("hash", &fields), r);
+    VERIFY(fields.size()==2 && fields["a"]=="1");
+
+    string_score_pair_vector_t scores;
+    VERIFY_MSG(r.zrange("zset", 0, -1, &scores), r);
+    VERIFY(scores.size()==2 && scores[0].second==1.5 && scores[1].second<-1e308);
+
+    // a bad score and an odd number of elements fail, but the stream stays in sync
+    scores.clear();
+    VERIFY(!r.zrangebyscore("zset", "-inf", "+inf", NULL, &scores));
+    VERIFY(!r.zrevrange("zset", 0, -1, &scores));
+    VERIFY(r.is_open());
+
+    cout << "typed_decoding_test ok" << endl;
+    return 0;
+  }
+
+  int cmd_test()
+  {
+    cout << "cmd_test..." << endl;
+
+    std::string bulk;
+    std::string value("a b\r\n\0c", 8);
+    MemoryTransport * transport = new MemoryTransport(
+        "+OK\r\n"
+        ":2\r\n"
+        "$8\r\n" + value + "\r\n"
+        "+OK\r\n"
+        "$-1\r\n", false);
+    transport->set_capture(true);
+    Redis2 r("memory", "0", 0, timeout, transport);
+
+    // binary values and spaces are sent as they are
+    RedisCommand c;
+    VERIFY_MSG(r.cmd(&c, "setex", "key", 10, value), r);
+    VERIFY(transport->written()=="*4\r\n$5\r\nSETEX\r\n$3\r\nkey\r\n$2\r\n10\r\n$8\r\n"
+        + value + "\r\n");
+    VERIFY(c.out.reply_type==kStatus);
+
+    VERIFY(!r.cmd(&c, "NOSUCHCOMMAND", "key"));
+    VERIFY(transport->writes()==1);
+
+    // queued in a pipeline, replied in execute()
+    Pipeline pipeline(&r);
+    RedisCommand del, get;
+    string_vector_t keys;
+    keys += "a", "b";
+    VERIFY(pipeline.cmd(&del, "DEL", keys));
+    VERIFY(pipeline.cmd(&get, "GET", "key"));
+    VERIFY_MSG(pipeline.execute(), pipeline);
+    VERIFY(transport->writes()==2);
+    int64_t i;
+    VERIFY(del.out.get_i(&i) && i==2);
+    VERIFY(get.out.get_bulk(&bulk) && bulk==value);
+
+    // options of SET
+    transport->clear_written();
+    VERIFY_MSG(r.cmd(&c, "SET", "key", "value", "EX", 10), r);
+    VERIFY(transport->written()=="*5\r\n$3\r\nSET\r\n$3\r\nkey\r\n$5\r\nvalue\r\n"
+        "$2\r\nEX\r\n$2\r\n10\r\n");
+    VERIFY(c.out.is_status_ok());
+    VERIFY_MSG(r.cmd(&c, "SET", "key", "value", "NX"), r);
+    VERIFY(c.out.is_nil_bulk());
+
+    cout << "cmd_test ok" << endl;
+    return 0;
+  }
+
+  int value_handoff_test()
+  {
+    cout << "value_handoff_test..." << endl;
+
+    int64_t i;
+    MemoryTransport * transport = new MemoryTransport("+OK\r\n:1\r\n", false);
+    transport->set_capture(true);
+    Redis2 r("memory", "0", 0, timeout, transport);
+
+    // a large value is swapped in and written as it is
+    std::string large(100 * 1024, 'x');
+    std::string value(large);
+    VERIFY_MSG(r.set_swap("key", &value), r);
+    VERIFY(value.empty());
+    VERIFY(transport->writes()==3);
+    VERIFY(transport->written()=="*3\r\n$3\r\nSET\r\n$3\r\nkey\r\n$102400\r\n"
+        + large + "\r\n");
+    transport->clear_written();
+
+    value = "small";
+    VERIFY_MSG(r.rpush_swap("list", &value, &i), r);
+    VERIFY(value.empty() && i==1);
+    VERIFY(transport->writes()==4);
+    VERIFY(transport->written()=="*3\r\n$5\r\nRPUSH\r\n$4\r\nlist\r\n$5\r\nsmall\r\n");
+
+    RedisCommand c;
+    c.push_arg("a\0b", 3);
+    VERIFY(c.args().back()==std::string("a\0b", 3));
+
+    cout << "value_handoff_test ok" << endl;
+    return 0;
+  }
+
+  int command_batch_test()
+  {
+    cout << "command_batch_test..." << endl;
+
+    int64_t i;
+    std::string bulk;
+    MemoryTransport * transport = new MemoryTransport("$5\r\nvalue\r\n:7\r\n");
+    Redis2 r("memory", "0", 0, timeout, transport);
+    CommandBatch batch;
+    std::string large(1024, 'x');
+    std::string key("key");
+
+    RedisCommand * first = NULL;
+    for (int round=0; round<3; round++)
+    {
+      batch.clear();
+      batch.add(GET)->push_arg(round==0 ? large : key);
+      batch.add("incr")->push_arg("counter");
+      VERIFY(batch.size()==2 && batch[1]->command()==INCR);
+      VERIFY_MSG(r.exec_pipeline(batch.commands()), r);
+      VERIFY(batch[0]->out.get_bulk(&bulk) && bulk=="value");
+      VERIFY(batch[1]->out.get_i(&i) && i==7);
+
+      // the same commands, arguments keep their capacity
+      if (round==0)
+        first = batch[0];
+      VERIFY(batch[0]==first);
+      VERIFY(batch[0]->args()[0].capacity()>=large.size());
+    }
+
+    cout << "command_batch_test ok" << endl;
+    return 0;
+  }
+
+  int pipeline_test()
+  {
+    cout << "pipeline_test..." << endl;
+
+    std::string bulk;
+    bool is_nil;
+    int64_t i;
+    double d;
+    MemoryTransport * transport = new MemoryTransport(
+        "+OK\r\n"
+        "-ERR wrong type\r\n"
+        "$5\r\nvalue\r\n"
+        "$3\r\n1.5\r\n"
+        "$5\r\nagain\r\n", false);
+    transport->set_capture(true);
+    Redis2 r("memory", "0", 0, timeout, transport);
+    Pipeline pipeline(&r);
+
+    VERIFY(pipeline.set("key", "value"));
+    VERIFY(pipeline.incr("key", &i));
+    VERIFY(pipeline.get("key", &bulk, &is_nil));
+    VERIFY(pipeline.zscore("zkey", "member", &d, &is_nil));
+    VERIFY(pipeline.size()==4);
+    VERIFY(transport->writes()==0);
+
+    // one write, the error reply fails only its own command
+    VERIFY(!pipeline.execute());
+    VERIFY(transport->writes()==1);
+    VERIFY(pipeline.succeeded(0) && !pipeline.succeeded(1)
+        && pipeline.succeeded(2) && pipeline.succeeded(3));
+    VERIFY(pipeline.last_error()=="ERR wrong type");
+    VERIFY(bulk=="value" && d==1.5 && !is_nil);
+    VERIFY(pipeline.size()==0);
+
+    // the stream is still in sync
+    VERIFY_MSG(r.get("key", &bulk, &is_nil), r);
+    VERIFY(bulk=="again");
+
+    VERIFY(!pipeline.multi());
+
+    // a reused pipeline allocates nothing in the steady state
+    {
+      Redis2 ok("memory", "0", 0, timeout, new MemoryTransport("+OK\r\n"));
+      Pipeline reused(&ok);
+      size_t warm = 0;
+      for (int round=0; round<5000; round++)
+      {
+        if (round==500)
+          warm = resident_pages();
+        for (int j=0; j<50; j++)
+          VERIFY(reused.set("key", "value"));
+        VERIFY_MSG(reused.execute(), reused);
+      }
+      size_t pages = resident_pages();
+      if (warm && pages)
+        VERIFY(pages<warm + 256);
+    }
+
+    cout << "pipeline_test ok" << endl;
+    return 0;
+  }
+
   int basic_test(RedisBase2& r)
   {
     cout << "basic_test..." << endl;
@@ -1079,6 +2665,27 @@ int main(int argc, char * argv[])
   }
 
   os_test();
+  unix_socket_test();
+  command_table_test();
+  memory_transport_test();
+  host_resolver_test();
+  reconnect_backoff_test();
+  latency_histogram_test();
+  deadline_test();
+  pipeline_test();
+  cmd_test();
+  value_handoff_test();
+  command_batch_test();
+  stream_test();
+  bulk_stream_test();
+  compression_test();
+  near_cache_test();
+  coalescing_test();
+  counter_aggregator_test();
+  partition_pipeline_test();
+  fanout_test();
+  runtime_test();
+  typed_decoding_test();
   protocol_test();
   get_redis_version();
 
@@ -0,0 +1,147 @@
+/** @file
+ * @brief encoding and parsing benchmark over MemoryTransport(no I/O)
+ * @author yafei.zhang@langtaojin.com
+ * @date
+ * @version
+ *
+ */
+#include <redis.h>
+#include <redis_transport.h>
+#include <iostream>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/program_options.hpp>
+
+USING_LIBREDIS_NAMESPACE
+
+namespace
+{
+  int requests, mbulks;
+
+  void report(const char * name, const MemoryTransport& transport,
+      const boost::posix_time::time_duration& td, int failed)
+  {
+    int64_t us = td.total_microseconds();
+    std::cout << name << ": " << requests << " requests cost " << us / 1000 << " ms, "
+      << (requests ? us * 1000 / requests : 0) << " ns/op, "
+      << (us ? static_cast<int64_t>(requests) * 1000000 / us : 0) << " qps, "
+      << transport.written_bytes() / (requests ? requests : 1) << " bytes/request, "
+      << failed << " failed" << std::endl;
+  }
+
+  std::string bulk_reply(const std::string& value)
+  {
+    return "$" + boost::lexical_cast<std::string>(value.size()) + "\r\n" + value + "\r\n";
+  }
+
+  void bench_get()
+  {
+    MemoryTransport * transport = new MemoryTransport(bulk_reply("value"));
+    Redis2 r("memory", "0", 0, 50, transport);
+    std::string value;
+    bool is_nil;
+    int failed = 0;
+
+    boost::posix_time::ptime begin = boost::posix_time::microsec_clock::local_time();
+    for (int i=0; i<requests; i++)
+    {
+      if (!r.get("key", &value, &is_nil))
+        failed++;
+    }
+    report("GET", *transport, boost::posix_time::microsec_clock::local_time() - begin, failed);
+  }
+
+  void bench_set()
+  {
+    MemoryTransport * transport = new MemoryTransport("+OK\r\n");
+    Redis2 r("memory", "0", 0, 50, transport);
+    int failed = 0;
+
+    boost::posix_time::ptime begin = boost::posix_time::microsec_clock::local_time();
+    for (int i=0; i<requests; i++)
+    {
+      if (!r.set("key", "value"))
+        failed++;
+    }
+    report("SET", *transport, boost::posix_time::microsec_clock::local_time() - begin, failed);
+  }
+
+  void bench_incr()
+  {
+    MemoryTransport * transport = new MemoryTransport(":1234567\r\n");
+    Redis2 r("memory", "0", 0, 50, transport);
+    int64_t i64;
+    int failed = 0;
+
+    boost::posix_time::ptime begin = boost::posix_time::microsec_clock::local_time();
+    for (int i=0; i<requests; i++)
+    {
+      if (!r.incr("key", &i64))
+        failed++;
+    }
+    report("INCR", *transport, boost::posix_time::microsec_clock::local_time() - begin, failed);
+  }
+
+  void bench_mget()
+  {
+    std::string reply = "*" + boost::lexical_cast<std::string>(mbulks) + "\r\n";
+    string_vector_t keys;
+    for (int i=0; i<mbulks; i++)
+    {
+      reply += bulk_reply("value" + boost::lexical_cast<std::string>(i));
+      keys.push_back("key" + boost::lexical_cast<std::string>(i));
+    }
+
+    MemoryTransport * transport = new MemoryTransport(reply);
+    Redis2 r("memory", "0", 0, 50, transport);
+    mbulk_t values;
+    int failed = 0;
+
+    boost::posix_time::ptime begin = boost::posix_time::microsec_clock::local_time();
+    for (int i=0; i<requests; i++)
+    {
+      if (!r.mget(keys, &values))
+        failed++;
+      clear_mbulks(&values);
+    }
+    report("MGET", *transport, boost::posix_time::microsec_clock::local_time() - begin, failed);
+  }
+}
+
+int main(int argc, char * argv[])
+{
+  try
+  {
+    namespace po = boost::program_options;
+    po::options_description desc("Options");
+    desc.add_options()
+      ("help,h", "produce help message")
+      ("requests,n", po::value<int>()->default_value(1000000), "requests per command")
+      ("mbulks,m", po::value<int>()->default_value(16), "keys per MGET");
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
+
+    if (vm.count("help"))
+    {
+      std::cout << desc << std::endl;
+      return 0;
+    }
+
+    requests = vm["requests"].as<int>();
+    mbulks = vm["mbulks"].as<int>();
+  }
+  catch (std::exception& e)
+  {
+    std::cout << "caught: " << e.what() << std::endl;
+    return 1;
+  }
+
+  bench_get();
+  bench_set();
+  bench_incr();
+  bench_mget();
+
+  return 0;
+}
@@ -0,0 +1,183 @@
+/** @file
+ * @brief numeric argument and reply conversion benchmark(no I/O)
+ * @author yafei.zhang@langtaojin.com
+ * @date
+ * @version
+ *
+ */
+#include <redis.h>
+#include <redis_transport.h>
+#include <stdlib.h>
+#include <iostream>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/program_options.hpp>
+
+USING_LIBREDIS_NAMESPACE
+
+namespace
+{
+  int requests, members;
+  // keeps results alive, so nothing is optimized away
+  volatile double s_sink;
+
+  void report(const char * name, const boost::posix_time::time_duration& td, int failed)
+  {
+    int64_t us = td.total_microseconds();
+    std::cout << name << ": " << requests << " ops cost " << us / 1000 << " ms, "
+      << (requests ? us * 1000 / requests : 0) << " ns/op, "
+      << failed << " failed" << std::endl;
+  }
+
+  boost::posix_time::ptime now()
+  {
+    return boost::posix_time::microsec_clock::local_time();
+  }
+
+  double score_of(int i)
+  {
+    // half integral scores, half fractional ones
+    return (i & 1) ? i * 0.25 : static_cast<double>(i);
+  }
+
+  void bench_format()
+  {
+    boost::posix_time::ptime begin = now();
+    for (int i=0; i<requests; i++)
+      s_sink = static_cast<double>(boost::lexical_cast<std::string>(int64_t(i) * 7919).size());
+    report("lexical_cast<string>(int64_t)", now() - begin, 0);
+
+    char buf[kDoubleChars];
+    begin = now();
+    for (int i=0; i<requests; i++)
+      s_sink = static_cast<double>(format_int64(int64_t(i) * 7919, buf));
+    report("format_int64", now() - begin, 0);
+
+    begin = now();
+    for (int i=0; i<requests; i++)
+      s_sink = static_cast<double>(boost::lexical_cast<std::string>(score_of(i)).size());
+    report("lexical_cast<string>(double)", now() - begin, 0);
+
+    begin = now();
+    for (int i=0; i<requests; i++)
+      s_sink = static_cast<double>(format_double(score_of(i), buf));
+    report("format_double", now() - begin, 0);
+  }
+
+  void bench_parse()
+  {
+    const std::string integer(":1234567890");
+    const std::string real("3.1415926");
+    int64_t i64;
+    double d;
+    int failed = 0;
+
+    boost::posix_time::ptime begin = now();
+    for (int i=0; i<requests; i++)
+      s_sink = static_cast<double>(strtol(integer.c_str() + 1, NULL, 10));
+    report("strtol", now() - begin, 0);
+
+    begin = now();
+    for (int i=0; i<requests; i++)
+    {
+      if (!parse_int64(integer.data() + 1, integer.data() + integer.size(), &i64))
+        failed++;
+      s_sink = static_cast<double>(i64);
+    }
+    report("parse_int64", now() - begin, failed);
+
+    begin = now();
+    for (int i=0; i<requests; i++)
+      s_sink = boost::lexical_cast<double>(real);
+    report("lexical_cast<double>", now() - begin, 0);
+
+    failed = 0;
+    begin = now();
+    for (int i=0; i<requests; i++)
+    {
+      if (!parse_double(real, &d))
+        failed++;
+      s_sink = d;
+    }
+    report("parse_double", now() - begin, failed);
+  }
+
+  void bench_zadd()
+  {
+    MemoryTransport * transport = new MemoryTransport(
+        ":" + boost::lexical_cast<std::string>(members) + "\r\n");
+    Redis2 r("memory", "0", 0, 50, transport);
+    std::vector<double> scores;
+    string_vector_t member_vector;
+    for (int i=0; i<members; i++)
+    {
+      scores.push_back(score_of(i));
+      member_vector.push_back("member" + boost::lexical_cast<std::string>(i));
+    }
+    int64_t added;
+    int failed = 0;
+
+    boost::posix_time::ptime begin = now();
+    for (int i=0; i<requests; i++)
+    {
+      if (!r.zadd("key", scores, member_vector, &added))
+        failed++;
+    }
+    report("ZADD", now() - begin, failed);
+  }
+
+  void bench_zscore()
+  {
+    MemoryTransport * transport = new MemoryTransport("$9\r\n3.1415926\r\n");
+    Redis2 r("memory", "0", 0, 50, transport);
+    double score;
+    bool is_nil;
+    int failed = 0;
+
+    boost::posix_time::ptime begin = now();
+    for (int i=0; i<requests; i++)
+    {
+      if (!r.zscore("key", "member", &score, &is_nil))
+        failed++;
+    }
+    report("ZSCORE", now() - begin, failed);
+  }
+}
+
+int main(int argc, char * argv[])
+{
+  try
+  {
+    namespace po = boost::program_options;
+    po::options_description desc("Options");
+    desc.add_options()
+      ("help,h", "produce help message")
+      ("requests,n", po::value<int>()->default_value(1000000), "operations per case")
+      ("members,m", po::value<int>()->default_value(16), "members per ZADD");
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
+
+    if (vm.count("help"))
+    {
+      std::cout << desc << std::endl;
+      return 0;
+    }
+
+    requests = vm["requests"].as<int>();
+    members = vm["members"].as<int>();
+  }
+  catch (std::exception& e)
+  {
+    std::cout << "caught: " << e.what() << std::endl;
+    return 1;
+  }
+
+  bench_format();
+  bench_parse();
+  bench_zadd();
+  bench_zscore();
+
+  return 0;
+}
@@ -0,0 +1,189 @@
+/** @file
+ * @brief RedisRuntime vs RedisTss benchmark
+ * @author yafei.zhang@langtaojin.com
+ * @date
+ * @version
+ *
+ */
+#include <redis_tss.h>
+#include <redis_runtime.h>
+#include <iostream>
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/program_options.hpp>
+#include <boost/thread.hpp>
+
+USING_LIBREDIS_NAMESPACE
+
+namespace
+{
+  std::string host, port;
+  int db_index, timeout, threads, requests, depth;
+
+  boost::atomic<int> s_failed(0);
+
+  void report(const char * name, const boost::posix_time::time_duration& td)
+  {
+    int64_t ms = td.total_milliseconds();
+    int64_t total = static_cast<int64_t>(threads) * requests;
+    std::cout << name << ": " << total << " GETs cost " << ms << " ms, "
+      << (ms ? total * 1000 / ms : total) << " qps, "
+      << s_failed << " failed" << std::endl;
+  }
+
+  /************************************************************************/
+  /*RedisTss: one blocking connection per thread*/
+  /************************************************************************/
+  void tss_thread(RedisTss * tss)
+  {
+    RedisBase2 * r = tss->get(kThreadSpecific);
+    std::string value;
+    bool is_nil;
+
+    for (int i=0; i<requests; i++)
+    {
+      if (!r->get("bench:" + boost::lexical_cast<std::string>(i % 1024), &value, &is_nil))
+        s_failed++;
+    }
+  }
+
+  void bench_tss()
+  {
+    RedisTss tss(host, port, db_index, 1, timeout, kNormal, threads);
+    boost::thread_group tg;
+
+    boost::posix_time::ptime begin = boost::posix_time::microsec_clock::local_time();
+    for (int i=0; i<threads; i++)
+      tg.create_thread(boost::bind(tss_thread, &tss));
+    tg.join_all();
+    report("RedisTss", boost::posix_time::microsec_clock::local_time() - begin);
+  }
+
+  /************************************************************************/
+  /*RedisRuntime: one event loop per core, 'depth' commands in flight*/
+  /************************************************************************/
+  class CoreDriver
+  {
+    private:
+      RedisRuntime * runtime_;
+      std::vector<RedisCommand> commands_;
+      int sent_;
+      int done_;
+      boost::mutex * lock_;
+      boost::condition_variable * cond_;
+      int * finished_;
+
+      void send(RedisCommand * command)
+      {
+        command->clear_arg();
+        command->push_arg("bench:" + boost::lexical_cast<std::string>(sent_ % 1024));
+        sent_++;
+        runtime_->submit(command, boost::bind(&CoreDriver::on_reply, this, _1, _2));
+      }
+
+      void on_reply(RedisCommand * command, bool ok)
+      {
+        if (!ok)
+          s_failed++;
+
+        if (++done_==requests)
+        {
+          boost::mutex::scoped_lock guard(*lock_);
+          (*finished_)++;
+          cond_->notify_one();
+        }
+        else if (sent_<requests)
+        {
+          send(command);
+        }
+      }
+
+    public:
+      CoreDriver(RedisRuntime * runtime, boost::mutex * lock,
+          boost::condition_variable * cond, int * finished)
+        : runtime_(runtime), commands_(static_cast<size_t>(depth), RedisCommand(GET)),
+        sent_(0), done_(0), lock_(lock), cond_(cond), finished_(finished) {}
+
+      void start()
+      {
+        for (size_t i=0; i<commands_.size() && sent_<requests; i++)
+          send(&commands_[i]);
+      }
+  };
+
+  void bench_runtime()
+  {
+    RedisRuntime runtime(host, port, db_index, timeout, static_cast<size_t>(threads));
+    boost::mutex lock;
+    boost::condition_variable cond;
+    int finished = 0;
+    std::vector<CoreDriver *> drivers;
+
+    boost::posix_time::ptime begin = boost::posix_time::microsec_clock::local_time();
+    for (int i=0; i<threads; i++)
+    {
+      drivers.push_back(new CoreDriver(&runtime, &lock, &cond, &finished));
+      runtime.post(static_cast<size_t>(i), boost::bind(&CoreDriver::start, drivers.back()));
+    }
+
+    {
+      boost::mutex::scoped_lock guard(lock);
+      while (finished<threads)
+        cond.wait(guard);
+    }
+    report("RedisRuntime", boost::posix_time::microsec_clock::local_time() - begin);
+
+    runtime.stop();
+    for (size_t i=0; i<drivers.size(); i++)
+      delete drivers[i];
+  }
+}
+
+int main(int argc, char * argv[])
+{
+  try
+  {
+    namespace po = boost::program_options;
+    po::options_description desc("Options");
+    desc.add_options()
+      ("help", "produce help message")
+      ("host,h", po::value<std::string>()->default_value("localhost"), "redis host")
+      ("port,p", po::value<std::string>()->default_value("6379"), "redis port")
+      ("db_index,i", po::value<int>()->default_value(5), "redis db index")
+      ("timeout,t", po::value<int>()->default_value(2000), "timeout in ms")
+      ("threads,c", po::value<int>()->default_value(4), "threads(RedisTss) or cores(RedisRuntime)")
+      ("requests,n", po::value<int>()->default_value(100000), "requests per thread")
+      ("depth,d", po::value<int>()->default_value(32), "commands in flight per core");
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
+
+    if (vm.count("help"))
+    {
+      std::cout << desc << std::endl;
+      return 0;
+    }
+
+    host = vm["host"].as<std::string>();
+    port = vm["port"].as<std::string>();
+    db_index = vm["db_index"].as<int>();
+    timeout = vm["timeout"].as<int>();
+    threads = vm["threads"].as<int>();
+    requests = vm["requests"].as<int>();
+    depth = vm["depth"].as<int>();
+  }
+  catch (std::exception& e)
+  {
+    std::cout << "caught: " << e.what() << std::endl;
+    return 1;
+  }
+
+  bench_tss();
+  s_failed = 0;
+  bench_runtime();
+
+  return 0;
+}
@@ -0,0 +1,189 @@
+/** @file
+ * @brief socket options benchmark: small command latency and pipeline throughput,
+ *        optionally with adaptive budgets
+ * @author yafei.zhang@langtaojin.com
+ * @date
+ * @version
+ *
+ */
+#include <redis.h>
+#include <iostream>
+#include <algorithm>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/program_options.hpp>
+
+USING_LIBREDIS_NAMESPACE
+
+namespace
+{
+  std::string host, port;
+  int db_index, timeout, requests, depth, buffer;
+
+  const char * class_name(kCommandClass command_class)
+  {
+    switch (command_class)
+    {
+      case kReadCommand: return "read";
+      case kWriteCommand: return "write";
+      case kSlowCommand: return "slow";
+      case kBlockingCommand: return "blocking";
+      default: return "unknown";
+    }
+  }
+
+  void print_adaptive_stats()
+  {
+    std::vector<AdaptiveTimeoutStats> stats;
+    get_adaptive_timeout_stats(&stats);
+    for (size_t i=0; i<stats.size(); i++)
+    {
+      const AdaptiveTimeoutStats& s = stats[i];
+      std::cout << "adaptive " << s.host << ":" << s.port << " " << class_name(s.command_class)
+        << ": " << s.samples << " samples, p " << s.percentile_us << " us, budget "
+        << s.timeout_ms << " ms, " << s.timeouts << " timeouts, " << s.decisions
+        << " decisions(" << s.clamped_min << " clamped to min, "
+        << s.clamped_max << " clamped to max)" << std::endl;
+    }
+  }
+
+  void bench_latency(const char * name, const SocketOptions& options)
+  {
+    Redis2 r(host, port, db_index, timeout, options);
+    std::vector<int64_t> latency;
+    std::string value;
+    bool is_nil;
+    int failed = 0;
+
+    latency.reserve(static_cast<size_t>(requests));
+    for (int i=0; i<requests; i++)
+    {
+      boost::posix_time::ptime begin = boost::posix_time::microsec_clock::local_time();
+      if (!r.get("bench:sockopt", &value, &is_nil))
+        failed++;
+      latency.push_back((boost::posix_time::microsec_clock::local_time() - begin).total_microseconds());
+    }
+
+    if (latency.empty())
+      return;
+
+    std::sort(latency.begin(), latency.end());
+    int64_t sum = 0;
+    for (size_t i=0; i<latency.size(); i++)
+      sum += latency[i];
+
+    std::cout << name << " GET: avg " << sum / static_cast<int64_t>(latency.size())
+      << " us, p50 " << latency[latency.size() / 2]
+      << " us, p99 " << latency[latency.size() * 99 / 100]
+      << " us, max " << latency.back()
+      << " us, " << failed << " failed" << std::endl;
+  }
+
+  void bench_pipeline(const char * name, const SocketOptions& options)
+  {
+    Redis2 r(host, port, db_index, timeout, options);
+    redis_command_vector_t commands;
+    std::string value(64, 'x');
+    int failed = 0;
+
+    for (int i=0; i<depth; i++)
+    {
+      RedisCommand * command = new RedisCommand(SET);
+      command->in.push_arg("bench:sockopt:" + boost::lexical_cast<std::string>(i));
+      command->in.push_arg(value);
+      commands.push_back(command);
+    }
+
+    int rounds = requests / (depth ? depth : 1);
+    boost::posix_time::ptime begin = boost::posix_time::microsec_clock::local_time();
+    for (int i=0; i<rounds; i++)
+    {
+      if (!r.exec_pipeline(&commands))
+        failed++;
+    }
+    int64_t us = (boost::posix_time::microsec_clock::local_time() - begin).total_microseconds();
+    int64_t total = static_cast<int64_t>(rounds) * depth;
+
+    std::cout << name << " pipeline(" << depth << "): " << total << " SETs cost "
+      << us / 1000 << " ms, " << (us ? total * 1000000 / us : 0) << " qps, "
+      << failed << " failed" << std::endl;
+
+    clear_commands(&commands);
+  }
+}
+
+int main(int argc, char * argv[])
+{
+  try
+  {
+    namespace po = boost::program_options;
+    po::options_description desc("Options");
+    desc.add_options()
+      ("help", "produce help message")
+      ("host,h", po::value<std::string>()->default_value("127.0.0.1"), "redis host")
+      ("port,p", po::value<std::string>()->default_value("6379"), "redis port")
+      ("db_index,i", po::value<int>()->default_value(5), "redis db index")
+      ("timeout,t", po::value<int>()->default_value(2000), "timeout in ms")
+      ("requests,n", po::value<int>()->default_value(20000), "requests per profile")
+      ("depth,d", po::value<int>()->default_value(32), "commands per pipeline")
+      ("buffer,b", po::value<int>()->default_value(262144), "SO_SNDBUF/SO_RCVBUF of the tuned profile")
+      ("adaptive,a", "enable adaptive budgets and print their decisions");
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
+
+    if (vm.count("help"))
+    {
+      std::cout << desc << std::endl;
+      return 0;
+    }
+
+    host = vm["host"].as<std::string>();
+    port = vm["port"].as<std::string>();
+    db_index = vm["db_index"].as<int>();
+    timeout = vm["timeout"].as<int>();
+    requests = vm["requests"].as<int>();
+    depth = vm["depth"].as<int>();
+    buffer = vm["buffer"].as<int>();
+
+    if (vm.count("adaptive"))
+    {
+      AdaptiveTimeout adaptive;
+      adaptive.enabled = true;
+      set_adaptive_timeout(adaptive);
+    }
+  }
+  catch (std::exception& e)
+  {
+    std::cout << "caught: " << e.what() << std::endl;
+    return 1;
+  }
+
+  SocketOptions nagle;
+  nagle.tcp_nodelay = false;
+
+  SocketOptions nodelay;
+
+  SocketOptions tuned;
+  tuned.send_buffer = buffer;
+  tuned.recv_buffer = buffer;
+  tuned.keepalive = true;
+  tuned.keepalive_idle = 60;
+  tuned.keepalive_interval = 10;
+  tuned.keepalive_count = 3;
+  tuned.user_timeout_ms = timeout;
+
+  bench_latency("nagle  ", nagle);
+  bench_latency("nodelay", nodelay);
+  bench_latency("tuned  ", tuned);
+
+  bench_pipeline("nagle  ", nagle);
+  bench_pipeline("nodelay", nodelay);
+  bench_pipeline("tuned  ", tuned);
+
+  if (get_adaptive_timeout().enabled)
+    print_adaptive_stats();
+
+  return 0;
+}
@@ -0,0 +1,109 @@
+/** @file
+ * @brief tcp vs unix domain socket benchmark, optionally over io_uring or busy-poll
+ * @author yafei.zhang@langtaojin.com
+ * @date
+ * @version
+ *
+ */
+#include <redis.h>
+#include <redis_transport.h>
+#include <iostream>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/program_options.hpp>
+
+USING_LIBREDIS_NAMESPACE
+
+namespace
+{
+  int db_index, timeout, requests;
+  SocketOptions options;
+
+  void bench(const char * name, const std::string& host, const std::string& port)
+  {
+    Redis2 r(host, port, db_index, timeout, options);
+    std::string value;
+    bool is_nil;
+    int failed = 0;
+
+    if (!r.set("bench:unix", "value"))
+    {
+      std::cout << name << ": " << r.last_error() << std::endl;
+      return;
+    }
+
+    boost::posix_time::ptime begin = boost::posix_time::microsec_clock::local_time();
+    for (int i=0; i<requests; i++)
+    {
+      if (!r.get("bench:unix", &value, &is_nil))
+        failed++;
+    }
+    boost::posix_time::time_duration td = boost::posix_time::microsec_clock::local_time() - begin;
+
+    int64_t us = td.total_microseconds();
+    std::cout << name << ": " << requests << " GETs cost " << us / 1000 << " ms, "
+      << (requests ? us / requests : 0) << " us/op, "
+      << (us ? static_cast<int64_t>(requests) * 1000000 / us : 0) << " qps, "
+      << failed << " failed" << std::endl;
+
+    SocketStats stats = r.get_socket_stats();
+    if (options.spin_us)
+      std::cout << "  reads: " << stats.reads << ", spin hits: " << stats.spin_hits
+        << ", spin misses: " << stats.spin_misses
+        << ", SO_BUSY_POLL: " << (stats.busy_poll ? "on" : "off") << std::endl;
+  }
+}
+
+int main(int argc, char * argv[])
+{
+  std::string host, port, socket;
+
+  try
+  {
+    namespace po = boost::program_options;
+    po::options_description desc("Options");
+    desc.add_options()
+      ("help", "produce help message")
+      ("host,h", po::value<std::string>()->default_value("127.0.0.1"), "redis host")
+      ("port,p", po::value<std::string>()->default_value("6379"), "redis port")
+      ("socket,s", po::value<std::string>()->default_value("/tmp/redis.sock"), "redis unix socket path")
+      ("db_index,i", po::value<int>()->default_value(5), "redis db index")
+      ("timeout,t", po::value<int>()->default_value(2000), "timeout in ms")
+      ("requests,n", po::value<int>()->default_value(100000), "requests")
+      ("io_uring,u", "use the io_uring backend")
+      ("spin_us", po::value<int>()->default_value(0), "busy-poll: spin before poll() in us")
+      ("busy_poll_us", po::value<int>()->default_value(0), "busy-poll: SO_BUSY_POLL in us");
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
+
+    if (vm.count("help"))
+    {
+      std::cout << desc << std::endl;
+      return 0;
+    }
+
+    host = vm["host"].as<std::string>();
+    port = vm["port"].as<std::string>();
+    socket = vm["socket"].as<std::string>();
+    db_index = vm["db_index"].as<int>();
+    timeout = vm["timeout"].as<int>();
+    requests = vm["requests"].as<int>();
+
+    if (vm.count("io_uring"))
+      options.io_backend = kUringBackend;
+    options.spin_us = vm["spin_us"].as<int>();
+    options.busy_poll_us = vm["busy_poll_us"].as<int>();
+  }
+  catch (std::exception& e)
+  {
+    std::cout << "caught: " << e.what() << std::endl;
+    return 1;
+  }
+
+  bench("tcp", host, port);
+  bench("unix", "unix:" + socket, port);
+
+  return 0;
+}